@@ -0,0 +1,53 @@
+// STREAM-style kernels, one float4 per work-item
+
+__kernel void stream_copy(__global const float4 *a, __global float4 *c)
+{
+    size_t i = get_global_id(0);
+    c[i] = a[i];
+}
+
+__kernel void stream_scale(__global const float4 *c, __global float4 *b, float scalar)
+{
+    size_t i = get_global_id(0);
+    b[i] = scalar * c[i];
+}
+
+__kernel void stream_triad(__global const float4 *b, __global const float4 *c, __global float4 *a, float scalar)
+{
+    size_t i = get_global_id(0);
+    a[i] = b[i] + scalar * c[i];
+}
+
+// Compute peak for the roofline, eight independent float4 mad chains per
+// work-item and a single store so the chains are not optimized away
+
+#ifndef MAD_LOOPS
+#define MAD_LOOPS 256
+#endif
+
+__kernel void peak_mad(__global float4 *out, float scalar)
+{
+    float4 a0 = (float4)((float)get_global_id(0), 1.0f, 2.0f, 3.0f);
+    float4 a1 = a0 + 1.0f;
+    float4 a2 = a0 + 2.0f;
+    float4 a3 = a0 + 3.0f;
+    float4 a4 = a0 + 4.0f;
+    float4 a5 = a0 + 5.0f;
+    float4 a6 = a0 + 6.0f;
+    float4 a7 = a0 + 7.0f;
+    float4 b = (float4)(0.5f);
+
+    for (int i = 0; i < MAD_LOOPS; i++)
+    {
+        a0 = mad(a0, scalar, b);
+        a1 = mad(a1, scalar, b);
+        a2 = mad(a2, scalar, b);
+        a3 = mad(a3, scalar, b);
+        a4 = mad(a4, scalar, b);
+        a5 = mad(a5, scalar, b);
+        a6 = mad(a6, scalar, b);
+        a7 = mad(a7, scalar, b);
+    }
+
+    out[get_global_id(0)] = a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7;
+}
@@ -0,0 +1,5 @@
+// Does nothing on purpose, only the cost of getting it launched is measured
+
+__kernel void empty_kernel(__global float *data, float value)
+{
+}
@@ -175,28 +175,15 @@ k_sincos4(int4 i, float4 *cretp)
         zi2 = bi2; \
     } while (0)
 
-// First pass of 1K FFT
+// First pass of 1K FFT, on transform data already in registers
 __attribute__((always_inline)) void
-kfft_pass1(uint me,
-        const __global float *gr, const __global float *gi,
+kfft_pass1_regs(uint me,
+        float4 zr0, float4 zr1, float4 zr2, float4 zr3,
+        float4 zi0, float4 zi1, float4 zi2, float4 zi3,
         __local float *lds)
 {
-    const __global float4 *gp;
     __local float *lp;
 
-    // Pull in transform data
-    gp = (const __global float4 *)(gr + (me << 2));
-    float4 zr0 = gp[0*64];
-    float4 zr1 = gp[1*64];
-    float4 zr2 = gp[2*64];
-    float4 zr3 = gp[3*64];
-
-    gp = (const __global float4 *)(gi + (me << 2));
-    float4 zi0 = gp[0*64];
-    float4 zi1 = gp[1*64];
-    float4 zi2 = gp[2*64];
-    float4 zi3 = gp[3*64];
-
     FFT4();
 
     int4 tbase = (int)(me << 2) + (int4)(0, 1, 2, 3);
@@ -257,6 +244,30 @@ kfft_pass1(uint me,
     barrier(CLK_LOCAL_MEM_FENCE);
 }
 
+// First pass of 1K FFT
+__attribute__((always_inline)) void
+kfft_pass1(uint me,
+        const __global float *gr, const __global float *gi,
+        __local float *lds)
+{
+    const __global float4 *gp;
+
+    // Pull in transform data
+    gp = (const __global float4 *)(gr + (me << 2));
+    float4 zr0 = gp[0*64];
+    float4 zr1 = gp[1*64];
+    float4 zr2 = gp[2*64];
+    float4 zr3 = gp[3*64];
+
+    gp = (const __global float4 *)(gi + (me << 2));
+    float4 zi0 = gp[0*64];
+    float4 zi1 = gp[1*64];
+    float4 zi2 = gp[2*64];
+    float4 zi3 = gp[3*64];
+
+    kfft_pass1_regs(me, zr0, zr1, zr2, zr3, zi0, zi1, zi2, zi3, lds);
+}
+
 // Second pass of 1K FFT
 __attribute__((always_inline)) void
 kfft_pass2(uint me, __local float *lds)
@@ -623,11 +634,11 @@ kfft_pass4(uint me, __local float *lds)
     barrier(CLK_LOCAL_MEM_FENCE);
 }
 
-// Fifth and last pass of 1K FFT
+// Fifth and last pass of 1K FFT, leaving the result in registers
 __attribute__((always_inline)) void
-kfft_pass5(uint me,
+kfft_pass5_regs(uint me,
        const __local float *lds,
-       __global float *gr, __global float *gi)
+       float4 *zr, float4 *zi)
 {
     const __local float *lp;
 
@@ -689,7 +700,39 @@ kfft_pass5(uint me,
     // Transform
     FFT4();
 
+    zr[0] = zr0;
+    zr[1] = zr1;
+    zr[2] = zr2;
+    zr[3] = zr3;
+
+    zi[0] = zi0;
+    zi[1] = zi1;
+    zi[2] = zi2;
+    zi[3] = zi3;
+}
+
+// Fifth and last pass of 1K FFT
+__attribute__((always_inline)) void
+kfft_pass5(uint me,
+       const __local float *lds,
+       __global float *gr, __global float *gi)
+{
+    float4 zr[4], zi[4];
+
+    kfft_pass5_regs(me, lds, zr, zi);
+
     // Save result
+    __global float4 *gp = (__global float4 *)(gr + (me << 2));
+    gp[0*64] = zr[0];
+    gp[1*64] = zr[1];
+    gp[2*64] = zr[2];
+    gp[3*64] = zr[3];
+
+    gp = (__global float4 *)(gi + (me << 2));
+    gp[0*64] = zi[0];
+    gp[1*64] = zi[1];
+    gp[2*64] = zi[2];
+    gp[3*64] = zi[3];
 }
 
 // Distance between first real element of successive 1K vectors
@@ -722,7 +765,279 @@ kfft(__global float *greal, __global float *gimag)
     kfft_pass3(me, lds);
     kfft_pass4(me, lds);
     kfft_pass5(me, lds, gr, gi);
+}
+
+// Real transforms of 2K samples, each one packed into a 1K complex transform
+// with the even samples as its real part and the odd samples as its imaginary
+// part. The spectrum X of a vector overwrites its samples: the 1024 real
+// parts, then the 1024 imaginary parts. X[0] and X[1024] are both real, so
+// the imaginary slot of X[0] holds X[1024].
+
+// Return sin and cos of -2*pi*i/2048, precise since they scale whole bins
+__attribute__((always_inline)) float
+k_sincos_real(int i, float *cretp)
+{
+    return sincos(i * -0x1.921fb6p-9F, cretp);
+}
+
+// Split the transform Z of the packed samples into the spectrum X at bins k
+// and 1024-k, Z being in the first 2K floats of lds
+__attribute__((always_inline)) void
+kfft_r2c_split(uint k, const __local float *lds, __global float *gr, __global float *gi)
+{
+    uint m = (1024 - k) & 1023;
+    float ar = lds[k];
+    float ai = lds[1024 + k];
+    float br = lds[m];
+    float bi = lds[1024 + m];
+
+    // Transforms of the even and odd samples, E = (Z[k] + Z*[m]) / 2 and O = (Z[k] - Z*[m]) / 2i
+    float evr = 0.5f * (ar + br);
+    float evi = 0.5f * (ai - bi);
+    float odr = 0.5f * (ai + bi);
+    float odi = 0.5f * (br - ar);
+
+    float c, s = k_sincos_real(k, &c);
+    float tr = c * odr - s * odi;
+    float ti = c * odi + s * odr;
+
+    // X[k] = E + W^k O and X[m] = (E - W^k O)*
+    if (k == 0)
+    {
+        gr[0] = evr + tr;
+        gi[0] = evr - tr;
+    }
+    else
+    {
+        gr[k] = evr + tr;
+        gi[k] = evi + ti;
+        gr[m] = evr - tr;
+        gi[m] = ti - evi;
+    }
+}
+
+// Merge the spectrum X at bins k to k+3 back into the transform Z of the
+// packed samples, swapped and scaled by 1/1024 so a forward 1K FFT inverts it
+__attribute__((always_inline)) void
+kfft_c2r_merge4(uint k, const __global float *gr, const __global float *gi, float4 *zr, float4 *zi)
+{
+    float z[8];
+
+    for (uint j = 0; j < 4; j++)
+    {
+        uint m = (1024 - k - j) & 1023;
+        float ar = gr[k + j];
+        float ai = (k + j) ? gi[k + j] : 0.0f;
+        float br = (k + j) ? gr[m] : gi[0];
+        float bi = (k + j) ? gi[m] : 0.0f;
+
+        // E = (X[k] + X*[m]) / 2 and O = (X[k] - X*[m]) W^-k / 2
+        float evr = 0.5f * (ar + br);
+        float evi = 0.5f * (ai - bi);
+        float dr = 0.5f * (ar - br);
+        float di = 0.5f * (ai + bi);
+
+        float c, s = k_sincos_real(k + j, &c);
+        float odr = c * dr + s * di;
+        float odi = c * di - s * dr;
+
+        // Z = E + iO, with its real and imaginary parts swapped
+        z[j] = (evi + odr) * (1.0f / 1024);
+        z[4 + j] = (evr - odi) * (1.0f / 1024);
+    }
+
+    *zr = (float4)(z[0], z[1], z[2], z[3]);
+    *zi = (float4)(z[4], z[5], z[6], z[7]);
+}
+
+// Performs a 2K real to complex FFT with every 64 global ids.
+// Each vector is a multiple of 2*VSTRIDE from the first
+// Number of global ids must be a multiple of 64
+//
+//   gdata - pointer to input samples and output spectrum
+__kernel void
+kfft_r2c(__global float *gdata)
+{
+    // This is 8704 bytes
+    __local float lds[68*4*4*2];
+
+    uint gid = get_global_id(0);
+    uint me = gid & 0x3fU;
+    __global float *gr = gdata + (gid >> 6) * 2 * VSTRIDE;
+    __global float *gi = gr + VSTRIDE;
+
+    // Pull in the samples, even ones to the real part and odd ones to the imaginary part
+    const __global float4 *gp = (const __global float4 *)(gr + (me << 3));
+    float4 a0 = gp[0*128], b0 = gp[0*128 + 1];
+    float4 a1 = gp[1*128], b1 = gp[1*128 + 1];
+    float4 a2 = gp[2*128], b2 = gp[2*128 + 1];
+    float4 a3 = gp[3*128], b3 = gp[3*128 + 1];
+
+    kfft_pass1_regs(me,
+                    (float4)(a0.x, a0.z, b0.x, b0.z), (float4)(a1.x, a1.z, b1.x, b1.z),
+                    (float4)(a2.x, a2.z, b2.x, b2.z), (float4)(a3.x, a3.z, b3.x, b3.z),
+                    (float4)(a0.y, a0.w, b0.y, b0.w), (float4)(a1.y, a1.w, b1.y, b1.w),
+                    (float4)(a2.y, a2.w, b2.y, b2.w), (float4)(a3.y, a3.w, b3.y, b3.w),
+                    lds);
+    kfft_pass2(me, lds);
+    kfft_pass3(me, lds);
+    kfft_pass4(me, lds);
+
+    float4 zr[4], zi[4];
+    kfft_pass5_regs(me, lds, zr, zi);
+
+    // Bin k pairs up with bin 1024-k of another work-item, so share Z in local memory
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint j = 0; j < 4; j++)
+    {
+        vstore4(zr[j], me + j*64, lds);
+        vstore4(zi[j], me + j*64, lds + 1024);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-    greal[gid] = gr[gid];
+    // The samples were all read in the first pass, so the spectrum can replace them
+    for (uint k = me; k < 512; k += 64)
+        kfft_r2c_split(k, lds, gr, gi);
+    if (me == 0)
+        kfft_r2c_split(512, lds, gr, gi);
 }
 
+// Performs a 2K complex to real FFT with every 64 global ids, the inverse
+// of kfft_r2c including the 1/2048 scale.
+// Each vector is a multiple of 2*VSTRIDE from the first
+// Number of global ids must be a multiple of 64
+//
+//   gdata - pointer to input spectrum and output samples
+__kernel void
+kfft_c2r(__global float *gdata)
+{
+    // This is 8704 bytes
+    __local float lds[68*4*4*2];
+
+    uint gid = get_global_id(0);
+    uint me = gid & 0x3fU;
+    __global float *gr = gdata + (gid >> 6) * 2 * VSTRIDE;
+    __global float *gi = gr + VSTRIDE;
+
+    float4 zr0, zr1, zr2, zr3;
+    float4 zi0, zi1, zi2, zi3;
+    kfft_c2r_merge4((me << 2) + 0*256, gr, gi, &zr0, &zi0);
+    kfft_c2r_merge4((me << 2) + 1*256, gr, gi, &zr1, &zi1);
+    kfft_c2r_merge4((me << 2) + 2*256, gr, gi, &zr2, &zi2);
+    kfft_c2r_merge4((me << 2) + 3*256, gr, gi, &zr3, &zi3);
+
+    kfft_pass1_regs(me, zr0, zr1, zr2, zr3, zi0, zi1, zi2, zi3, lds);
+    kfft_pass2(me, lds);
+    kfft_pass3(me, lds);
+    kfft_pass4(me, lds);
+
+    float4 zr[4], zi[4];
+    kfft_pass5_regs(me, lds, zr, zi);
+
+    // Swap back, the even samples are the real part and the odd samples the imaginary part
+    __global float4 *gp = (__global float4 *)(gr + (me << 3));
+    for (uint j = 0; j < 4; j++)
+    {
+        gp[j*128] = (float4)(zi[j].x, zr[j].x, zi[j].y, zr[j].y);
+        gp[j*128 + 1] = (float4)(zi[j].z, zr[j].z, zi[j].w, zr[j].w);
+    }
+}
+
+// Convolution of a long real signal with a real filter of taps samples by
+// overlap-save over 1K blocks. Block b starts taps-1 samples ahead of the
+// 1025-taps outputs it produces, and since the filter is real two blocks
+// share each complex transform, one as its real and one as its imaginary part.
+
+// Gathers the blocks, one global id per point of each transform
+__kernel void
+kconv_gather(const __global float *signal, uint count, uint taps,
+             __global float *greal, __global float *gimag)
+{
+    uint gid = get_global_id(0);
+    uint step = 1025 - taps;
+    int first = (int)(2 * (gid >> 10) * step + (gid & 1023)) - (int)(taps - 1);
+    int second = first + (int)step;
+    uint i = (gid >> 10) * VSTRIDE + (gid & 1023);
+
+    greal[i] = (first >= 0 && first < (int)count) ? signal[first] : 0.0f;
+    gimag[i] = (second >= 0 && second < (int)count) ? signal[second] : 0.0f;
+}
+
+// Multiplies the block spectra by the filter spectrum. The product is
+// conjugated and scaled by 1/1024, so another forward kfft inverts it up to
+// a last conjugation that kconv_scatter takes care of
+__kernel void
+kconv_multiply(__global float *greal, __global float *gimag,
+               const __global float *hreal, const __global float *himag)
+{
+    uint gid = get_global_id(0);
+    uint n = gid & 1023;
+    uint i = (gid >> 10) * VSTRIDE + n;
+    float xr = greal[i];
+    float xi = gimag[i];
+
+    greal[i] = (xr * hreal[n] - xi * himag[n]) * (1.0f / 1024);
+    gimag[i] = -(xr * himag[n] + xi * hreal[n]) * (1.0f / 1024);
+}
+
+// Scatters the outputs of each block past its first taps-1 points, which
+// wrapped around
+__kernel void
+kconv_scatter(const __global float *greal, const __global float *gimag,
+              uint count, uint taps, __global float *output)
+{
+    uint gid = get_global_id(0);
+    uint n = gid & 1023;
+    uint step = 1025 - taps;
+    uint i = (gid >> 10) * VSTRIDE + n;
+    uint o = 2 * (gid >> 10) * step + n - (taps - 1);
+
+    if (n < taps - 1)
+        return;
+
+    if (o < count)
+        output[o] = greal[i];
+    if (o + step < count)
+        output[o + step] = -gimag[i];
+}
+
+// Direct convolution, one global id per output. Samples ahead of the
+// signal count as zero
+__kernel void
+kconv_direct(const __global float *signal, uint count,
+             __constant float *filter, uint taps,
+             __global float *output)
+{
+    uint i = get_global_id(0);
+    float sum = 0.0f;
+
+    if (i >= count)
+        return;
+
+    uint last = min(taps, i + 1);
+    for (uint j = 0; j < last; j++)
+        sum = mad(filter[j], signal[i - j], sum);
+
+    output[i] = sum;
+}
+
+// Fills count floats with values uniform in [low, high), hashed from the
+// index and the seed so that animated frames get new inputs without any
+// host work
+__kernel void
+kfill(__global float *data, uint count, uint seed, float low, float high)
+{
+    uint i = get_global_id(0);
+    uint h = i ^ (seed * 0x9e3779b9U);
+
+    if (i >= count)
+        return;
+
+    h ^= h >> 16;
+    h *= 0x7feb352dU;
+    h ^= h >> 15;
+    h *= 0x846ca68bU;
+    h ^= h >> 16;
+
+    data[i] = low + (high - low) * (float)(h >> 8) * (1.0f / 16777216.0f);
+}
@@ -59,9 +59,16 @@
 #define BOUNDING_RADIUS_SQR         (SQR(BOUNDING_RADIUS))
 #define ESCAPE_THRESHOLD            (BOUNDING_RADIUS * 1.5f)
 #define DELTA                       (1e-5f)
+#ifndef ITERATIONS
 #define ITERATIONS                  (10)
+#endif
 #define EPSILON                     (0.003f)
+#ifndef SHADOWS
 #define SHADOWS                     (0)
+#endif
+#ifndef TILE_SIZE
+#define TILE_SIZE                   (8)
+#endif
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -140,12 +147,14 @@ IntersectQJulia(
     float3 rD,
     float4 c,
     float epsilon,
-    float escape)
+    float escape,
+    uint *steps)
 {
     float rd = 0.0f;
     float dist = epsilon;
     while ( dist >= epsilon && rd < escape)
     {
+        (*steps)++;
         float4 z = (float4)( rO.x, rO.y, rO.z, 0.0f );
         float4 zp = (float4)( 1.0f, 0.0f, 0.0f, 0.0f );
         float zd = 0.0f;
@@ -225,23 +234,41 @@ RaytraceQJulia(
     float3 diffuse,
     float radius,
     bool shadows,
-    int iterations )
+    int iterations,
+    float *depth,
+    uint *steps )
 {
     const float4 background = (float4)( 0.15f, 0.15f, 0.15f, 0.0f );
     float4 color = background;
+    float3 origin = rO;
+    float start = *depth;
+
+    // On return depth holds the distance to the hit, or -1 for a miss
+    *depth = -1.0f;
 
     rD = fast_normalize( rD );
     float t = IntersectSphere( rO, rD, radius );
     if ( t <= 0.0f )
         return color;
 
-    rO += rD * t;
-    float4 hit = IntersectQJulia( rO, rD, mu, epsilon, ESCAPE_THRESHOLD );
+    // A depth hint past the bounding sphere starts the march there, falling back
+    // to the full march from the sphere if nothing is hit from the hint onwards
+    float4 hit = (float4)( 0.0f, 0.0f, 0.0f, epsilon );
+    if ( start > t )
+        hit = IntersectQJulia( rO + rD * start, rD, mu, epsilon, ESCAPE_THRESHOLD, steps );
+
+    if ( hit.w >= epsilon )
+    {
+        rO += rD * t;
+        hit = IntersectQJulia( rO, rD, mu, epsilon, ESCAPE_THRESHOLD, steps );
+    }
+
     float dist = hit.w;
     if (dist >= epsilon)
         return color;
 
     rO.xyz = hit.xyz;
+    *depth = fast_distance( rO, origin );
     float3 normal = EstimateNormalQJulia( rO, mu, iterations );
 
     float3 rgb = Phong( light, rD, rO, normal, diffuse );
@@ -252,7 +279,7 @@ RaytraceQJulia(
     {
         float3 light_dir = fast_normalize( light - rO );
         rO += normal * epsilon * 2.0f;
-        hit = IntersectQJulia( rO, light_dir, mu, epsilon, ESCAPE_THRESHOLD );
+        hit = IntersectQJulia( rO, light_dir, mu, epsilon, ESCAPE_THRESHOLD, steps );
         dist = hit.w;
         color.xyz *= (dist < epsilon) ? (0.4f) : (1.0f);
     }
@@ -271,7 +298,9 @@ QJulia(
     float iterations,
     int shadows,
     uint width,
-    uint height)
+    uint height,
+    float *depth,
+    uint *steps)
 {
     float zoom = BOUNDING_RADIUS_SQR;
     float radius = BOUNDING_RADIUS_SQR;
@@ -290,7 +319,7 @@ QJulia(
     float3 rO = eye;
     float3 rD = (ray - rO);
     
-    float4 color = RaytraceQJulia( rO, rD, mu, epsilon, eye, light, base, radius, shadows, iterations);
+    float4 color = RaytraceQJulia( rO, rD, mu, epsilon, eye, light, base, radius, shadows, iterations, depth, steps);
 
     return color;
 }
@@ -310,15 +339,266 @@ QJuliaKernel(
     int sy = get_global_size(1);
     int index = ty * WIDTH + tx;
     bool valid = (tx < WIDTH) && (ty < HEIGHT);
+    uint steps = 0;
+    float depth = 0.0f;
 
     float4 coord = (float4)((float)tx, (float)ty, 0.0f, 0.0f);
     
     if(valid)
     {
-        float4 color = QJulia(coord, mu, diffuse, epsilon, ITERATIONS, SHADOWS, WIDTH, HEIGHT);
+        float4 color = QJulia(coord, mu, diffuse, epsilon, ITERATIONS, SHADOWS, WIDTH, HEIGHT, &depth, &steps);
         uchar4 output = convert_uchar4_sat_rte(color * 255.0f);
         result[index] = output;
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Progressive rendering
+//
+// The coarse pass traces one sample per step x step block and splats it over the block. The
+// classify pass flags blocks whose 3x3 neighborhood of coarse samples has a luminance variance
+// above the threshold and compacts them into a work-list with an atomic counter. The refine pass
+// then traces the remaining pixels of the flagged blocks only.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+float
+Luminance(uchar4 c)
+{
+    float4 f = convert_float4(c) * (1.0f / 255.0f);
+    return dot(f.xyz, (float3)(0.299f, 0.587f, 0.114f));
+}
+
+__kernel void
+QJuliaCoarseKernel(
+    __global uchar4 *result,
+    const float4 mu,
+    const float4 diffuse,
+    const float epsilon,
+    const uint step)
+{
+    int tx = get_global_id(0) * step;
+    int ty = get_global_id(1) * step;
+    bool valid = (tx < WIDTH) && (ty < HEIGHT);
+    uint steps = 0;
+    float depth = 0.0f;
+
+    float4 coord = (float4)((float)tx, (float)ty, 0.0f, 0.0f);
+
+    if(valid)
+    {
+        float4 color = QJulia(coord, mu, diffuse, epsilon, ITERATIONS, SHADOWS, WIDTH, HEIGHT, &depth, &steps);
+        uchar4 output = convert_uchar4_sat_rte(color * 255.0f);
+
+        int ex = min(tx + (int)step, WIDTH);
+        int ey = min(ty + (int)step, HEIGHT);
+        for(int y = ty; y < ey; y++)
+            for(int x = tx; x < ex; x++)
+                result[y * WIDTH + x] = output;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__kernel void
+QJuliaClassifyKernel(
+    __global const uchar4 *result,
+    __global uint *worklist,
+    __global uint *count,
+    const uint step,
+    const float threshold)
+{
+    int bx = get_global_id(0);
+    int by = get_global_id(1);
+    int bw = (WIDTH + step - 1) / step;
+    int bh = (HEIGHT + step - 1) / step;
+    bool valid = (bx < bw) && (by < bh);
+
+    if(valid)
+    {
+        float sum = 0.0f;
+        float sum2 = 0.0f;
+        for(int j = -1; j <= 1; j++)
+        {
+            for(int i = -1; i <= 1; i++)
+            {
+                int x = clamp(bx + i, 0, bw - 1) * step;
+                int y = clamp(by + j, 0, bh - 1) * step;
+                float l = Luminance(result[y * WIDTH + x]);
+                sum += l;
+                sum2 += l * l;
+            }
+        }
+
+        float mean = sum * (1.0f / 9.0f);
+        float variance = sum2 * (1.0f / 9.0f) - mean * mean;
+        if(variance > threshold)
+            worklist[atomic_inc(count)] = by * bw + bx;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__kernel void
+QJuliaRefineKernel(
+    __global uchar4 *result,
+    __global const uint *worklist,
+    const uint count,
+    const float4 mu,
+    const float4 diffuse,
+    const float epsilon,
+    const uint step)
+{
+    uint gid = get_global_id(0);
+    uint area = step * step;
+    uint sub = gid % area;
+    uint steps = 0;
+    float depth = 0.0f;
+    int bw = (WIDTH + step - 1) / step;
+
+    // Sub-pixel 0 is the block anchor, already traced by the coarse pass
+    if((gid < count * area) && (sub != 0))
+    {
+        uint block = worklist[gid / area];
+        int tx = (block % bw) * step + sub % step;
+        int ty = (block / bw) * step + sub / step;
+
+        if((tx < WIDTH) && (ty < HEIGHT))
+        {
+            float4 coord = (float4)((float)tx, (float)ty, 0.0f, 0.0f);
+            float4 color = QJulia(coord, mu, diffuse, epsilon, ITERATIONS, SHADOWS, WIDTH, HEIGHT, &depth, &steps);
+            result[ty * WIDTH + tx] = convert_uchar4_sat_rte(color * 255.0f);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// Persistent threads
+//
+// A fixed number of TILE_SIZE x TILE_SIZE work-groups is launched, each of which keeps pulling
+// the next image tile from a global counter until the frame is exhausted. Groups which land on
+// cheap tiles simply take more of them, instead of idling behind the deepest ray of a static
+// grid. The number of march steps spent on each tile is written out for the cost histogram.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__kernel void
+QJuliaPersistentKernel(
+    __global uchar4 *result,
+    const float4 mu,
+    const float4 diffuse,
+    const float epsilon,
+    __global uint *next_tile,
+    __global uint *tile_cost)
+{
+    __local uint tile;
+    __local uint cost;
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    bool first = (lx == 0) && (ly == 0);
+    uint tiles_x = (WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    uint tiles = tiles_x * ((HEIGHT + TILE_SIZE - 1) / TILE_SIZE);
+
+    for(;;)
+    {
+        if(first)
+        {
+            tile = atomic_inc(next_tile);
+            cost = 0;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        uint t = tile;
+        if(t >= tiles)
+            break;
+
+        int tx = (t % tiles_x) * TILE_SIZE + lx;
+        int ty = (t / tiles_x) * TILE_SIZE + ly;
+        uint steps = 0;
+        float depth = 0.0f;
+
+        if((tx < WIDTH) && (ty < HEIGHT))
+        {
+            float4 coord = (float4)((float)tx, (float)ty, 0.0f, 0.0f);
+            float4 color = QJulia(coord, mu, diffuse, epsilon, ITERATIONS, SHADOWS, WIDTH, HEIGHT, &depth, &steps);
+            result[ty * WIDTH + tx] = convert_uchar4_sat_rte(color * 255.0f);
+        }
+
+        atomic_add(&cost, steps);
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if(first)
+            tile_cost[t] = cost;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__kernel void
+QJuliaImageKernel(
+    __write_only image2d_t result,
+    const float4 mu,
+    const float4 diffuse,
+    const float epsilon)
+{
+    int tx = get_global_id(0);
+    int ty = get_global_id(1);
+    bool valid = (tx < WIDTH) && (ty < HEIGHT);
+    uint steps = 0;
+    float depth = 0.0f;
+
+    float4 coord = (float4)((float)tx, (float)ty, 0.0f, 0.0f);
+
+    // Same as QJuliaKernel, writing the texture directly instead of the result buffer
+    if(valid)
+    {
+        float4 color = QJulia(coord, mu, diffuse, epsilon, ITERATIONS, SHADOWS, WIDTH, HEIGHT, &depth, &steps);
+        write_imagef(result, (int2)(tx, ty), color);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//
+// Temporal reprojection
+//
+// The per-pixel hit distance of the previous frame is kept in depth and the march of the
+// next frame starts a little before it. When the parameters only drift slightly between
+// frames this skips most of the march through empty space. Misses fall back to the full
+// march, so only surfaces which moved closer by more than the backoff can be lost.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__kernel void
+QJuliaReprojectKernel(
+    __global uchar4 *result,
+    __global float *depth,
+    const float4 mu,
+    const float4 diffuse,
+    const float epsilon,
+    const float backoff)
+{
+    int tx = get_global_id(0);
+    int ty = get_global_id(1);
+    int index = ty * WIDTH + tx;
+    bool valid = (tx < WIDTH) && (ty < HEIGHT);
+    uint steps = 0;
+
+    float4 coord = (float4)((float)tx, (float)ty, 0.0f, 0.0f);
+
+    if(valid)
+    {
+        float hint = depth[index];
+        hint = (hint > 0.0f) ? fmax(hint - backoff, 0.0f) : 0.0f;
+
+        float4 color = QJulia(coord, mu, diffuse, epsilon, ITERATIONS, SHADOWS, WIDTH, HEIGHT, &hint, &steps);
+        result[index] = convert_uchar4_sat_rte(color * 255.0f);
+        depth[index] = hint;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -20,16 +20,12 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #define TILEY_SHIFT 2
 
 /* Output tile size : 4x4 = Each thread computes 16 float values*/
-/* Required global threads = (widthC / 4, heightC / 4) */
-/* This kernel runs on 7xx and CPU as they don't have hardware local memory */
-__kernel void mmmKernel(__global float4 *matrixA,
-                        __global float4 *matrixB,
-                        __global float4* matrixC,
-            uint widthA, uint widthB)
+/* Accumulates the tile at pos into sum[], one float4 per row */
+void mmmTile(__global float4 *matrixA,
+             __global float4 *matrixB,
+             uint widthA, uint widthB,
+             int2 pos, float4 *sum)
 {
-    int2 pos = (int2)(get_global_id(0), get_global_id(1));
-
-
     float4 sum0 = (float4)(0);
     float4 sum1 = (float4)(0);
     float4 sum2 = (float4)(0);
@@ -71,25 +67,79 @@ __kernel void mmmKernel(__global float4 *matrixA,
         sum3.z += tempA3.x * tempB0.z + tempA3.y * tempB1.z + tempA3.z * tempB2.z + tempA3.w * tempB3.z;
         sum3.w += tempA3.x * tempB0.w + tempA3.y * tempB1.w + tempA3.z * tempB2.w + tempA3.w * tempB3.w;
     }
-    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 0) * widthB] = sum0;
-    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 1) * widthB] = sum1;
-    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 2) * widthB] = sum2;
-    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 3) * widthB] = sum3;
+    sum[0] = sum0;
+    sum[1] = sum1;
+    sum[2] = sum2;
+    sum[3] = sum3;
+}
+
+/* Maps an element of C to a display colour. The exposure brings the mean of C to
+   the middle of a Reinhard curve, which is then spread over a blue to white ramp */
+float4 tonemap(float value, float exposure)
+{
+    float x = max(value * exposure, 0.0f);
+    float t = x / (1.0f + x);
+    return (float4)(t * t, t, sqrt(t), 1.0f);
 }
 
+/* Writes the tile at pos into an RGBA8 image, one texel per float, tonemapped the
+   same way as mmmPresent so the image matches the presented matrixC */
+void storeTile(__write_only image2d_t imageC, int2 pos, float4 *sum, float exposure)
+{
+    int x = pos.x << TILEX_SHIFT;
+    for(int r = 0; r < TILEY; r++)
+    {
+        int y = (pos.y << TILEY_SHIFT) + r;
+        write_imagef(imageC, (int2)(x + 0, y), tonemap(sum[r].x, exposure));
+        write_imagef(imageC, (int2)(x + 1, y), tonemap(sum[r].y, exposure));
+        write_imagef(imageC, (int2)(x + 2, y), tonemap(sum[r].z, exposure));
+        write_imagef(imageC, (int2)(x + 3, y), tonemap(sum[r].w, exposure));
+    }
+}
 
-/* Matrix A is cached into local memory block */
 /* Required global threads = (widthC / 4, heightC / 4) */
-__kernel void mmmKernel_local(__global float4 *matrixA,
+/* This kernel runs on 7xx and CPU as they don't have hardware local memory */
+__kernel void mmmKernel(__global float4 *matrixA,
+                        __global float4 *matrixB,
+                        __global float4* matrixC,
+            uint widthA, uint widthB)
+{
+    int2 pos = (int2)(get_global_id(0), get_global_id(1));
+    float4 sum[TILEY];
+
+    mmmTile(matrixA, matrixB, widthA, widthB, pos, sum);
+
+    widthB /= 4;
+    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 0) * widthB] = sum[0];
+    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 1) * widthB] = sum[1];
+    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 2) * widthB] = sum[2];
+    matrixC[pos.x + ((pos.y <<  TILEY_SHIFT) + 3) * widthB] = sum[3];
+}
+
+/* Same as mmmKernel, writing the result straight into the displayed image */
+__kernel void mmmKernel_image(__global float4 *matrixA,
                               __global float4 *matrixB,
-                              __global float4* matrixC,
-                              int widthA,
-                              __local float4 *blockA)
+                              __write_only image2d_t imageC,
+                              uint widthA, uint widthB,
+                              float exposure)
+{
+    int2 pos = (int2)(get_global_id(0), get_global_id(1));
+    float4 sum[TILEY];
+
+    mmmTile(matrixA, matrixB, widthA, widthB, pos, sum);
+    storeTile(imageC, pos, sum, exposure);
+}
+
+
+/* Matrix A is cached into local memory block */
+/* Accumulates the tile of this thread into sum[], one float4 per row */
+void mmmTile_local(__global float4 *matrixA,
+                   __global float4 *matrixB,
+                   int widthA,
+                   __local float4 *blockA,
+                   float4 *sum)
 {
     int blockPos = get_local_id(0) + get_local_size(0) * (get_local_id(1) << TILEY_SHIFT); //Should be : localId * (TILEX / 4) (float4)
-    
-    /* Position of thread will be according to the number of values it writes i.e TILE size */
-    int globalPos =  get_global_id(0) + (get_global_id(1) << TILEY_SHIFT) * get_global_size(0);
 
     /* Each thread writes 4 float4s */
     float4 sum0 = (float4)(0);
@@ -154,11 +204,404 @@ __kernel void mmmKernel_local(__global float4 *matrixA,
         }
 		barrier(CLK_LOCAL_MEM_FENCE);
     }
+    sum[0] = sum0;
+    sum[1] = sum1;
+    sum[2] = sum2;
+    sum[3] = sum3;
+}
+
+/* Required global threads = (widthC / 4, heightC / 4) */
+__kernel void mmmKernel_local(__global float4 *matrixA,
+                              __global float4 *matrixB,
+                              __global float4* matrixC,
+                              int widthA,
+                              __local float4 *blockA)
+{
+    /* Position of thread will be according to the number of values it writes i.e TILE size */
+    int globalPos =  get_global_id(0) + (get_global_id(1) << TILEY_SHIFT) * get_global_size(0);
+    float4 sum[TILEY];
+
+    mmmTile_local(matrixA, matrixB, widthA, blockA, sum);
+
     /* Write 16 values to matrixC */
-    matrixC[globalPos] = sum0;
-    matrixC[globalPos +  get_global_size(0)] = sum1;
-    matrixC[globalPos +  2 * get_global_size(0)] = sum2;
-    matrixC[globalPos +  3 * get_global_size(0)] = sum3;
+    matrixC[globalPos] = sum[0];
+    matrixC[globalPos +  get_global_size(0)] = sum[1];
+    matrixC[globalPos +  2 * get_global_size(0)] = sum[2];
+    matrixC[globalPos +  3 * get_global_size(0)] = sum[3];
     
 }
 
+/* Same as mmmKernel_local, writing the result straight into the displayed image */
+__kernel void mmmKernel_local_image(__global float4 *matrixA,
+                                    __global float4 *matrixB,
+                                    __write_only image2d_t imageC,
+                                    int widthA,
+                                    __local float4 *blockA,
+                                    float exposure)
+{
+    int2 pos = (int2)(get_global_id(0), get_global_id(1));
+    float4 sum[TILEY];
+
+    mmmTile_local(matrixA, matrixB, widthA, blockA, sum);
+    storeTile(imageC, pos, sum, exposure);
+}
+
+
+/* Both A and B are staged through local memory in TILE_M x TILE_K and TILE_K x TILE_N
+   tiles, and each thread keeps a REG_TILE_M x REG_TILE_N block of C in registers.
+   The tile shape comes from the host as build options */
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 8
+#endif
+#ifndef REG_TILE_M
+#define REG_TILE_M 8
+#endif
+#ifndef REG_TILE_N
+#define REG_TILE_N 8
+#endif
+#ifndef TILE_K
+#define TILE_K 16
+#endif
+
+#define TILE_M (BLOCK_SIZE * REG_TILE_M)
+#define TILE_N (BLOCK_SIZE * REG_TILE_N)
+#define TILE_THREADS (BLOCK_SIZE * BLOCK_SIZE)
+#define LOADS_A (TILE_M * TILE_K / 4 / TILE_THREADS)
+#define LOADS_B (TILE_K * TILE_N / 4 / TILE_THREADS)
+
+/* Reads the next pair of tiles from global memory into registers */
+void loadTiles(__global const float4 *matrixA,
+               __global const float4 *matrixB,
+               int widthA, int widthB,
+               int2 origin, int k, int tid,
+               float4 *nextA, float4 *nextB)
+{
+    for(int l = 0; l < LOADS_A; l++)
+    {
+        int id = tid + l * TILE_THREADS;
+        int row = id / (TILE_K / 4);
+        int col = id % (TILE_K / 4);
+        nextA[l] = matrixA[(origin.y + row) * (widthA / 4) + k / 4 + col];
+    }
+
+    for(int l = 0; l < LOADS_B; l++)
+    {
+        int id = tid + l * TILE_THREADS;
+        int row = id / (TILE_N / 4);
+        int col = id % (TILE_N / 4);
+        nextB[l] = matrixB[(k + row) * (widthB / 4) + origin.x / 4 + col];
+    }
+}
+
+/* Writes the prefetched tiles into one half of the local buffers, A transposed so
+   both tiles are read along k with consecutive threads on consecutive addresses */
+void storeTiles(__local float *tileA, __local float *tileB, int tid, float4 *nextA, float4 *nextB)
+{
+    for(int l = 0; l < LOADS_A; l++)
+    {
+        int id = tid + l * TILE_THREADS;
+        int row = id / (TILE_K / 4);
+        int col = (id % (TILE_K / 4)) * 4;
+        tileA[(col + 0) * TILE_M + row] = nextA[l].x;
+        tileA[(col + 1) * TILE_M + row] = nextA[l].y;
+        tileA[(col + 2) * TILE_M + row] = nextA[l].z;
+        tileA[(col + 3) * TILE_M + row] = nextA[l].w;
+    }
+
+    for(int l = 0; l < LOADS_B; l++)
+    {
+        int id = tid + l * TILE_THREADS;
+        int row = id / (TILE_N / 4);
+        int col = id % (TILE_N / 4);
+        vstore4(nextB[l], row * (TILE_N / 4) + col, tileB);
+    }
+}
+
+/* Accumulates the register tile of this thread. Rows and columns are strided by
+   BLOCK_SIZE, so the work-group covers a TILE_M x TILE_N block of C. The next tiles
+   are fetched into registers while the current ones are multiplied, and written to
+   the other half of the local buffers, leaving one barrier per step along k */
+void mmmTile_tiled(__global const float4 *matrixA,
+                   __global const float4 *matrixB,
+                   int widthA, int widthB,
+                   __local float *tileA,
+                   __local float *tileB,
+                   float sum[REG_TILE_M][REG_TILE_N])
+{
+    int2 lid = (int2)(get_local_id(0), get_local_id(1));
+    int tid = lid.y * BLOCK_SIZE + lid.x;
+
+    /* Work-group origin in C, taken from the global ids so global offsets are honoured */
+    int2 origin = (int2)((get_global_id(0) - lid.x) * REG_TILE_N, (get_global_id(1) - lid.y) * REG_TILE_M);
+
+    float4 nextA[LOADS_A];
+    float4 nextB[LOADS_B];
+
+    for(int i = 0; i < REG_TILE_M; i++)
+        for(int j = 0; j < REG_TILE_N; j++)
+            sum[i][j] = 0.0f;
+
+    loadTiles(matrixA, matrixB, widthA, widthB, origin, 0, tid, nextA, nextB);
+    storeTiles(tileA, tileB, tid, nextA, nextB);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int steps = widthA / TILE_K;
+    for(int t = 0; t < steps; t++)
+    {
+        __local float *curA = tileA + (t & 1) * TILE_K * TILE_M;
+        __local float *curB = tileB + (t & 1) * TILE_K * TILE_N;
+
+        if(t + 1 < steps)
+            loadTiles(matrixA, matrixB, widthA, widthB, origin, (t + 1) * TILE_K, tid, nextA, nextB);
+
+        #pragma unroll
+        for(int k = 0; k < TILE_K; k++)
+        {
+            float a[REG_TILE_M];
+            float b[REG_TILE_N];
+
+            for(int i = 0; i < REG_TILE_M; i++)
+                a[i] = curA[k * TILE_M + lid.y + i * BLOCK_SIZE];
+            for(int j = 0; j < REG_TILE_N; j++)
+                b[j] = curB[k * TILE_N + lid.x + j * BLOCK_SIZE];
+
+            for(int i = 0; i < REG_TILE_M; i++)
+                for(int j = 0; j < REG_TILE_N; j++)
+                    sum[i][j] = mad(a[i], b[j], sum[i][j]);
+        }
+
+        /* Everyone finished reading this half one step ago, the barrier below covers it */
+        if(t + 1 < steps)
+            storeTiles(tileA + ((t + 1) & 1) * TILE_K * TILE_M, tileB + ((t + 1) & 1) * TILE_K * TILE_N,
+                       tid, nextA, nextB);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+/* Required global threads = (widthC / REG_TILE_N, heightC / REG_TILE_M),
+   local threads = (BLOCK_SIZE, BLOCK_SIZE) */
+__kernel __attribute__((reqd_work_group_size(BLOCK_SIZE, BLOCK_SIZE, 1)))
+void mmmKernel_tiled(__global const float4 *matrixA,
+                     __global const float4 *matrixB,
+                     __global float *matrixC,
+                     int widthA, int widthB)
+{
+    __local float tileA[2 * TILE_K * TILE_M];
+    __local float tileB[2 * TILE_K * TILE_N];
+    float sum[REG_TILE_M][REG_TILE_N];
+
+    mmmTile_tiled(matrixA, matrixB, widthA, widthB, tileA, tileB, sum);
+
+    int x = get_global_id(0) - get_local_id(0);
+    int y = get_global_id(1) - get_local_id(1);
+    for(int i = 0; i < REG_TILE_M; i++)
+    {
+        int row = y * REG_TILE_M + get_local_id(1) + i * BLOCK_SIZE;
+        for(int j = 0; j < REG_TILE_N; j++)
+            matrixC[row * widthB + x * REG_TILE_N + get_local_id(0) + j * BLOCK_SIZE] = sum[i][j];
+    }
+}
+
+/* Same as mmmKernel_tiled, writing the result straight into the displayed image */
+__kernel __attribute__((reqd_work_group_size(BLOCK_SIZE, BLOCK_SIZE, 1)))
+void mmmKernel_tiled_image(__global const float4 *matrixA,
+                           __global const float4 *matrixB,
+                           __write_only image2d_t imageC,
+                           int widthA, int widthB,
+                           float exposure)
+{
+    __local float tileA[2 * TILE_K * TILE_M];
+    __local float tileB[2 * TILE_K * TILE_N];
+    float sum[REG_TILE_M][REG_TILE_N];
+
+    mmmTile_tiled(matrixA, matrixB, widthA, widthB, tileA, tileB, sum);
+
+    int x = get_global_id(0) - get_local_id(0);
+    int y = get_global_id(1) - get_local_id(1);
+    for(int i = 0; i < REG_TILE_M; i++)
+    {
+        int row = y * REG_TILE_M + get_local_id(1) + i * BLOCK_SIZE;
+        for(int j = 0; j < REG_TILE_N; j++)
+        {
+            int col = x * REG_TILE_N + get_local_id(0) + j * BLOCK_SIZE;
+            write_imagef(imageC, (int2)(col, row), tonemap(sum[i][j], exposure));
+        }
+    }
+}
+
+/* Presents matrixC in the displayed RGBA8 image, one work-item per texel. C is
+   sampled nearest neighbour when its size differs from the image
+   Required global threads = (image width, image height) */
+__kernel void mmmPresent(__global const float *matrixC,
+                         __write_only image2d_t imageC,
+                         int widthC, int heightC,
+                         float exposure)
+{
+    int2 pos = (int2)(get_global_id(0), get_global_id(1));
+    int2 size = get_image_dim(imageC);
+
+    if(pos.x >= size.x || pos.y >= size.y)
+        return;
+
+    int x = pos.x * widthC / size.x;
+    int y = pos.y * heightC / size.y;
+    write_imagef(imageC, pos, tonemap(matrixC[y * widthC + x], exposure));
+}
+
+/* Batched GEMM over many small n x n matrices, n a multiple of 4. Each work-item
+   computes four adjacent elements of a row of C; a work-group covers as many whole
+   matrices as its size allows, and a single matrix once n * n / 4 exceeds it */
+void mmmBatchedItem(__global const float4 *matrixA,
+                    __global const float4 *matrixB,
+                    __global float4 *matrixC,
+                    int n, int row, int col)
+{
+    float4 sum = (float4)(0);
+
+    for(int k = 0; k < n / 4; k++)
+    {
+        float4 a = matrixA[row * (n / 4) + k];
+        sum += a.x * matrixB[(4 * k + 0) * (n / 4) + col];
+        sum += a.y * matrixB[(4 * k + 1) * (n / 4) + col];
+        sum += a.z * matrixB[(4 * k + 2) * (n / 4) + col];
+        sum += a.w * matrixB[(4 * k + 3) * (n / 4) + col];
+    }
+    matrixC[row * (n / 4) + col] = sum;
+}
+
+/* Required global threads = ceil((end - first) / matrices per group) * local size.
+   Matrix b of the batch is stored at b * n * n in each buffer */
+__kernel void mmmKernel_batched(__global const float4 *matrixA,
+                                __global const float4 *matrixB,
+                                __global float4 *matrixC,
+                                int n, int end, int first)
+{
+    int items = n * n / 4;
+    int per_group = max(1, (int)get_local_size(0) / items);
+
+    for(int i = get_local_id(0); i < per_group * items; i += get_local_size(0))
+    {
+        int b = first + get_group_id(0) * per_group + i / items;
+        int e = i % items;
+        if(b < end)
+            mmmBatchedItem(matrixA + b * items, matrixB + b * items, matrixC + b * items, n, e / (n / 4), e % (n / 4));
+    }
+}
+
+/* Same as mmmKernel_batched with the matrices placed anywhere in the buffers: slots
+   holds the float4 offsets of A, B and C for every matrix of the batch */
+__kernel void mmmKernel_batched_indexed(__global const float4 *matrixA,
+                                        __global const float4 *matrixB,
+                                        __global float4 *matrixC,
+                                        __global const uint *slots,
+                                        int n, int end, int first)
+{
+    int items = n * n / 4;
+    int per_group = max(1, (int)get_local_size(0) / items);
+
+    for(int i = get_local_id(0); i < per_group * items; i += get_local_size(0))
+    {
+        int b = first + get_group_id(0) * per_group + i / items;
+        int e = i % items;
+        if(b < end)
+            mmmBatchedItem(matrixA + slots[3 * b], matrixB + slots[3 * b + 1], matrixC + slots[3 * b + 2],
+                           n, e / (n / 4), e % (n / 4));
+    }
+}
+
+/* Reduced precision variants of mmmKernel with the same 4x4 tile per thread. The half
+   kernel reads fp16 inputs and accumulates in float; vload_half4 is core OpenCL, so
+   runtimes without cl_khr_fp16 unpack the halves in software */
+#ifdef cl_khr_fp16
+#pragma OPENCL EXTENSION cl_khr_fp16 : enable
+#define LOAD_HALF4(i, p) convert_float4(vload4(i, p))
+#else
+#define LOAD_HALF4(i, p) vload_half4(i, p)
+#endif
+
+/* Required global threads = (widthC / 4, heightC / 4) */
+__kernel void mmmKernel_half(__global const half *matrixA,
+                             __global const half *matrixB,
+                             __global float4 *matrixC,
+                             uint widthA, uint widthB)
+{
+    int2 pos = (int2)(get_global_id(0), get_global_id(1));
+    float4 sum[TILEY];
+
+    for(int r = 0; r < TILEY; r++)
+        sum[r] = (float4)(0);
+
+    widthB /= 4;
+    for(int i = 0; i < widthA; i = i + 4)
+    {
+        float4 tempB0 = LOAD_HALF4(pos.x + i * widthB, matrixB);
+        float4 tempB1 = LOAD_HALF4(pos.x + (i + 1) * widthB, matrixB);
+        float4 tempB2 = LOAD_HALF4(pos.x + (i + 2) * widthB, matrixB);
+        float4 tempB3 = LOAD_HALF4(pos.x + (i + 3) * widthB, matrixB);
+
+        for(int r = 0; r < TILEY; r++)
+        {
+            float4 tempA = LOAD_HALF4(i / 4 + ((pos.y << TILEY_SHIFT) + r) * (widthA / 4), matrixA);
+            sum[r] += tempA.x * tempB0 + tempA.y * tempB1 + tempA.z * tempB2 + tempA.w * tempB3;
+        }
+    }
+
+    for(int r = 0; r < TILEY; r++)
+        matrixC[pos.x + ((pos.y << TILEY_SHIFT) + r) * widthB] = sum[r];
+}
+
+/* int8 inputs with int32 accumulation. A is quantized per row and B per column, so
+   the integer sums are scaled back to float on the way out */
+/* Required global threads = (widthC / 4, heightC / 4) */
+__kernel void mmmKernel_int8(__global const char4 *matrixA,
+                             __global const char4 *matrixB,
+                             __global float4 *matrixC,
+                             __global const float *scaleA,
+                             __global const float4 *scaleB,
+                             uint widthA, uint widthB)
+{
+    int2 pos = (int2)(get_global_id(0), get_global_id(1));
+    int4 sum[TILEY];
+
+    for(int r = 0; r < TILEY; r++)
+        sum[r] = (int4)(0);
+
+    widthB /= 4;
+    for(int i = 0; i < widthA; i = i + 4)
+    {
+        int4 tempB0 = convert_int4(matrixB[pos.x + i * widthB]);
+        int4 tempB1 = convert_int4(matrixB[pos.x + (i + 1) * widthB]);
+        int4 tempB2 = convert_int4(matrixB[pos.x + (i + 2) * widthB]);
+        int4 tempB3 = convert_int4(matrixB[pos.x + (i + 3) * widthB]);
+
+        for(int r = 0; r < TILEY; r++)
+        {
+            int4 tempA = convert_int4(matrixA[i / 4 + ((pos.y << TILEY_SHIFT) + r) * (widthA / 4)]);
+            sum[r] += tempA.x * tempB0 + tempA.y * tempB1 + tempA.z * tempB2 + tempA.w * tempB3;
+        }
+    }
+
+    for(int r = 0; r < TILEY; r++)
+    {
+        int row = (pos.y << TILEY_SHIFT) + r;
+        matrixC[pos.x + row * widthB] = convert_float4(sum[r]) * scaleA[row] * scaleB[pos.x];
+    }
+}
+
+/* Fills count floats with values uniform in [low, high), hashed from the index and the
+   seed so that animated frames get new inputs without any host work */
+__kernel void mmmFill(__global float *data, uint count, uint seed, float low, float high)
+{
+    uint i = get_global_id(0);
+    if(i >= count)
+        return;
+
+    uint h = i ^ (seed * 0x9e3779b9U);
+    h ^= h >> 16;
+    h *= 0x7feb352dU;
+    h ^= h >> 15;
+    h *= 0x846ca68bU;
+    h ^= h >> 16;
+
+    data[i] = low + (high - low) * (float)(h >> 8) * (1.0f / 16777216.0f);
+}
@@ -79,4 +79,253 @@ void nbody_sim(__global float4* pos, __global float4* vel
     // write to global memory
     newPosition[gid] = newPos;
     newVelocity[gid] = newVel;
-}
\ No newline at end of file
+}
+
+/*
+ * Short-range mode: the bodies are binned into a uniform grid of cells at
+ * least the cutoff radius wide, so every body within the cutoff of another
+ * one is in the same or in one of the 26 neighbouring cells. A counting sort
+ * orders the bodies by cell, cell_count, exclusive_scan and cell_scatter, and
+ * nbody_cutoff then only visits the neighbouring cells.
+ *
+ * grid holds the grid origin in xyz and the cell width in w, dims the cells
+ * along each axis in xyz and their total in w.
+ */
+
+// Cell coordinates of a position, clamped to the grid so strays fall in the
+// border cells. Clamping never pulls two positions more than a cell apart.
+int4 cell_coords(float4 p, float4 grid, int4 dims)
+{
+    int4 c;
+    c.x = clamp((int)floor((p.x - grid.x) / grid.w), 0, dims.x - 1);
+    c.y = clamp((int)floor((p.y - grid.y) / grid.w), 0, dims.y - 1);
+    c.z = clamp((int)floor((p.z - grid.z) / grid.w), 0, dims.z - 1);
+    c.w = 0;
+    return c;
+}
+
+// Finds the cell of each body and its slot within the cell
+__kernel
+void cell_count(__global float4* pos, float4 grid, int4 dims
+		,__global uint* cellOf, __global uint* rank, __global uint* cellCount) {
+
+    unsigned int gid = get_global_id(0);
+    int4 c = cell_coords(pos[gid], grid, dims);
+    uint cell = (c.z * dims.y + c.y) * dims.x + c.x;
+
+    cellOf[gid] = cell;
+    rank[gid] = atomic_inc(&cellCount[cell]);
+}
+
+// Exclusive prefix sum of counts with a single work-group, every work-item
+// scanning a contiguous run of them. starts takes one more entry for the
+// total, and the counts are cleared for the next round. Shared by the cell
+// grid and the radix sort.
+__kernel
+void exclusive_scan(__global uint* counts, int numCounts
+		,__global uint* starts, __local uint* sums) {
+
+    uint me = get_local_id(0);
+    uint items = get_local_size(0);
+    uint run = (numCounts + items - 1) / items;
+    uint first = min(me * run, (uint)numCounts);
+    uint last = min(first + run, (uint)numCounts);
+
+    uint sum = 0;
+    for (uint c = first; c < last; c++)
+        sum += counts[c];
+    sums[me] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // inclusive scan of the run totals
+    for (uint d = 1; d < items; d <<= 1) {
+        uint add = (me >= d) ? sums[me - d] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        sums[me] += add;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    uint start = sums[me] - sum;
+    for (uint c = first; c < last; c++) {
+        uint n = counts[c];
+        starts[c] = start;
+        counts[c] = 0;
+        start += n;
+    }
+    if (me == items - 1)
+        starts[numCounts] = sums[me];
+}
+
+// Moves each body to its slot in cell order and records where it came from
+__kernel
+void cell_scatter(__global float4* pos, __global float4* vel
+		,__global uint* cellOf, __global uint* rank, __global uint* cellStart
+		,__global float4* sortedPos, __global float4* sortedVel, __global uint* sortedIndex) {
+
+    unsigned int gid = get_global_id(0);
+    uint slot = cellStart[cellOf[gid]] + rank[gid];
+
+    sortedPos[slot] = pos[gid];
+    sortedVel[slot] = vel[gid];
+    sortedIndex[slot] = gid;
+}
+
+// Carries the ids into cell order along with the bodies, so each slot still
+// knows which body it holds
+__kernel
+void cell_ids(__global uint* ids, __global uint* sortedIndex, __global uint* newIds) {
+
+    unsigned int gid = get_global_id(0);
+    newIds[gid] = ids[sortedIndex[gid]];
+}
+
+// nbody_sim over the bodies within the cutoff only, the bodies sorted by
+// cell. The three cells along x of each neighbouring row are adjacent in the
+// sorted order, so they are one range. Also counts the pairs within the cutoff.
+__kernel
+void nbody_cutoff(__global float4* pos, __global float4* vel, __global uint* cellStart
+		,float4 grid, int4 dims, float deltaTime, float epsSqr, float cutoffSqr
+		,__global float4* newPosition, __global float4* newVelocity, __global uint* pairCount) {
+
+    unsigned int gid = get_global_id(0);
+    float4 myPos = pos[gid];
+    float4 acc = (float4)0.0f;
+    uint pairs = 0;
+
+    int4 c = cell_coords(myPos, grid, dims);
+    int x0 = max(c.x - 1, 0);
+    int x1 = min(c.x + 1, dims.x - 1);
+
+    for (int z = max(c.z - 1, 0); z <= min(c.z + 1, dims.z - 1); z++) {
+        for (int y = max(c.y - 1, 0); y <= min(c.y + 1, dims.y - 1); y++) {
+            uint row = (z * dims.y + y) * dims.x;
+            uint last = cellStart[row + x1 + 1];
+
+            for (uint i = cellStart[row + x0]; i < last; i++) {
+                float4 p = pos[i];
+                float4 r;
+                r.xyz = p.xyz - myPos.xyz;
+                float distSqr = r.x * r.x  +  r.y * r.y  +  r.z * r.z;
+
+                if (distSqr < cutoffSqr) {
+                    float invDist = 1.0f / sqrt(distSqr + epsSqr);
+                    float invDistCube = invDist * invDist * invDist;
+                    float s = p.w * invDistCube;
+
+                    // accumulate effect of the particles in range
+                    acc.xyz += s * r.xyz;
+                    pairs++;
+                }
+            }
+        }
+    }
+
+    float4 oldVel = vel[gid];
+
+    // updated position and velocity
+    float4 newPos;
+    newPos.xyz = myPos.xyz + oldVel.xyz * deltaTime + acc.xyz * 0.5f * deltaTime * deltaTime;
+    newPos.w = myPos.w;
+
+    float4 newVel;
+    newVel.xyz = oldVel.xyz + acc.xyz * deltaTime;
+    newVel.w = oldVel.w;
+
+    // write to global memory
+    newPosition[gid] = newPos;
+    newVelocity[gid] = newVel;
+    pairCount[gid] = pairs;
+}
+
+
+/*
+ * Stable least significant digit radix sort of uint keys, each carrying a
+ * uint value, RADIX_BITS per pass. Every work-item owns a run of keys: it
+ * counts their digits with radix_count, exclusive_scan turns the counts into
+ * the first slot of each digit and work-item, and radix_scatter moves the
+ * run there in order.
+ */
+
+#define RADIX_BITS  4
+#define RADIX_DIGITS  (1 << RADIX_BITS)
+
+// Digit counts of each run, digit-major so that the scan orders them by digit
+// first and by work-item second
+__kernel
+void radix_count(__global uint* keys, uint count, uint run, uint shift
+		,__global uint* counts) {
+
+    uint gid = get_global_id(0);
+    uint items = get_global_size(0);
+    uint first = min(gid * run, count);
+    uint last = min(first + run, count);
+    uint n[RADIX_DIGITS];
+
+    for (uint d = 0; d < RADIX_DIGITS; d++)
+        n[d] = 0;
+    for (uint i = first; i < last; i++)
+        n[(keys[i] >> shift) & (RADIX_DIGITS - 1)]++;
+    for (uint d = 0; d < RADIX_DIGITS; d++)
+        counts[d * items + gid] = n[d];
+}
+
+__kernel
+void radix_scatter(__global uint* keys, __global uint* values, uint count, uint run, uint shift
+		,__global uint* starts, __global uint* newKeys, __global uint* newValues) {
+
+    uint gid = get_global_id(0);
+    uint items = get_global_size(0);
+    uint first = min(gid * run, count);
+    uint last = min(first + run, count);
+    uint slot[RADIX_DIGITS];
+
+    for (uint d = 0; d < RADIX_DIGITS; d++)
+        slot[d] = starts[d * items + gid];
+    for (uint i = first; i < last; i++) {
+        uint key = keys[i];
+        uint s = slot[(key >> shift) & (RADIX_DIGITS - 1)]++;
+        newKeys[s] = key;
+        newValues[s] = values[i];
+    }
+}
+
+// Spreads the low 10 bits of v out to every third bit
+uint morton_spread(uint v)
+{
+    v = (v | (v << 16)) & 0x030000FFU;
+    v = (v | (v << 8)) & 0x0300F00FU;
+    v = (v | (v << 4)) & 0x030C30C3U;
+    v = (v | (v << 2)) & 0x09249249U;
+    return v;
+}
+
+// Z-order code of each body on a 1024 cell a side grid, with the body as the
+// value. frame holds the grid origin in xyz and 1024 over its width in w,
+// bodies outside of it take the code of the nearest border cell.
+__kernel
+void morton_codes(__global float4* pos, float4 frame
+		,__global uint* keys, __global uint* values) {
+
+    unsigned int gid = get_global_id(0);
+    float4 p = pos[gid];
+    uint x = (uint)clamp((p.x - frame.x) * frame.w, 0.0f, 1023.0f);
+    uint y = (uint)clamp((p.y - frame.y) * frame.w, 0.0f, 1023.0f);
+    uint z = (uint)clamp((p.z - frame.z) * frame.w, 0.0f, 1023.0f);
+
+    keys[gid] = (morton_spread(z) << 2) | (morton_spread(y) << 1) | morton_spread(x);
+    values[gid] = gid;
+}
+
+// Gathers the bodies in the order of the sorted values, ids follow them so
+// each slot still knows which body it holds
+__kernel
+void permute_bodies(__global float4* pos, __global float4* vel, __global uint* ids, __global uint* order
+		,__global float4* newPosition, __global float4* newVelocity, __global uint* newIds) {
+
+    unsigned int gid = get_global_id(0);
+    uint from = order[gid];
+
+    newPosition[gid] = pos[from];
+    newVelocity[gid] = vel[from];
+    newIds[gid] = ids[from];
+}
@@ -0,0 +1,386 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Headless stand-in for the GL/CL interop in NBody, FFT and GaussianNoise
+//
+// Two worker threads play the GL and CL command queues, the main thread plays
+// the application. Each frame CL writes a shared buffer that GL then draws,
+// first with the glFinish/clFinish hard syncs the benchmarks use, then with
+// fences the queues wait on themselves, then with no synchronization at all.
+// The commands check the buffer hand-off, so a missing fence shows up as
+// errors while the hard syncs and the fences must both come out clean.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_COMMANDS                    (64)
+#define FRAMES_IN_FLIGHT                (2)
+#define SEPARATOR                       ("----------------------------------------------------------------------\n")
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int signaled;
+} SimFence;
+
+typedef void (*SimAction)(int frame, int done);
+
+typedef struct
+{
+    SimFence *wait;
+    double work_ms;
+    SimAction action;
+    int frame;
+    SimFence *signal;
+} SimCommand;
+
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    SimCommand commands[MAX_COMMANDS];
+    int head;
+    int tail;
+    int quit;
+} SimQueue;
+
+enum
+{
+    SYNC_HARD = 0,
+    SYNC_FENCE,
+    SYNC_NONE,
+    SYNC_MODES
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static SimQueue GLQueue;
+static SimQueue CLQueue;
+
+static pthread_mutex_t DataLock         = PTHREAD_MUTEX_INITIALIZER;
+static int SharedFrame                  = -1;
+static int DrawnFrame                   = -1;
+static int Errors                       = 0;
+
+static int Frames                       = 200;
+static double AppMs                     = 4.0;
+static double ComputeMs                 = 3.0;
+static double RenderMs                  = 3.0;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static double
+GetPreciseTime()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+Work(double ms)
+{
+    struct timespec ts;
+
+    if (ms <= 0)
+        return;
+
+    ts.tv_sec = (time_t)(ms / 1000.0);
+    ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1000000.0);
+    nanosleep(&ts, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+InitFence(SimFence *fence)
+{
+    pthread_mutex_init(&fence->lock, NULL);
+    pthread_cond_init(&fence->cond, NULL);
+    fence->signaled = 0;
+}
+
+static void
+DestroyFence(SimFence *fence)
+{
+    pthread_mutex_destroy(&fence->lock);
+    pthread_cond_destroy(&fence->cond);
+}
+
+static void
+SignalFence(SimFence *fence)
+{
+    pthread_mutex_lock(&fence->lock);
+    fence->signaled = 1;
+    pthread_cond_broadcast(&fence->cond);
+    pthread_mutex_unlock(&fence->lock);
+}
+
+static void
+WaitFence(SimFence *fence)
+{
+    pthread_mutex_lock(&fence->lock);
+    while (!fence->signaled)
+        pthread_cond_wait(&fence->cond, &fence->lock);
+    pthread_mutex_unlock(&fence->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void *
+RunQueue(void *arg)
+{
+    SimQueue *queue = (SimQueue *)arg;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;)
+    {
+        while (queue->head == queue->tail && !queue->quit)
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        if (queue->head == queue->tail)
+            break;
+
+        // Leave the command in the ring until it retires so Finish sees it
+        SimCommand command = queue->commands[queue->head % MAX_COMMANDS];
+        pthread_mutex_unlock(&queue->lock);
+
+        if (command.wait)
+            WaitFence(command.wait);
+        if (command.action)
+            command.action(command.frame, 0);
+        Work(command.work_ms);
+        if (command.action)
+            command.action(command.frame, 1);
+        if (command.signal)
+            SignalFence(command.signal);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->head++;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+static int
+CreateQueue(SimQueue *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+
+    return pthread_create(&queue->thread, NULL, RunQueue, queue);
+}
+
+static void
+ReleaseQueue(SimQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->quit = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_join(queue->thread, NULL);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->cond);
+}
+
+static void
+Enqueue(SimQueue *queue, SimFence *wait, double work_ms, SimAction action, int frame, SimFence *signal)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->tail - queue->head >= MAX_COMMANDS)
+        pthread_cond_wait(&queue->cond, &queue->lock);
+
+    SimCommand *command = &queue->commands[queue->tail % MAX_COMMANDS];
+    command->wait = wait;
+    command->work_ms = work_ms;
+    command->action = action;
+    command->frame = frame;
+    command->signal = signal;
+    queue->tail++;
+
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// glFinish/clFinish: the host blocks until everything queued so far retired
+static void
+Finish(SimQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head != queue->tail)
+        pthread_cond_wait(&queue->cond, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// CL side: may only overwrite the buffer once GL drew the previous frame from it
+static void
+KernelAction(int frame, int done)
+{
+    pthread_mutex_lock(&DataLock);
+    if (!done && DrawnFrame != frame - 1)
+        Errors++;
+    if (done)
+        SharedFrame = frame;
+    pthread_mutex_unlock(&DataLock);
+}
+
+// GL side: must see this frame's results for the whole draw
+static void
+RenderAction(int frame, int done)
+{
+    pthread_mutex_lock(&DataLock);
+    if (SharedFrame != frame)
+        Errors++;
+    if (done)
+        DrawnFrame = frame;
+    pthread_mutex_unlock(&DataLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int
+RunFrames(int mode, double *frame_ms, double *stall_ms, int *errors)
+{
+    SimFence *fences = (SimFence *)calloc(3 * Frames, sizeof(SimFence));
+    double stall = 0;
+
+    if (!fences)
+        return -1;
+
+    for (int i = 0; i < 3 * Frames; i++)
+        InitFence(&fences[i]);
+
+    SharedFrame = -1;
+    DrawnFrame = -1;
+    Errors = 0;
+
+    double start = GetPreciseTime();
+    for (int f = 0; f < Frames; f++)
+    {
+        SimFence *gl_done = &fences[3 * f];
+        SimFence *cl_done = &fences[3 * f + 1];
+        SimFence *presented = &fences[3 * f + 2];
+
+        // Application work between frames
+        Work(AppMs);
+
+        if (mode == SYNC_HARD)
+        {
+            double begin = GetPreciseTime();
+            Finish(&GLQueue);
+            stall += GetPreciseTime() - begin;
+
+            Enqueue(&CLQueue, NULL, ComputeMs, KernelAction, f, NULL);
+
+            begin = GetPreciseTime();
+            Finish(&CLQueue);
+            stall += GetPreciseTime() - begin;
+
+            Enqueue(&GLQueue, NULL, RenderMs, RenderAction, f, presented);
+        }
+        else
+        {
+            int fenced = (mode == SYNC_FENCE);
+
+            // glFenceSync, the CL queue waits on it instead of the host
+            Enqueue(&GLQueue, NULL, 0, NULL, f, gl_done);
+            Enqueue(&CLQueue, fenced ? gl_done : NULL, ComputeMs, KernelAction, f, cl_done);
+            Enqueue(&GLQueue, fenced ? cl_done : NULL, RenderMs, RenderAction, f, presented);
+        }
+
+        // Swap chain throttling, the same for every mode
+        if (f >= FRAMES_IN_FLIGHT)
+            WaitFence(&fences[3 * (f - FRAMES_IN_FLIGHT) + 2]);
+    }
+    Finish(&CLQueue);
+    Finish(&GLQueue);
+
+    *frame_ms = (GetPreciseTime() - start) / Frames;
+    *stall_ms = stall / Frames;
+    *errors = Errors;
+
+    for (int i = 0; i < 3 * Frames; i++)
+        DestroyFence(&fences[i]);
+    free(fences);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line options
+    //
+    int i;
+    const char *names[SYNC_MODES] = { "glFinish/clFinish", "fences", "no sync" };
+    double frame_ms[SYNC_MODES];
+    double stall_ms[SYNC_MODES];
+    int errors[SYNC_MODES];
+
+    for( i = 0; i < argc && argv; i++)
+    {
+        if(!argv[i] || i + 1 >= argc)
+            continue;
+
+        if(strstr(argv[i], "-frames"))
+            Frames = atoi(argv[i+1]) > 0 ? atoi(argv[i+1]) : 1;
+
+        else if(strstr(argv[i], "-app"))
+            AppMs = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-compute"))
+            ComputeMs = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-render"))
+            RenderMs = atof(argv[i+1]);
+    }
+
+    if (CreateQueue(&GLQueue) || CreateQueue(&CLQueue))
+    {
+        printf("Failed to start queue threads!\n");
+        return 1;
+    }
+
+    printf(SEPARATOR);
+    printf("Fence simulation (%d frames, app %.2f ms, compute %.2f ms, render %.2f ms)\n",
+        Frames, AppMs, ComputeMs, RenderMs);
+
+    for (int mode = 0; mode < SYNC_MODES; mode++)
+    {
+        if (RunFrames(mode, &frame_ms[mode], &stall_ms[mode], &errors[mode]))
+        {
+            printf("Failed to allocate fences!\n");
+            return 1;
+        }
+
+        printf("  %-18s %8.3f ms per frame  stalled %8.3f ms  hand-off errors %d\n",
+            names[mode], frame_ms[mode], stall_ms[mode], errors[mode]);
+    }
+
+    printf("  Hard syncs cost    %8.3f ms per frame (%4.1f%%)\n", frame_ms[SYNC_HARD] - frame_ms[SYNC_FENCE],
+        100.0 * (frame_ms[SYNC_HARD] - frame_ms[SYNC_FENCE]) / frame_ms[SYNC_HARD]);
+    printf(SEPARATOR);
+
+    ReleaseQueue(&GLQueue);
+    ReleaseQueue(&CLQueue);
+
+    // Both synchronized modes must hand every frame over cleanly
+    return (errors[SYNC_HARD] || errors[SYNC_FENCE]) ? 1 : 0;
+}
@@ -0,0 +1,651 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Memory bandwidth baseline for the bandwidth-bound kernels in the suite
+//
+// Host<->device reads and writes from pageable and pinned memory, device
+// buffer copies, buffer to image copies as MatMul and Julia use them, and
+// STREAM-style copy/scale/triad kernels, over a sweep of sizes. The kernels
+// are then put against the best device bandwidth measured in the run, and a
+// mad-bound kernel gives the compute peak for the benchmarks' roofline reports.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <CL/cl.h>
+
+#include "MeasureUtil.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define COMPUTE_KERNEL_FILENAME         ("Bandwidth_Kernels.cl")
+#define COMPUTE_KERNEL_COPY_NAME        ("stream_copy")
+#define COMPUTE_KERNEL_SCALE_NAME       ("stream_scale")
+#define COMPUTE_KERNEL_TRIAD_NAME       ("stream_triad")
+#define COMPUTE_KERNEL_PEAK_NAME        ("peak_mad")
+#define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#define MAX_SAMPLES                     (1000)
+#define MIN_SIZE                        (4 * 1024)
+#define IMAGE_WIDTH                     (1024)     // RGBA float texels per image row
+#define BYTES_PER_SAMPLE                (256 * 1024 * 1024)
+#define MAX_REPEATS                     (1000)
+#define MAD_LOOPS                       (256)
+#define PEAK_ITEMS                      (1024 * 1024)
+#define PEAK_FLOPS_PER_ITEM             (MAD_LOOPS * 8 * 4 * 2)   // 8 float4 mad chains
+
+////////////////////////////////////////////////////////////////////////////////
+
+static cl_context                       ComputeContext;
+static cl_command_queue                 ComputeCommands;
+static cl_kernel                        CopyKernel;
+static cl_kernel                        ScaleKernel;
+static cl_kernel                        TriadKernel;
+static cl_kernel                        PeakKernel;
+static cl_program                       ComputeProgram;
+static cl_device_id                     ComputeDeviceId;
+static cl_device_type                   ComputeDeviceType;
+static cl_mem                           ComputeA;
+static cl_mem                           ComputeB;
+static cl_mem                           ComputeC;
+static cl_mem                           ComputePinned;
+static cl_mem                           ComputeImage;
+static cl_mem                           ComputePeak;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int Samples                      = 10;
+static size_t MaxSize                   = 64 * 1024 * 1024;
+static size_t CurrentSize               = MIN_SIZE;
+static int Repeats                      = 1;
+static float Scalar                     = 3.0f;
+static float PeakScalar                 = 0.999f;
+
+static unsigned char *PageableData      = NULL;
+static unsigned char *PinnedData        = NULL;
+static cl_bool ImageSupport             = CL_FALSE;
+
+static double SampleTimes[MAX_SAMPLES];
+static double PeakBandwidth             = 0;
+static size_t PeakSize                  = 0;
+static cl_ulong CacheSize               = 0;
+
+FILE *fp;
+static int EnableOutput                 = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int LoadTextFromFile(
+    const char *file_name, char **result_string, size_t *string_len)
+{
+    int fd;
+    unsigned file_len;
+    struct stat file_status;
+    int ret;
+
+    *string_len = 0;
+    fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+    {
+        printf("Error opening file %s\n", file_name);
+        return -1;
+    }
+    ret = fstat(fd, &file_status);
+    if (ret)
+    {
+        printf("Error reading status for file %s\n", file_name);
+        return -1;
+    }
+    file_len = file_status.st_size;
+
+    *result_string = (char*)calloc(file_len + 1, sizeof(char));
+    ret = read(fd, *result_string, file_len);
+    if (!ret)
+    {
+        printf("Error reading from file %s\n", file_name);
+        return -1;
+    }
+
+    close(fd);
+
+    *string_len = file_len;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Each measurement moves CurrentSize bytes Repeats times and returns ms per repeat
+
+static int
+MeasureWrite(unsigned char *host, double *ms)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Repeats && err == CL_SUCCESS; i++)
+        err = clEnqueueWriteBuffer(ComputeCommands, ComputeA, CL_FALSE, 0, CurrentSize, host, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *ms = (GetHostTime() - start) / Repeats;
+    return err;
+}
+
+static int
+MeasureRead(unsigned char *host, double *ms)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Repeats && err == CL_SUCCESS; i++)
+        err = clEnqueueReadBuffer(ComputeCommands, ComputeA, CL_FALSE, 0, CurrentSize, host, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *ms = (GetHostTime() - start) / Repeats;
+    return err;
+}
+
+static int
+MeasureWritePageable(double *ms)
+{
+    return MeasureWrite(PageableData, ms);
+}
+
+static int
+MeasureWritePinned(double *ms)
+{
+    return MeasureWrite(PinnedData, ms);
+}
+
+static int
+MeasureReadPageable(double *ms)
+{
+    return MeasureRead(PageableData, ms);
+}
+
+static int
+MeasureReadPinned(double *ms)
+{
+    return MeasureRead(PinnedData, ms);
+}
+
+static int
+MeasureCopyBuffer(double *ms)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Repeats && err == CL_SUCCESS; i++)
+        err = clEnqueueCopyBuffer(ComputeCommands, ComputeA, ComputeB, 0, 0, CurrentSize, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *ms = (GetHostTime() - start) / Repeats;
+    return err;
+}
+
+static int
+MeasureCopyToImage(double *ms)
+{
+    int err = CL_SUCCESS;
+    size_t origin[3] = { 0, 0, 0 };
+    size_t region[3] = { IMAGE_WIDTH, CurrentSize / (IMAGE_WIDTH * 4 * sizeof(float)), 1 };
+
+    double start = GetHostTime();
+    for (int i = 0; i < Repeats && err == CL_SUCCESS; i++)
+        err = clEnqueueCopyBufferToImage(ComputeCommands, ComputeA, ComputeImage, 0, origin, region, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *ms = (GetHostTime() - start) / Repeats;
+    return err;
+}
+
+static int
+MeasureKernel(cl_kernel kernel, double *ms)
+{
+    int err = CL_SUCCESS;
+    size_t global = CurrentSize / (4 * sizeof(float));
+
+    double start = GetHostTime();
+    for (int i = 0; i < Repeats && err == CL_SUCCESS; i++)
+        err = clEnqueueNDRangeKernel(ComputeCommands, kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *ms = (GetHostTime() - start) / Repeats;
+    return err;
+}
+
+static int
+MeasureStreamCopy(double *ms)
+{
+    return MeasureKernel(CopyKernel, ms);
+}
+
+static int
+MeasureStreamScale(double *ms)
+{
+    return MeasureKernel(ScaleKernel, ms);
+}
+
+static int
+MeasureStreamTriad(double *ms)
+{
+    return MeasureKernel(TriadKernel, ms);
+}
+
+static int
+MeasurePeakMad(double *ms)
+{
+    int err = CL_SUCCESS;
+    size_t global = PEAK_ITEMS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Repeats && err == CL_SUCCESS; i++)
+        err = clEnqueueNDRangeKernel(ComputeCommands, PeakKernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *ms = (GetHostTime() - start) / Repeats;
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int
+RunMeasurement(const char *name, int (*measure)(double *ms), int traffic, int device, double *result)
+{
+    double sorted[MAX_SAMPLES];
+    double warmup;
+    double mean = 0;
+    double variance = 0;
+
+    // One untimed pass pages in the buffers and the runtime paths
+    int err = measure(&warmup);
+    for (int s = 0; s < Samples && err == CL_SUCCESS; s++)
+        err = measure(&SampleTimes[s]);
+    if (err != CL_SUCCESS)
+    {
+        printf("Failed to measure %s! %d\n", name, err);
+        return err;
+    }
+
+    // Bandwidth per sample, traffic counts every byte read plus written
+    for (int s = 0; s < Samples; s++)
+    {
+        sorted[s] = (SampleTimes[s] > 0) ? traffic * (double)CurrentSize / (SampleTimes[s] * 1000000.0) : 0;
+        mean += sorted[s] / Samples;
+    }
+    for (int s = 0; s < Samples; s++)
+        variance += (sorted[s] - mean) * (sorted[s] - mean) / (Samples > 1 ? Samples - 1 : 1);
+
+    qsort(sorted, Samples, sizeof(double), CompareDoubles);
+    double median = (Samples & 1) ? sorted[Samples / 2] : 0.5 * (sorted[Samples / 2 - 1] + sorted[Samples / 2]);
+    double stddev = sqrt(variance);
+
+    printf("  %-22s %8u KB  %8.2f GB/s  max %8.2f  stddev %6.2f\n",
+        name, (unsigned)(CurrentSize / 1024), median, sorted[Samples - 1], stddev);
+
+    if (EnableOutput)
+        fprintf(fp, "%s Size %u Median %.3f GB/s Max %.3f GB/s Stddev %.3f GB/s\n", name, (unsigned)CurrentSize,
+            median, sorted[Samples - 1], stddev);
+
+    // Cache resident sizes overstate the peak, only the largest size or those past the cache count
+    int uncached = CurrentSize > CacheSize || CurrentSize * 4 > MaxSize;
+    if (device && uncached && median > PeakBandwidth)
+    {
+        PeakBandwidth = median;
+        PeakSize = CurrentSize;
+    }
+    if (result)
+        *result = median;
+
+    return CL_SUCCESS;
+}
+
+static int
+RunPeakCompute(void)
+{
+    double sorted[MAX_SAMPLES];
+    double warmup;
+
+    Repeats = 10;
+
+    int err = MeasurePeakMad(&warmup);
+    for (int s = 0; s < Samples && err == CL_SUCCESS; s++)
+        err = MeasurePeakMad(&SampleTimes[s]);
+    if (err != CL_SUCCESS)
+    {
+        printf("Failed to measure peak compute! %d\n", err);
+        return err;
+    }
+
+    for (int s = 0; s < Samples; s++)
+        sorted[s] = (SampleTimes[s] > 0) ? (double)PEAK_ITEMS * PEAK_FLOPS_PER_ITEM / (SampleTimes[s] * 1000000.0) : 0;
+
+    qsort(sorted, Samples, sizeof(double), CompareDoubles);
+    double median = (Samples & 1) ? sorted[Samples / 2] : 0.5 * (sorted[Samples / 2 - 1] + sorted[Samples / 2]);
+
+    printf("Compute peak (%d work-items, %d mads each)\n", PEAK_ITEMS, PEAK_FLOPS_PER_ITEM / 2);
+    printf("  %-22s %8.2f GFLOP/s  max %8.2f\n", "peak mad", median, sorted[Samples - 1]);
+    printf(SEPARATOR);
+
+    // Paste into MatMul, NBody, FFT, GaussianNoise or Julia for the roofline
+    printf("Roofline peaks: -peakgflops %.1f -peakbw %.1f (bandwidth at %u KB)\n", median, PeakBandwidth,
+        (unsigned)(PeakSize / 1024));
+    printf(SEPARATOR);
+
+    if (EnableOutput)
+        fprintf(fp, "PeakCompute %.3f GFLOP/s Max %.3f GFLOP/s\n", median, sorted[Samples - 1]);
+
+    return CL_SUCCESS;
+}
+
+static int
+RunSweep(void)
+{
+    int err = CL_SUCCESS;
+    double stream[3] = { 0, 0, 0 };
+
+    printf(SEPARATOR);
+    printf("Memory bandwidth (%d samples, %u KB to %u KB, %u KB cache)\n", Samples, (unsigned)(MIN_SIZE / 1024),
+        (unsigned)(MaxSize / 1024), (unsigned)(CacheSize / 1024));
+
+    for (CurrentSize = MIN_SIZE; CurrentSize <= MaxSize && err == CL_SUCCESS; CurrentSize *= 4)
+    {
+        Repeats = BYTES_PER_SAMPLE / CurrentSize;
+        Repeats = (Repeats < 1) ? 1 : (Repeats > MAX_REPEATS ? MAX_REPEATS : Repeats);
+
+        err |= RunMeasurement("write pageable", MeasureWritePageable, 1, 0, NULL);
+        err |= RunMeasurement("write pinned", MeasureWritePinned, 1, 0, NULL);
+        err |= RunMeasurement("read pageable", MeasureReadPageable, 1, 0, NULL);
+        err |= RunMeasurement("read pinned", MeasureReadPinned, 1, 0, NULL);
+        err |= RunMeasurement("copy buffer", MeasureCopyBuffer, 2, 1, NULL);
+        if (ImageSupport && CurrentSize >= IMAGE_WIDTH * 4 * sizeof(float))
+            err |= RunMeasurement("copy buffer to image", MeasureCopyToImage, 2, 1, NULL);
+        err |= RunMeasurement("stream copy", MeasureStreamCopy, 2, 1, &stream[0]);
+        err |= RunMeasurement("stream scale", MeasureStreamScale, 2, 1, &stream[1]);
+        err |= RunMeasurement("stream triad", MeasureStreamTriad, 3, 1, &stream[2]);
+    }
+    printf(SEPARATOR);
+
+    if (err != CL_SUCCESS)
+        return err;
+
+    // The largest size is the one that is not cache resident
+    printf("Kernel bandwidth at %u KB against the measured peak of %.2f GB/s at %u KB\n",
+        (unsigned)(CurrentSize / 4 / 1024), PeakBandwidth, (unsigned)(PeakSize / 1024));
+    printf("  stream copy:  %8.2f GB/s  %5.1f%%\n", stream[0], PeakBandwidth > 0 ? 100.0 * stream[0] / PeakBandwidth : 0.0);
+    printf("  stream scale: %8.2f GB/s  %5.1f%%\n", stream[1], PeakBandwidth > 0 ? 100.0 * stream[1] / PeakBandwidth : 0.0);
+    printf("  stream triad: %8.2f GB/s  %5.1f%%\n", stream[2], PeakBandwidth > 0 ? 100.0 * stream[2] / PeakBandwidth : 0.0);
+    printf(SEPARATOR);
+
+    if (EnableOutput)
+        fprintf(fp, "Peak %.3f GB/s Size %u Copy %.1f%% Scale %.1f%% Triad %.1f%%\n", PeakBandwidth, (unsigned)PeakSize,
+            PeakBandwidth > 0 ? 100.0 * stream[0] / PeakBandwidth : 0.0,
+            PeakBandwidth > 0 ? 100.0 * stream[1] / PeakBandwidth : 0.0,
+            PeakBandwidth > 0 ? 100.0 * stream[2] / PeakBandwidth : 0.0);
+
+    return CL_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int
+SetupComputeDevices(int device_type)
+{
+    int err;
+    cl_uint platform_count = 0;
+    cl_platform_id platforms[16];
+
+    ComputeDeviceType = device_type;
+
+    // Any platform will do, the first one that has a device of the requested type
+    err = clGetPlatformIDs(16, platforms, &platform_count);
+    if (err != CL_SUCCESS || !platform_count)
+    {
+        printf("clGetPlatformIDs Failed\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeDeviceId = 0;
+    for (cl_uint p = 0; p < platform_count && p < 16 && !ComputeDeviceId; p++)
+    {
+        if (clGetDeviceIDs(platforms[p], ComputeDeviceType, 1, &ComputeDeviceId, NULL) != CL_SUCCESS)
+            ComputeDeviceId = 0;
+    }
+
+    if (!ComputeDeviceId)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeContext = clCreateContext(0, 1, &ComputeDeviceId, NULL, NULL, &err);
+    if (!ComputeContext)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
+    if (!ComputeCommands)
+    {
+        printf("Error: Failed to create a command queue!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Report the device vendor and device name
+    //
+    cl_char vendor_name[1024] = {0};
+    cl_char device_name[1024] = {0};
+    cl_ulong max_alloc = 0;
+    err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, NULL);
+    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_IMAGE_SUPPORT, sizeof(ImageSupport), &ImageSupport, NULL);
+    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(CacheSize), &CacheSize, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve device info!\n");
+        return EXIT_FAILURE;
+    }
+
+    printf(SEPARATOR);
+    printf("Connecting to %s %s...\n", vendor_name, device_name);
+
+    while (MaxSize > MIN_SIZE && MaxSize > max_alloc)
+        MaxSize /= 4;
+
+    return CL_SUCCESS;
+}
+
+static int
+SetupComputeKernel(void)
+{
+    int err = 0;
+    char *source = 0;
+    size_t length = 0;
+
+    printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);
+    err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
+    if (!source || err)
+    {
+        printf("Error: Failed to load kernel source!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeProgram = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
+    if (!ComputeProgram || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute program!\n");
+        return EXIT_FAILURE;
+    }
+    free(source);
+
+    char options[64];
+    sprintf(options, "-D MAD_LOOPS=%d", MAD_LOOPS);
+    err = clBuildProgram(ComputeProgram, 0, NULL, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build program executable!\n");
+        clGetProgramBuildInfo(ComputeProgram, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        return EXIT_FAILURE;
+    }
+
+    CopyKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_COPY_NAME, &err);
+    ScaleKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_SCALE_NAME, &err);
+    TriadKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_TRIAD_NAME, &err);
+    PeakKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_PEAK_NAME, &err);
+    if (!CopyKernel || !ScaleKernel || !TriadKernel || !PeakKernel)
+    {
+        printf("Error: Failed to create compute kernels!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeA = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, MaxSize, NULL, &err);
+    ComputeB = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, MaxSize, NULL, &err);
+    ComputeC = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, MaxSize, NULL, &err);
+    ComputePinned = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, MaxSize, NULL, &err);
+    ComputePeak = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, PEAK_ITEMS * 4 * sizeof(float), NULL, &err);
+    PageableData = (unsigned char *)calloc(MaxSize, 1);
+    if (!ComputeA || !ComputeB || !ComputeC || !ComputePinned || !ComputePeak || !PageableData)
+    {
+        printf("Failed to create OpenCL buffers!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Mapping a host-allocated buffer hands out memory the runtime has pinned
+    PinnedData = (unsigned char *)clEnqueueMapBuffer(ComputeCommands, ComputePinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+        0, MaxSize, 0, NULL, NULL, &err);
+    if (!PinnedData || err != CL_SUCCESS)
+    {
+        printf("Failed to map pinned host buffer! %d\n", err);
+        return EXIT_FAILURE;
+    }
+    memset(PinnedData, 0, MaxSize);
+
+    if (ImageSupport && MaxSize >= IMAGE_WIDTH * 4 * sizeof(float))
+    {
+        cl_image_format format;
+        cl_image_desc desc;
+
+        format.image_channel_order = CL_RGBA;
+        format.image_channel_data_type = CL_FLOAT;
+
+        memset(&desc, 0, sizeof(desc));
+        desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+        desc.image_width = IMAGE_WIDTH;
+        desc.image_height = MaxSize / (IMAGE_WIDTH * 4 * sizeof(float));
+
+        ComputeImage = clCreateImage(ComputeContext, CL_MEM_WRITE_ONLY, &format, &desc, NULL, &err);
+        if (!ComputeImage || err != CL_SUCCESS)
+        {
+            printf("Skipping image copies, failed to create image! %d\n", err);
+            ImageSupport = CL_FALSE;
+        }
+    }
+
+    err = clSetKernelArg(CopyKernel, 0, sizeof(cl_mem), &ComputeA);
+    err |= clSetKernelArg(CopyKernel, 1, sizeof(cl_mem), &ComputeC);
+    err |= clSetKernelArg(ScaleKernel, 0, sizeof(cl_mem), &ComputeC);
+    err |= clSetKernelArg(ScaleKernel, 1, sizeof(cl_mem), &ComputeB);
+    err |= clSetKernelArg(ScaleKernel, 2, sizeof(float), &Scalar);
+    err |= clSetKernelArg(TriadKernel, 0, sizeof(cl_mem), &ComputeB);
+    err |= clSetKernelArg(TriadKernel, 1, sizeof(cl_mem), &ComputeC);
+    err |= clSetKernelArg(TriadKernel, 2, sizeof(cl_mem), &ComputeA);
+    err |= clSetKernelArg(TriadKernel, 3, sizeof(float), &Scalar);
+    err |= clSetKernelArg(PeakKernel, 0, sizeof(cl_mem), &ComputePeak);
+    err |= clSetKernelArg(PeakKernel, 1, sizeof(float), &PeakScalar);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to set kernel arguments! %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    return CL_SUCCESS;
+}
+
+static void
+Cleanup(void)
+{
+    clFinish(ComputeCommands);
+    if (PinnedData)
+        clEnqueueUnmapMemObject(ComputeCommands, ComputePinned, PinnedData, 0, NULL, NULL);
+    clFinish(ComputeCommands);
+    clReleaseKernel(CopyKernel);
+    clReleaseKernel(ScaleKernel);
+    clReleaseKernel(TriadKernel);
+    clReleaseKernel(PeakKernel);
+    clReleaseProgram(ComputeProgram);
+    clReleaseMemObject(ComputeA);
+    clReleaseMemObject(ComputeB);
+    clReleaseMemObject(ComputeC);
+    clReleaseMemObject(ComputePinned);
+    clReleaseMemObject(ComputePeak);
+    if (ComputeImage)
+        clReleaseMemObject(ComputeImage);
+    clReleaseCommandQueue(ComputeCommands);
+    clReleaseContext(ComputeContext);
+
+    free(PageableData);
+    PageableData = NULL;
+    PinnedData = NULL;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line options
+    //
+    int i;
+    int err;
+    cl_device_type device_type = CL_DEVICE_TYPE_CPU;
+    for( i = 0; i < argc && argv; i++)
+    {
+        if(!argv[i])
+            continue;
+
+        if(strstr(argv[i], "-cpu"))
+            device_type = CL_DEVICE_TYPE_CPU;
+
+        else if(strstr(argv[i], "-gpu"))
+            device_type = CL_DEVICE_TYPE_GPU;
+
+        else if(strstr(argv[i], "-output") && i + 1 < argc)
+        {
+            EnableOutput = 1;
+            fp = fopen(argv[i+1], "w+");
+        }
+
+        else if(strstr(argv[i], "-samples") && i + 1 < argc)
+            Samples = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-maxsize") && i + 1 < argc)
+            MaxSize = (size_t)atoi(argv[i+1]) * 1024 * 1024;
+    }
+
+    if (Samples < 1 || Samples > MAX_SAMPLES)
+        Samples = (Samples < 1) ? 1 : MAX_SAMPLES;
+    if (MaxSize < MIN_SIZE)
+        MaxSize = MIN_SIZE;
+
+    err = SetupComputeDevices(device_type);
+    if (err == CL_SUCCESS)
+        err = SetupComputeKernel();
+    if (err == CL_SUCCESS)
+        err = RunSweep();
+    if (err == CL_SUCCESS)
+        err = RunPeakCompute();
+
+    Cleanup();
+    if (EnableOutput)
+        fclose(fp);
+
+    return err ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,500 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Host-side API overhead of the OpenCL runtime the benchmarks sit on
+//
+// Empty-kernel launch rate, clSetKernelArg, small blocking and non-blocking
+// transfers, clFinish round-trips and map/unmap latency. No GL is involved,
+// so it runs on any OpenCL platform including CPU-only ones.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <CL/cl.h>
+
+#include "MeasureUtil.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define COMPUTE_KERNEL_FILENAME         ("HostOverhead_Kernels.cl")
+#define COMPUTE_KERNEL_EMPTY_NAME       ("empty_kernel")
+#define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#define MAX_SAMPLES                     (1000)
+#define MAX_TRANSFER_SIZE               (64 * 1024)
+
+////////////////////////////////////////////////////////////////////////////////
+
+static cl_context                       ComputeContext;
+static cl_command_queue                 ComputeCommands;
+static cl_kernel                        ComputeKernel;
+static cl_program                       ComputeProgram;
+static cl_device_id                     ComputeDeviceId;
+static cl_device_type                   ComputeDeviceType;
+static cl_mem                           ComputeBuffer[2];
+static cl_mem                           ComputeMapped;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int Samples                      = 20;
+static int Iterations                   = 1000;
+static size_t TransferSize              = 4;
+static unsigned char *HostData          = NULL;
+
+static double SampleTimes[MAX_SAMPLES];
+
+FILE *fp;
+static int EnableOutput                 = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int LoadTextFromFile(
+    const char *file_name, char **result_string, size_t *string_len)
+{
+    int fd;
+    unsigned file_len;
+    struct stat file_status;
+    int ret;
+
+    *string_len = 0;
+    fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+    {
+        printf("Error opening file %s\n", file_name);
+        return -1;
+    }
+    ret = fstat(fd, &file_status);
+    if (ret)
+    {
+        printf("Error reading status for file %s\n", file_name);
+        return -1;
+    }
+    file_len = file_status.st_size;
+
+    *result_string = (char*)calloc(file_len + 1, sizeof(char));
+    ret = read(fd, *result_string, file_len);
+    if (!ret)
+    {
+        printf("Error reading from file %s\n", file_name);
+        return -1;
+    }
+
+    close(fd);
+
+    *string_len = file_len;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Each measurement runs Iterations operations and returns microseconds per operation
+
+static int
+MeasureLaunch(double *us)
+{
+    int err = CL_SUCCESS;
+    size_t global = 1;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+        err = clEnqueueNDRangeKernel(ComputeCommands, ComputeKernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureSetArgBuffer(double *us)
+{
+    int err = CL_SUCCESS;
+
+    // Alternate so no runtime can short-cut a repeated binding
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+        err = clSetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeBuffer[i & 1]);
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureSetArgScalar(double *us)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+    {
+        float value = (float)i;
+        err = clSetKernelArg(ComputeKernel, 1, sizeof(float), &value);
+    }
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureWriteBlocking(double *us)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+        err = clEnqueueWriteBuffer(ComputeCommands, ComputeBuffer[0], CL_TRUE, 0, TransferSize, HostData, 0, NULL, NULL);
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureWriteNonBlocking(double *us)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+        err = clEnqueueWriteBuffer(ComputeCommands, ComputeBuffer[0], CL_FALSE, 0, TransferSize, HostData, 0, NULL, NULL);
+    err |= clFinish(ComputeCommands);
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureReadBlocking(double *us)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+        err = clEnqueueReadBuffer(ComputeCommands, ComputeBuffer[0], CL_TRUE, 0, TransferSize, HostData, 0, NULL, NULL);
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureFinishEmpty(double *us)
+{
+    int err = CL_SUCCESS;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+        err = clFinish(ComputeCommands);
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureFinishRoundTrip(double *us)
+{
+    int err = CL_SUCCESS;
+    size_t global = 1;
+
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+    {
+        err = clEnqueueNDRangeKernel(ComputeCommands, ComputeKernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+        err |= clFinish(ComputeCommands);
+    }
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+static int
+MeasureMapUnmap(double *us)
+{
+    int err = CL_SUCCESS;
+
+    // The blocking map waits for the previous unmap, the queue is in order
+    double start = GetHostTime();
+    for (int i = 0; i < Iterations && err == CL_SUCCESS; i++)
+    {
+        void *ptr = clEnqueueMapBuffer(ComputeCommands, ComputeMapped, CL_TRUE, CL_MAP_WRITE, 0, TransferSize,
+            0, NULL, NULL, &err);
+        if (!ptr || err != CL_SUCCESS)
+            break;
+
+        ((unsigned char *)ptr)[0] = (unsigned char)i;
+        err = clEnqueueUnmapMemObject(ComputeCommands, ComputeMapped, ptr, 0, NULL, NULL);
+    }
+    err |= clFinish(ComputeCommands);
+
+    *us = 1000.0 * (GetHostTime() - start) / Iterations;
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int
+RunMeasurement(const char *name, int (*measure)(double *us))
+{
+    double mean = 0;
+    double variance = 0;
+    double sorted[MAX_SAMPLES];
+    double warmup;
+
+    // One untimed pass pages in the runtime paths being measured
+    int err = measure(&warmup);
+    for (int s = 0; s < Samples && err == CL_SUCCESS; s++)
+        err = measure(&SampleTimes[s]);
+    if (err != CL_SUCCESS)
+    {
+        printf("Failed to measure %s! %d\n", name, err);
+        return err;
+    }
+
+    for (int s = 0; s < Samples; s++)
+        mean += SampleTimes[s] / Samples;
+    for (int s = 0; s < Samples; s++)
+        variance += (SampleTimes[s] - mean) * (SampleTimes[s] - mean) / (Samples > 1 ? Samples - 1 : 1);
+
+    memcpy(sorted, SampleTimes, Samples * sizeof(double));
+    qsort(sorted, Samples, sizeof(double), CompareDoubles);
+    double median = (Samples & 1) ? sorted[Samples / 2] : 0.5 * (sorted[Samples / 2 - 1] + sorted[Samples / 2]);
+    double stddev = sqrt(variance);
+
+    printf("  %-30s %9.3f us  median %9.3f  min %9.3f  stddev %7.3f  %10.0f /s\n",
+        name, mean, median, sorted[0], stddev, mean > 0 ? 1000000.0 / mean : 0.0);
+
+    if (EnableOutput)
+        fprintf(fp, "%s Mean %.3f us Median %.3f us Min %.3f us Stddev %.3f us\n", name, mean, median, sorted[0], stddev);
+
+    return CL_SUCCESS;
+}
+
+static int
+RunMeasurements(void)
+{
+    static const size_t sizes[] = { 4, 4 * 1024, MAX_TRANSFER_SIZE };
+    char name[64];
+    int err = CL_SUCCESS;
+
+    printf(SEPARATOR);
+    printf("Host API overhead (%d samples of %d operations)\n", Samples, Iterations);
+
+    err |= RunMeasurement("empty kernel launch", MeasureLaunch);
+    err |= RunMeasurement("clSetKernelArg buffer", MeasureSetArgBuffer);
+    err |= RunMeasurement("clSetKernelArg scalar", MeasureSetArgScalar);
+    err |= RunMeasurement("clFinish empty queue", MeasureFinishEmpty);
+    err |= RunMeasurement("launch + clFinish round-trip", MeasureFinishRoundTrip);
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        TransferSize = sizes[s];
+
+        sprintf(name, "blocking write %u B", (unsigned)TransferSize);
+        err |= RunMeasurement(name, MeasureWriteBlocking);
+        sprintf(name, "non-blocking write %u B", (unsigned)TransferSize);
+        err |= RunMeasurement(name, MeasureWriteNonBlocking);
+        sprintf(name, "blocking read %u B", (unsigned)TransferSize);
+        err |= RunMeasurement(name, MeasureReadBlocking);
+        sprintf(name, "map/unmap %u B", (unsigned)TransferSize);
+        err |= RunMeasurement(name, MeasureMapUnmap);
+    }
+
+    printf(SEPARATOR);
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int
+SetupComputeDevices(int device_type)
+{
+    int err;
+    cl_uint platform_count = 0;
+    cl_platform_id platforms[16];
+
+    ComputeDeviceType = device_type;
+
+    // Any platform will do, the first one that has a device of the requested type
+    err = clGetPlatformIDs(16, platforms, &platform_count);
+    if (err != CL_SUCCESS || !platform_count)
+    {
+        printf("clGetPlatformIDs Failed\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeDeviceId = 0;
+    for (cl_uint p = 0; p < platform_count && p < 16 && !ComputeDeviceId; p++)
+    {
+        if (clGetDeviceIDs(platforms[p], ComputeDeviceType, 1, &ComputeDeviceId, NULL) != CL_SUCCESS)
+            ComputeDeviceId = 0;
+    }
+
+    if (!ComputeDeviceId)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeContext = clCreateContext(0, 1, &ComputeDeviceId, NULL, NULL, &err);
+    if (!ComputeContext)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
+    if (!ComputeCommands)
+    {
+        printf("Error: Failed to create a command queue!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Report the device vendor and device name
+    //
+    cl_char vendor_name[1024] = {0};
+    cl_char device_name[1024] = {0};
+    err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, NULL);
+    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve device info!\n");
+        return EXIT_FAILURE;
+    }
+
+    printf(SEPARATOR);
+    printf("Connecting to %s %s...\n", vendor_name, device_name);
+
+    return CL_SUCCESS;
+}
+
+static int
+SetupComputeKernel(void)
+{
+    int err = 0;
+    char *source = 0;
+    size_t length = 0;
+    float value = 0;
+
+    printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);
+    err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
+    if (!source || err)
+    {
+        printf("Error: Failed to load kernel source!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeProgram = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
+    if (!ComputeProgram || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute program!\n");
+        return EXIT_FAILURE;
+    }
+    free(source);
+
+    err = clBuildProgram(ComputeProgram, 0, NULL, NULL, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build program executable!\n");
+        clGetProgramBuildInfo(ComputeProgram, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        return EXIT_FAILURE;
+    }
+
+    ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_EMPTY_NAME, &err);
+    if (!ComputeKernel || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute kernel!\n");
+        return EXIT_FAILURE;
+    }
+
+    ComputeBuffer[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, MAX_TRANSFER_SIZE, NULL, &err);
+    ComputeBuffer[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, MAX_TRANSFER_SIZE, NULL, &err);
+    ComputeMapped = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, MAX_TRANSFER_SIZE, NULL, &err);
+    HostData = (unsigned char *)calloc(MAX_TRANSFER_SIZE, 1);
+    if (!ComputeBuffer[0] || !ComputeBuffer[1] || !ComputeMapped || !HostData)
+    {
+        printf("Failed to create OpenCL buffers!\n");
+        return EXIT_FAILURE;
+    }
+
+    err = clSetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeBuffer[0]);
+    err |= clSetKernelArg(ComputeKernel, 1, sizeof(float), &value);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to set kernel arguments! %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    return CL_SUCCESS;
+}
+
+static void
+Cleanup(void)
+{
+    clFinish(ComputeCommands);
+    clReleaseKernel(ComputeKernel);
+    clReleaseProgram(ComputeProgram);
+    clReleaseMemObject(ComputeBuffer[0]);
+    clReleaseMemObject(ComputeBuffer[1]);
+    clReleaseMemObject(ComputeMapped);
+    clReleaseCommandQueue(ComputeCommands);
+    clReleaseContext(ComputeContext);
+
+    free(HostData);
+    HostData = NULL;
+}
+
+int main(int argc, char** argv)
+{
+    // Parse command line options
+    //
+    int i;
+    int err;
+    cl_device_type device_type = CL_DEVICE_TYPE_CPU;
+    for( i = 0; i < argc && argv; i++)
+    {
+        if(!argv[i])
+            continue;
+
+        if(strstr(argv[i], "-cpu"))
+            device_type = CL_DEVICE_TYPE_CPU;
+
+        else if(strstr(argv[i], "-gpu"))
+            device_type = CL_DEVICE_TYPE_GPU;
+
+        else if(strstr(argv[i], "-output") && i + 1 < argc)
+        {
+            EnableOutput = 1;
+            fp = fopen(argv[i+1], "w+");
+        }
+
+        else if(strstr(argv[i], "-samples") && i + 1 < argc)
+            Samples = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-iterations") && i + 1 < argc)
+            Iterations = atoi(argv[i+1]);
+    }
+
+    if (Samples < 1 || Samples > MAX_SAMPLES)
+        Samples = (Samples < 1) ? 1 : MAX_SAMPLES;
+    if (Iterations < 1)
+        Iterations = 1;
+
+    err = SetupComputeDevices(device_type);
+    if (err == CL_SUCCESS)
+        err = SetupComputeKernel();
+    if (err == CL_SUCCESS)
+        err = RunMeasurements();
+
+    Cleanup();
+    if (EnableOutput)
+        fclose(fp);
+
+    return err ? EXIT_FAILURE : 0;
+}
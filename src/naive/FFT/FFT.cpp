@@ -24,13 +24,26 @@
 #include <CL/cl.h>
 #include <CL/cl_gl.h>
 
+#include "MeasureUtil.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 
 #define USE_GL_ATTACHMENTS              (0)  // enable OpenGL attachments for Compute results
 #define DEBUG_INFO                      (0)     
 #define COMPUTE_KERNEL_FILENAME         ("FFT_Kernels.cl")
 #define COMPUTE_KERNEL_MATMUL_NAME      ("kfft")
+#define COMPUTE_KERNEL_R2C_NAME         ("kfft_r2c")
+#define COMPUTE_KERNEL_C2R_NAME         ("kfft_c2r")
+#define COMPUTE_KERNEL_FILL_NAME        ("kfill")
+#define MAX_BUILD_OPTION_SETS           (8)
 #define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#define MAX_CACHED_KERNELS              (8)
+#define MAX_CACHED_ARGS                 (16)
+#define MAX_CACHED_ARG_SIZE             (64)
+#define MAX_DEVICES                     (16)
+#define FFT_BATCH_SIZE                  (1024)  // points per transform, VSTRIDE in the kernel
+#define FFT_BATCH_ITEMS                 (64)    // work-items per transform
+#define MAX_CHUNKS                      (16)
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -76,20 +89,85 @@ const char *FragShaderSource =
 
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef struct
+{
+	cl_kernel kernel;
+	size_t sizes[MAX_CACHED_ARGS];
+	unsigned char values[MAX_CACHED_ARGS][MAX_CACHED_ARG_SIZE];
+} KernelArgCache;
+
+typedef cl_event (*CreateEventFromGLsyncFn)(cl_context, cl_GLsync, cl_int *);
+
 static cl_context                       ComputeContext;
 static cl_command_queue                 ComputeCommands;
+static cl_command_queue                 UploadCommands;
+static cl_command_queue                 DownloadCommands;
 static cl_kernel                        ComputeKernel;
+static cl_kernel                        RealKernel;
+static cl_kernel                        FillKernel;
 static cl_program                       ComputeProgram;
 static cl_device_id                     ComputeDeviceId;
 static cl_device_type                   ComputeDeviceType;
+static CreateEventFromGLsyncFn          CreateEventFromGLsync;
+static GLsync                           PendingFence;
+static cl_event                         PendingGLEvent;
 static cl_mem                           ComputeInputOutputReal;
 static cl_mem                           ComputeInputOutputImaginary;
+static cl_device_id                     DeviceIds[MAX_DEVICES];
+static cl_command_queue                 DeviceCommands[MAX_DEVICES];
+static cl_mem                           DeviceReal[MAX_DEVICES];
+static cl_mem                           DeviceImaginary[MAX_DEVICES];
+static cl_uint                          DeviceCount = 1;
+static cl_device_id                     ContextDeviceIds[MAX_DEVICES + 1];
+static cl_uint                          ContextDeviceCount = 1;
+static cl_uint                          FirstPrivateDevice = 1;
 
 ////////////////////////////////////////////////////////////////////////////////
 
 static int MaxNDRange                   = 0x7FFFFFFF;
+static int BenchmarkFrames              = 20;
+
+static KernelArgCache ArgCache[MAX_CACHED_KERNELS];
+static double HostSubmitTime            = 0;
+static int HostSubmitFrames             = 0;
+static int HostArgSets                  = 0;
+static int HostArgSkips                 = 0;
+static int HostLaunches                 = 0;
+
+static int Roofline                     = 0;
+static RooflineStats Rooflines;
+static cl_event RooflineEvent           = 0;
+
+static int GLSyncEvents                 = 0;
+static double SyncStall                 = 0;
+static int SyncCount                    = 0;
+
+static int MultiDevice                  = 0;
+static int Balance                      = 0;
+static const char *FissionSpec          = NULL;
+static const char *BuildOptions         = NULL;
+static int BuildSweep                   = 0;
+static const char *BuildOptionSets[]    = { "", "-cl-mad-enable", "-cl-no-signed-zeros", "-cl-finite-math-only",
+                                            "-cl-unsafe-math-optimizations", "-cl-fast-relaxed-math", "-cl-opt-disable" };
+static float DeviceShare[MAX_DEVICES];
+static double DeviceTime[MAX_DEVICES];
+static int MultiDeviceCount             = 0;
+
+static int RealTransform                = 0;
+static int Convolution                  = 0;
+static const int ConvolutionTaps[]      = { 8, 16, 32, 64, 128, 256, 512 };
+
+static int Overlap                      = 0;
+static int Chunks                       = 4;
+static double OverlapSpan               = 0;
+static double OverlapTransfer           = 0;
+static double OverlapCompute            = 0;
+static double OverlapHidden             = 0;
+static int OverlapCount                 = 0;
 
 static int Animated                     = 0;
+static int DeviceInputs                 = 0;
+static cl_uint FillSeed                 = 0;
 static int Update                       = 1;
 
 static int Width                        = 512;
@@ -109,12 +187,15 @@ static int FrameCount                   = 0;
 static int NDRangeCount                 = 0;
 static uint ReportStatsInterval         = 30;
 
+static FrameWindow Frames               = { 10, 5.0 };     // warm-up frames and steady cv
+static double MinRunTime                = 0;
+
 static float ShadowTextColor[4]         = { 0.0f, 0.0f, 0.0f, 1.0f };
 static float HighlightTextColor[4]      = { 0.9f, 0.9f, 0.9f, 1.0f };
 static uint TextOffset[2]               = { 25, 25 };
 
 static uint ShowStats                   = 1;
-static char StatsString[512]            = "\0";
+static char StatsString[1024]           = "\0";
 static uint ShowInfo                    = 1;
 static char InfoString[512]             = "\0";
 
@@ -155,6 +236,118 @@ SubtractTime( long uiEndTime, long uiStartTime )
 	return uiEndTime - uiStartTime;
 }
 
+static double
+GetPreciseTime()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Analytic work per launch of kfft: the usual 5 N log2 N flops for each
+// radix transform of FFT_BATCH_SIZE points, with the real and imaginary
+// planes read and written back in place once. kfft_r2c does half of that
+// for twice the points, on a single plane
+static double
+KernelFlops(void)
+{
+	if (RealTransform)
+		return 2.5 * 2 * FFT_BATCH_SIZE * log2(2.0 * FFT_BATCH_SIZE) * (DataElemCount / (2 * FFT_BATCH_SIZE));
+	return 5.0 * FFT_BATCH_SIZE * log2((double)FFT_BATCH_SIZE) * (DataElemCount / FFT_BATCH_SIZE);
+}
+
+static double
+KernelBytes(void)
+{
+	return (RealTransform ? 2.0 : 4.0) * sizeof(float) * DataElemCount;
+}
+
+static void
+CollectRoofline(void)
+{
+	if (!RooflineEvent)
+		return;
+
+	clWaitForEvents(1, &RooflineEvent);
+	Rooflines.time += GetEventTime(RooflineEvent);
+	Rooflines.count++;
+	RooflineEvent = 0;
+}
+
+// Appends the achieved rates of the kernel launches timed since the last report
+static void
+ReportRoofline(void)
+{
+	CollectRoofline();
+	AppendRoofline(&Rooflines, KernelFlops(), KernelBytes(), StatsString, sizeof(StatsString));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+ResetKernelArgs(void)
+{
+	memset(ArgCache, 0, sizeof(ArgCache));
+}
+
+// clSetKernelArg copies the value, so an argument that is bound to the same
+// bytes already can be skipped. Local memory sizes are always passed through.
+static cl_int
+SetKernelArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+{
+	KernelArgCache *cache = NULL;
+	cl_int err;
+
+	for (int i = 0; i < MAX_CACHED_KERNELS && !cache; i++)
+	{
+		if (ArgCache[i].kernel == kernel || !ArgCache[i].kernel)
+		{
+			cache = &ArgCache[i];
+			cache->kernel = kernel;
+		}
+	}
+
+	int cacheable = cache && value && index < MAX_CACHED_ARGS && size <= MAX_CACHED_ARG_SIZE;
+	if (cacheable && cache->sizes[index] == size && !memcmp(cache->values[index], value, size))
+	{
+		HostArgSkips++;
+		return CL_SUCCESS;
+	}
+
+	err = clSetKernelArg(kernel, index, size, value);
+	if (cacheable && err == CL_SUCCESS)
+	{
+		cache->sizes[index] = size;
+		memcpy(cache->values[index], value, size);
+	}
+	else if (cache && index < MAX_CACHED_ARGS)
+	{
+		cache->sizes[index] = 0;
+	}
+
+	HostArgSets++;
+	return err;
+}
+
+static cl_int
+EnqueueKernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t *offset, const size_t *global,
+	const size_t *local, cl_uint wait_count, const cl_event *wait_list, cl_event *event)
+{
+	HostLaunches++;
+	return clEnqueueNDRangeKernel(queue, kernel, dims, offset, global, local, wait_count, wait_list, event);
+}
+
+// A frame's argument setup and launches are timed as one block, the single
+// calls are too short to time on their own
+static void
+CountHostSubmit(double start)
+{
+	HostSubmitTime += GetHostTime() - start;
+	HostSubmitFrames++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static int LoadTextFromFile(
@@ -410,6 +603,398 @@ CreateGLResouce()
 	return 1;
 }
 
+// Partitions of one device share its memory and work on the primary buffers
+// directly, separate devices go through buffers of their own
+static int
+PrivateBuffers(cl_uint device)
+{
+	return FirstPrivateDevice && device >= FirstPrivateDevice;
+}
+
+static void
+PartitionWork(size_t units, size_t *offset, size_t *count)
+{
+	cl_uint i;
+	size_t start = 0;
+
+	for(i = 0; i < DeviceCount; i++)
+	{
+		size_t n = (i == DeviceCount - 1) ? units - start : (size_t)(units * DeviceShare[i] + 0.5f);
+		if (start + n > units)
+			n = units - start;
+
+		offset[i] = start;
+		count[i] = n;
+		start += n;
+	}
+}
+
+static void
+BalanceDevices(size_t *count, double *ms)
+{
+	cl_uint i;
+	double rate[MAX_DEVICES];
+	double measured_rate = 0;
+	double measured_share = 0;
+
+	// Devices that got no work this frame keep their share, the rest split
+	// what is left in proportion to the batches per ms they just achieved
+	for(i = 0; i < DeviceCount; i++)
+	{
+		rate[i] = (count[i] && ms[i] > 0) ? count[i] / ms[i] : 0;
+		if (rate[i] > 0)
+		{
+			measured_rate += rate[i];
+			measured_share += DeviceShare[i];
+		}
+	}
+
+	if (measured_rate <= 0)
+		return;
+
+	for(i = 0; i < DeviceCount; i++)
+	{
+		if (rate[i] > 0)
+			DeviceShare[i] = 0.5f * DeviceShare[i] + 0.5f * (float)(measured_share * rate[i] / measured_rate);
+	}
+}
+
+static int
+EnqueueMultiDevice(void)
+{
+	int err = CL_SUCCESS;
+	cl_uint i;
+	size_t offset[MAX_DEVICES];
+	size_t count[MAX_DEVICES];
+	double ms[MAX_DEVICES];
+	cl_event events[MAX_DEVICES];
+	cl_event ready = 0;
+	size_t local = FFT_BATCH_ITEMS;
+	size_t batch_bytes = FFT_BATCH_SIZE * sizeof(float);
+
+	// Whole transforms per device, each one is FFT_BATCH_ITEMS work-items
+	PartitionWork(DataElemCount / FFT_BATCH_SIZE, offset, count);
+
+	// Hand the other devices their batches of the primary copy on the primary
+	// queue, ahead of the kernel that transforms the rest of it in place.
+	// Partitions transform their batches in the primary buffers instead
+	for(i = FirstPrivateDevice; i < DeviceCount && !err; i++)
+	{
+		size_t first = offset[i] * batch_bytes;
+		size_t length = count[i] * batch_bytes;
+		if (!length || !PrivateBuffers(i))
+			continue;
+
+		err = clEnqueueCopyBuffer(ComputeCommands, ComputeInputOutputReal, DeviceReal[i], first, first, length,
+			0, NULL, NULL);
+		err |= clEnqueueCopyBuffer(ComputeCommands, ComputeInputOutputImaginary, DeviceImaginary[i], first, first, length,
+			0, NULL, NULL);
+	}
+	if (FirstPrivateDevice < DeviceCount && !err)
+		err = clEnqueueMarkerWithWaitList(ComputeCommands, 0, NULL, &ready);
+	if (err)
+	{
+		printf("Failed to hand out device batches! %d\n", err);
+		return err;
+	}
+
+	for(i = 0; i < DeviceCount; i++)
+	{
+		size_t batch_offset = offset[i] * local;
+		size_t batch_global = count[i] * local;
+		int other = (i >= FirstPrivateDevice);
+
+		events[i] = 0;
+		if (!count[i])
+			continue;
+
+		if (PrivateBuffers(i))
+		{
+			err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &DeviceReal[i]);
+			err |= SetKernelArg(ComputeKernel, 1, sizeof(cl_mem), &DeviceImaginary[i]);
+		}
+		else
+		{
+			err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeInputOutputReal);
+			err |= SetKernelArg(ComputeKernel, 1, sizeof(cl_mem), &ComputeInputOutputImaginary);
+		}
+
+		err |= EnqueueKernel(DeviceCommands[i], ComputeKernel, 1, &batch_offset, &batch_global, &local,
+			other ? 1 : 0, other ? &ready : NULL, &events[i]);
+		if (err)
+		{
+			printf("Failed to enqueue kernel on device %d! %d\n", i, err);
+			break;
+		}
+		clFlush(DeviceCommands[i]);
+	}
+	if (ready)
+		clReleaseEvent(ready);
+	if (err)
+		return err;
+
+	err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeInputOutputReal);
+	err |= SetKernelArg(ComputeKernel, 1, sizeof(cl_mem), &ComputeInputOutputImaginary);
+
+	// Copy the transformed batches back into the primary buffers as each
+	// device finishes, device to device without a trip through the host
+	for(i = FirstPrivateDevice; i < DeviceCount && !err; i++)
+	{
+		size_t first = offset[i] * batch_bytes;
+		size_t length = count[i] * batch_bytes;
+		if (!length || !PrivateBuffers(i))
+			continue;
+
+		err = clEnqueueCopyBuffer(ComputeCommands, DeviceReal[i], ComputeInputOutputReal, first, first, length,
+			1, &events[i], NULL);
+		err |= clEnqueueCopyBuffer(ComputeCommands, DeviceImaginary[i], ComputeInputOutputImaginary, first, first, length,
+			1, &events[i], NULL);
+	}
+
+	for(i = 0; i < DeviceCount; i++)
+	{
+		ms[i] = 0;
+		if (!events[i])
+			continue;
+
+		clWaitForEvents(1, &events[i]);
+		ms[i] = GetEventTime(events[i]);
+		DeviceTime[i] += ms[i];
+	}
+	MultiDeviceCount++;
+
+	if (err)
+	{
+		printf("Failed to gather device results! %d\n", err);
+		return err;
+	}
+
+	if (Balance)
+		BalanceDevices(count, ms);
+
+	return CL_SUCCESS;
+}
+
+static void
+AccumulateEvents(cl_event *events, int count, double *busy, cl_ulong *first, cl_ulong *last)
+{
+	for (int i = 0; i < count; i++)
+	{
+		cl_ulong start = 0;
+		cl_ulong end = 0;
+
+		if (!events[i])
+			continue;
+
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		clReleaseEvent(events[i]);
+
+		*busy += (end - start) / 1000000.0;
+		if (!*first || start < *first)
+			*first = start;
+		if (end > *last)
+			*last = end;
+	}
+}
+
+static int
+EnqueueOverlapped(int chunks)
+{
+	int err = 0;
+	size_t batches = DataElemCount / FFT_BATCH_SIZE;
+	size_t local = FFT_BATCH_ITEMS;
+	size_t batch_bytes = FFT_BATCH_SIZE * sizeof(float);
+	cl_event ready = 0;
+	cl_event upload[2 * MAX_CHUNKS];
+	cl_event kernel[MAX_CHUNKS];
+	cl_event download[2 * MAX_CHUNKS];
+	double transfer = 0;
+	double compute = 0;
+	cl_ulong first = 0;
+	cl_ulong last = 0;
+
+	if (chunks > (int)batches)
+		chunks = batches;
+	if (chunks > MAX_CHUNKS)
+		chunks = MAX_CHUNKS;
+
+#if (USE_GL_ATTACHMENTS)
+	// The uploads land in the shared VBOs, hold them until the acquire is through
+	err = clEnqueueMarkerWithWaitList(ComputeCommands, 0, NULL, &ready);
+	clFlush(ComputeCommands);
+#endif
+
+	for (int k = 0; k < chunks && !err; k++)
+	{
+		size_t start = batches * k / chunks;
+		size_t count = batches * (k + 1) / chunks - start;
+		size_t offset = start * local;
+		size_t range = count * local;
+		size_t bytes = start * batch_bytes;
+		size_t length = count * batch_bytes;
+
+		err = clEnqueueWriteBuffer(UploadCommands, ComputeInputOutputReal, CL_FALSE, bytes, length,
+			(char *)DataReal + bytes, ready ? 1 : 0, ready ? &ready : NULL, &upload[2 * k]);
+		err |= clEnqueueWriteBuffer(UploadCommands, ComputeInputOutputImaginary, CL_FALSE, bytes, length,
+			(char *)DataImaginary + bytes, ready ? 1 : 0, ready ? &ready : NULL, &upload[2 * k + 1]);
+
+		err |= EnqueueKernel(ComputeCommands, ComputeKernel, 1, &offset, &range, &local, 2, &upload[2 * k], &kernel[k]);
+
+#if (USE_GL_ATTACHMENTS)
+		download[2 * k] = 0;
+		download[2 * k + 1] = 0;
+#else
+		err |= clEnqueueReadBuffer(DownloadCommands, ComputeInputOutputReal, CL_FALSE, bytes, length,
+			(char *)DataReal + bytes, 1, &kernel[k], &download[2 * k]);
+		err |= clEnqueueReadBuffer(DownloadCommands, ComputeInputOutputImaginary, CL_FALSE, bytes, length,
+			(char *)DataImaginary + bytes, 1, &kernel[k], &download[2 * k + 1]);
+#endif
+		if (err)
+		{
+			printf("Failed to enqueue chunk %d! %d\n", k, err);
+			return err;
+		}
+
+		// Get this chunk going so the next upload runs under its kernel
+		clFlush(UploadCommands);
+		clFlush(ComputeCommands);
+	}
+
+	clFlush(DownloadCommands);
+	clFinish(UploadCommands);
+	clFinish(ComputeCommands);
+	clFinish(DownloadCommands);
+	if (ready)
+		clReleaseEvent(ready);
+	if (err)
+		return err;
+
+	AccumulateEvents(upload, 2 * chunks, &transfer, &first, &last);
+	AccumulateEvents(download, 2 * chunks, &transfer, &first, &last);
+	AccumulateEvents(kernel, chunks, &compute, &first, &last);
+
+	double span = (last - first) / 1000000.0;
+	OverlapSpan += span;
+	OverlapTransfer += transfer;
+	OverlapCompute += compute;
+	OverlapHidden += (transfer + compute > span) ? transfer + compute - span : 0;
+	OverlapCount++;
+
+	return CL_SUCCESS;
+}
+
+static void
+SetupGLSync(cl_platform_id platform_id)
+{
+	size_t length = 0;
+	int supported = 0;
+
+	// Fences need the CL context to share the GL one, copying builds keep the hard syncs
+	if (USE_GL_ATTACHMENTS && GLEW_ARB_sync &&
+		clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_EXTENSIONS, 0, NULL, &length) == CL_SUCCESS)
+	{
+		char *extensions = (char *)calloc(length + 1, sizeof(char));
+		if (clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_EXTENSIONS, length, extensions, NULL) == CL_SUCCESS)
+			supported = strstr(extensions, "cl_khr_gl_event") != NULL;
+		free(extensions);
+	}
+
+	if (supported)
+		CreateEventFromGLsync = (CreateEventFromGLsyncFn)clGetExtensionFunctionAddressForPlatform(platform_id,
+			"clCreateEventFromGLsyncKHR");
+
+	if (!CreateEventFromGLsync)
+	{
+		printf("GL sync events not available, falling back to glFinish/clFinish...\n");
+		GLSyncEvents = 0;
+		return;
+	}
+
+	printf("Synchronizing with GL through cl_khr_gl_event...\n");
+}
+
+static void
+WaitForGL(void)
+{
+	double start = GetPreciseTime();
+	int err = CL_SUCCESS;
+
+	if (GLSyncEvents)
+	{
+		// The queue waits on a fence behind the GL commands issued so far, the host does not
+		PendingFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		PendingGLEvent = CreateEventFromGLsync(ComputeContext, (cl_GLsync)PendingFence, &err);
+		if (PendingGLEvent)
+			err = clEnqueueBarrierWithWaitList(ComputeCommands, 1, &PendingGLEvent, NULL);
+	}
+
+	if (!GLSyncEvents || !PendingGLEvent || err != CL_SUCCESS)
+		glFinish();
+
+	SyncStall += GetPreciseTime() - start;
+}
+
+static void
+WaitForCL(void)
+{
+	double start = GetPreciseTime();
+
+	// cl_khr_gl_event orders later GL commands after the release, a flush is enough
+	if (GLSyncEvents)
+		clFlush(ComputeCommands);
+	else
+		clFinish(ComputeCommands);
+
+	if (PendingGLEvent)
+		clReleaseEvent(PendingGLEvent);
+	if (PendingFence)
+		glDeleteSync(PendingFence);
+	PendingGLEvent = 0;
+	PendingFence = 0;
+
+	SyncStall += GetPreciseTime() - start;
+	SyncCount++;
+}
+
+// Animated frames regenerate the data with kfill rather than on the host,
+// except on the overlapped and multi-device paths, which take it from the host
+static int
+DeviceGenerates(void)
+{
+	return DeviceInputs && Animated && !Overlap && !MultiDevice;
+}
+
+// Fills the planes in place with new values in the UpdateData() range, the
+// imaginary plane is skipped when it is 0
+static int
+EnqueueInputFill(cl_command_queue queue, cl_mem real, cl_mem imag)
+{
+	cl_mem buffers[2] = { real, imag };
+	cl_uint count = DataElemCount;
+	cl_float low = 0.0f;
+	cl_float high = 100.0f;
+	size_t local = FFT_BATCH_ITEMS;
+	size_t global = (DataElemCount + local - 1) / local * local;
+	int err = CL_SUCCESS;
+
+	FillSeed++;
+	for (int i = 0; i < 2 && buffers[i] && !err; i++)
+	{
+		cl_uint seed = 2 * FillSeed + i;
+
+		err = SetKernelArg(FillKernel, 0, sizeof(cl_mem), &buffers[i]);
+		err |= SetKernelArg(FillKernel, 1, sizeof(cl_uint), &count);
+		err |= SetKernelArg(FillKernel, 2, sizeof(cl_uint), &seed);
+		err |= SetKernelArg(FillKernel, 3, sizeof(cl_float), &low);
+		err |= SetKernelArg(FillKernel, 4, sizeof(cl_float), &high);
+		err |= EnqueueKernel(queue, FillKernel, 1, NULL, &global, &local, 0, NULL, NULL);
+	}
+
+	return err;
+}
+
 static int
 Recompute(void)
 {
@@ -434,16 +1019,24 @@ Recompute(void)
 
 	int err = 0;
 	unsigned int v = 0, s = 0, a = 0;
+
+	// The overlapped and multi-device paths stay on the complex transform
+	int real = RealTransform && !Overlap && !MultiDevice;
+	int generate = DeviceGenerates();
+	cl_kernel kernel = real ? RealKernel : ComputeKernel;
+
 	values[v++] = &ComputeInputOutputReal;
 	values[v++] = &ComputeInputOutputImaginary;
 
 	sizes[s++] = sizeof(cl_mem);
 	sizes[s++] = sizeof(cl_mem);
+	if (real)
+		s = 1;
 
 	if(Animated || Update)
 	{
 
-		glFinish();
+		WaitForGL();
 
 		// If use shared context, then data for ComputeInputOutput* is already in Vbo*
 #if (USE_GL_ATTACHMENTS)
@@ -492,16 +1085,19 @@ Recompute(void)
 #else
 
 		// Not sharing context with OpenGL, needs to explicitly copy/write to exchange data
-		err = clEnqueueWriteBuffer(ComputeCommands, ComputeInputOutputReal, 1, 0, 
-			DataElemCount * sizeof(float), DataReal, 0, 0, NULL);
+		// The overlapped path streams the data itself
+		if (!Overlap && !generate)
+			err = clEnqueueWriteBuffer(ComputeCommands, ComputeInputOutputReal, 1, 0, 
+				DataElemCount * sizeof(float), DataReal, 0, 0, NULL);
 		if (err != CL_SUCCESS)
 		{
 			printf("Failed to write buffer! %d\n", err);
 			return EXIT_FAILURE;
 		}
 
-		err = clEnqueueWriteBuffer(ComputeCommands, ComputeInputOutputImaginary, 1, 0, 
-			DataElemCount * sizeof(float), DataImaginary, 0, 0, NULL);
+		if (!Overlap && !real && !generate)
+			err = clEnqueueWriteBuffer(ComputeCommands, ComputeInputOutputImaginary, 1, 0, 
+				DataElemCount * sizeof(float), DataImaginary, 0, 0, NULL);
 		if (err != CL_SUCCESS)
 		{
 			printf("Failed to write buffer! %d\n", err);
@@ -509,10 +1105,25 @@ Recompute(void)
 		}
 
 #endif
+
+		if (generate)
+		{
+			err = EnqueueInputFill(ComputeCommands, ComputeInputOutputReal, real ? 0 : ComputeInputOutputImaginary);
+			if (err != CL_SUCCESS)
+			{
+				printf("Failed to generate inputs! %d\n", err);
+				return EXIT_FAILURE;
+			}
+		}
+
+		// The roofline wait for the last launch stays out of the host time
+		CollectRoofline();
+		double submit = GetHostTime();
+
 		Update = 0;
 		err = CL_SUCCESS;
 		for (a = 0; a < s; a++)
-			err |= clSetKernelArg(ComputeKernel, a, sizes[a], values[a]);
+			err |= SetKernelArg(kernel, a, sizes[a], values[a]);
 
 		if (err)
 			return -10;
@@ -520,8 +1131,9 @@ Recompute(void)
 		size_t global[1];
 		size_t local[1];
 
-		global[0] = DataElemCount;
-		local[0] = 64;
+		// One group of FFT_BATCH_ITEMS per transform, real ones take twice the points
+		global[0] = DataElemCount / (real ? 2 * FFT_BATCH_SIZE : FFT_BATCH_SIZE) * FFT_BATCH_ITEMS;
+		local[0] = FFT_BATCH_ITEMS;
 
 #if (DEBUG_INFO)
 	if(FrameCount <= 1)
@@ -529,13 +1141,22 @@ Recompute(void)
 			(int)global[0], (int)local[0]);
 #endif
 
-		err = clEnqueueNDRangeKernel(ComputeCommands, ComputeKernel, 1, NULL, global, local, 0, NULL, NULL);
+		if (Overlap)
+			err = EnqueueOverlapped(Chunks);
+		else if (MultiDevice)
+			err = EnqueueMultiDevice();
+		else
+			err = EnqueueKernel(ComputeCommands, kernel, 1, NULL, global, local, 0, NULL, Roofline ? &RooflineEvent : NULL);
 		if (err)
 		{
 			printf("Failed to enqueue kernel! %d\n", err);
 			return err;
 		}
 
+		// Overlapped and multi-device frames wait for their kernels inside the launch
+		if (!Overlap && !MultiDevice)
+			CountHostSubmit(submit);
+
 		NDRangeCount++;
 
 #if DEBUG_INFO
@@ -583,25 +1204,29 @@ Recompute(void)
 		}
 
 #else
-		// Explicitly copy data back to host and update VBOs
-		err = clEnqueueReadBuffer( ComputeCommands, ComputeInputOutputReal, CL_TRUE, 0, DataElemCount * sizeof(float), DataReal, 0, NULL, NULL );      
-		if (err != CL_SUCCESS)
+		// Explicitly copy data back to host and update VBOs, the overlapped path already has
+		if (!Overlap)
 		{
-			printf("Failed to read buffer! %d\n", err);
-			return EXIT_FAILURE;
-		}
+			err = clEnqueueReadBuffer( ComputeCommands, ComputeInputOutputReal, CL_TRUE, 0, DataElemCount * sizeof(float), DataReal, 0, NULL, NULL );      
+			if (err != CL_SUCCESS)
+			{
+				printf("Failed to read buffer! %d\n", err);
+				return EXIT_FAILURE;
+			}
 
-		err = clEnqueueReadBuffer( ComputeCommands, ComputeInputOutputImaginary, CL_TRUE, 0, DataElemCount * sizeof(float), DataImaginary, 0, NULL, NULL );      
-		if (err != CL_SUCCESS)
-		{
-			printf("Failed to read buffer! %d\n", err);
-			return EXIT_FAILURE;
+			if (!real)
+				err = clEnqueueReadBuffer( ComputeCommands, ComputeInputOutputImaginary, CL_TRUE, 0, DataElemCount * sizeof(float), DataImaginary, 0, NULL, NULL );      
+			if (err != CL_SUCCESS)
+			{
+				printf("Failed to read buffer! %d\n", err);
+				return EXIT_FAILURE;
+			}
 		}
 
 		UpdateVBOs();
 #endif
 
-		clFinish(ComputeCommands);
+		WaitForCL();
 	}
 
 	return CL_SUCCESS;
@@ -614,6 +1239,8 @@ CreateComputeResource(void)
 {
 	int err = 0;
 
+	ResetKernelArgs();
+
 #if (USE_GL_ATTACHMENTS)
 
 	if(ComputeInputOutputReal)
@@ -686,27 +1313,196 @@ CreateComputeResource(void)
 
 #endif
 
+	if (MultiDevice)
+	{
+		for(cl_uint i = FirstPrivateDevice; i < DeviceCount && PrivateBuffers(i); i++)
+		{
+			if(DeviceReal[i])
+				clReleaseMemObject(DeviceReal[i]);
+			if(DeviceImaginary[i])
+				clReleaseMemObject(DeviceImaginary[i]);
+
+			DeviceReal[i] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(float) * DataElemCount, 0, &err);
+			DeviceImaginary[i] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(float) * DataElemCount, 0, &err);
+			if (!DeviceReal[i] || !DeviceImaginary[i])
+			{
+				printf("Failed to create buffers for device %d! %d\n", i, err);
+				return -1;
+			}
+		}
+	}
+
 	return CL_SUCCESS;
 }
 
-static int 
-SetupComputeDevices(int gpu)
+static int
+PartitionDevice(void)
 {
+	cl_device_partition_property properties[MAX_DEVICES + 3];
+	cl_uint p = 0;
+	cl_uint i;
+	cl_uint count = 0;
 	int err;
-	size_t returned_size;
-	ComputeDeviceType = gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
-
-#if (USE_GL_ATTACHMENTS)
-
-	printf(SEPARATOR);
-	printf("Using active OpenGL context...\n");
 
-	// Bind to platform
-	cl_platform_id platform_id;
+	if (ComputeDeviceType != CL_DEVICE_TYPE_CPU)
+	{
+		printf("Device fission needs the CPU device, ignoring '%s'\n", FissionSpec);
+		return CL_SUCCESS;
+	}
 
-	cl_uint numPlatforms;
-	cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
-	if (status != CL_SUCCESS)
+	// equal:<units>, counts:<units>,<units>,... or an affinity domain (numa, l3, l2, next)
+	if (!strncmp(FissionSpec, "equal:", 6))
+	{
+		properties[p++] = CL_DEVICE_PARTITION_EQUALLY;
+		properties[p++] = atoi(FissionSpec + 6);
+	}
+	else if (!strncmp(FissionSpec, "counts:", 7))
+	{
+		const char *c = FissionSpec + 7;
+
+		properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS;
+		while (c && *c && p < MAX_DEVICES + 1)
+		{
+			properties[p++] = atoi(c);
+			c = strchr(c, ',');
+			if (c)
+				c++;
+		}
+		properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+	}
+	else
+	{
+		properties[p++] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+		if (!strcmp(FissionSpec, "numa"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+		else if (!strcmp(FissionSpec, "l3"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE;
+		else if (!strcmp(FissionSpec, "l2"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE;
+		else if (!strcmp(FissionSpec, "next"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE;
+		else
+		{
+			printf("Error: Unknown device fission '%s', use equal:<units>, counts:<units>,... numa, l3, l2 or next!\n",
+				FissionSpec);
+			return EXIT_FAILURE;
+		}
+	}
+	properties[p++] = 0;
+
+	err = clCreateSubDevices(ComputeDeviceId, properties, 0, NULL, &count);
+	if (err != CL_SUCCESS || !count || count >= MAX_DEVICES)
+	{
+		printf("Error: Failed to partition compute device '%s'! %d\n", FissionSpec, err);
+		return EXIT_FAILURE;
+	}
+
+	err = clCreateSubDevices(ComputeDeviceId, properties, count, DeviceIds, &DeviceCount);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to create sub-devices! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	// Every partition works on its range of the root device buffers, the root
+	// device runs the monolithic baseline
+	FirstPrivateDevice = 0;
+	MultiDevice = 1;
+	for(i = 0; i < DeviceCount; i++)
+		DeviceShare[i] = 1.0f / DeviceCount;
+
+	printf("Partitioned compute device into %d sub-devices (%s)...\n", DeviceCount, FissionSpec);
+
+	return CL_SUCCESS;
+}
+
+static void
+ListContextDevices(void)
+{
+	cl_uint i;
+
+	// The root goes first so it is still the device picked for the main queue
+	ContextDeviceCount = 0;
+	if (!FirstPrivateDevice)
+		ContextDeviceIds[ContextDeviceCount++] = ComputeDeviceId;
+	for(i = 0; i < DeviceCount; i++)
+		ContextDeviceIds[ContextDeviceCount++] = DeviceIds[i];
+}
+
+static int
+GatherDevices(cl_platform_id platform_id)
+{
+	cl_uint i;
+	int err;
+
+	err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, MAX_DEVICES, DeviceIds, &DeviceCount);
+	if (err != CL_SUCCESS || !DeviceCount)
+	{
+		printf("Error: Failed to locate compute devices!\n");
+		return EXIT_FAILURE;
+	}
+	if (DeviceCount > MAX_DEVICES)
+		DeviceCount = MAX_DEVICES;
+
+	// Keep the requested device first, it owns the result and the GL copy
+	for(i = 0; i < DeviceCount; i++)
+	{
+		if(DeviceIds[i] == ComputeDeviceId)
+		{
+			DeviceIds[i] = DeviceIds[0];
+			DeviceIds[0] = ComputeDeviceId;
+			break;
+		}
+	}
+
+	for(i = 0; i < DeviceCount; i++)
+		DeviceShare[i] = 1.0f / DeviceCount;
+
+	return CL_SUCCESS;
+}
+
+static int
+CreateDeviceQueues(void)
+{
+	cl_uint i;
+	int err;
+
+	for(i = FirstPrivateDevice; i < DeviceCount; i++)
+	{
+		cl_char device_name[1024] = {0};
+
+		DeviceCommands[i] = clCreateCommandQueue(ComputeContext, DeviceIds[i], CL_QUEUE_PROFILING_ENABLE, &err);
+		if (!DeviceCommands[i])
+		{
+			printf("Error: Failed to create a command queue for device %d!\n", i);
+			return EXIT_FAILURE;
+		}
+
+		clGetDeviceInfo(DeviceIds[i], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+		printf("Connecting to %s as device %d...\n", device_name, i);
+	}
+
+	return CL_SUCCESS;
+}
+
+static int 
+SetupComputeDevices(int gpu)
+{
+	int err;
+	size_t returned_size;
+	ComputeDeviceType = gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
+
+#if (USE_GL_ATTACHMENTS)
+
+	printf(SEPARATOR);
+	printf("Using active OpenGL context...\n");
+
+	// Bind to platform
+	cl_platform_id platform_id;
+
+	cl_uint numPlatforms;
+	cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
+	if (status != CL_SUCCESS)
 	{
 		printf("clGetPlatformIDs Failed\n");
 		return EXIT_FAILURE;
@@ -748,6 +1544,15 @@ SetupComputeDevices(int gpu)
 		printf("Error: Failed to locate compute device!\n");
 		return EXIT_FAILURE;
 	}
+	DeviceIds[0] = ComputeDeviceId;
+
+	if (FissionSpec)
+		err = PartitionDevice();
+	else if (MultiDevice)
+		err = GatherDevices(platform_id);
+	if (err != CL_SUCCESS)
+		return EXIT_FAILURE;
+	ListContextDevices();
 
 	// Create a context  
 	cl_context_properties properties[] =
@@ -760,7 +1565,7 @@ SetupComputeDevices(int gpu)
 
 	// Create a context from a CGL share group
 	//
-	ComputeContext = clCreateContext(properties, 1, &ComputeDeviceId, NULL, 0, 0);
+	ComputeContext = clCreateContext(properties, ContextDeviceCount, ContextDeviceIds, NULL, 0, 0);
 	if (!ComputeContext)
 	{
 		printf("Error: Failed to create a compute context!\n");
@@ -816,10 +1621,19 @@ SetupComputeDevices(int gpu)
 		printf("Error: Failed to locate compute device!\n");
 		return EXIT_FAILURE;
 	}
+	DeviceIds[0] = ComputeDeviceId;
+
+	if (FissionSpec)
+		err = PartitionDevice();
+	else if (MultiDevice)
+		err = GatherDevices(platform_id);
+	if (err != CL_SUCCESS)
+		return EXIT_FAILURE;
+	ListContextDevices();
 
 	// Create a context containing the compute device(s)
 	//
-	ComputeContext = clCreateContext(0, 1, &ComputeDeviceId, NULL, NULL, &err);
+	ComputeContext = clCreateContext(0, ContextDeviceCount, ContextDeviceIds, NULL, NULL, &err);
 	if (!ComputeContext)
 	{
 		printf("Error: Failed to create a compute context!\n");
@@ -862,13 +1676,29 @@ SetupComputeDevices(int gpu)
 
 	// Create a command queue
 	//
-	ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
+	cl_command_queue_properties queue_properties = (MultiDevice || Overlap || Roofline) ? CL_QUEUE_PROFILING_ENABLE : 0;
+	ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
 	if (!ComputeCommands)
 	{
 		printf("Error: Failed to create a command queue!\n");
 		return EXIT_FAILURE;
 	}
 
+	// Transfers get their own queues so they can run under the kernels
+	if (Overlap)
+	{
+		UploadCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
+		DownloadCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
+		if (!UploadCommands || !DownloadCommands)
+		{
+			printf("Error: Failed to create transfer command queues!\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (GLSyncEvents)
+		SetupGLSync(platform_id);
+
 	// Report the device vendor and device name
 	// 
 	cl_char vendor_name[1024] = {0};
@@ -884,6 +1714,11 @@ SetupComputeDevices(int gpu)
 	printf(SEPARATOR);
 	printf("Connecting to %s %s...\n", vendor_name, device_name);
 
+	if (FirstPrivateDevice)
+		DeviceCommands[0] = ComputeCommands;
+	if (MultiDevice)
+		return CreateDeviceQueues();
+
 	return CL_SUCCESS;
 }
 
@@ -928,28 +1763,20 @@ SetupGLProgram()
 	return 1;
 }
 
-static int 
-SetupComputeKernel(void)
+static cl_program
+BuildComputeProgram(const char *options)
 {
 	int err = 0;
 	char *source = 0;
 	size_t length = 0;
+	cl_program program;
 
-	if(ComputeKernel)
-		clReleaseKernel(ComputeKernel);    
-	ComputeKernel = 0;
-
-	if(ComputeProgram)
-		clReleaseProgram(ComputeProgram);
-	ComputeProgram = 0;
-
-	printf(SEPARATOR);
-	printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);    
+	printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);
 	err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
 	if (!source || err)
 	{
 		printf("Error: Failed to load kernel source!\n");
-		return EXIT_FAILURE;
+		return 0;
 	}
 
 #if (DEBUG_INFO)
@@ -958,28 +1785,62 @@ SetupComputeKernel(void)
 
 	// Create the compute program from the source buffer
 	//
-	ComputeProgram = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
-	if (!ComputeProgram || err != CL_SUCCESS)
+	program = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
+	free(source);
+	if (!program || err != CL_SUCCESS)
 	{
 		printf("Error: Failed to create compute program!\n");
-		return EXIT_FAILURE;
+		return 0;
 	}
-	free(source);
 
 	// Build the program executable
 	//
-	err = clBuildProgram(ComputeProgram, 0, NULL, NULL, NULL, NULL);
+	if (options && options[0])
+		printf("Building program with options '%s'...\n", options);
+	err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
 	if (err != CL_SUCCESS)
 	{
 		size_t len;
 		char buffer[2048];
 
 		printf("Error: Failed to build program executable!\n");
-		clGetProgramBuildInfo(ComputeProgram, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+		clGetProgramBuildInfo(program, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
 		printf("%s\n", buffer);
-		return EXIT_FAILURE;
+		clReleaseProgram(program);
+		return 0;
 	}
 
+	return program;
+}
+
+static int 
+SetupComputeKernel(void)
+{
+	int err = 0;
+
+	ResetKernelArgs();
+
+	if(ComputeKernel)
+		clReleaseKernel(ComputeKernel);    
+	ComputeKernel = 0;
+
+	if(RealKernel)
+		clReleaseKernel(RealKernel);
+	RealKernel = 0;
+
+	if(FillKernel)
+		clReleaseKernel(FillKernel);
+	FillKernel = 0;
+
+	if(ComputeProgram)
+		clReleaseProgram(ComputeProgram);
+	ComputeProgram = 0;
+
+	printf(SEPARATOR);
+	ComputeProgram = BuildComputeProgram(BuildOptions);
+	if (!ComputeProgram)
+		return EXIT_FAILURE;
+
 	// Create the compute kernel from within the program
 	//
 	printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_MATMUL_NAME); 
@@ -991,22 +1852,901 @@ SetupComputeKernel(void)
 		return EXIT_FAILURE;
 	}
 
+	if (RealTransform)
+	{
+		printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_R2C_NAME);
+		RealKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_R2C_NAME, &err);
+		if (!RealKernel || err != CL_SUCCESS)
+		{
+			printf("Error: Failed to create compute kernel!\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (DeviceInputs)
+	{
+		printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_FILL_NAME);
+		FillKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_FILL_NAME, &err);
+		if (!FillKernel || err != CL_SUCCESS)
+		{
+			printf("Error: Failed to create fill kernel!\n");
+			return EXIT_FAILURE;
+		}
+	}
+
 	return CL_SUCCESS;
 }
 
+static int
+CompareDevices(void)
+{
+	int err = 0;
+	int f;
+	cl_uint i, d;
+	double single[MAX_DEVICES];
+	double single_rate = 0;
+	double best = 0;
+	double multi;
+	double monolithic = 0;
+	float shares[MAX_DEVICES];
+
+	glFinish();
+
+#if (USE_GL_ATTACHMENTS)
+	err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputeInputOutputReal, 0, 0, 0);
+	err |= clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputeInputOutputImaginary, 0, 0, 0);
+	if (err != CL_SUCCESS)
+	{
+		printf("Failed to acquire GL object! %d\n", err);
+		return EXIT_FAILURE;
+	}
+#else
+	err = clEnqueueWriteBuffer(ComputeCommands, ComputeInputOutputReal, CL_TRUE, 0, DataElemCount * sizeof(float), DataReal, 0, NULL, NULL);
+	err |= clEnqueueWriteBuffer(ComputeCommands, ComputeInputOutputImaginary, CL_TRUE, 0, DataElemCount * sizeof(float), DataImaginary, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("Failed to write buffer! %d\n", err);
+		return EXIT_FAILURE;
+	}
+#endif
+
+	memcpy(shares, DeviceShare, sizeof(shares));
+
+	// Each device on its own with every batch
+	for(d = 0; d < DeviceCount; d++)
+	{
+		for(i = 0; i < DeviceCount; i++)
+			DeviceShare[i] = (i == d) ? 1.0f : 0.0f;
+
+		long start = GetCurrentTime();
+		for(f = 0; f < BenchmarkFrames && !err; f++)
+			err = EnqueueMultiDevice();
+		clFinish(ComputeCommands);
+		if (err)
+			return err;
+
+		single[d] = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+		single_rate += 1.0 / single[d];
+		if (!best || single[d] < best)
+			best = single[d];
+	}
+
+	// All devices together, letting the balancer settle first when enabled
+	memcpy(DeviceShare, shares, sizeof(shares));
+	for(f = 0; f < (Balance ? BenchmarkFrames : 1) && !err; f++)
+		err = EnqueueMultiDevice();
+	clFinish(ComputeCommands);
+
+	long start = GetCurrentTime();
+	for(f = 0; f < BenchmarkFrames && !err; f++)
+		err = EnqueueMultiDevice();
+	clFinish(ComputeCommands);
+	if (err)
+		return err;
+
+	multi = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+
+	// With fission the root device shares the context, time it on the whole problem
+	if (!FirstPrivateDevice)
+	{
+		size_t global = DataElemCount / FFT_BATCH_SIZE * FFT_BATCH_ITEMS;
+		size_t local = FFT_BATCH_ITEMS;
+
+		start = GetCurrentTime();
+		for(f = 0; f < BenchmarkFrames && !err; f++)
+			err = EnqueueKernel(ComputeCommands, ComputeKernel, 1, NULL, &global, &local, 0, NULL, NULL);
+		clFinish(ComputeCommands);
+		if (err)
+			return err;
+
+		monolithic = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+	}
+
+#if (USE_GL_ATTACHMENTS)
+	clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputeInputOutputReal, 0, 0, 0);
+	clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputeInputOutputImaginary, 0, 0, 0);
+	clFinish(ComputeCommands);
+#endif
+
+	printf(SEPARATOR);
+	printf("Multi-device scaling (%d frames, %d transforms of %d, %s)\n", BenchmarkFrames, DataElemCount / FFT_BATCH_SIZE,
+		FFT_BATCH_SIZE, Balance ? "balanced" : "equal split");
+	for(d = 0; d < DeviceCount; d++)
+	{
+		cl_char device_name[1024] = {0};
+		clGetDeviceInfo(DeviceIds[d], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+		printf("  Device %2d: %8.3f ms  share %5.1f%%  %s\n", d, single[d], 100.0f * DeviceShare[d], device_name);
+	}
+	printf("  All devices: %8.3f ms  speedup %5.2fx  efficiency %5.1f%%\n",
+		multi, best / multi, 100.0 * (1.0 / multi) / single_rate);
+	if (!FirstPrivateDevice)
+		printf("  Monolithic:  %8.3f ms  partitions %5.2fx\n", monolithic, monolithic / multi);
+	printf(SEPARATOR);
+
+	if (fp)
+		fprintf(fp, "Devices %d Best %.3f ms All %.3f ms Efficiency %.1f%%\n", DeviceCount, best, multi,
+			100.0 * (1.0 / multi) / single_rate);
+	if (fp && !FirstPrivateDevice)
+		fprintf(fp, "Monolithic %.3f ms\n", monolithic);
+
+	for(d = 0; d < DeviceCount; d++)
+		DeviceTime[d] = 0;
+	MultiDeviceCount = 0;
+
+	Update = 1;
+	return CL_SUCCESS;
+}
+
+static int
+CompareOverlap(void)
+{
+	int err = 0;
+	int chunks[2] = { 1, Chunks };
+
+	err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeInputOutputReal);
+	err |= SetKernelArg(ComputeKernel, 1, sizeof(cl_mem), &ComputeInputOutputImaginary);
+	if (err)
+		return -10;
+
+	glFinish();
+
+#if (USE_GL_ATTACHMENTS)
+	err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputeInputOutputReal, 0, 0, 0);
+	err |= clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputeInputOutputImaginary, 0, 0, 0);
+	if (err != CL_SUCCESS)
+	{
+		printf("Failed to acquire GL object! %d\n", err);
+		return EXIT_FAILURE;
+	}
+#endif
+
+	printf(SEPARATOR);
+	printf("Transfer overlap (%d frames, %d transforms of %d, %s)\n", BenchmarkFrames, DataElemCount / FFT_BATCH_SIZE,
+		FFT_BATCH_SIZE, USE_GL_ATTACHMENTS ? "attached" : "copying");
+
+	for (int c = 0; c < 2 && !err; c++)
+	{
+		OverlapSpan = OverlapTransfer = OverlapCompute = OverlapHidden = 0;
+		OverlapCount = 0;
+
+		for (int f = 0; f < BenchmarkFrames && !err; f++)
+			err = EnqueueOverlapped(chunks[c]);
+		if (err)
+			break;
+
+		printf("  %2d chunk(s):  span %8.3f ms  transfers %8.3f ms  kernels %8.3f ms  hidden %5.1f%%\n",
+			chunks[c], OverlapSpan / OverlapCount, OverlapTransfer / OverlapCount, OverlapCompute / OverlapCount,
+			OverlapTransfer > 0 ? 100.0 * OverlapHidden / OverlapTransfer : 0.0);
+
+		if (fp)
+			fprintf(fp, "Chunks %d Span %.3f ms Transfers %.3f ms Kernels %.3f ms Hidden %.3f ms\n", chunks[c],
+				OverlapSpan / OverlapCount, OverlapTransfer / OverlapCount, OverlapCompute / OverlapCount,
+				OverlapHidden / OverlapCount);
+	}
+	printf(SEPARATOR);
+
+#if (USE_GL_ATTACHMENTS)
+	clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputeInputOutputReal, 0, 0, 0);
+	clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputeInputOutputImaginary, 0, 0, 0);
+	clFinish(ComputeCommands);
+#endif
+	if (err)
+		return err;
+
+	OverlapSpan = OverlapTransfer = OverlapCompute = OverlapHidden = 0;
+	OverlapCount = 0;
+
+	Update = 1;
+	return CL_SUCCESS;
+}
+
+static int
+CompareSync(void)
+{
+	int err = 0;
+	int sync = GLSyncEvents;
+	int ndrange = NDRangeCount;
+	double ms[2];
+	double stall[2];
+
+	// The same frames with the hard syncs and then with the fences, both drained at the end
+	for (int mode = 0; mode < 2 && !err; mode++)
+	{
+		GLSyncEvents = mode;
+		SyncStall = 0;
+		SyncCount = 0;
+
+		glFinish();
+		clFinish(ComputeCommands);
+
+		double start = GetPreciseTime();
+		for (int f = 0; f < BenchmarkFrames && !err; f++)
+		{
+			Update = 1;
+			err = Recompute();
+		}
+		glFinish();
+		clFinish(ComputeCommands);
+
+		ms[mode] = (GetPreciseTime() - start) / BenchmarkFrames;
+		stall[mode] = SyncCount ? SyncStall / SyncCount : 0;
+	}
+
+	GLSyncEvents = sync;
+	NDRangeCount = ndrange;
+	SyncStall = 0;
+	SyncCount = 0;
+	if (err)
+		return err;
+
+	printf(SEPARATOR);
+	printf("GL/CL synchronization (%d frames)\n", BenchmarkFrames);
+	printf("  glFinish/clFinish: %8.3f ms per frame  stalled %8.3f ms\n", ms[0], stall[0]);
+	printf("  GL sync events:    %8.3f ms per frame  stalled %8.3f ms\n", ms[1], stall[1]);
+	printf("  Hard syncs cost    %8.3f ms per frame (%4.1f%%)\n", ms[0] - ms[1],
+		ms[0] > 0 ? 100.0 * (ms[0] - ms[1]) / ms[0] : 0.0);
+	printf(SEPARATOR);
+
+	if (fp)
+		fprintf(fp, "Hard %.3f ms Stall %.3f ms Fenced %.3f ms Stall %.3f ms\n", ms[0], stall[0], ms[1], stall[1]);
+
+	Update = 1;
+	return CL_SUCCESS;
+}
+
+// Largest and root mean square difference to the reference output, both relative to
+// the largest reference magnitude. NaNs and infinities count as an infinite error.
+static void
+MeasureError(const float *reference, const float *result, size_t count, double *max_err, double *rms_err)
+{
+	double scale = 0;
+	double sum = 0;
+	size_t i;
+
+	*max_err = 0;
+	for (i = 0; i < count; i++)
+	{
+		double diff = fabs((double)result[i] - reference[i]);
+		if (diff != diff)
+			diff = HUGE_VAL;
+		scale = (fabs(reference[i]) > scale) ? fabs(reference[i]) : scale;
+		*max_err = (diff > *max_err) ? diff : *max_err;
+		sum += diff * diff;
+	}
+
+	scale = (scale > 0) ? scale : 1;
+	*max_err /= scale;
+	*rms_err = sqrt(sum / count) / scale;
+}
+
+// Builds kfft with each option set and transforms the current input on private
+// buffers, timing the kernel and comparing the spectrum to the default build
+static int
+CompareBuildOptions(void)
+{
+	int err = CL_SUCCESS;
+	int count = 0;
+	int s, f;
+	const char *options[MAX_BUILD_OPTION_SETS];
+	double ms[MAX_BUILD_OPTION_SETS];
+	double max_err[MAX_BUILD_OPTION_SETS];
+	double rms_err[MAX_BUILD_OPTION_SETS];
+	int built[MAX_BUILD_OPTION_SETS];
+
+	// The first set builds the reference, a -buildopts set is tried last
+	for (s = 0; s < (int)(sizeof(BuildOptionSets) / sizeof(BuildOptionSets[0])); s++)
+		options[count++] = BuildOptionSets[s];
+	if (BuildOptions)
+		options[count++] = BuildOptions;
+
+	size_t bytes = sizeof(float) * DataElemCount;
+	size_t global = DataElemCount / FFT_BATCH_SIZE * FFT_BATCH_ITEMS;
+	size_t local = FFT_BATCH_ITEMS;
+	float *reference = (float *)malloc(2 * bytes);
+	float *result = (float *)malloc(2 * bytes);
+	cl_command_queue queue = clCreateCommandQueue(ComputeContext, ComputeDeviceId, CL_QUEUE_PROFILING_ENABLE, &err);
+	cl_mem buffers[2];
+
+	buffers[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+	buffers[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+	if (!reference || !result || !queue || !buffers[0] || !buffers[1] || !DataReal || !DataImaginary)
+	{
+		printf("Failed to create build sweep resources!\n");
+		err = EXIT_FAILURE;
+		count = 0;
+	}
+
+	for (s = 0; s < count && err == CL_SUCCESS; s++)
+	{
+		cl_program program = BuildComputeProgram(options[s]);
+		cl_kernel kernel = program ? clCreateKernel(program, COMPUTE_KERNEL_MATMUL_NAME, NULL) : 0;
+		float *output = s ? result : reference;
+
+		// Other sets may be rejected by the compiler, but the reference has to build
+		built[s] = (kernel != 0);
+		max_err[s] = rms_err[s] = 0;
+		if (!kernel)
+		{
+			if (program)
+				clReleaseProgram(program);
+			err = s ? CL_SUCCESS : EXIT_FAILURE;
+			continue;
+		}
+
+		// A transient kernel, so the arguments bypass the cache
+		err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffers[0]);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffers[1]);
+
+		// One untimed launch, then the kernel time of each launch from its profiling event
+		ms[s] = 0;
+		for (f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+		{
+			cl_event event;
+
+			// The transform is in place, so every launch starts from the input again
+			err = clEnqueueWriteBuffer(queue, buffers[0], CL_FALSE, 0, bytes, DataReal, 0, NULL, NULL);
+			err |= clEnqueueWriteBuffer(queue, buffers[1], CL_FALSE, 0, bytes, DataImaginary, 0, NULL, NULL);
+			err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &local, 0, NULL, &event);
+			if (err == CL_SUCCESS)
+			{
+				clWaitForEvents(1, &event);
+				ms[s] += f ? GetEventTime(event) / BenchmarkFrames : 0;
+				if (!f)
+					clReleaseEvent(event);
+			}
+		}
+
+		err |= clEnqueueReadBuffer(queue, buffers[0], CL_TRUE, 0, bytes, output, 0, NULL, NULL);
+		err |= clEnqueueReadBuffer(queue, buffers[1], CL_TRUE, 0, bytes, output + DataElemCount, 0, NULL, NULL);
+		if (s)
+			MeasureError(reference, result, 2 * DataElemCount, &max_err[s], &rms_err[s]);
+
+		clReleaseKernel(kernel);
+		clReleaseProgram(program);
+	}
+
+	if (err != CL_SUCCESS)
+		printf("Failed to run build option sweep! %d\n", err);
+	else
+	{
+		printf(SEPARATOR);
+		printf("Build option sweep (%d launches each, errors relative to the default build)\n", BenchmarkFrames);
+		for (s = 0; s < count; s++)
+		{
+			const char *label = options[s][0] ? options[s] : "(default)";
+			if (!built[s])
+				printf("  %-32s failed to build\n", label);
+			else
+				printf("  %-32s %8.3f ms %5.2fx  max err %9.3e  rms err %9.3e\n", label, ms[s],
+					(ms[s] > 0) ? ms[0] / ms[s] : 0.0, max_err[s], rms_err[s]);
+			if (fp && built[s])
+				fprintf(fp, "BuildOptions '%s' %.3f ms MaxErr %.3e RmsErr %.3e\n", options[s], ms[s], max_err[s], rms_err[s]);
+		}
+		printf(SEPARATOR);
+	}
+
+	for (f = 0; f < 2; f++)
+	{
+		if (buffers[f])
+			clReleaseMemObject(buffers[f]);
+	}
+	if (queue)
+		clReleaseCommandQueue(queue);
+	free(reference);
+	free(result);
+
+	return err;
+}
+
+// Real input through the full complex path and through the packed real
+// transform. The complex path transforms the even and the odd samples of each
+// 2K vector separately with zero imaginary parts, the last radix-2 step on
+// the host then gives the reference spectrum for kfft_r2c. kfft_c2r has to
+// give back the samples from that spectrum.
+static int
+CompareRealTransform(void)
+{
+	int err = CL_SUCCESS;
+	int f, p, i;
+	size_t v, k, n;
+	size_t vectors = DataElemCount / (2 * FFT_BATCH_SIZE);
+	size_t bytes = sizeof(float) * DataElemCount;
+	size_t global[3] = { 2 * vectors * FFT_BATCH_ITEMS, vectors * FFT_BATCH_ITEMS, vectors * FFT_BATCH_ITEMS };
+	size_t local = FFT_BATCH_ITEMS;
+	const char *names[3] = { COMPUTE_KERNEL_MATMUL_NAME, COMPUTE_KERNEL_R2C_NAME, COMPUTE_KERNEL_C2R_NAME };
+	const char *labels[3] = { "complex", "real to complex", "complex to real" };
+	int planes[3] = { 2, 1, 1 };
+	double kernel_ms[3] = { 0, 0, 0 };
+	double total_ms[3] = { 0, 0, 0 };
+	double max_err[3] = { 0, 0, 0 };
+	double rms_err[3] = { 0, 0, 0 };
+	cl_kernel kernels[3];
+	float *packed = (float *)calloc(2, bytes);
+	float *transformed = (float *)malloc(2 * bytes);
+	float *spectrum = (float *)malloc(bytes);
+	float *samples = (float *)malloc(bytes);
+	float *reference = (float *)malloc(bytes);
+	const float *inputs[3] = { packed, DataReal, spectrum };
+	float *outputs[3] = { transformed, spectrum, samples };
+	cl_command_queue queue = clCreateCommandQueue(ComputeContext, ComputeDeviceId, CL_QUEUE_PROFILING_ENABLE, &err);
+	cl_mem buffers[2];
+
+	for (p = 0; p < 3; p++)
+		kernels[p] = clCreateKernel(ComputeProgram, names[p], NULL);
+	buffers[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+	buffers[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+	if (!packed || !transformed || !spectrum || !samples || !reference || !queue || !buffers[0] || !buffers[1] ||
+		!kernels[0] || !kernels[1] || !kernels[2] || !vectors || DataElemCount % (2 * FFT_BATCH_SIZE))
+	{
+		printf("Failed to create real transform resources!\n");
+		err = EXIT_FAILURE;
+	}
+
+	// Even samples of vector v are complex transform 2v, odd samples 2v+1
+	for (v = 0; v < vectors && err == CL_SUCCESS; v++)
+	{
+		for (n = 0; n < FFT_BATCH_SIZE; n++)
+		{
+			packed[(2 * v) * FFT_BATCH_SIZE + n] = DataReal[v * 2 * FFT_BATCH_SIZE + 2 * n];
+			packed[(2 * v + 1) * FFT_BATCH_SIZE + n] = DataReal[v * 2 * FFT_BATCH_SIZE + 2 * n + 1];
+		}
+	}
+
+	for (p = 0; p < 3 && err == CL_SUCCESS; p++)
+	{
+		// Transient kernels, so the arguments bypass the cache
+		for (i = 0; i < planes[p]; i++)
+			err |= clSetKernelArg(kernels[p], i, sizeof(cl_mem), &buffers[i]);
+
+		// One untimed launch, then the kernel time from its profiling event and
+		// the time to the results back on the host
+		for (f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+		{
+			cl_event event;
+			double start = GetPreciseTime();
+
+			// The transforms are in place, so every launch starts from the input again
+			for (i = 0; i < planes[p]; i++)
+				err |= clEnqueueWriteBuffer(queue, buffers[i], CL_FALSE, 0, bytes, inputs[p] + i * DataElemCount, 0, NULL, NULL);
+			err |= clEnqueueNDRangeKernel(queue, kernels[p], 1, NULL, &global[p], &local, 0, NULL, &event);
+			if (err == CL_SUCCESS)
+			{
+				for (i = 0; i < planes[p]; i++)
+					err |= clEnqueueReadBuffer(queue, buffers[i], CL_FALSE, 0, bytes, outputs[p] + i * DataElemCount, 0, NULL, NULL);
+				clFinish(queue);
+				total_ms[p] += f ? (GetPreciseTime() - start) / BenchmarkFrames : 0;
+				kernel_ms[p] += f ? GetEventTime(event) / BenchmarkFrames : 0;
+				if (!f)
+					clReleaseEvent(event);
+			}
+		}
+	}
+
+	// X[k] = E[k] + W^k O[k] over both halves of the complex results, in the
+	// layout of kfft_r2c with X[1024] in place of the imaginary part of X[0]
+	for (v = 0; v < vectors && err == CL_SUCCESS; v++)
+	{
+		const float *er = transformed + (2 * v) * FFT_BATCH_SIZE;
+		const float *ei = er + DataElemCount;
+		const float *odr = transformed + (2 * v + 1) * FFT_BATCH_SIZE;
+		const float *odi = odr + DataElemCount;
+		float *xr = reference + v * 2 * FFT_BATCH_SIZE;
+		float *xi = xr + FFT_BATCH_SIZE;
+
+		for (k = 0; k <= FFT_BATCH_SIZE; k++)
+		{
+			size_t j = k % FFT_BATCH_SIZE;
+			double c = cos(-M_PI * k / FFT_BATCH_SIZE);
+			double s = sin(-M_PI * k / FFT_BATCH_SIZE);
+			double re = er[j] + c * odr[j] - s * odi[j];
+			double im = ei[j] + c * odi[j] + s * odr[j];
+
+			if (k == 0)
+				xr[0] = (float)re;
+			else if (k == FFT_BATCH_SIZE)
+				xi[0] = (float)re;
+			else
+			{
+				xr[k] = (float)re;
+				xi[k] = (float)im;
+			}
+		}
+	}
+
+	if (err != CL_SUCCESS)
+		printf("Failed to run real transform comparison! %d\n", err);
+	else
+	{
+		MeasureError(reference, spectrum, DataElemCount, &max_err[1], &rms_err[1]);
+		MeasureError(DataReal, samples, DataElemCount, &max_err[2], &rms_err[2]);
+
+		printf(SEPARATOR);
+		printf("Real transforms (%d launches each, %d vectors of %d real samples)\n", BenchmarkFrames, (int)vectors,
+			2 * FFT_BATCH_SIZE);
+		for (p = 0; p < 3; p++)
+		{
+			printf("  %-16s %8.3f ms kernel %8.3f ms total %6.2f MB moved", labels[p], kernel_ms[p], total_ms[p],
+				2.0 * planes[p] * bytes / (1024.0 * 1024.0));
+			if (p)
+				printf("  max err %9.3e  rms err %9.3e", max_err[p], rms_err[p]);
+			printf("\n");
+			if (fp)
+				fprintf(fp, "RealTransform %s %.3f ms %.3f ms MaxErr %.3e RmsErr %.3e\n", names[p], kernel_ms[p],
+					total_ms[p], max_err[p], rms_err[p]);
+		}
+		printf("  Real input is %5.2fx faster in the kernel, %5.2fx with transfers\n",
+			(kernel_ms[1] > 0) ? kernel_ms[0] / kernel_ms[1] : 0.0, (total_ms[1] > 0) ? total_ms[0] / total_ms[1] : 0.0);
+		printf("  Errors are against the complex path for the spectrum, against the input for the samples\n");
+		printf(SEPARATOR);
+	}
+
+	for (p = 0; p < 3; p++)
+	{
+		if (kernels[p])
+			clReleaseKernel(kernels[p]);
+	}
+	for (f = 0; f < 2; f++)
+	{
+		if (buffers[f])
+			clReleaseMemObject(buffers[f]);
+	}
+	if (queue)
+		clReleaseCommandQueue(queue);
+	free(packed);
+	free(transformed);
+	free(spectrum);
+	free(samples);
+	free(reference);
+
+	return err;
+}
+
+// Sets the arguments of a transient kernel, so they bypass the cache
+static cl_int
+SetTransientArgs(cl_kernel kernel, int count, const size_t *sizes, const void **values)
+{
+	cl_int err = CL_SUCCESS;
+
+	for (int a = 0; a < count; a++)
+		err |= clSetKernelArg(kernel, a, sizes[a], values[a]);
+
+	return err;
+}
+
+// Convolution of the real plane with random filters of ConvolutionTaps
+// lengths, everything resident on the device. The FFT pipeline is overlap-save
+// over FFT_BATCH_SIZE point blocks: kconv_gather, kfft, kconv_multiply with
+// the filter spectrum, kfft again and kconv_scatter. The filter spectrum is
+// set up once per length and not timed. The direct kernel is the reference
+// for the errors.
+static int
+CompareConvolution(void)
+{
+	int err = CL_SUCCESS;
+	int f, t;
+	int taps_count = (int)(sizeof(ConvolutionTaps) / sizeof(ConvolutionTaps[0]));
+	int max_taps = ConvolutionTaps[taps_count - 1];
+	int crossover = 0;
+	size_t bytes = sizeof(float) * DataElemCount;
+	size_t max_transforms = (DataElemCount / (FFT_BATCH_SIZE + 1 - max_taps) + 2) / 2;
+	size_t block_bytes = sizeof(float) * max_transforms * FFT_BATCH_SIZE;
+	size_t local = FFT_BATCH_ITEMS;
+	double direct_ms[sizeof(ConvolutionTaps) / sizeof(ConvolutionTaps[0])];
+	double fft_ms[sizeof(ConvolutionTaps) / sizeof(ConvolutionTaps[0])];
+	double max_err[sizeof(ConvolutionTaps) / sizeof(ConvolutionTaps[0])];
+	double rms_err[sizeof(ConvolutionTaps) / sizeof(ConvolutionTaps[0])];
+	float *filter = (float *)calloc(FFT_BATCH_SIZE, sizeof(float));
+	float *zeros = (float *)calloc(FFT_BATCH_SIZE, sizeof(float));
+	float *direct = (float *)malloc(bytes);
+	float *result = (float *)malloc(bytes);
+	cl_kernel fft = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_NAME, NULL);
+	cl_kernel gather = clCreateKernel(ComputeProgram, "kconv_gather", NULL);
+	cl_kernel multiply = clCreateKernel(ComputeProgram, "kconv_multiply", NULL);
+	cl_kernel scatter = clCreateKernel(ComputeProgram, "kconv_scatter", NULL);
+	cl_kernel convolve = clCreateKernel(ComputeProgram, "kconv_direct", NULL);
+	cl_mem signal = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY, bytes, NULL, NULL);
+	cl_mem output = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, bytes, NULL, NULL);
+	cl_mem taps_buffer = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY, sizeof(float) * max_taps, NULL, NULL);
+	cl_mem block_real = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, block_bytes, NULL, NULL);
+	cl_mem block_imag = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, block_bytes, NULL, NULL);
+	cl_mem filter_real = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(float) * FFT_BATCH_SIZE, NULL, NULL);
+	cl_mem filter_imag = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(float) * FFT_BATCH_SIZE, NULL, NULL);
+
+	if (!filter || !zeros || !direct || !result || !fft || !gather || !multiply || !scatter || !convolve || !signal ||
+		!output || !taps_buffer || !block_real || !block_imag || !filter_real || !filter_imag)
+	{
+		printf("Failed to create convolution resources!\n");
+		err = EXIT_FAILURE;
+		taps_count = 0;
+	}
+	else
+		err = clEnqueueWriteBuffer(ComputeCommands, signal, CL_TRUE, 0, bytes, DataReal, 0, NULL, NULL);
+
+	for (t = 0; t < taps_count && err == CL_SUCCESS; t++)
+	{
+		cl_uint count = DataElemCount;
+		cl_uint taps = ConvolutionTaps[t];
+		size_t step = FFT_BATCH_SIZE + 1 - taps;
+		size_t transforms = ((DataElemCount + step - 1) / step + 1) / 2;
+		size_t points = transforms * FFT_BATCH_SIZE;
+		size_t fft_global = transforms * FFT_BATCH_ITEMS;
+		size_t filter_global = FFT_BATCH_ITEMS;
+		size_t direct_global = (DataElemCount + local - 1) / local * local;
+
+		// Filter spectrum, the filter zero padded to a whole transform. The
+		// lengths only go up, so the padding is still zero
+		RandomFillArray_Float(filter, taps, 1, -1.0f, 1.0f);
+		err = clEnqueueWriteBuffer(ComputeCommands, taps_buffer, CL_FALSE, 0, sizeof(float) * taps, filter, 0, NULL, NULL);
+		err |= clEnqueueWriteBuffer(ComputeCommands, filter_real, CL_FALSE, 0, sizeof(float) * FFT_BATCH_SIZE, filter, 0, NULL, NULL);
+		err |= clEnqueueWriteBuffer(ComputeCommands, filter_imag, CL_FALSE, 0, sizeof(float) * FFT_BATCH_SIZE, zeros, 0, NULL, NULL);
+		err |= clSetKernelArg(fft, 0, sizeof(cl_mem), &filter_real);
+		err |= clSetKernelArg(fft, 1, sizeof(cl_mem), &filter_imag);
+		err |= clEnqueueNDRangeKernel(ComputeCommands, fft, 1, NULL, &filter_global, &local, 0, NULL, NULL);
+
+		const void *gather_values[] = { &signal, &count, &taps, &block_real, &block_imag };
+		const size_t gather_sizes[] = { sizeof(cl_mem), sizeof(cl_uint), sizeof(cl_uint), sizeof(cl_mem), sizeof(cl_mem) };
+		const void *multiply_values[] = { &block_real, &block_imag, &filter_real, &filter_imag };
+		const size_t multiply_sizes[] = { sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_mem) };
+		const void *scatter_values[] = { &block_real, &block_imag, &count, &taps, &output };
+		const size_t scatter_sizes[] = { sizeof(cl_mem), sizeof(cl_mem), sizeof(cl_uint), sizeof(cl_uint), sizeof(cl_mem) };
+		const void *direct_values[] = { &signal, &count, &taps_buffer, &taps, &output };
+		const size_t direct_sizes[] = { sizeof(cl_mem), sizeof(cl_uint), sizeof(cl_mem), sizeof(cl_uint), sizeof(cl_mem) };
+
+		err |= SetTransientArgs(gather, 5, gather_sizes, gather_values);
+		err |= SetTransientArgs(multiply, 4, multiply_sizes, multiply_values);
+		err |= SetTransientArgs(scatter, 5, scatter_sizes, scatter_values);
+		err |= SetTransientArgs(convolve, 5, direct_sizes, direct_values);
+		err |= clFinish(ComputeCommands);
+
+		// The filter is transformed, the same kernel does the blocks from here on
+		err |= clSetKernelArg(fft, 0, sizeof(cl_mem), &block_real);
+		err |= clSetKernelArg(fft, 1, sizeof(cl_mem), &block_imag);
+
+		// One untimed pass of each, then the time from the first launch to the
+		// result being complete on the device
+		direct_ms[t] = fft_ms[t] = 0;
+		for (f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+		{
+			double start = GetPreciseTime();
+
+			err = clEnqueueNDRangeKernel(ComputeCommands, convolve, 1, NULL, &direct_global, &local, 0, NULL, NULL);
+			err |= clFinish(ComputeCommands);
+			direct_ms[t] += f ? (GetPreciseTime() - start) / BenchmarkFrames : 0;
+		}
+		err |= clEnqueueReadBuffer(ComputeCommands, output, CL_TRUE, 0, bytes, direct, 0, NULL, NULL);
+
+		for (f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+		{
+			double start = GetPreciseTime();
+
+			err = clEnqueueNDRangeKernel(ComputeCommands, gather, 1, NULL, &points, &local, 0, NULL, NULL);
+			err |= clEnqueueNDRangeKernel(ComputeCommands, fft, 1, NULL, &fft_global, &local, 0, NULL, NULL);
+			err |= clEnqueueNDRangeKernel(ComputeCommands, multiply, 1, NULL, &points, &local, 0, NULL, NULL);
+			err |= clEnqueueNDRangeKernel(ComputeCommands, fft, 1, NULL, &fft_global, &local, 0, NULL, NULL);
+			err |= clEnqueueNDRangeKernel(ComputeCommands, scatter, 1, NULL, &points, &local, 0, NULL, NULL);
+			err |= clFinish(ComputeCommands);
+			fft_ms[t] += f ? (GetPreciseTime() - start) / BenchmarkFrames : 0;
+		}
+		err |= clEnqueueReadBuffer(ComputeCommands, output, CL_TRUE, 0, bytes, result, 0, NULL, NULL);
+
+		if (err == CL_SUCCESS)
+			MeasureError(direct, result, DataElemCount, &max_err[t], &rms_err[t]);
+		if (!crossover && fft_ms[t] < direct_ms[t])
+			crossover = taps;
+	}
+
+	if (err != CL_SUCCESS)
+		printf("Failed to run convolution comparison! %d\n", err);
+	else
+	{
+		printf(SEPARATOR);
+		printf("Convolution of %d samples (%d passes each, overlap-save over %d point blocks)\n", DataElemCount,
+			BenchmarkFrames, FFT_BATCH_SIZE);
+		printf("  taps  direct ms  Msamples/s     fft ms  Msamples/s  speedup    max err    rms err\n");
+		for (t = 0; t < taps_count; t++)
+		{
+			printf("  %4d %10.3f %11.1f %10.3f %11.1f %7.2fx  %9.3e  %9.3e\n", ConvolutionTaps[t],
+				direct_ms[t], (direct_ms[t] > 0) ? DataElemCount / (direct_ms[t] * 1000.0) : 0.0,
+				fft_ms[t], (fft_ms[t] > 0) ? DataElemCount / (fft_ms[t] * 1000.0) : 0.0,
+				(fft_ms[t] > 0) ? direct_ms[t] / fft_ms[t] : 0.0, max_err[t], rms_err[t]);
+			if (fp)
+				fprintf(fp, "Convolution %d taps Direct %.3f ms FFT %.3f ms MaxErr %.3e RmsErr %.3e\n",
+					ConvolutionTaps[t], direct_ms[t], fft_ms[t], max_err[t], rms_err[t]);
+		}
+		if (crossover)
+			printf("  FFT convolution is faster from %d taps\n", crossover);
+		else
+			printf("  Direct convolution is faster up to %d taps\n", max_taps);
+		printf("  Errors are against the direct convolution\n");
+		printf(SEPARATOR);
+	}
+
+	cl_kernel kernels[] = { fft, gather, multiply, scatter, convolve };
+	cl_mem buffers[] = { signal, output, taps_buffer, block_real, block_imag, filter_real, filter_imag };
+	for (f = 0; f < (int)(sizeof(kernels) / sizeof(kernels[0])); f++)
+	{
+		if (kernels[f])
+			clReleaseKernel(kernels[f]);
+	}
+	for (f = 0; f < (int)(sizeof(buffers) / sizeof(buffers[0])); f++)
+	{
+		if (buffers[f])
+			clReleaseMemObject(buffers[f]);
+	}
+	free(filter);
+	free(zeros);
+	free(direct);
+	free(result);
+
+	return err;
+}
+
+// Animated frames with both planes refilled on the host and uploaded, as the
+// frame loop does by default, against kfill refilling them in place. Each step
+// is timed to its completion, and the display is left out of both
+static int
+CompareInputs(void)
+{
+	int err = CL_SUCCESS;
+	int m, f, p;
+	int planes = RealTransform ? 1 : 2;
+	const char *labels[2] = { "host fill + upload", "device fill" };
+	const char *name = RealTransform ? COMPUTE_KERNEL_R2C_NAME : COMPUTE_KERNEL_MATMUL_NAME;
+	double fill_ms[2] = { 0, 0 };
+	double upload_ms[2] = { 0, 0 };
+	double compute_ms[2] = { 0, 0 };
+	double fps[2] = { 0, 0 };
+	size_t bytes = sizeof(float) * DataElemCount;
+	size_t global = DataElemCount / (planes == 1 ? 2 * FFT_BATCH_SIZE : FFT_BATCH_SIZE) * FFT_BATCH_ITEMS;
+	size_t local = FFT_BATCH_ITEMS;
+	float *data[2] = { DataReal, DataImaginary };
+	cl_kernel kernel = clCreateKernel(ComputeProgram, name, NULL);
+	cl_mem buffers[2];
+
+	buffers[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+	buffers[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+	if (!kernel || !buffers[0] || !buffers[1])
+		err = EXIT_FAILURE;
+
+	// A transient kernel, so the arguments bypass the cache
+	for (p = 0; p < planes && err == CL_SUCCESS; p++)
+		err = clSetKernelArg(kernel, p, sizeof(cl_mem), &buffers[p]);
+
+	for (m = 0; m < 2 && err == CL_SUCCESS; m++)
+	{
+		// One untimed frame each
+		for (f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+		{
+			double start = GetPreciseTime();
+			double filled = start;
+
+			if (m == 0)
+			{
+				UpdateData();
+				filled = GetPreciseTime();
+				for (p = 0; p < planes; p++)
+					err |= clEnqueueWriteBuffer(ComputeCommands, buffers[p], CL_TRUE, 0, bytes, data[p], 0, NULL, NULL);
+			}
+			else
+			{
+				err = EnqueueInputFill(ComputeCommands, buffers[0], (planes == 2) ? buffers[1] : 0);
+				err |= clFinish(ComputeCommands);
+				filled = GetPreciseTime();
+			}
+			double uploaded = GetPreciseTime();
+
+			err |= clEnqueueNDRangeKernel(ComputeCommands, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
+			err |= clFinish(ComputeCommands);
+			if (f)
+			{
+				fill_ms[m] += (filled - start) / BenchmarkFrames;
+				upload_ms[m] += (uploaded - filled) / BenchmarkFrames;
+				compute_ms[m] += (GetPreciseTime() - uploaded) / BenchmarkFrames;
+			}
+		}
+		fps[m] = 1000.0 / (fill_ms[m] + upload_ms[m] + compute_ms[m]);
+	}
+
+	if (err != CL_SUCCESS)
+		printf("Failed to run input generation comparison! %d\n", err);
+	else
+	{
+		printf(SEPARATOR);
+		printf("Animated inputs (%d frames, %d points, %s)\n", BenchmarkFrames, DataElemCount, name);
+		for (m = 0; m < 2; m++)
+			printf("  %-20s fill %8.3f ms  upload %8.3f ms  compute %8.3f ms  %8.1f fps\n", labels[m], fill_ms[m],
+				upload_ms[m], compute_ms[m], fps[m]);
+		printf("  Device inputs: %.1f fps pure compute against %.1f fps end to end (%.2fx)\n", fps[1], fps[0],
+			fps[1] / fps[0]);
+		printf(SEPARATOR);
+
+		if (fp)
+			fprintf(fp, "Inputs Host %.3f ms %.1f fps Device %.3f ms %.1f fps\n", 1000.0 / fps[0], fps[0],
+				1000.0 / fps[1], fps[1]);
+	}
+
+	for (p = 0; p < 2; p++)
+	{
+		if (buffers[p])
+			clReleaseMemObject(buffers[p]);
+	}
+	if (kernel)
+		clReleaseKernel(kernel);
+
+	Update = 1;
+	return err;
+}
+
 static void
 Cleanup(void)
 {
 	clFinish(ComputeCommands);
+	if (RooflineEvent)
+		clReleaseEvent(RooflineEvent);
+	RooflineEvent = 0;
+	ResetKernelArgs();
 	clReleaseKernel(ComputeKernel);
+	if (RealKernel)
+		clReleaseKernel(RealKernel);
+	if (FillKernel)
+		clReleaseKernel(FillKernel);
 	clReleaseProgram(ComputeProgram);
 	clReleaseCommandQueue(ComputeCommands);
+	if (Overlap)
+	{
+		clReleaseCommandQueue(UploadCommands);
+		clReleaseCommandQueue(DownloadCommands);
+	}
 	clReleaseMemObject(ComputeInputOutputReal);
 	clReleaseMemObject(ComputeInputOutputImaginary);
+	if (MultiDevice)
+	{
+		for(cl_uint i = FirstPrivateDevice; i < DeviceCount; i++)
+		{
+			clFinish(DeviceCommands[i]);
+			clReleaseCommandQueue(DeviceCommands[i]);
+			if(DeviceReal[i])
+				clReleaseMemObject(DeviceReal[i]);
+			if(DeviceImaginary[i])
+				clReleaseMemObject(DeviceImaginary[i]);
+			DeviceCommands[i] = 0;
+			DeviceReal[i] = 0;
+			DeviceImaginary[i] = 0;
+		}
+		if (!FirstPrivateDevice)
+		{
+			for(cl_uint i = 0; i < DeviceCount; i++)
+				clReleaseDevice(DeviceIds[i]);
+		}
+	}
 	clReleaseContext(ComputeContext);
 
 	ComputeCommands = 0;
+	UploadCommands = 0;
+	DownloadCommands = 0;
 	ComputeKernel = 0;
+	RealKernel = 0;
+	FillKernel = 0;
 	ComputeProgram = 0;    
 	ComputeInputOutputReal = 0;
 	ComputeInputOutputImaginary = 0;
@@ -1144,24 +2884,83 @@ ReportInfo(void)
 
 static void 
 ReportStats(
-	uint64_t uiStartTime, uint64_t uiEndTime)
+	double fStartTime, double fEndTime)
 {
-	TimeElapsed += SubtractTime(uiEndTime, uiStartTime);
+	double frame_ms = fEndTime - fStartTime;
+	int measured = MeasureFrame(&Frames, frame_ms);
 
-	if(TimeElapsed && FrameCount && FrameCount > (int)ReportStatsInterval) 
+	TimeElapsed += frame_ms;
+
+	// Frames the policy drops still go through the report to reset the per-frame
+	// counters, they are just not shown
+	if(TimeElapsed && FrameCount && (!measured || (FrameCount > (int)ReportStatsInterval && TimeElapsed >= MinRunTime)))
 	{
 		double fMs = (TimeElapsed / (double) FrameCount);
+		double fMean = fMs;
+		double fMad = 0;
+		double fLow = fMs;
+		double fHigh = fMs;
+		if (measured)
+			RobustStats(&Frames, &fMs, &fMad, &fLow, &fHigh);
 		double fFps = 1.0 / (fMs / 1000.0);
 
 		sprintf(StatsString, "[%s] Compute: %3.2f ms  Display: %3.2f fps (%s)\n", 
 			(ComputeDeviceType == CL_DEVICE_TYPE_GPU) ? "GPU" : "CPU", 
 			fMs, fFps, USE_GL_ATTACHMENTS ? "attached" : "copying");
+		sprintf(StatsString + strlen(StatsString) - 1, "  Mean: %3.2f ms  MAD: %3.2f ms  95%% CI: %3.2f-%3.2f ms\n",
+			fMean, fMad, fLow, fHigh);
+		if (Frames.count > MAX_WINDOW_FRAMES)
+			sprintf(StatsString + strlen(StatsString) - 1, "  Window: latest %d of %d frames\n",
+				MAX_WINDOW_FRAMES, Frames.count);
 
-		glutSetWindowTitle(StatsString);
-		if (fp)
-			fprintf(fp, "%s\n", StatsString);
+		if(Overlap && OverlapCount)
+		{
+			sprintf(StatsString + strlen(StatsString) - 1, "  Overlap: %3.2f ms span  %3.0f%% of transfers hidden\n",
+				OverlapSpan / OverlapCount, OverlapTransfer > 0 ? 100.0 * OverlapHidden / OverlapTransfer : 0.0);
+			OverlapSpan = OverlapTransfer = OverlapCompute = OverlapHidden = 0;
+			OverlapCount = 0;
+		}
+
+		if(MultiDevice && MultiDeviceCount)
+		{
+			for(cl_uint d = 0; d < DeviceCount && strlen(StatsString) < sizeof(StatsString) - 32; d++)
+			{
+				sprintf(StatsString + strlen(StatsString) - 1, "  [%d] %3.2f ms %3.0f%%\n",
+					d, DeviceTime[d] / MultiDeviceCount, 100.0f * DeviceShare[d]);
+				DeviceTime[d] = 0;
+			}
+			MultiDeviceCount = 0;
+		}
+
+		if(SyncCount)
+		{
+			sprintf(StatsString + strlen(StatsString) - 1, "  Sync: %3.2f ms stalled (%2.0f%%)\n",
+				SyncStall / SyncCount, 100.0 * SyncStall / TimeElapsed);
+			SyncStall = 0;
+			SyncCount = 0;
+		}
+
+		if(HostLaunches)
+		{
+			sprintf(StatsString + strlen(StatsString) - 1, "  Host: %3.1f us/frame (%2.1f%%) over %d frames %d args set %d cached %d launches\n",
+				HostSubmitFrames ? 1000.0 * HostSubmitTime / HostSubmitFrames : 0.0, 100.0 * HostSubmitTime / TimeElapsed,
+				HostSubmitFrames, HostArgSets, HostArgSkips, HostLaunches);
+			HostSubmitTime = 0;
+			HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+		}
+
+		if(Roofline)
+			ReportRoofline();
+
+		if(measured)
+		{
+			glutSetWindowTitle(StatsString);
+			if (fp)
+				fprintf(fp, "%s\n", StatsString);
+		}
 		FrameCount = 0;
 		TimeElapsed = 0;
+		Frames.count = 0;
 	}    
 }
 
@@ -1170,13 +2969,13 @@ Display_(void)
 {
 	FrameCount++;
 	ExecutionCount++;
-	uint64_t uiStartTime = GetCurrentTime();
+	double fStartTime = GetPreciseTime();
 
 
 	glClearColor (0.0, 0.0, 0.0, 0.0);
 	glClear (GL_COLOR_BUFFER_BIT);
 
-	if(Animated)
+	if(Animated && !DeviceGenerates())
 	{
 		UpdateData();
 		UpdateVBOs();
@@ -1200,8 +2999,8 @@ Display_(void)
 
 	glFinish(); // for timing
 
-	uint64_t uiEndTime = GetCurrentTime();
-	ReportStats(uiStartTime, uiEndTime);
+	double fEndTime = GetPreciseTime();
+	ReportStats(fStartTime, fEndTime);
 	DrawText(TextOffset[0], TextOffset[1], 1, (Animated == 0) ? "Press space to animate" : " ");
 	glutSwapBuffers();
 }
@@ -1281,6 +3080,9 @@ int main(int argc, char** argv)
         else if(strstr(argv[i], "-animate"))
             Animated = 1;
 
+        else if(strstr(argv[i], "-devicegen"))
+            DeviceInputs = 1;
+
         else if(strstr(argv[i], "-w"))
             Width = atoi(argv[i+1]);
 
@@ -1296,6 +3098,60 @@ int main(int argc, char** argv)
         else if(strstr(argv[i], "-maxframe"))
             MaxNDRange = atoi(argv[i+1]);
 
+        else if(strstr(argv[i], "-glsync"))
+            GLSyncEvents = 1;
+
+        else if(strstr(argv[i], "-multi"))
+            MultiDevice = 1;
+
+        else if(strstr(argv[i], "-balance"))
+            Balance = 1;
+
+        else if(strstr(argv[i], "-fission"))
+            FissionSpec = argv[i+1];
+
+        else if(strstr(argv[i], "-overlap"))
+            Overlap = 1;
+
+        else if(strstr(argv[i], "-chunks"))
+            Chunks = (atoi(argv[i+1]) > 1) ? atoi(argv[i+1]) : 1;
+
+        else if(strstr(argv[i], "-buildopts"))
+            BuildOptions = argv[i+1];
+
+        else if(strstr(argv[i], "-buildsweep"))
+            BuildSweep = 1;
+
+        else if(strstr(argv[i], "-realfft"))
+            RealTransform = 1;
+
+        else if(strstr(argv[i], "-convolve"))
+            Convolution = 1;
+
+        else if(strstr(argv[i], "-discard"))
+            Frames.warmup_frames = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-steadycv"))
+            Frames.steady_cv = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-mintime"))
+            MinRunTime = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-roofline"))
+            Roofline = 1;
+
+        else if(strstr(argv[i], "-peakgflops"))
+        {
+            Roofline = 1;
+            Rooflines.peak_gflops = atof(argv[i+1]);
+        }
+
+        else if(strstr(argv[i], "-peakbw"))
+        {
+            Roofline = 1;
+            Rooflines.peak_bandwidth = atof(argv[i+1]);
+        }
+
         else if(strstr(argv[i], "-stride"))
         {
             ExecuteStride = atoi(argv[i+1]);
@@ -1311,11 +3167,39 @@ int main(int argc, char** argv)
 	glutCreateWindow (argv[0]);
 	if (Initialize (use_gpu) == GL_NO_ERROR)
 	{
+		if (MultiDevice && CompareDevices() != CL_SUCCESS)
+			Shutdown();
+
+		if (BuildSweep && CompareBuildOptions() != CL_SUCCESS)
+			Shutdown();
+
+		if (RealTransform && CompareRealTransform() != CL_SUCCESS)
+			Shutdown();
+
+		if (Convolution && CompareConvolution() != CL_SUCCESS)
+			Shutdown();
+
+		if (DeviceInputs && CompareInputs() != CL_SUCCESS)
+			Shutdown();
+
+		if (GLSyncEvents && CompareSync() != CL_SUCCESS)
+			Shutdown();
+
+		if (Overlap && CompareOverlap() != CL_SUCCESS)
+			Shutdown();
+
+		if (Roofline)
+			ShowRooflineModel(&Rooflines, KernelFlops(), KernelBytes());
+
 		glutDisplayFunc(Display_);
 		glutIdleFunc(Idle);
 		glutReshapeFunc(Reshape);
 		glutKeyboardFunc(Keyboard);
 
+		// Startup comparisons do not count towards the per-frame host overhead
+		HostSubmitTime = 0;
+		HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+
 		atexit(Shutdown);
 		printf("Starting event loop...\n");
 
@@ -72,18 +72,42 @@
 #include <CL/cl.h>
 #include <CL/cl_gl.h>
 
+#include "MeasureUtil.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 
 #define USE_GL_ATTACHMENTS              (0)  // enable OpenGL attachments for Compute results
 #define DEBUG_INFO                      (0)     
 #define COMPUTE_KERNEL_FILENAME         ("Julia_Kernel.cl")
 #define COMPUTE_KERNEL_METHOD_NAME      ("QJuliaKernel")
+#define COARSE_KERNEL_METHOD_NAME       ("QJuliaCoarseKernel")
+#define CLASSIFY_KERNEL_METHOD_NAME     ("QJuliaClassifyKernel")
+#define REFINE_KERNEL_METHOD_NAME       ("QJuliaRefineKernel")
+#define PERSISTENT_KERNEL_METHOD_NAME   ("QJuliaPersistentKernel")
+#define IMAGE_KERNEL_METHOD_NAME        ("QJuliaImageKernel")
+#define REPROJECT_KERNEL_METHOD_NAME    ("QJuliaReprojectKernel")
+#define PERSISTENT_TILE_SIZE            (8)
+#define COST_HISTOGRAM_BINS             (16)
+#define MAX_PROGRAM_VARIANTS            (32)
+#define MAX_DEVICES                     (16)
+#define ROOFLINE_MARCH_STEPS            (16)        // assumed mean ray march steps per pixel
+#define MAX_BUILD_OPTION_SETS           (8)
 #define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#define MAX_CACHED_KERNELS              (8)
+#define MAX_CACHED_ARGS                 (16)
+#define MAX_CACHED_ARG_SIZE             (64)
 #define WIDTH                           (512)
 #define HEIGHT                          (512)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef struct
+{
+    cl_kernel kernel;
+    size_t sizes[MAX_CACHED_ARGS];
+    unsigned char values[MAX_CACHED_ARGS][MAX_CACHED_ARG_SIZE];
+} KernelArgCache;
+
 static cl_context                       ComputeContext;
 static cl_command_queue                 ComputeCommands;
 static cl_kernel                        ComputeKernel;
@@ -95,6 +119,26 @@ static cl_mem                           ComputeImage;
 static size_t                           MaxWorkGroupSize;
 static int                              WorkGroupSize[2];
 static int                              WorkGroupItems = 32;
+static cl_kernel                        CoarseKernel;
+static cl_kernel                        ClassifyKernel;
+static cl_kernel                        RefineKernel;
+static cl_mem                           ComputeWorkList;
+static cl_mem                           ComputeWorkCount;
+static cl_kernel                        PersistentKernel;
+static cl_mem                           ComputeTileCounter;
+static cl_mem                           ComputeTileCost;
+static cl_uint                          ComputeUnits;
+static cl_kernel                        ImageKernel;
+static cl_kernel                        ReprojectKernel;
+static cl_mem                           ComputeDepth;
+static cl_mem                           ComputeReference;
+static cl_device_id                     DeviceIds[MAX_DEVICES];
+static cl_command_queue                 DeviceCommands[MAX_DEVICES];
+static cl_mem                           DeviceResult[MAX_DEVICES];
+static cl_uint                          DeviceCount = 1;
+static cl_device_id                     ContextDeviceIds[MAX_DEVICES + 1];
+static cl_uint                          ContextDeviceCount = 1;
+static cl_uint                          FirstPrivateDevice = 1;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -107,6 +151,65 @@ static int Animated                     = 0;
 static int Update                       = 1;
 
 static float Epsilon                    = 0.003f;
+static int Iterations                   = 10;
+static int Shadows                      = 0;
+
+static int Sweep                        = 0;
+static int BenchmarkFrames              = 20;
+
+static KernelArgCache ArgCache[MAX_CACHED_KERNELS];
+static double HostSubmitTime            = 0;
+static int HostSubmitFrames             = 0;
+static int HostArgSets                  = 0;
+static int HostArgSkips                 = 0;
+static int HostLaunches                 = 0;
+
+static int Roofline                     = 0;
+static RooflineStats Rooflines;
+static cl_event RooflineEvent           = 0;
+
+static int SweepSizes[]                 = { 256, 512, 1024, 2048 };
+static int SweepIterations[]            = { 5, 10, 20, 40 };
+
+static char ProgramOptions[MAX_PROGRAM_VARIANTS][256];
+static cl_program ProgramVariants[MAX_PROGRAM_VARIANTS];
+static int ProgramVariantCount          = 0;
+
+static int Progressive                  = 0;
+static uint ProgressiveStep             = 2;
+static float RefineThreshold            = 0.001f;
+static int RefinePending                = 0;
+static const cl_uint CounterReset       = 0;
+static double CoarseTime                = 0;
+static double ClassifyTime              = 0;
+static double FirstImageTime            = 0;
+static double ConvergedTime             = 0;
+static double RefinedFraction           = 0;
+static int ProgressiveCount             = 0;
+
+static int Persistent                   = 0;
+static int PersistentGroupsPerUnit      = 4;
+
+static int Direct                       = 0;
+
+static int Reproject                    = 0;
+static float ReprojectBackoff           = 0.05f;
+static double ReprojectTime             = 0;
+static int ReprojectCount               = 0;
+static double ReprojectSpeedup          = 0;
+static double ReprojectError            = 0;
+static double ReprojectPSNR             = 0;
+
+static int MultiDevice                  = 0;
+static int Balance                      = 0;
+static const char *FissionSpec          = NULL;
+static const char *BuildOptions         = NULL;
+static int BuildSweep                   = 0;
+static const char *BuildOptionSets[]    = { "", "-cl-mad-enable", "-cl-no-signed-zeros", "-cl-finite-math-only",
+                                            "-cl-unsafe-math-optimizations", "-cl-fast-relaxed-math", "-cl-opt-disable" };
+static float DeviceShare[MAX_DEVICES];
+static double DeviceTime[MAX_DEVICES];
+static int MultiDeviceCount             = 0;
 
 static float ColorT                     = 0.0f;
 static float ColorA[4]                  = { 0.25f, 0.45f, 1.0f, 1.0f };
@@ -136,12 +239,15 @@ static int FrameCount                   = 0;
 static int NDRangeCount                 = 0;
 static uint ReportStatsInterval         = 30;
 
+static FrameWindow Frames               = { 10, 5.0 };     // warm-up frames and steady cv
+static double MinRunTime                = 0;
+
 static float ShadowTextColor[4]         = { 0.0f, 0.0f, 0.0f, 1.0f };
 static float HighlightTextColor[4]      = { 0.9f, 0.9f, 0.9f, 1.0f };
 static uint TextOffset[2]               = { 25, 25 };
 
 static uint ShowStats                   = 1;
-static char StatsString[512]            = "\0";
+static char StatsString[1024]           = "\0";
 static uint ShowInfo                    = 1;
 static char InfoString[512]             = "\0";
 
@@ -189,6 +295,120 @@ SubtractTime( long uiEndTime, long uiStartTime )
     return uiEndTime - uiStartTime;
 }
 
+static double
+GetPreciseTime()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Analytic work per launch of QJuliaKernel. The march length depends on the
+// view, so this assumes ROOFLINE_MARCH_STEPS steps per pixel (the -persistent
+// comparison prints the measured steps per tile) of Iterations quaternion
+// iterations at 54 flops each plus 32 for the distance estimate, then the
+// six-sided normal and the shading. Each pixel is a single uchar4 store.
+static double
+KernelFlops(void)
+{
+    double steps = ROOFLINE_MARCH_STEPS * (Shadows ? 2 : 1);
+    double pixel = steps * (54.0 * Iterations + 32.0) + 6.0 * 15.0 * Iterations + 80.0;
+
+    return pixel * TextureWidth * TextureHeight;
+}
+
+static double
+KernelBytes(void)
+{
+    return 4.0 * sizeof(unsigned char) * TextureWidth * TextureHeight;
+}
+
+static void
+CollectRoofline(void)
+{
+    if (!RooflineEvent)
+        return;
+
+    clWaitForEvents(1, &RooflineEvent);
+    Rooflines.time += GetEventTime(RooflineEvent);
+    Rooflines.count++;
+    RooflineEvent = 0;
+}
+
+// Appends the achieved rates of the kernel launches timed since the last report
+static void
+ReportRoofline(void)
+{
+    CollectRoofline();
+    AppendRoofline(&Rooflines, KernelFlops(), KernelBytes(), StatsString, sizeof(StatsString));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+ResetKernelArgs(void)
+{
+    memset(ArgCache, 0, sizeof(ArgCache));
+}
+
+// clSetKernelArg copies the value, so an argument that is bound to the same
+// bytes already can be skipped. Local memory sizes are always passed through.
+static cl_int
+SetKernelArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+{
+    KernelArgCache *cache = NULL;
+    cl_int err;
+
+    for (int i = 0; i < MAX_CACHED_KERNELS && !cache; i++)
+    {
+        if (ArgCache[i].kernel == kernel || !ArgCache[i].kernel)
+        {
+            cache = &ArgCache[i];
+            cache->kernel = kernel;
+        }
+    }
+
+    int cacheable = cache && value && index < MAX_CACHED_ARGS && size <= MAX_CACHED_ARG_SIZE;
+    if (cacheable && cache->sizes[index] == size && !memcmp(cache->values[index], value, size))
+    {
+        HostArgSkips++;
+        return CL_SUCCESS;
+    }
+
+    err = clSetKernelArg(kernel, index, size, value);
+    if (cacheable && err == CL_SUCCESS)
+    {
+        cache->sizes[index] = size;
+        memcpy(cache->values[index], value, size);
+    }
+    else if (cache && index < MAX_CACHED_ARGS)
+    {
+        cache->sizes[index] = 0;
+    }
+
+    HostArgSets++;
+    return err;
+}
+
+static cl_int
+EnqueueKernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t *offset, const size_t *global,
+    const size_t *local, cl_uint wait_count, const cl_event *wait_list, cl_event *event)
+{
+    HostLaunches++;
+    return clEnqueueNDRangeKernel(queue, kernel, dims, offset, global, local, wait_count, wait_list, event);
+}
+
+// A frame's argument setup and launches are timed as one block, the single
+// calls are too short to time on their own
+static void
+CountHostSubmit(double start)
+{
+    HostSubmitTime += GetHostTime() - start;
+    HostSubmitFrames++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static int LoadTextFromFile(
@@ -431,76 +651,258 @@ UpdateColor( float t[4], float a[4], float b[4] )
 }
 
 static int
-Recompute(void)
+SetProgressiveKernelArgs(void)
 {
-    if(!ComputeKernel || !ComputeResult)
-        return CL_SUCCESS;
+    int err = CL_SUCCESS;
+
+    err |= SetKernelArg(CoarseKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(CoarseKernel, 1, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(CoarseKernel, 2, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(CoarseKernel, 3, sizeof(float), &Epsilon);
+    err |= SetKernelArg(CoarseKernel, 4, sizeof(cl_uint), &ProgressiveStep);
+
+    err |= SetKernelArg(ClassifyKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(ClassifyKernel, 1, sizeof(cl_mem), &ComputeWorkList);
+    err |= SetKernelArg(ClassifyKernel, 2, sizeof(cl_mem), &ComputeWorkCount);
+    err |= SetKernelArg(ClassifyKernel, 3, sizeof(cl_uint), &ProgressiveStep);
+    err |= SetKernelArg(ClassifyKernel, 4, sizeof(float), &RefineThreshold);
+
+    // Argument 2 (the work-list length) is set per dispatch
+    err |= SetKernelArg(RefineKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(RefineKernel, 1, sizeof(cl_mem), &ComputeWorkList);
+    err |= SetKernelArg(RefineKernel, 3, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(RefineKernel, 4, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(RefineKernel, 5, sizeof(float), &Epsilon);
+    err |= SetKernelArg(RefineKernel, 6, sizeof(cl_uint), &ProgressiveStep);
+
+    return err;
+}
 
-    if (NDRangeCount > MaxNDRange)
+static int
+SetPersistentKernelArgs(void)
+{
+    int err = CL_SUCCESS;
+
+    err |= SetKernelArg(PersistentKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(PersistentKernel, 1, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(PersistentKernel, 2, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(PersistentKernel, 3, sizeof(float), &Epsilon);
+    err |= SetKernelArg(PersistentKernel, 4, sizeof(cl_mem), &ComputeTileCounter);
+    err |= SetKernelArg(PersistentKernel, 5, sizeof(cl_mem), &ComputeTileCost);
+
+    return err;
+}
+
+static int
+EnqueuePersistent(void)
+{
+    int err = 0;
+    size_t global[2];
+    size_t local[2];
+
+    // Just enough groups to fill the device, the tile counter hands out the work
+    local[0] = PERSISTENT_TILE_SIZE;
+    local[1] = PERSISTENT_TILE_SIZE;
+    global[0] = PERSISTENT_TILE_SIZE * ComputeUnits * PersistentGroupsPerUnit;
+    global[1] = PERSISTENT_TILE_SIZE;
+
+    err = clEnqueueWriteBuffer(ComputeCommands, ComputeTileCounter, CL_FALSE, 0, sizeof(cl_uint), &CounterReset, 0, NULL, NULL);
+    if (err)
     {
-        printf("Reach Max NDRange, Quitting\n");
-        Cleanup();
-        exit(0);
+        printf("Failed to reset tile counter! %d\n", err);
+        return err;
     }
 
-    if ( EnableStideExec && (ExecutionCount / ExecuteStride) % 2 == 1)
+    return EnqueueKernel(ComputeCommands, PersistentKernel, 2, NULL, global, local, 0, NULL, NULL);
+}
+
+static int
+SetReprojectKernelArgs(void)
+{
+    int err = CL_SUCCESS;
+
+    err |= SetKernelArg(ReprojectKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(ReprojectKernel, 1, sizeof(cl_mem), &ComputeDepth);
+    err |= SetKernelArg(ReprojectKernel, 2, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(ReprojectKernel, 3, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(ReprojectKernel, 4, sizeof(float), &Epsilon);
+    err |= SetKernelArg(ReprojectKernel, 5, sizeof(float), &ReprojectBackoff);
+
+    return err;
+}
+
+static int
+MeasureReprojection(size_t *global, size_t *local, double reproject_ms)
+{
+    int err = 0;
+    int i;
+    cl_event event;
+    size_t size = TextureWidth * TextureHeight * TextureTypeSize * 4;
+
+    // Trace the same frame from scratch into the reference buffer
+    err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeReference);
+    err |= EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, &event);
+    err |= SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeResult);
+    if (err)
     {
-        printf("GL only for frame %d\n", ExecutionCount);
-        return CL_SUCCESS;
+        printf("Failed to enqueue reference kernel! %d\n", err);
+        return err;
     }
 
-    void *values[10];
-    size_t sizes[10];
-    size_t global[2];
-    size_t local[2];
+    clWaitForEvents(1, &event);
+    double reference_ms = GetEventTime(event);
+
+    unsigned char *reprojected = (unsigned char *)malloc(size);
+    unsigned char *reference = (unsigned char *)malloc(size);
+    err = clEnqueueReadBuffer(ComputeCommands, ComputeResult, CL_FALSE, 0, size, reprojected, 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(ComputeCommands, ComputeReference, CL_TRUE, 0, size, reference, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Failed to read buffer! %d\n", err);
+        free(reprojected);
+        free(reference);
+        return EXIT_FAILURE;
+    }
+
+    double sum = 0;
+    double sum2 = 0;
+    for(i = 0; i < size; i++)
+    {
+        double diff = (double)reprojected[i] - (double)reference[i];
+        sum += fabs(diff);
+        sum2 += diff * diff;
+    }
+    free(reprojected);
+    free(reference);
+
+    ReprojectSpeedup = (reproject_ms > 0) ? reference_ms / reproject_ms : 0;
+    ReprojectError = sum / size;
+    ReprojectPSNR = (sum2 > 0) ? 10.0 * log10(255.0 * 255.0 / (sum2 / size)) : 99.0;
+
+    return CL_SUCCESS;
+}
 
+static int
+RecomputeReprojected(size_t *global, size_t *local)
+{
     int err = 0;
-    unsigned int v = 0, s = 0, a = 0;
-    values[v++] = &ComputeResult;
-    values[v++] = MuC;
-    values[v++] = ColorC;
-    values[v++] = &Epsilon;
+    cl_event event;
 
-    sizes[s++] = sizeof(cl_mem);
-    sizes[s++] = 4 * (sizeof(float));
-    sizes[s++] = 4 * (sizeof(float));
-    sizes[s++] = sizeof(float);
+    err = EnqueueKernel(ComputeCommands, ReprojectKernel, 2, NULL, global, local, 0, NULL, &event);
+    if (err)
+        return err;
 
-    if(Animated || Update)
+    clWaitForEvents(1, &event);
+    double ms = GetEventTime(event);
+    ReprojectTime += ms;
+    ReprojectCount++;
+
+    // Compare against a full trace once per stats interval
+    if (ReprojectCount == 1)
+        return MeasureReprojection(global, local, ms);
+
+    return CL_SUCCESS;
+}
+
+static int
+RecomputeProgressive(int defer_refine)
+{
+    int err = 0;
+    cl_event coarse_event;
+    cl_event classify_event;
+    cl_event refine_event;
+    cl_uint count = 0;
+    double refine_time = 0;
+    size_t global[2];
+    size_t local[2];
+
+    int blocks_x = DivideUp(TextureWidth, ProgressiveStep);
+    int blocks_y = DivideUp(TextureHeight, ProgressiveStep);
+
+    // Trace one sample per block and flag the blocks which need refinement. When the
+    // parameters have just changed interactively the coarse image is shown first and
+    // the refinement is left for the next frame. A change while that refinement is still
+    // pending starts over, the old work-list and coarse samples belong to the old parameters.
+    if(!RefinePending || defer_refine)
     {
-        Update = 0;
-        err = CL_SUCCESS;
-        for (a = 0; a < s; a++)
-            err |= clSetKernelArg(ComputeKernel, a, sizes[a], values[a]);
+        local[0] = WorkGroupSize[0];
+        local[1] = WorkGroupSize[1];
+        global[0] = DivideUp(blocks_x, local[0]) * local[0];
+        global[1] = DivideUp(blocks_y, local[1]) * local[1];
 
+        err = EnqueueKernel(ComputeCommands, CoarseKernel, 2, NULL, global, local, 0, NULL, &coarse_event);
         if (err)
-            return -10;
-    }
+        {
+            printf("Failed to enqueue coarse kernel! %d\n", err);
+            return err;
+        }
 
-    int size_x = WorkGroupSize[0];
-    int size_y = WorkGroupSize[1];
+        err = clEnqueueWriteBuffer(ComputeCommands, ComputeWorkCount, CL_FALSE, 0, sizeof(cl_uint), &CounterReset, 0, NULL, NULL);
+        if (err)
+        {
+            printf("Failed to reset work-list! %d\n", err);
+            return err;
+        }
 
-    global[0] = DivideUp(TextureWidth, size_x) * size_x; 
-    global[1] = DivideUp(TextureHeight, size_y) * size_y;
+        err = EnqueueKernel(ComputeCommands, ClassifyKernel, 2, NULL, global, local, 0, NULL, &classify_event);
+        if (err)
+        {
+            printf("Failed to enqueue classify kernel! %d\n", err);
+            return err;
+        }
 
-    local[0] = size_x;
-    local[1] = size_y;
+        clWaitForEvents(1, &classify_event);
+        CoarseTime = GetEventTime(coarse_event);
+        ClassifyTime = GetEventTime(classify_event);
 
-#if (DEBUG_INFO)
-    if(FrameCount <= 1)
-        printf("Global[%4d %4d] Local[%4d %4d]\n", 
-            (int)global[0], (int)global[1],
-            (int)local[0], (int)local[1]);
-#endif
+        if(defer_refine)
+        {
+            RefinePending = 1;
+            return CL_SUCCESS;
+        }
+    }
+
+    RefinePending = 0;
 
-    err = clEnqueueNDRangeKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, NULL);
+    err = clEnqueueReadBuffer(ComputeCommands, ComputeWorkCount, CL_TRUE, 0, sizeof(cl_uint), &count, 0, NULL, NULL);
     if (err)
     {
-        printf("Failed to enqueue kernel! %d\n", err);
+        printf("Failed to read work-list length! %d\n", err);
         return err;
     }
 
-    NDRangeCount++;
+    if(count)
+    {
+        size_t refine_local = MaxWorkGroupSize;
+        size_t refine_global = DivideUp(count * ProgressiveStep * ProgressiveStep, refine_local) * refine_local;
+
+        err = SetKernelArg(RefineKernel, 2, sizeof(cl_uint), &count);
+        if (err)
+            return -10;
+
+        err = EnqueueKernel(ComputeCommands, RefineKernel, 1, NULL, &refine_global, &refine_local, 0, NULL, &refine_event);
+        if (err)
+        {
+            printf("Failed to enqueue refine kernel! %d\n", err);
+            return err;
+        }
+
+        clWaitForEvents(1, &refine_event);
+        refine_time = GetEventTime(refine_event);
+    }
+
+    FirstImageTime += CoarseTime;
+    ConvergedTime += CoarseTime + ClassifyTime + refine_time;
+    RefinedFraction += (double)count / (blocks_x * blocks_y);
+    ProgressiveCount++;
+
+    return CL_SUCCESS;
+}
+
+static int
+EnqueueResultCopy(cl_event *copy_event)
+{
+    int err = 0;
 
 #if (USE_GL_ATTACHMENTS)
 
@@ -514,7 +916,7 @@ Recompute(void)
     size_t origin[] = { 0, 0, 0 };
     size_t region[] = { TextureWidth, TextureHeight, 1 };
     err = clEnqueueCopyBufferToImage(ComputeCommands, ComputeResult, ComputeImage, 
-        0, origin, region, 0, NULL, 0);
+        0, origin, region, 0, NULL, copy_event);
 
     if(err != CL_SUCCESS)
     {
@@ -531,7 +933,7 @@ Recompute(void)
 
 #else
 
-    err = clEnqueueReadBuffer( ComputeCommands, ComputeResult, CL_TRUE, 0, Width * Height * TextureTypeSize * 4, HostImageBuffer, 0, NULL, NULL );      
+    err = clEnqueueReadBuffer( ComputeCommands, ComputeResult, CL_TRUE, 0, TextureWidth * TextureHeight * TextureTypeSize * 4, HostImageBuffer, 0, NULL, copy_event );      
     if (err != CL_SUCCESS)
     {
         printf("Failed to read buffer! %d\n", err);
@@ -543,357 +945,1648 @@ Recompute(void)
     return CL_SUCCESS;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-static int 
-CreateComputeResult(void)
+static int
+SetDirectKernelArgs(void)
 {
+    int err = CL_SUCCESS;
 
-#if (USE_GL_ATTACHMENTS)
+    err |= SetKernelArg(ImageKernel, 0, sizeof(cl_mem), &ComputeImage);
+    err |= SetKernelArg(ImageKernel, 1, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(ImageKernel, 2, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(ImageKernel, 3, sizeof(float), &Epsilon);
+
+    return err;
+}
+
+static int
+EnqueueDirect(size_t *global, size_t *local, cl_event *kernel_event, cl_event *copy_event)
+{
     int err = 0;
 
-    if(ComputeImage)
-        clReleaseMemObject(ComputeImage);
-    ComputeImage = 0;
+    // The kernel writes the texture itself, so there is nothing to copy afterwards
+#if (USE_GL_ATTACHMENTS)
 
-    printf("Allocating compute result image in device memory...\n");
-    // ComputeImage = clCreateFromGLTexture2D(ComputeContext, CL_MEM_WRITE_ONLY, TextureTarget, 0, TextureId, &err);
-    ComputeImage = clCreateFromGLTexture(ComputeContext, CL_MEM_WRITE_ONLY, TextureTarget, 0, TextureId, &err);
-    if (!ComputeImage || err != CL_SUCCESS)
+    err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputeImage, 0, 0, 0);
+    if (err != CL_SUCCESS)
     {
-        printf("Failed to create OpenGL texture reference! %d\n", err);
-        return -1;
+        printf("Failed to acquire GL object! %d\n", err);
+        return EXIT_FAILURE;
     }
 
-#else
-
-    if (HostImageBuffer)
-        free(HostImageBuffer);
+    err = EnqueueKernel(ComputeCommands, ImageKernel, 2, NULL, global, local, 0, NULL, kernel_event);
+    if (err)
+    {
+        printf("Failed to enqueue kernel! %d\n", err);
+        return err;
+    }
 
-    printf("Allocating compute result image in host memory...\n");
-    HostImageBuffer = malloc(TextureWidth * TextureHeight * TextureTypeSize * 4);
-    if(!HostImageBuffer)
+    err = clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputeImage, 0, 0, 0);
+    if (err != CL_SUCCESS)
     {
-        printf("Failed to create host image buffer!\n");
-        return -1;
+        printf("Failed to release GL object! %d\n", err);
+        return EXIT_FAILURE;
     }
 
-    memset(HostImageBuffer, 0, TextureWidth * TextureHeight * TextureTypeSize * 4);
+    if (copy_event)
+        *copy_event = 0;
 
-#endif
+#else
 
-    if(ComputeResult)
-        clReleaseMemObject(ComputeResult);
-    ComputeResult = 0;
+    err = EnqueueKernel(ComputeCommands, ImageKernel, 2, NULL, global, local, 0, NULL, kernel_event);
+    if (err)
+    {
+        printf("Failed to enqueue kernel! %d\n", err);
+        return err;
+    }
 
-    ComputeResult = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, TextureTypeSize * 4 * TextureWidth * TextureHeight, NULL, NULL);
-    if (!ComputeResult)
+    // Without a shared texture the image is still read back for display
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { TextureWidth, TextureHeight, 1 };
+    err = clEnqueueReadImage(ComputeCommands, ComputeImage, CL_TRUE, origin, region, 0, 0, HostImageBuffer, 0, NULL, copy_event);
+    if (err != CL_SUCCESS)
     {
-        printf("Failed to create OpenCL array!\n");
-        return -1;
+        printf("Failed to read image! %d\n", err);
+        return EXIT_FAILURE;
     }
 
+#endif
+
     return CL_SUCCESS;
 }
 
-static int 
+// Partitions of one device share its memory and work on the primary buffers
+// directly, separate devices go through buffers of their own
+static int
+PrivateBuffers(cl_uint device)
+{
+    return FirstPrivateDevice && device >= FirstPrivateDevice;
+}
+
+static void
+PartitionWork(size_t units, size_t *offset, size_t *count)
+{
+    cl_uint i;
+    size_t start = 0;
+
+    for(i = 0; i < DeviceCount; i++)
+    {
+        size_t n = (i == DeviceCount - 1) ? units - start : (size_t)(units * DeviceShare[i] + 0.5f);
+        if (start + n > units)
+            n = units - start;
+
+        offset[i] = start;
+        count[i] = n;
+        start += n;
+    }
+}
+
+static void
+BalanceDevices(size_t *count, double *ms)
+{
+    cl_uint i;
+    double rate[MAX_DEVICES];
+    double measured_rate = 0;
+    double measured_share = 0;
+
+    // Devices that got no work this frame keep their share, the rest split
+    // what is left in proportion to the rows per ms they just achieved
+    for(i = 0; i < DeviceCount; i++)
+    {
+        rate[i] = (count[i] && ms[i] > 0) ? count[i] / ms[i] : 0;
+        if (rate[i] > 0)
+        {
+            measured_rate += rate[i];
+            measured_share += DeviceShare[i];
+        }
+    }
+
+    if (measured_rate <= 0)
+        return;
+
+    for(i = 0; i < DeviceCount; i++)
+    {
+        if (rate[i] > 0)
+            DeviceShare[i] = 0.5f * DeviceShare[i] + 0.5f * (float)(measured_share * rate[i] / measured_rate);
+    }
+}
+
+static int
+EnqueueMultiDevice(size_t *global, size_t *local)
+{
+    int err = CL_SUCCESS;
+    cl_uint i;
+    size_t offset[MAX_DEVICES];
+    size_t count[MAX_DEVICES];
+    double ms[MAX_DEVICES];
+    cl_event events[MAX_DEVICES];
+    cl_event ready = 0;
+    size_t row_bytes = TextureWidth * TextureTypeSize * 4;
+
+    // The other devices start once the primary queue is done with the result
+    if (FirstPrivateDevice < DeviceCount)
+    {
+        err = clEnqueueMarkerWithWaitList(ComputeCommands, 0, NULL, &ready);
+        if (err)
+        {
+            printf("Failed to enqueue marker! %d\n", err);
+            return err;
+        }
+    }
+
+    // Scanline bands in units of work-group rows
+    PartitionWork(global[1] / local[1], offset, count);
+
+    for(i = 0; i < DeviceCount; i++)
+    {
+        size_t band_offset[2] = { 0, offset[i] * local[1] };
+        size_t band_global[2] = { global[0], count[i] * local[1] };
+        int other = (i >= FirstPrivateDevice);
+        cl_mem output = PrivateBuffers(i) ? DeviceResult[i] : ComputeResult;
+
+        events[i] = 0;
+        if (!count[i])
+            continue;
+
+        err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &output);
+        err |= EnqueueKernel(DeviceCommands[i], ComputeKernel, 2, band_offset, band_global, local,
+            other ? 1 : 0, other ? &ready : NULL, &events[i]);
+        if (err)
+        {
+            printf("Failed to enqueue kernel on device %d! %d\n", i, err);
+            break;
+        }
+        clFlush(DeviceCommands[i]);
+    }
+    if (ready)
+        clReleaseEvent(ready);
+    if (err)
+        return err;
+
+    err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeResult);
+
+    // Copy the bands traced on the other devices into the primary result as
+    // each device finishes, device to device without a trip through the host
+    for(i = FirstPrivateDevice; i < DeviceCount && !err; i++)
+    {
+        size_t first = offset[i] * local[1];
+        size_t last = (offset[i] + count[i]) * local[1];
+        if (last > TextureHeight)
+            last = TextureHeight;
+        if (first >= last || !PrivateBuffers(i))
+            continue;
+
+        err = clEnqueueCopyBuffer(ComputeCommands, DeviceResult[i], ComputeResult, first * row_bytes, first * row_bytes,
+            (last - first) * row_bytes, 1, &events[i], NULL);
+    }
+
+    for(i = 0; i < DeviceCount; i++)
+    {
+        ms[i] = 0;
+        if (!events[i])
+            continue;
+
+        clWaitForEvents(1, &events[i]);
+        ms[i] = GetEventTime(events[i]);
+        DeviceTime[i] += ms[i];
+    }
+    MultiDeviceCount++;
+
+    if (err)
+    {
+        printf("Failed to gather device results! %d\n", err);
+        return err;
+    }
+
+    if (Balance)
+        BalanceDevices(count, ms);
+
+    return CL_SUCCESS;
+}
+
+static int
+Recompute(void)
+{
+    if(!ComputeKernel || !ComputeResult)
+        return CL_SUCCESS;
+
+    if (NDRangeCount > MaxNDRange)
+    {
+        printf("Reach Max NDRange, Quitting\n");
+        Cleanup();
+        exit(0);
+    }
+
+    if ( EnableStideExec && (ExecutionCount / ExecuteStride) % 2 == 1)
+    {
+        printf("GL only for frame %d\n", ExecutionCount);
+        return CL_SUCCESS;
+    }
+
+    void *values[10];
+    size_t sizes[10];
+    size_t global[2];
+    size_t local[2];
+
+    int err = 0;
+    int changed = Update;
+    unsigned int v = 0, s = 0, a = 0;
+    values[v++] = &ComputeResult;
+    values[v++] = MuC;
+    values[v++] = ColorC;
+    values[v++] = &Epsilon;
+
+    sizes[s++] = sizeof(cl_mem);
+    sizes[s++] = 4 * (sizeof(float));
+    sizes[s++] = 4 * (sizeof(float));
+    sizes[s++] = sizeof(float);
+
+    // The roofline wait for the last launch stays out of the host time
+    CollectRoofline();
+    double submit = GetHostTime();
+
+    if(Animated || Update)
+    {
+        Update = 0;
+        err = CL_SUCCESS;
+        for (a = 0; a < s; a++)
+            err |= SetKernelArg(ComputeKernel, a, sizes[a], values[a]);
+
+        if (Progressive)
+            err |= SetProgressiveKernelArgs();
+
+        if (Persistent)
+            err |= SetPersistentKernelArgs();
+
+        if (Direct)
+            err |= SetDirectKernelArgs();
+
+        if (Reproject)
+            err |= SetReprojectKernelArgs();
+
+        if (err)
+            return -10;
+    }
+
+    int size_x = WorkGroupSize[0];
+    int size_y = WorkGroupSize[1];
+
+    global[0] = DivideUp(TextureWidth, size_x) * size_x; 
+    global[1] = DivideUp(TextureHeight, size_y) * size_y;
+
+    local[0] = size_x;
+    local[1] = size_y;
+
+#if (DEBUG_INFO)
+    if(FrameCount <= 1)
+        printf("Global[%4d %4d] Local[%4d %4d]\n", 
+            (int)global[0], (int)global[1],
+            (int)local[0], (int)local[1]);
+#endif
+
+    if (Direct)
+    {
+        NDRangeCount++;
+        err = EnqueueDirect(global, local, NULL, NULL);
+        CountHostSubmit(submit);
+        return err;
+    }
+
+    if (Progressive)
+        err = RecomputeProgressive(changed && !Animated);
+    else if (Persistent)
+        err = EnqueuePersistent();
+    else if (Reproject)
+        err = RecomputeReprojected(global, local);
+    else if (MultiDevice)
+        err = EnqueueMultiDevice(global, local);
+    else
+        err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, Roofline ? &RooflineEvent : NULL);
+    if (err)
+    {
+        printf("Failed to enqueue kernel! %d\n", err);
+        return err;
+    }
+
+    // Progressive, reprojected and multi-device frames wait for their kernels inside the launch
+    if (!Progressive && !Reproject && !MultiDevice)
+        CountHostSubmit(submit);
+
+    NDRangeCount++;
+
+    return EnqueueResultCopy(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int 
+CreateComputeResult(void)
+{
+    ResetKernelArgs();
+
+#if (USE_GL_ATTACHMENTS)
+    int err = 0;
+
+    if(ComputeImage)
+        clReleaseMemObject(ComputeImage);
+    ComputeImage = 0;
+
+    printf("Allocating compute result image in device memory...\n");
+    // ComputeImage = clCreateFromGLTexture2D(ComputeContext, CL_MEM_WRITE_ONLY, TextureTarget, 0, TextureId, &err);
+    ComputeImage = clCreateFromGLTexture(ComputeContext, CL_MEM_WRITE_ONLY, TextureTarget, 0, TextureId, &err);
+    if (!ComputeImage || err != CL_SUCCESS)
+    {
+        printf("Failed to create OpenGL texture reference! %d\n", err);
+        return -1;
+    }
+
+#else
+
+    if (HostImageBuffer)
+        free(HostImageBuffer);
+
+    printf("Allocating compute result image in host memory...\n");
+    HostImageBuffer = malloc(TextureWidth * TextureHeight * TextureTypeSize * 4);
+    if(!HostImageBuffer)
+    {
+        printf("Failed to create host image buffer!\n");
+        return -1;
+    }
+
+    memset(HostImageBuffer, 0, TextureWidth * TextureHeight * TextureTypeSize * 4);
+
+    if(ComputeImage)
+        clReleaseMemObject(ComputeImage);
+    ComputeImage = 0;
+
+    if(Direct)
+    {
+        int err = 0;
+        cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+        cl_image_desc desc;
+
+        memset(&desc, 0, sizeof(desc));
+        desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+        desc.image_width = TextureWidth;
+        desc.image_height = TextureHeight;
+
+        printf("Allocating compute result image object...\n");
+        ComputeImage = clCreateImage(ComputeContext, CL_MEM_WRITE_ONLY, &format, &desc, NULL, &err);
+        if (!ComputeImage || err != CL_SUCCESS)
+        {
+            printf("Failed to create OpenCL image! %d\n", err);
+            return -1;
+        }
+    }
+
+#endif
+
+    if(ComputeResult)
+        clReleaseMemObject(ComputeResult);
+    ComputeResult = 0;
+
+    // The progressive classify pass reads the coarse samples back
+    cl_mem_flags flags = Progressive ? CL_MEM_READ_WRITE : CL_MEM_WRITE_ONLY;
+    ComputeResult = clCreateBuffer(ComputeContext, flags, TextureTypeSize * 4 * TextureWidth * TextureHeight, NULL, NULL);
+    if (!ComputeResult)
+    {
+        printf("Failed to create OpenCL array!\n");
+        return -1;
+    }
+
+    if(Progressive)
+    {
+        if(ComputeWorkList)
+            clReleaseMemObject(ComputeWorkList);
+        if(ComputeWorkCount)
+            clReleaseMemObject(ComputeWorkCount);
+
+        int blocks = DivideUp(TextureWidth, ProgressiveStep) * DivideUp(TextureHeight, ProgressiveStep);
+        ComputeWorkList = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, blocks * sizeof(cl_uint), NULL, NULL);
+        ComputeWorkCount = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+        if (!ComputeWorkList || !ComputeWorkCount)
+        {
+            printf("Failed to create OpenCL work-list!\n");
+            return -1;
+        }
+
+        RefinePending = 0;
+        Update = 1;
+    }
+
+    if(Reproject)
+    {
+        if(ComputeDepth)
+            clReleaseMemObject(ComputeDepth);
+        if(ComputeReference)
+            clReleaseMemObject(ComputeReference);
+
+        // A zero depth means no hint, so the first frame does the full march
+        float *zeros = (float *)calloc(TextureWidth * TextureHeight, sizeof(float));
+        ComputeDepth = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, TextureWidth * TextureHeight * sizeof(float), zeros, NULL);
+        ComputeReference = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, TextureTypeSize * 4 * TextureWidth * TextureHeight, NULL, NULL);
+        free(zeros);
+        if (!ComputeDepth || !ComputeReference)
+        {
+            printf("Failed to create OpenCL depth buffer!\n");
+            return -1;
+        }
+
+        Update = 1;
+    }
+
+    if(MultiDevice)
+    {
+        cl_uint i;
+        for(i = FirstPrivateDevice; i < DeviceCount && PrivateBuffers(i); i++)
+        {
+            if(DeviceResult[i])
+                clReleaseMemObject(DeviceResult[i]);
+
+            DeviceResult[i] = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, TextureTypeSize * 4 * TextureWidth * TextureHeight, NULL, NULL);
+            if (!DeviceResult[i])
+            {
+                printf("Failed to create OpenCL array for device %d!\n", i);
+                return -1;
+            }
+        }
+    }
+
+    if(Persistent)
+    {
+        if(ComputeTileCounter)
+            clReleaseMemObject(ComputeTileCounter);
+        if(ComputeTileCost)
+            clReleaseMemObject(ComputeTileCost);
+
+        int tiles = DivideUp(TextureWidth, PERSISTENT_TILE_SIZE) * DivideUp(TextureHeight, PERSISTENT_TILE_SIZE);
+        ComputeTileCounter = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+        ComputeTileCost = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, tiles * sizeof(cl_uint), NULL, NULL);
+        if (!ComputeTileCounter || !ComputeTileCost)
+        {
+            printf("Failed to create OpenCL tile counter!\n");
+            return -1;
+        }
+
+        Update = 1;
+    }
+
+    return CL_SUCCESS;
+}
+
+static int
+PartitionDevice(void)
+{
+    cl_device_partition_property properties[MAX_DEVICES + 3];
+    cl_uint p = 0;
+    cl_uint i;
+    cl_uint count = 0;
+    int err;
+
+    if (ComputeDeviceType != CL_DEVICE_TYPE_CPU)
+    {
+        printf("Device fission needs the CPU device, ignoring '%s'\n", FissionSpec);
+        return CL_SUCCESS;
+    }
+
+    // equal:<units>, counts:<units>,<units>,... or an affinity domain (numa, l3, l2, next)
+    if (!strncmp(FissionSpec, "equal:", 6))
+    {
+        properties[p++] = CL_DEVICE_PARTITION_EQUALLY;
+        properties[p++] = atoi(FissionSpec + 6);
+    }
+    else if (!strncmp(FissionSpec, "counts:", 7))
+    {
+        const char *c = FissionSpec + 7;
+
+        properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS;
+        while (c && *c && p < MAX_DEVICES + 1)
+        {
+            properties[p++] = atoi(c);
+            c = strchr(c, ',');
+            if (c)
+                c++;
+        }
+        properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+    }
+    else
+    {
+        properties[p++] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+        if (!strcmp(FissionSpec, "numa"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+        else if (!strcmp(FissionSpec, "l3"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE;
+        else if (!strcmp(FissionSpec, "l2"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE;
+        else if (!strcmp(FissionSpec, "next"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE;
+        else
+        {
+            printf("Error: Unknown device fission '%s', use equal:<units>, counts:<units>,... numa, l3, l2 or next!\n",
+                FissionSpec);
+            return EXIT_FAILURE;
+        }
+    }
+    properties[p++] = 0;
+
+    err = clCreateSubDevices(ComputeDeviceId, properties, 0, NULL, &count);
+    if (err != CL_SUCCESS || !count || count >= MAX_DEVICES)
+    {
+        printf("Error: Failed to partition compute device '%s'! %d\n", FissionSpec, err);
+        return EXIT_FAILURE;
+    }
+
+    err = clCreateSubDevices(ComputeDeviceId, properties, count, DeviceIds, &DeviceCount);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create sub-devices! %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    // Every partition works on its range of the root device buffers, the root
+    // device runs the monolithic baseline
+    FirstPrivateDevice = 0;
+    MultiDevice = 1;
+    for(i = 0; i < DeviceCount; i++)
+        DeviceShare[i] = 1.0f / DeviceCount;
+
+    printf("Partitioned compute device into %d sub-devices (%s)...\n", DeviceCount, FissionSpec);
+
+    return CL_SUCCESS;
+}
+
+static void
+ListContextDevices(void)
+{
+    cl_uint i;
+
+    // The root goes first so it is still the device picked for the main queue
+    ContextDeviceCount = 0;
+    if (!FirstPrivateDevice)
+        ContextDeviceIds[ContextDeviceCount++] = ComputeDeviceId;
+    for(i = 0; i < DeviceCount; i++)
+        ContextDeviceIds[ContextDeviceCount++] = DeviceIds[i];
+}
+
+static int
+GatherDevices(cl_platform_id platform_id)
+{
+    cl_uint i;
+    int err;
+
+    err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, MAX_DEVICES, DeviceIds, &DeviceCount);
+    if (err != CL_SUCCESS || !DeviceCount)
+    {
+        printf("Error: Failed to locate compute devices!\n");
+        return EXIT_FAILURE;
+    }
+    if (DeviceCount > MAX_DEVICES)
+        DeviceCount = MAX_DEVICES;
+
+    // Keep the requested device first, it owns the result and the GL copy
+    for(i = 0; i < DeviceCount; i++)
+    {
+        if(DeviceIds[i] == ComputeDeviceId)
+        {
+            DeviceIds[i] = DeviceIds[0];
+            DeviceIds[0] = ComputeDeviceId;
+            break;
+        }
+    }
+
+    for(i = 0; i < DeviceCount; i++)
+        DeviceShare[i] = 1.0f / DeviceCount;
+
+    return CL_SUCCESS;
+}
+
+static int
+CreateDeviceQueues(void)
+{
+    cl_uint i;
+    int err;
+
+    for(i = FirstPrivateDevice; i < DeviceCount; i++)
+    {
+        cl_char device_name[1024] = {0};
+
+        DeviceCommands[i] = clCreateCommandQueue(ComputeContext, DeviceIds[i], CL_QUEUE_PROFILING_ENABLE, &err);
+        if (!DeviceCommands[i])
+        {
+            printf("Error: Failed to create a command queue for device %d!\n", i);
+            return EXIT_FAILURE;
+        }
+
+        clGetDeviceInfo(DeviceIds[i], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+        printf("Connecting to %s as device %d...\n", device_name, i);
+    }
+
+    return CL_SUCCESS;
+}
+
+static int 
 SetupComputeDevices(int gpu)
 {
     int err;
     size_t returned_size;
     ComputeDeviceType = gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
 
-#if (USE_GL_ATTACHMENTS)
+#if (USE_GL_ATTACHMENTS)
+
+    printf(SEPARATOR);
+    printf("Using active OpenGL context...\n");
+
+    // Bind to platform
+    cl_platform_id platform_id;
+
+    cl_uint numPlatforms;
+    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
+    if (status != CL_SUCCESS)
+    {
+        printf("clGetPlatformIDs Failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (0 < numPlatforms)
+    {
+        cl_platform_id* platforms = calloc(numPlatforms, sizeof(cl_platform_id));
+
+        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+
+        char platformName[100];
+        for (unsigned i = 0; i < numPlatforms; ++i)
+        {
+            status = clGetPlatformInfo(platforms[i],
+                CL_PLATFORM_VENDOR,
+                sizeof(platformName),
+                platformName,
+                NULL);
+            platform_id = platforms[i];
+            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
+            {
+                break;
+            }
+        }
+        printf("Platform found : %s\n", platformName);
+        free(platforms);
+    }
+    if(NULL == platform_id)
+    {
+        printf("NULL platform found so Exiting Application.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Get ID for the device
+    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+    DeviceIds[0] = ComputeDeviceId;
+
+    if (FissionSpec)
+        err = PartitionDevice();
+    else if (MultiDevice)
+        err = GatherDevices(platform_id);
+    if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+    ListContextDevices();
+
+    // Create a context  
+    cl_context_properties properties[] =
+    {
+        CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
+        CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
+        CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_id),
+        0
+    };
+
+    // Create a context from a CGL share group
+    //
+    ComputeContext = clCreateContext(properties, ContextDeviceCount, ContextDeviceIds, NULL, 0, 0);
+    if (!ComputeContext)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+#else
+
+    // Bind to platform
+    cl_platform_id platform_id;
+
+    cl_uint numPlatforms;
+    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
+    if (status != CL_SUCCESS)
+    {
+        printf("clGetPlatformIDs Failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (0 < numPlatforms)
+    {
+        cl_platform_id* platforms = calloc(numPlatforms, sizeof(cl_platform_id));
+
+        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+
+        char platformName[100];
+        for (unsigned i = 0; i < numPlatforms; ++i)
+        {
+            status = clGetPlatformInfo(platforms[i],
+                CL_PLATFORM_VENDOR,
+                sizeof(platformName),
+                platformName,
+                NULL);
+            platform_id = platforms[i];
+            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
+            {
+                break;
+            }
+        }
+        printf("Platform found : %s\n", platformName);
+        free(platforms);
+    }
+    if(NULL == platform_id)
+    {
+        printf("NULL platform found so Exiting Application.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Get ID for the device
+    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+    DeviceIds[0] = ComputeDeviceId;
+
+    if (FissionSpec)
+        err = PartitionDevice();
+    else if (MultiDevice)
+        err = GatherDevices(platform_id);
+    if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+    ListContextDevices();
+
+    // Create a context containing the compute device(s)
+    //
+    ComputeContext = clCreateContext(0, ContextDeviceCount, ContextDeviceIds, NULL, NULL, &err);
+    if (!ComputeContext)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+#endif
+
+    unsigned int device_count;
+    cl_device_id device_ids[16];
+
+    err = clGetContextInfo(ComputeContext, CL_CONTEXT_DEVICES, sizeof(device_ids), device_ids, &returned_size);
+    if(err)
+    {
+        printf("Error: Failed to retrieve compute devices for context!\n");
+        return EXIT_FAILURE;
+    }
+
+    device_count = returned_size / sizeof(cl_device_id);
+
+    int i = 0;
+    int device_found = 0;
+    cl_device_type device_type; 
+    for(i = 0; i < device_count; i++) 
+    {
+        clGetDeviceInfo(device_ids[i], CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, NULL);
+        if(device_type == ComputeDeviceType) 
+        {
+            ComputeDeviceId = device_ids[i];
+            device_found = 1;
+            break;
+        }   
+    }
+
+    if(!device_found)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Create a command queue
+    //
+    cl_command_queue_properties queue_properties = (Progressive || Direct || Reproject || MultiDevice || Roofline) ? CL_QUEUE_PROFILING_ENABLE : 0;
+    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
+    if (!ComputeCommands)
+    {
+        printf("Error: Failed to create a command queue!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Report the device vendor and device name
+    // 
+    cl_char vendor_name[1024] = {0};
+    cl_char device_name[1024] = {0};
+    err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, &returned_size);
+    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, &returned_size);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve device info!\n");
+        return EXIT_FAILURE;
+    }
 
     printf(SEPARATOR);
-    printf("Using active OpenGL context...\n");
+    printf("Connecting to %s %s...\n", vendor_name, device_name);
 
-    // Bind to platform
-    cl_platform_id platform_id;
+    if (FirstPrivateDevice)
+        DeviceCommands[0] = ComputeCommands;
+    if (MultiDevice)
+        return CreateDeviceQueues();
 
-    cl_uint numPlatforms;
-    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
-    if (status != CL_SUCCESS)
+    return CL_SUCCESS;
+}
+
+static cl_program
+GetProgramVariant(int width, int height, int iterations, int shadows, const char *build_options)
+{
+    int err = 0;
+    int i = 0;
+    char *source = 0;
+    size_t length = 0;
+    char options[256];
+    cl_program program;
+
+    // Image size and iteration depth are compile time constants in the kernel, so each
+    // configuration gets its own program which is kept for the lifetime of the context.
+    // Extra build options are part of the configuration as well.
+    snprintf(options, sizeof(options), "-D WIDTH=%d -D HEIGHT=%d -D ITERATIONS=%d -D SHADOWS=%d -D TILE_SIZE=%d %s",
+        width, height, iterations, shadows, PERSISTENT_TILE_SIZE, build_options ? build_options : "");
+
+    for(i = 0; i < ProgramVariantCount; i++)
     {
-        printf("clGetPlatformIDs Failed\n");
-        return EXIT_FAILURE;
+        if(!strcmp(ProgramOptions[i], options))
+            return ProgramVariants[i];
     }
 
-    if (0 < numPlatforms)
+    printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);    
+    err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
+    if (!source || err)
     {
-        cl_platform_id* platforms = calloc(numPlatforms, sizeof(cl_platform_id));
+        printf("Error: Failed to load kernel source!\n");
+        return 0;
+    }
 
-        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+    // Create the compute program from the source buffer
+    //
+    program = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
+    free(source);
+    if (!program || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute program!\n");
+        return 0;
+    }
 
-        char platformName[100];
-        for (unsigned i = 0; i < numPlatforms; ++i)
+    // Build the program executable
+    //
+    printf("Building program with options '%s'...\n", options);
+    err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build program executable!\n");
+        clGetProgramBuildInfo(program, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    if(ProgramVariantCount == MAX_PROGRAM_VARIANTS)
+    {
+        // Evict the oldest variant which is not in use by the interactive kernel
+        i = (ProgramVariants[0] == ComputeProgram) ? 1 : 0;
+        clReleaseProgram(ProgramVariants[i]);
+        ProgramVariantCount--;
+        memmove(&ProgramVariants[i], &ProgramVariants[i + 1], (ProgramVariantCount - i) * sizeof(cl_program));
+        memmove(ProgramOptions[i], ProgramOptions[i + 1], (ProgramVariantCount - i) * sizeof(ProgramOptions[0]));
+    }
+
+    strcpy(ProgramOptions[ProgramVariantCount], options);
+    ProgramVariants[ProgramVariantCount] = program;
+    ProgramVariantCount++;
+
+    return program;
+}
+
+static void
+ReleaseProgramVariants(void)
+{
+    int i;
+    for(i = 0; i < ProgramVariantCount; i++)
+        clReleaseProgram(ProgramVariants[i]);
+    ProgramVariantCount = 0;
+}
+
+static int
+SetupProgressiveKernels(void)
+{
+    const char *names[] = { COARSE_KERNEL_METHOD_NAME, CLASSIFY_KERNEL_METHOD_NAME, REFINE_KERNEL_METHOD_NAME };
+    cl_kernel *kernels[] = { &CoarseKernel, &ClassifyKernel, &RefineKernel };
+    size_t max_size = 0;
+    int err = 0;
+    int i;
+
+    ResetKernelArgs();
+
+    for(i = 0; i < 3; i++)
+    {
+        if(*kernels[i])
+            clReleaseKernel(*kernels[i]);
+        *kernels[i] = 0;
+
+        printf("Creating kernel '%s'...\n", names[i]);
+        *kernels[i] = clCreateKernel(ComputeProgram, names[i], &err);
+        if (!*kernels[i] || err != CL_SUCCESS)
         {
-            status = clGetPlatformInfo(platforms[i],
-                CL_PLATFORM_VENDOR,
-                sizeof(platformName),
-                platformName,
-                NULL);
-            platform_id = platforms[i];
-            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
-            {
-                break;
-            }
+            printf("Error: Failed to create compute kernel!\n");
+            return EXIT_FAILURE;
         }
-        printf("Platform found : %s\n", platformName);
-        free(platforms);
+
+        // All passes share the work group size of the main kernel
+        err = clGetKernelWorkGroupInfo(*kernels[i], ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_size, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        if(max_size < MaxWorkGroupSize)
+            MaxWorkGroupSize = max_size;
     }
-    if(NULL == platform_id)
+
+    return CL_SUCCESS;
+}
+
+static int 
+SetupComputeKernel(void)
+{
+    int err = 0;
+
+    ResetKernelArgs();
+
+    if(ComputeKernel)
+        clReleaseKernel(ComputeKernel);    
+    ComputeKernel = 0;
+
+    // The kernel is built for the size of the texture it writes to
+    printf(SEPARATOR);
+    ComputeProgram = GetProgramVariant(TextureWidth, TextureHeight, Iterations, Shadows, BuildOptions);
+    if (!ComputeProgram)
+        return EXIT_FAILURE;
+
+    // Create the compute kernel from within the program
+    //
+    printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_METHOD_NAME);    
+    ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_METHOD_NAME, &err);
+    if (!ComputeKernel || err != CL_SUCCESS)
     {
-        printf("NULL platform found so Exiting Application.\n");
+        printf("Error: Failed to create compute kernel!\n");
         return EXIT_FAILURE;
     }
 
-    // Get ID for the device
-    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+    // Get the maximum work group size for executing the kernel on the device
+    //
+    err = clGetKernelWorkGroupInfo(ComputeKernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &MaxWorkGroupSize, NULL);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to locate compute device!\n");
-        return EXIT_FAILURE;
+        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+        exit(1);
     }
 
-    // Create a context  
-    cl_context_properties properties[] =
+    if(Progressive)
     {
-        CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
-        CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
-        CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_id),
-        0
-    };
+        err = SetupProgressiveKernels();
+        if (err != CL_SUCCESS)
+            return err;
+    }
 
-    // Create a context from a CGL share group
-    //
-    ComputeContext = clCreateContext(properties, 1, &ComputeDeviceId, NULL, 0, 0);
-    if (!ComputeContext)
+    if(Reproject)
     {
-        printf("Error: Failed to create a compute context!\n");
-        return EXIT_FAILURE;
+        if(ReprojectKernel)
+            clReleaseKernel(ReprojectKernel);
+
+        printf("Creating kernel '%s'...\n", REPROJECT_KERNEL_METHOD_NAME);
+        ReprojectKernel = clCreateKernel(ComputeProgram, REPROJECT_KERNEL_METHOD_NAME, &err);
+        if (!ReprojectKernel || err != CL_SUCCESS)
+        {
+            printf("Error: Failed to create compute kernel!\n");
+            return EXIT_FAILURE;
+        }
     }
 
-#else
+    if(Direct)
+    {
+        if(ImageKernel)
+            clReleaseKernel(ImageKernel);
 
-    // Bind to platform
-    cl_platform_id platform_id;
+        printf("Creating kernel '%s'...\n", IMAGE_KERNEL_METHOD_NAME);
+        ImageKernel = clCreateKernel(ComputeProgram, IMAGE_KERNEL_METHOD_NAME, &err);
+        if (!ImageKernel || err != CL_SUCCESS)
+        {
+            printf("Error: Failed to create compute kernel!\n");
+            return EXIT_FAILURE;
+        }
+    }
 
-    cl_uint numPlatforms;
-    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
-    if (status != CL_SUCCESS)
+    if(Persistent)
     {
-        printf("clGetPlatformIDs Failed\n");
-        return EXIT_FAILURE;
+        size_t max_size = 0;
+
+        if(PersistentKernel)
+            clReleaseKernel(PersistentKernel);
+
+        printf("Creating kernel '%s'...\n", PERSISTENT_KERNEL_METHOD_NAME);
+        PersistentKernel = clCreateKernel(ComputeProgram, PERSISTENT_KERNEL_METHOD_NAME, &err);
+        if (!PersistentKernel || err != CL_SUCCESS)
+        {
+            printf("Error: Failed to create compute kernel!\n");
+            return EXIT_FAILURE;
+        }
+
+        err = clGetKernelWorkGroupInfo(PersistentKernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_size, NULL);
+        err |= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &ComputeUnits, NULL);
+        if (err != CL_SUCCESS || max_size < PERSISTENT_TILE_SIZE * PERSISTENT_TILE_SIZE)
+        {
+            printf("Error: Persistent kernel needs %d work-items per group! %d\n", PERSISTENT_TILE_SIZE * PERSISTENT_TILE_SIZE, err);
+            return EXIT_FAILURE;
+        }
     }
 
-    if (0 < numPlatforms)
+#if (DEBUG_INFO)
+    printf("MaxWorkGroupSize: %d\n", MaxWorkGroupSize);
+    printf("WorkGroupItems: %d\n", WorkGroupItems);
+#endif
+
+    WorkGroupSize[0] = (MaxWorkGroupSize > 1) ? (MaxWorkGroupSize / WorkGroupItems) : MaxWorkGroupSize;
+    WorkGroupSize[1] = MaxWorkGroupSize / WorkGroupSize[0];
+
+    printf(SEPARATOR);
+
+    return CL_SUCCESS;
+
+}
+
+static int
+RunSweep(void)
+{
+    int err = 0;
+    int r, n, f;
+
+    printf(SEPARATOR);
+    printf("Sweeping resolution and iteration depth (%d frames each)...\n", BenchmarkFrames);
+    printf("%10s %10s %10s %12s %12s %12s\n", "Width", "Height", "Iterations", "Build (ms)", "Frame (ms)", "MPixels/s");
+
+    for(r = 0; r < sizeof(SweepSizes) / sizeof(SweepSizes[0]); r++)
     {
-        cl_platform_id* platforms = calloc(numPlatforms, sizeof(cl_platform_id));
+        for(n = 0; n < sizeof(SweepIterations) / sizeof(SweepIterations[0]); n++)
+        {
+            int width = SweepSizes[r];
+            int height = SweepSizes[r];
+            size_t max_size = 0;
+            size_t global[2];
+            size_t local[2];
+
+            long long build_start = GetCurrentTime();
+            cl_program program = GetProgramVariant(width, height, SweepIterations[n], Shadows, BuildOptions);
+            long long build_end = GetCurrentTime();
+            if (!program)
+                return EXIT_FAILURE;
+
+            cl_kernel kernel = clCreateKernel(program, COMPUTE_KERNEL_METHOD_NAME, &err);
+            if (!kernel || err != CL_SUCCESS)
+            {
+                printf("Error: Failed to create compute kernel!\n");
+                return EXIT_FAILURE;
+            }
 
-        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+            cl_mem result = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, TextureTypeSize * 4 * width * height, NULL, NULL);
+            if (!result)
+            {
+                printf("Failed to create OpenCL array!\n");
+                return EXIT_FAILURE;
+            }
 
-        char platformName[100];
-        for (unsigned i = 0; i < numPlatforms; ++i)
+            err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &result);
+            err |= clSetKernelArg(kernel, 1, 4 * sizeof(float), MuC);
+            err |= clSetKernelArg(kernel, 2, 4 * sizeof(float), ColorC);
+            err |= clSetKernelArg(kernel, 3, sizeof(float), &Epsilon);
+            err |= clGetKernelWorkGroupInfo(kernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_size, NULL);
+            if (err != CL_SUCCESS)
+            {
+                printf("Error: Failed to setup sweep kernel! %d\n", err);
+                return EXIT_FAILURE;
+            }
+
+            local[0] = (max_size > 1) ? (max_size / WorkGroupItems) : max_size;
+            local[1] = max_size / local[0];
+            global[0] = DivideUp(width, local[0]) * local[0];
+            global[1] = DivideUp(height, local[1]) * local[1];
+
+            // One untimed frame to page in the program and the buffer
+            err = clEnqueueNDRangeKernel(ComputeCommands, kernel, 2, NULL, global, local, 0, NULL, NULL);
+            clFinish(ComputeCommands);
+
+            long long start = GetCurrentTime();
+            for(f = 0; f < BenchmarkFrames && err == CL_SUCCESS; f++)
+                err = clEnqueueNDRangeKernel(ComputeCommands, kernel, 2, NULL, global, local, 0, NULL, NULL);
+            clFinish(ComputeCommands);
+            long long end = GetCurrentTime();
+
+            clReleaseKernel(kernel);
+            clReleaseMemObject(result);
+
+            if (err)
+            {
+                printf("Failed to enqueue kernel! %d\n", err);
+                return err;
+            }
+
+            double ms = SubtractTime(end, start) / (double)BenchmarkFrames;
+            double mpixels = (ms > 0) ? (width * height / (ms * 1000.0)) : 0;
+            printf("%10d %10d %10d %12lld %12.3f %12.2f\n", width, height, SweepIterations[n], build_end - build_start, ms, mpixels);
+            if (fp)
+                fprintf(fp, "%d %d %d %lld %.3f %.2f\n", width, height, SweepIterations[n], build_end - build_start, ms, mpixels);
+        }
+    }
+
+    printf(SEPARATOR);
+    return CL_SUCCESS;
+}
+
+// Builds QJuliaKernel with each option set and renders the current view into a private
+// buffer, timing the kernel and comparing the pixels to the default build
+static int
+CompareBuildOptions(void)
+{
+    int err = CL_SUCCESS;
+    int count = 0;
+    int s, f;
+    const char *options[MAX_BUILD_OPTION_SETS];
+    double ms[MAX_BUILD_OPTION_SETS];
+    int max_diff[MAX_BUILD_OPTION_SETS];
+    double differing[MAX_BUILD_OPTION_SETS];
+    int built[MAX_BUILD_OPTION_SETS];
+
+    // The first set builds the reference, a -buildopts set is tried last
+    for(s = 0; s < (int)(sizeof(BuildOptionSets) / sizeof(BuildOptionSets[0])); s++)
+        options[count++] = BuildOptionSets[s];
+    if(BuildOptions)
+        options[count++] = BuildOptions;
+
+    size_t pixels = TextureWidth * TextureHeight;
+    size_t bytes = TextureTypeSize * 4 * pixels;
+    unsigned char *reference = (unsigned char *)malloc(bytes);
+    unsigned char *result = (unsigned char *)malloc(bytes);
+    cl_command_queue queue = clCreateCommandQueue(ComputeContext, ComputeDeviceId, CL_QUEUE_PROFILING_ENABLE, &err);
+    cl_mem buffer = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, bytes, NULL, NULL);
+    if (!reference || !result || !queue || !buffer)
+    {
+        printf("Failed to create build sweep resources!\n");
+        err = EXIT_FAILURE;
+        count = 0;
+    }
+
+    for(s = 0; s < count && err == CL_SUCCESS; s++)
+    {
+        size_t max_size = 0;
+        size_t global[2];
+        size_t local[2];
+        size_t i;
+
+        // Programs stay in the variant cache, only the kernel is released here
+        cl_program program = GetProgramVariant(TextureWidth, TextureHeight, Iterations, Shadows, options[s]);
+        cl_kernel kernel = program ? clCreateKernel(program, COMPUTE_KERNEL_METHOD_NAME, NULL) : 0;
+
+        // Other sets may be rejected by the compiler, but the reference has to build
+        built[s] = (kernel != 0);
+        max_diff[s] = 0;
+        differing[s] = 0;
+        if (!kernel)
         {
-            status = clGetPlatformInfo(platforms[i],
-                CL_PLATFORM_VENDOR,
-                sizeof(platformName),
-                platformName,
-                NULL);
-            platform_id = platforms[i];
-            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
+            err = s ? CL_SUCCESS : EXIT_FAILURE;
+            continue;
+        }
+
+        // A transient kernel, so the arguments bypass the cache
+        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer);
+        err |= clSetKernelArg(kernel, 1, 4 * sizeof(float), MuC);
+        err |= clSetKernelArg(kernel, 2, 4 * sizeof(float), ColorC);
+        err |= clSetKernelArg(kernel, 3, sizeof(float), &Epsilon);
+        err |= clGetKernelWorkGroupInfo(kernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_size, NULL);
+
+        local[0] = (max_size > 1) ? (max_size / WorkGroupItems) : max_size;
+        local[1] = max_size / local[0];
+        global[0] = DivideUp(TextureWidth, local[0]) * local[0];
+        global[1] = DivideUp(TextureHeight, local[1]) * local[1];
+
+        // One untimed launch, then the kernel time of each launch from its profiling event
+        ms[s] = 0;
+        for(f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+        {
+            cl_event event;
+            err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, NULL, &event);
+            if (err == CL_SUCCESS)
+            {
+                clWaitForEvents(1, &event);
+                ms[s] += f ? GetEventTime(event) / BenchmarkFrames : 0;
+                if (!f)
+                    clReleaseEvent(event);
+            }
+        }
+
+        err |= clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, bytes, s ? result : reference, 0, NULL, NULL);
+        clReleaseKernel(kernel);
+
+        // Largest channel difference and the share of pixels that changed at all
+        for(i = 0; s && err == CL_SUCCESS && i < pixels; i++)
+        {
+            int c, changed = 0;
+            for(c = 0; c < 4; c++)
             {
-                break;
+                int diff = abs((int)result[4 * i + c] - (int)reference[4 * i + c]);
+                max_diff[s] = (diff > max_diff[s]) ? diff : max_diff[s];
+                changed |= diff;
             }
+            differing[s] += changed ? 100.0 / pixels : 0;
         }
-        printf("Platform found : %s\n", platformName);
-        free(platforms);
-    }
-    if(NULL == platform_id)
-    {
-        printf("NULL platform found so Exiting Application.\n");
-        return EXIT_FAILURE;
     }
 
-    // Get ID for the device
-    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
     if (err != CL_SUCCESS)
+        printf("Failed to run build option sweep! %d\n", err);
+    else
     {
-        printf("Error: Failed to locate compute device!\n");
-        return EXIT_FAILURE;
+        printf(SEPARATOR);
+        printf("Build option sweep (%d frames each, %d x %d, differences to the default build)\n", BenchmarkFrames,
+            TextureWidth, TextureHeight);
+        for(s = 0; s < count; s++)
+        {
+            const char *label = options[s][0] ? options[s] : "(default)";
+            if (!built[s])
+                printf("  %-32s failed to build\n", label);
+            else
+                printf("  %-32s %8.3f ms %5.2fx  max diff %3d  pixels differing %6.2f%%\n", label, ms[s],
+                    (ms[s] > 0) ? ms[0] / ms[s] : 0.0, max_diff[s], differing[s]);
+            if (fp && built[s])
+                fprintf(fp, "BuildOptions '%s' %.3f ms MaxDiff %d Differing %.2f%%\n", options[s], ms[s], max_diff[s], differing[s]);
+        }
+        printf(SEPARATOR);
     }
 
-    // Create a context containing the compute device(s)
-    //
-    ComputeContext = clCreateContext(0, 1, &ComputeDeviceId, NULL, NULL, &err);
-    if (!ComputeContext)
-    {
-        printf("Error: Failed to create a compute context!\n");
-        return EXIT_FAILURE;
-    }
+    if (buffer)
+        clReleaseMemObject(buffer);
+    if (queue)
+        clReleaseCommandQueue(queue);
+    free(reference);
+    free(result);
 
-#endif
+    return err;
+}
 
-    unsigned int device_count;
-    cl_device_id device_ids[16];
+static int
+CompareSchedules(void)
+{
+    int err = 0;
+    int f, i;
+    size_t global[2];
+    size_t local[2];
+    long long start, end;
+    uint histogram[COST_HISTOGRAM_BINS] = { 0 };
 
-    err = clGetContextInfo(ComputeContext, CL_CONTEXT_DEVICES, sizeof(device_ids), device_ids, &returned_size);
-    if(err)
+    int tiles = DivideUp(TextureWidth, PERSISTENT_TILE_SIZE) * DivideUp(TextureHeight, PERSISTENT_TILE_SIZE);
+
+    err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(ComputeKernel, 1, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(ComputeKernel, 2, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(ComputeKernel, 3, sizeof(float), &Epsilon);
+    err |= SetPersistentKernelArgs();
+    if (err)
+        return -10;
+
+    local[0] = WorkGroupSize[0];
+    local[1] = WorkGroupSize[1];
+    global[0] = DivideUp(TextureWidth, local[0]) * local[0];
+    global[1] = DivideUp(TextureHeight, local[1]) * local[1];
+
+    // Static grid, one untimed frame first
+    err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, NULL);
+    clFinish(ComputeCommands);
+    start = GetCurrentTime();
+    for(f = 0; f < BenchmarkFrames && err == CL_SUCCESS; f++)
+        err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, NULL);
+    clFinish(ComputeCommands);
+    end = GetCurrentTime();
+    double static_ms = SubtractTime(end, start) / (double)BenchmarkFrames;
+
+    // Persistent threads
+    err |= EnqueuePersistent();
+    clFinish(ComputeCommands);
+    start = GetCurrentTime();
+    for(f = 0; f < BenchmarkFrames && err == CL_SUCCESS; f++)
+        err = EnqueuePersistent();
+    clFinish(ComputeCommands);
+    end = GetCurrentTime();
+    double persistent_ms = SubtractTime(end, start) / (double)BenchmarkFrames;
+
+    if (err)
     {
-        printf("Error: Failed to retrieve compute devices for context!\n");
-        return EXIT_FAILURE;
+        printf("Failed to enqueue kernel! %d\n", err);
+        return err;
     }
 
-    device_count = returned_size / sizeof(cl_device_id);
+    // Histogram of the march steps per tile in the last frame, in power of two bins
+    cl_uint *cost = (cl_uint *)malloc(tiles * sizeof(cl_uint));
+    err = clEnqueueReadBuffer(ComputeCommands, ComputeTileCost, CL_TRUE, 0, tiles * sizeof(cl_uint), cost, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Failed to read tile cost! %d\n", err);
+        free(cost);
+        return err;
+    }
 
-    int i = 0;
-    int device_found = 0;
-    cl_device_type device_type; 
-    for(i = 0; i < device_count; i++) 
+    cl_uint min_cost = cost[0];
+    cl_uint max_cost = cost[0];
+    double total_cost = 0;
+    for(i = 0; i < tiles; i++)
     {
-        clGetDeviceInfo(device_ids[i], CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, NULL);
-        if(device_type == ComputeDeviceType) 
-        {
-            ComputeDeviceId = device_ids[i];
-            device_found = 1;
-            break;
-        }   
+        int bin = 0;
+        while((cost[i] >> bin) > 1 && bin < COST_HISTOGRAM_BINS - 1)
+            bin++;
+        histogram[bin]++;
+        min_cost = (cost[i] < min_cost) ? cost[i] : min_cost;
+        max_cost = (cost[i] > max_cost) ? cost[i] : max_cost;
+        total_cost += cost[i];
     }
+    free(cost);
 
-    if(!device_found)
+    printf(SEPARATOR);
+    printf("Schedule comparison (%d frames, %d x %d, %d tiles of %d x %d)\n", BenchmarkFrames,
+        TextureWidth, TextureHeight, tiles, PERSISTENT_TILE_SIZE, PERSISTENT_TILE_SIZE);
+    printf("  Static grid:      %8.3f ms\n", static_ms);
+    printf("  Persistent:       %8.3f ms (%d groups, %.2fx)\n", persistent_ms,
+        ComputeUnits * PersistentGroupsPerUnit, (persistent_ms > 0) ? static_ms / persistent_ms : 0);
+    printf("March steps per tile: min %u  mean %.1f  max %u\n", min_cost, total_cost / tiles, max_cost);
+    for(i = 0; i < COST_HISTOGRAM_BINS; i++)
     {
-        printf("Error: Failed to locate compute device!\n");
-        return EXIT_FAILURE;
+        if(histogram[i])
+            printf("  [%8u - %8u] %6u tiles (%5.1f%%)\n", (i ? 1u << i : 0), (2u << i) - 1, histogram[i], 100.0 * histogram[i] / tiles);
     }
+    printf(SEPARATOR);
 
-    // Create a command queue
-    //
-    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
-    if (!ComputeCommands)
+    if (fp)
     {
-        printf("Error: Failed to create a command queue!\n");
-        return EXIT_FAILURE;
+        fprintf(fp, "Static %.3f ms Persistent %.3f ms\n", static_ms, persistent_ms);
+        for(i = 0; i < COST_HISTOGRAM_BINS; i++)
+            fprintf(fp, "%u %u\n", (i ? 1u << i : 0), histogram[i]);
     }
 
-    // Report the device vendor and device name
-    // 
-    cl_char vendor_name[1024] = {0};
-    cl_char device_name[1024] = {0};
-    err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, &returned_size);
-    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, &returned_size);
-    if (err != CL_SUCCESS)
+    Update = 1;
+    return CL_SUCCESS;
+}
+
+static int
+CompareImageWrites(void)
+{
+    int err = 0;
+    int f;
+    size_t global[2];
+    size_t local[2];
+    cl_event kernel_event;
+    cl_event copy_event;
+    double buffer_kernel = 0;
+    double buffer_copy = 0;
+    double direct_kernel = 0;
+    double direct_copy = 0;
+
+    err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(ComputeKernel, 1, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(ComputeKernel, 2, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(ComputeKernel, 3, sizeof(float), &Epsilon);
+    err |= SetDirectKernelArgs();
+    if (err)
+        return -10;
+
+    local[0] = WorkGroupSize[0];
+    local[1] = WorkGroupSize[1];
+    global[0] = DivideUp(TextureWidth, local[0]) * local[0];
+    global[1] = DivideUp(TextureHeight, local[1]) * local[1];
+
+    for(f = 0; f < BenchmarkFrames; f++)
     {
-        printf("Error: Failed to retrieve device info!\n");
-        return EXIT_FAILURE;
+        // Kernel into the result buffer, then the copy Recompute does every frame
+        err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, &kernel_event);
+        if (err)
+        {
+            printf("Failed to enqueue kernel! %d\n", err);
+            return err;
+        }
+
+        err = EnqueueResultCopy(&copy_event);
+        if (err)
+            return err;
+
+        clFinish(ComputeCommands);
+        buffer_kernel += GetEventTime(kernel_event);
+        buffer_copy += GetEventTime(copy_event);
+
+        // Kernel writing the image directly
+        err = EnqueueDirect(global, local, &kernel_event, &copy_event);
+        if (err)
+            return err;
+
+        clFinish(ComputeCommands);
+        direct_kernel += GetEventTime(kernel_event);
+        if (copy_event)
+            direct_copy += GetEventTime(copy_event);
     }
 
+    buffer_kernel /= BenchmarkFrames;
+    buffer_copy /= BenchmarkFrames;
+    direct_kernel /= BenchmarkFrames;
+    direct_copy /= BenchmarkFrames;
+
     printf(SEPARATOR);
-    printf("Connecting to %s %s...\n", vendor_name, device_name);
+    printf("Image write comparison (%d frames, %d x %d, %s)\n", BenchmarkFrames, TextureWidth, TextureHeight,
+        USE_GL_ATTACHMENTS ? "attached" : "copying");
+    printf("  Buffer + copy:    kernel %8.3f ms  copy %8.3f ms\n", buffer_kernel, buffer_copy);
+    printf("  Direct image:     kernel %8.3f ms  copy %8.3f ms\n", direct_kernel, direct_copy);
+    printf("  Saved per frame:  %8.3f ms\n", (buffer_kernel + buffer_copy) - (direct_kernel + direct_copy));
+    printf(SEPARATOR);
+
+    if (fp)
+        fprintf(fp, "Buffer %.3f + %.3f ms Direct %.3f + %.3f ms\n", buffer_kernel, buffer_copy, direct_kernel, direct_copy);
 
+    Update = 1;
     return CL_SUCCESS;
 }
 
-static int 
-SetupComputeKernel(void)
+static int
+CompareDevices(void)
 {
     int err = 0;
-    char *source = 0;
-    size_t length = 0;
+    int f;
+    cl_uint i, d;
+    size_t global[2];
+    size_t local[2];
+    double single[MAX_DEVICES];
+    double single_rate = 0;
+    double best = 0;
+    double multi;
+    double monolithic = 0;
+    float shares[MAX_DEVICES];
+
+    err = SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputeResult);
+    err |= SetKernelArg(ComputeKernel, 1, 4 * sizeof(float), MuC);
+    err |= SetKernelArg(ComputeKernel, 2, 4 * sizeof(float), ColorC);
+    err |= SetKernelArg(ComputeKernel, 3, sizeof(float), &Epsilon);
+    if (err)
+        return -10;
 
-    if(ComputeKernel)
-        clReleaseKernel(ComputeKernel);    
-    ComputeKernel = 0;
+    local[0] = WorkGroupSize[0];
+    local[1] = WorkGroupSize[1];
+    global[0] = DivideUp(TextureWidth, local[0]) * local[0];
+    global[1] = DivideUp(TextureHeight, local[1]) * local[1];
 
-    if(ComputeProgram)
-        clReleaseProgram(ComputeProgram);
-    ComputeProgram = 0;
+    memcpy(shares, DeviceShare, sizeof(shares));
 
-    printf(SEPARATOR);
-    printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);    
-    err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
-    if (!source || err)
+    // Each device on its own with the whole frame
+    for(d = 0; d < DeviceCount; d++)
     {
-        printf("Error: Failed to load kernel source!\n");
-        return EXIT_FAILURE;
-    }
+        for(i = 0; i < DeviceCount; i++)
+            DeviceShare[i] = (i == d) ? 1.0f : 0.0f;
 
-    const char* width_macro = "#define WIDTH";
-    const char* height_macro = "#define HEIGHT";
-
-    char* preprocess = malloc(strlen(source) + 1024);
-    sprintf(preprocess, "\n%s (%d)\n%s (%d)\n%s", width_macro, Width, height_macro, Height, source); 
-#if (DEBUG_INFO)
-    printf("%s", preprocess);
-#endif
+        long long start = GetCurrentTime();
+        for(f = 0; f < BenchmarkFrames && !err; f++)
+            err = EnqueueMultiDevice(global, local);
+        clFinish(ComputeCommands);
+        if (err)
+            return err;
 
-    // Create the compute program from the source buffer
-    //
-    ComputeProgram = clCreateProgramWithSource(ComputeContext, 1, (const char **) & preprocess, NULL, &err);
-    if (!ComputeProgram || err != CL_SUCCESS)
-    {
-        printf("Error: Failed to create compute program!\n");
-        return EXIT_FAILURE;
+        single[d] = (double)SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+        single_rate += 1.0 / single[d];
+        if (!best || single[d] < best)
+            best = single[d];
     }
-    free(source);
-    free(preprocess);
 
-    // Build the program executable
-    //
-    err = clBuildProgram(ComputeProgram, 0, NULL, NULL, NULL, NULL);
-    if (err != CL_SUCCESS)
-    {
-        size_t len;
-        char buffer[2048];
+    // All devices together, letting the balancer settle first when enabled
+    memcpy(DeviceShare, shares, sizeof(shares));
+    for(f = 0; f < (Balance ? BenchmarkFrames : 1) && !err; f++)
+        err = EnqueueMultiDevice(global, local);
+    clFinish(ComputeCommands);
 
-        printf("Error: Failed to build program executable!\n");
-        clGetProgramBuildInfo(ComputeProgram, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-        printf("%s\n", buffer);
-        return EXIT_FAILURE;
-    }
+    long long start = GetCurrentTime();
+    for(f = 0; f < BenchmarkFrames && !err; f++)
+        err = EnqueueMultiDevice(global, local);
+    clFinish(ComputeCommands);
+    if (err)
+        return err;
 
-    // Create the compute kernel from within the program
-    //
-    printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_METHOD_NAME);    
-    ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_METHOD_NAME, &err);
-    if (!ComputeKernel || err != CL_SUCCESS)
+    multi = (double)SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+
+    // With fission the root device shares the context, time it on the whole problem
+    if (!FirstPrivateDevice)
     {
-        printf("Error: Failed to create compute kernel!\n");
-        return EXIT_FAILURE;
+        start = GetCurrentTime();
+        for(f = 0; f < BenchmarkFrames && !err; f++)
+            err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, NULL);
+        clFinish(ComputeCommands);
+        if (err)
+            return err;
+
+        monolithic = (double)SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
     }
 
-    // Get the maximum work group size for executing the kernel on the device
-    //
-    err = clGetKernelWorkGroupInfo(ComputeKernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &MaxWorkGroupSize, NULL);
-    if (err != CL_SUCCESS)
+    printf(SEPARATOR);
+    printf("Multi-device scaling (%d frames, %d x %d, %s)\n", BenchmarkFrames, TextureWidth, TextureHeight,
+        Balance ? "balanced" : "equal split");
+    for(d = 0; d < DeviceCount; d++)
     {
-        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-        exit(1);
+        cl_char device_name[1024] = {0};
+        clGetDeviceInfo(DeviceIds[d], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+        printf("  Device %2d: %8.3f ms  share %5.1f%%  %s\n", d, single[d], 100.0f * DeviceShare[d], device_name);
     }
+    printf("  All devices: %8.3f ms  speedup %5.2fx  efficiency %5.1f%%\n",
+        multi, best / multi, 100.0 * (1.0 / multi) / single_rate);
+    if (!FirstPrivateDevice)
+        printf("  Monolithic:  %8.3f ms  partitions %5.2fx\n", monolithic, monolithic / multi);
+    printf(SEPARATOR);
 
-#if (DEBUG_INFO)
-    printf("MaxWorkGroupSize: %d\n", MaxWorkGroupSize);
-    printf("WorkGroupItems: %d\n", WorkGroupItems);
-#endif
-
-    WorkGroupSize[0] = (MaxWorkGroupSize > 1) ? (MaxWorkGroupSize / WorkGroupItems) : MaxWorkGroupSize;
-    WorkGroupSize[1] = MaxWorkGroupSize / WorkGroupSize[0];
+    if (fp)
+        fprintf(fp, "Devices %d Best %.3f ms All %.3f ms Efficiency %.1f%%\n", DeviceCount, best, multi,
+            100.0 * (1.0 / multi) / single_rate);
+    if (fp && !FirstPrivateDevice)
+        fprintf(fp, "Monolithic %.3f ms\n", monolithic);
 
-    printf(SEPARATOR);
+    for(d = 0; d < DeviceCount; d++)
+        DeviceTime[d] = 0;
+    MultiDeviceCount = 0;
 
+    Update = 1;
     return CL_SUCCESS;
-
 }
 
 static void
 Cleanup(void)
 {
     clFinish(ComputeCommands);
+    if (RooflineEvent)
+        clReleaseEvent(RooflineEvent);
+    RooflineEvent = 0;
+    ResetKernelArgs();
     clReleaseKernel(ComputeKernel);
-    clReleaseProgram(ComputeProgram);
+    ReleaseProgramVariants();
     clReleaseCommandQueue(ComputeCommands);
     clReleaseMemObject(ComputeResult);
     clReleaseMemObject(ComputeImage);
+    if(Direct)
+        clReleaseKernel(ImageKernel);
+    if(Reproject)
+    {
+        clReleaseKernel(ReprojectKernel);
+        clReleaseMemObject(ComputeDepth);
+        clReleaseMemObject(ComputeReference);
+    }
+    if(MultiDevice)
+    {
+        cl_uint i;
+        for(i = FirstPrivateDevice; i < DeviceCount; i++)
+        {
+            clFinish(DeviceCommands[i]);
+            clReleaseCommandQueue(DeviceCommands[i]);
+            if(DeviceResult[i])
+                clReleaseMemObject(DeviceResult[i]);
+            DeviceCommands[i] = 0;
+            DeviceResult[i] = 0;
+        }
+        if (!FirstPrivateDevice)
+        {
+            for(i = 0; i < DeviceCount; i++)
+                clReleaseDevice(DeviceIds[i]);
+        }
+    }
+    if(Persistent)
+    {
+        clReleaseKernel(PersistentKernel);
+        clReleaseMemObject(ComputeTileCounter);
+        clReleaseMemObject(ComputeTileCost);
+    }
+    if(Progressive)
+    {
+        clReleaseKernel(CoarseKernel);
+        clReleaseKernel(ClassifyKernel);
+        clReleaseKernel(RefineKernel);
+        clReleaseMemObject(ComputeWorkList);
+        clReleaseMemObject(ComputeWorkCount);
+    }
     clReleaseContext(ComputeContext);
 
     ComputeCommands = 0;
@@ -901,6 +2594,18 @@ Cleanup(void)
     ComputeProgram = 0;    
     ComputeResult = 0;
     ComputeImage = 0;
+    CoarseKernel = 0;
+    ClassifyKernel = 0;
+    RefineKernel = 0;
+    ComputeWorkList = 0;
+    ComputeWorkCount = 0;
+    ImageKernel = 0;
+    ReprojectKernel = 0;
+    ComputeDepth = 0;
+    ComputeReference = 0;
+    PersistentKernel = 0;
+    ComputeTileCounter = 0;
+    ComputeTileCost = 0;
     ComputeContext = 0;
 }
 
@@ -1029,24 +2734,87 @@ ReportInfo(void)
 
 static void 
 ReportStats(
-    uint64_t uiStartTime, uint64_t uiEndTime)
+    double fStartTime, double fEndTime)
 {
-    TimeElapsed += SubtractTime(uiEndTime, uiStartTime);
+    double frame_ms = fEndTime - fStartTime;
+    int measured = MeasureFrame(&Frames, frame_ms);
+
+    TimeElapsed += frame_ms;
 
-    if(TimeElapsed && FrameCount && FrameCount > ReportStatsInterval) 
+    // Frames the policy drops still go through the report to reset the per-frame
+    // counters, they are just not shown
+    if(TimeElapsed && FrameCount && (!measured || (FrameCount > ReportStatsInterval && TimeElapsed >= MinRunTime)))
     {
         double fMs = (TimeElapsed / (double) FrameCount);
+        double fMean = fMs;
+        double fMad = 0;
+        double fLow = fMs;
+        double fHigh = fMs;
+        if (measured)
+            RobustStats(&Frames, &fMs, &fMad, &fLow, &fHigh);
         double fFps = 1.0 / (fMs / 1000.0);
 
         sprintf(StatsString, "[%s] Compute: %3.2f ms  Display: %3.2f fps (%s)\n", 
             (ComputeDeviceType == CL_DEVICE_TYPE_GPU) ? "GPU" : "CPU", 
             fMs, fFps, USE_GL_ATTACHMENTS ? "attached" : "copying");
+        sprintf(StatsString + strlen(StatsString) - 1, "  Mean: %3.2f ms  MAD: %3.2f ms  95%% CI: %3.2f-%3.2f ms\n",
+            fMean, fMad, fLow, fHigh);
+        if (Frames.count > MAX_WINDOW_FRAMES)
+            sprintf(StatsString + strlen(StatsString) - 1, "  Window: latest %d of %d frames\n",
+                MAX_WINDOW_FRAMES, Frames.count);
+
+        if(Progressive && ProgressiveCount)
+        {
+            sprintf(StatsString + strlen(StatsString) - 1, "  First: %3.2f ms  Converged: %3.2f ms  Refined: %3.1f%%\n",
+                FirstImageTime / ProgressiveCount, ConvergedTime / ProgressiveCount,
+                100.0 * RefinedFraction / ProgressiveCount);
+            FirstImageTime = 0;
+            ConvergedTime = 0;
+            RefinedFraction = 0;
+            ProgressiveCount = 0;
+        }
+
+        if(Reproject && ReprojectCount)
+        {
+            sprintf(StatsString + strlen(StatsString) - 1, "  Reproject: %3.2f ms (%3.2fx)  Error: %3.2f (%3.1f dB)\n",
+                ReprojectTime / ReprojectCount, ReprojectSpeedup, ReprojectError, ReprojectPSNR);
+            ReprojectTime = 0;
+            ReprojectCount = 0;
+        }
+
+        if(MultiDevice && MultiDeviceCount)
+        {
+            cl_uint d;
+            for(d = 0; d < DeviceCount && strlen(StatsString) < sizeof(StatsString) - 32; d++)
+            {
+                sprintf(StatsString + strlen(StatsString) - 1, "  [%d] %3.2f ms %3.0f%%\n",
+                    d, DeviceTime[d] / MultiDeviceCount, 100.0f * DeviceShare[d]);
+                DeviceTime[d] = 0;
+            }
+            MultiDeviceCount = 0;
+        }
         
-        glutSetWindowTitle(StatsString);
-        if (fp)
-            fprintf(fp, "%s\n", StatsString);
+        if(HostLaunches)
+        {
+            sprintf(StatsString + strlen(StatsString) - 1, "  Host: %3.1f us/frame (%2.1f%%) over %d frames %d args set %d cached %d launches\n",
+                HostSubmitFrames ? 1000.0 * HostSubmitTime / HostSubmitFrames : 0.0, 100.0 * HostSubmitTime / TimeElapsed,
+                HostSubmitFrames, HostArgSets, HostArgSkips, HostLaunches);
+            HostSubmitTime = 0;
+            HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+        }
+
+        if(Roofline)
+            ReportRoofline();
+
+        if(measured)
+        {
+            glutSetWindowTitle(StatsString);
+            if (fp)
+                fprintf(fp, "%s\n", StatsString);
+        }
         FrameCount = 0;
         TimeElapsed = 0;
+        Frames.count = 0;
     }    
 }
 
@@ -1055,7 +2823,7 @@ Display_(void)
 {
     FrameCount++;
     ExecutionCount++;
-    uint64_t uiStartTime = GetCurrentTime();
+    double fStartTime = GetPreciseTime();
 
     glClearColor (0.0, 0.0, 0.0, 0.0);
     glClear (GL_COLOR_BUFFER_BIT);
@@ -1087,8 +2855,8 @@ Display_(void)
 
     glFinish(); // for timing
     
-    uint64_t uiEndTime = GetCurrentTime();
-    ReportStats(uiStartTime, uiEndTime);
+    double fEndTime = GetPreciseTime();
+    ReportStats(fStartTime, fEndTime);
     DrawText(TextOffset[0], TextOffset[1], 1, (Animated == 0) ? "Press space to animate" : " ");
     glutSwapBuffers();
 }
@@ -1192,6 +2960,16 @@ void Keyboard( unsigned char key, int x, int y )
         glutFullScreen(); 
         break;
 
+        case '[':
+        case ']':
+        Iterations = (key == ']') ? Iterations + 1 : Iterations - 1;
+        Iterations = (Iterations < 1) ? 1 : Iterations;
+        sprintf(InfoString, "Iterations = %d\n", Iterations);
+        ShowInfo = 1;
+        if(SetupComputeKernel() != CL_SUCCESS)
+            Shutdown();
+        break;
+
     }
     Update = 1;
     glutPostRedisplay();
@@ -1231,12 +3009,81 @@ int main(int argc, char** argv)
         else if(strstr(argv[i], "-maxframe"))
             MaxNDRange = atoi(argv[i+1]);
 
+        else if(strstr(argv[i], "-buildopts"))
+            BuildOptions = argv[i+1];
+
+        else if(strstr(argv[i], "-buildsweep"))
+            BuildSweep = 1;
+
+        else if(strstr(argv[i], "-discard"))
+            Frames.warmup_frames = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-steadycv"))
+            Frames.steady_cv = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-mintime"))
+            MinRunTime = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-roofline"))
+            Roofline = 1;
+
+        else if(strstr(argv[i], "-peakgflops"))
+        {
+            Roofline = 1;
+            Rooflines.peak_gflops = atof(argv[i+1]);
+        }
+
+        else if(strstr(argv[i], "-peakbw"))
+        {
+            Roofline = 1;
+            Rooflines.peak_bandwidth = atof(argv[i+1]);
+        }
+
         else if(strstr(argv[i], "-stride"))
         {
             ExecuteStride = atoi(argv[i+1]);
             if (ExecuteStride > 0 )
                 EnableStideExec = 1;
         }
+
+        else if(strstr(argv[i], "-progressive"))
+            Progressive = 1;
+
+        else if(strstr(argv[i], "-coarse"))
+            ProgressiveStep = (atoi(argv[i+1]) > 1) ? atoi(argv[i+1]) : 1;
+
+        else if(strstr(argv[i], "-threshold"))
+            RefineThreshold = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-iterations"))
+            Iterations = (atoi(argv[i+1]) > 1) ? atoi(argv[i+1]) : 1;
+
+        else if(strstr(argv[i], "-shadows"))
+            Shadows = 1;
+
+        else if(strstr(argv[i], "-sweep"))
+            Sweep = 1;
+
+        else if(strstr(argv[i], "-persistent"))
+            Persistent = 1;
+
+        else if(strstr(argv[i], "-direct"))
+            Direct = 1;
+
+        else if(strstr(argv[i], "-reproject"))
+            Reproject = 1;
+
+        else if(strstr(argv[i], "-backoff"))
+            ReprojectBackoff = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-multi"))
+            MultiDevice = 1;
+
+        else if(strstr(argv[i], "-balance"))
+            Balance = 1;
+
+        else if(strstr(argv[i], "-fission"))
+            FissionSpec = argv[i+1];
     }
 
     glutInit(&argc, argv);
@@ -1246,11 +3093,36 @@ int main(int argc, char** argv)
     glutCreateWindow (argv[0]);
     if (Initialize (use_gpu) == GL_NO_ERROR)
     {
+        if (Sweep)
+        {
+            RunSweep();
+            Shutdown();
+        }
+
+        if (Persistent && CompareSchedules() != CL_SUCCESS)
+            Shutdown();
+
+        if (Direct && CompareImageWrites() != CL_SUCCESS)
+            Shutdown();
+
+        if (MultiDevice && CompareDevices() != CL_SUCCESS)
+            Shutdown();
+
+        if (BuildSweep && CompareBuildOptions() != CL_SUCCESS)
+            Shutdown();
+
+        if (Roofline)
+            ShowRooflineModel(&Rooflines, KernelFlops(), KernelBytes());
+
         glutDisplayFunc(Display_);
         glutIdleFunc(Idle);
         glutReshapeFunc(Reshape);
         glutKeyboardFunc(Keyboard);
 
+        // Startup comparisons do not count towards the per-frame host overhead
+        HostSubmitTime = 0;
+        HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+
         atexit(Shutdown);
         printf("Starting event loop...\n");
 
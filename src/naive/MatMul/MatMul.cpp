@@ -24,6 +24,8 @@
 #include <CL/cl.h>
 #include <CL/cl_gl.h>
 
+#include "MeasureUtil.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 
 #define USE_GL_ATTACHMENTS              (0)  // enable OpenGL attachments for Compute results
@@ -31,15 +33,46 @@
 #define COMPUTE_KERNEL_FILENAME         ("MatrixMultiplication_Kernels.cl")
 #define COMPUTE_KERNEL_MATMUL_NAME      ("mmmKernel")
 #define COMPUTE_KERNEL_MATMUL_LDS_NAME  ("mmmKernel_local")
+#define COMPUTE_KERNEL_IMAGE_NAME       ("mmmKernel_image")
+#define COMPUTE_KERNEL_LDS_IMAGE_NAME   ("mmmKernel_local_image")
+#define COMPUTE_KERNEL_TILED_NAME       ("mmmKernel_tiled")
+#define COMPUTE_KERNEL_TILED_IMAGE_NAME ("mmmKernel_tiled_image")
+#define COMPUTE_KERNEL_BATCHED_NAME     ("mmmKernel_batched")
+#define COMPUTE_KERNEL_INDEXED_NAME     ("mmmKernel_batched_indexed")
+#define COMPUTE_KERNEL_HALF_NAME        ("mmmKernel_half")
+#define COMPUTE_KERNEL_INT8_NAME        ("mmmKernel_int8")
+#define COMPUTE_KERNEL_PRESENT_NAME     ("mmmPresent")
+#define COMPUTE_KERNEL_FILL_NAME        ("mmmFill")
 #define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#define MAX_CACHED_KERNELS              (8)
+#define MAX_CACHED_ARGS                 (16)
+#define MAX_CACHED_ARG_SIZE             (64)
 #define WIDTH                           (512)
 #define HEIGHT                          (512)
+#define MAX_DEVICES                     (16)
+#define MAX_CHUNKS                      (16)
+#define BATCHED_GROUP_SIZE              (64)
+#define BATCHED_PASSES                  (5)
+#define BATCHED_CHECK                   (256)       // matrices checked against the CPU
+#define BATCHED_MAX_ELEMENTS            (1 << 22)   // per operand, larger points are skipped
 
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef struct
+{
+	cl_kernel kernel;
+	size_t sizes[MAX_CACHED_ARGS];
+	unsigned char values[MAX_CACHED_ARGS][MAX_CACHED_ARG_SIZE];
+} KernelArgCache;
+
 static cl_context                       ComputeContext;
 static cl_command_queue                 ComputeCommands;
+static cl_command_queue                 UploadCommands;
+static cl_command_queue                 DownloadCommands;
 static cl_kernel                        ComputeKernel;
+static cl_kernel                        ComputeImageKernel;
+static cl_kernel                        PresentKernel;
+static cl_kernel                        FillKernel;
 static cl_program                       ComputeProgram;
 static cl_device_id                     ComputeDeviceId;
 static cl_device_type                   ComputeDeviceType;
@@ -47,6 +80,13 @@ static cl_mem                           ComputeMatrixA;
 static cl_mem                           ComputeMatrixB;
 static cl_mem                           ComputeMatrixC;
 static cl_mem                           ComputeImage;
+static cl_device_id                     DeviceIds[MAX_DEVICES];
+static cl_command_queue                 DeviceCommands[MAX_DEVICES];
+static cl_mem                           DeviceResult[MAX_DEVICES];
+static cl_uint                          DeviceCount = 1;
+static cl_device_id                     ContextDeviceIds[MAX_DEVICES + 1];
+static cl_uint                          ContextDeviceCount = 1;
+static cl_uint                          FirstPrivateDevice = 1;
 static size_t                           MaxWorkGroupSize;
 static int                              WorkGroupSize[2];
 static int                              WorkGroupItems = 32;
@@ -66,12 +106,53 @@ static int Height                       = Height0;
 static int Animated                     = 0;
 static int Update                       = 1;
 static int Lds                          = 0;
+static int Tiled                        = 0;
+static int Batched                      = 0;
+static int Precision                    = 0;
+static int Direct                       = 0;
+static int DeviceInputs                 = 0;
+static cl_uint FillSeed                 = 0;
+static int BenchmarkFrames              = 20;
+
+static KernelArgCache ArgCache[MAX_CACHED_KERNELS];
+static double HostSubmitTime            = 0;
+static int HostSubmitFrames             = 0;
+static int HostArgSets                  = 0;
+static int HostArgSkips                 = 0;
+static int HostLaunches                 = 0;
+
+static int Roofline                     = 0;
+static RooflineStats Rooflines;
+static cl_event RooflineEvent           = 0;
+static cl_event PresentEvent            = 0;
+static double PresentTime               = 0;
+static int PresentCount                 = 0;
+static float PresentExposure            = 1.0f;
+
+static int MultiDevice                  = 0;
+static int Balance                      = 0;
+static const char *FissionSpec          = NULL;
+static const char *BuildOptions         = NULL;
+static float DeviceShare[MAX_DEVICES];
+static double DeviceTime[MAX_DEVICES];
+static int MultiDeviceCount             = 0;
+
+static int Overlap                      = 0;
+static int Chunks                       = 4;
+static double OverlapSpan               = 0;
+static double OverlapTransfer           = 0;
+static double OverlapCompute            = 0;
+static double OverlapHidden             = 0;
+static int OverlapCount                 = 0;
 
 static float *Input0                    = NULL;
 static float *Input1                    = NULL;
 static float *Output                    = NULL;
 
 static int BlockSize                    = 8;
+static int RegTileM                     = 8;
+static int RegTileN                     = 8;
+static int TileK                        = 16;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -91,12 +172,15 @@ static int FrameCount                   = 0;
 static int NDRangeCount                 = 0;
 static uint ReportStatsInterval         = 30;
 
+static FrameWindow Frames               = { 10, 5.0 };     // warm-up frames and steady cv
+static double MinRunTime                = 0;
+
 static float ShadowTextColor[4]         = { 0.0f, 0.0f, 0.0f, 1.0f };
 static float HighlightTextColor[4]      = { 0.9f, 0.9f, 0.9f, 1.0f };
 static uint TextOffset[2]               = { 25, 25 };
 
 static uint ShowStats                   = 1;
-static char StatsString[512]            = "\0";
+static char StatsString[1024]           = "\0";
 static uint ShowInfo                    = 1;
 static char InfoString[512]             = "\0";
 
@@ -138,6 +222,129 @@ SubtractTime( long uiEndTime, long uiStartTime )
 	return uiEndTime - uiStartTime;
 }
 
+static double
+GetPreciseTime()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Analytic work per launch of mmmKernel: every element of C is a Width0 long
+// dot product, and at best A and B are read and C written back once
+static double
+KernelFlops(void)
+{
+	return 2.0 * Height0 * Width1 * Width0;
+}
+
+static double
+KernelBytes(void)
+{
+	return ((double)Width0 * Height0 + (double)Width1 * Height1 + (double)Width1 * Height0) * sizeof(float);
+}
+
+static void
+CollectRoofline(void)
+{
+	if (PresentEvent)
+	{
+		clWaitForEvents(1, &PresentEvent);
+		PresentTime += GetEventTime(PresentEvent);
+		PresentCount++;
+		PresentEvent = 0;
+	}
+
+	if (!RooflineEvent)
+		return;
+
+	clWaitForEvents(1, &RooflineEvent);
+	Rooflines.time += GetEventTime(RooflineEvent);
+	Rooflines.count++;
+	RooflineEvent = 0;
+}
+
+// Appends the achieved rates of the kernel launches timed since the last report
+static void
+ReportRoofline(void)
+{
+	CollectRoofline();
+
+	// Presentation is timed on its own so it does not count towards the GEMM
+	if (PresentCount && strlen(StatsString) < sizeof(StatsString) - 64)
+		sprintf(StatsString + strlen(StatsString) - 1, "  Present: %3.2f ms\n", PresentTime / PresentCount);
+	PresentTime = 0;
+	PresentCount = 0;
+
+	AppendRoofline(&Rooflines, KernelFlops(), KernelBytes(), StatsString, sizeof(StatsString));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+ResetKernelArgs(void)
+{
+	memset(ArgCache, 0, sizeof(ArgCache));
+}
+
+// clSetKernelArg copies the value, so an argument that is bound to the same
+// bytes already can be skipped. Local memory sizes are always passed through.
+static cl_int
+SetKernelArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+{
+	KernelArgCache *cache = NULL;
+	cl_int err;
+
+	for (int i = 0; i < MAX_CACHED_KERNELS && !cache; i++)
+	{
+		if (ArgCache[i].kernel == kernel || !ArgCache[i].kernel)
+		{
+			cache = &ArgCache[i];
+			cache->kernel = kernel;
+		}
+	}
+
+	int cacheable = cache && value && index < MAX_CACHED_ARGS && size <= MAX_CACHED_ARG_SIZE;
+	if (cacheable && cache->sizes[index] == size && !memcmp(cache->values[index], value, size))
+	{
+		HostArgSkips++;
+		return CL_SUCCESS;
+	}
+
+	err = clSetKernelArg(kernel, index, size, value);
+	if (cacheable && err == CL_SUCCESS)
+	{
+		cache->sizes[index] = size;
+		memcpy(cache->values[index], value, size);
+	}
+	else if (cache && index < MAX_CACHED_ARGS)
+	{
+		cache->sizes[index] = 0;
+	}
+
+	HostArgSets++;
+	return err;
+}
+
+static cl_int
+EnqueueKernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t *offset, const size_t *global,
+	const size_t *local, cl_uint wait_count, const cl_event *wait_list, cl_event *event)
+{
+	HostLaunches++;
+	return clEnqueueNDRangeKernel(queue, kernel, dims, offset, global, local, wait_count, wait_list, event);
+}
+
+// A frame's argument setup and launches are timed as one block, the single
+// calls are too short to time on their own
+static void
+CountHostSubmit(double start)
+{
+	HostSubmitTime += GetHostTime() - start;
+	HostSubmitFrames++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static int LoadTextFromFile(
@@ -351,82 +558,109 @@ CreateRandomFilledArray_Float(int width, int height, float rangeMin, float range
 	return array;
 }
 
+// Rows and columns of C each work-item computes
 static int
-Recompute(void)
+ItemRows(void)
 {
-	if(!ComputeKernel || !ComputeMatrixC)
-		return CL_SUCCESS;
-
-    if (NDRangeCount > MaxNDRange)
-    {
-        printf("Reach Max NDRange, Quitting\n");
-        Cleanup();
-        exit(0);
-    }
+	return Tiled ? RegTileM : 4;
+}
 
-    if ( EnableStideExec && (ExecutionCount / ExecuteStride) % 2 == 1)
-    {
-        printf("GL only for frame %d\n", ExecutionCount);
-        return CL_SUCCESS;
-    }
+static int
+ItemCols(void)
+{
+	return Tiled ? RegTileN : 4;
+}
 
-	void *values[5];
-	size_t sizes[5];
-	size_t global[2];
-	size_t local[2];
+static int
+SetComputeKernelArgs(cl_kernel kernel, cl_mem *output)
+{
+	void *values[6];
+	size_t sizes[6];
 
-	int err = 0;
+	int err = CL_SUCCESS;
+	int lds = Lds && !Tiled;
 	unsigned int v = 0, s = 0, a = 0;
 	values[v++] = &ComputeMatrixA;
 	values[v++] = &ComputeMatrixB;
-	values[v++] = &ComputeMatrixC;
+	values[v++] = output;
 	values[v++] = &Width0;
-	if (Lds)
+	if (lds)
 		values[v++] = NULL;
 	else
 		values[v++] = &Width1;
+	if (output == &ComputeImage)
+		values[v++] = &PresentExposure;
 
 	sizes[s++] = sizeof(cl_mem);
 	sizes[s++] = sizeof(cl_mem);
 	sizes[s++] = sizeof(cl_mem);
 	sizes[s++] = sizeof(cl_int);
-	if (Lds)
+	if (lds)
 		sizes[s++] = (BlockSize * 4) * (BlockSize * 4) * sizeof(cl_float);
 	else
 		sizes[s++] = sizeof(cl_int);
+	if (output == &ComputeImage)
+		sizes[s++] = sizeof(cl_float);
 
-	if(Animated || Update)
-	{
-		clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixA, CL_TRUE, 0, Width0 * Height0 * sizeof(float), Input0, 0, NULL, NULL);
-		clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixB, CL_TRUE, 0, Width1 * Height1 * sizeof(float), Input1, 0, NULL, NULL);
-		clFlush(ComputeCommands);
+	for (a = 0; a < s; a++)
+		err |= SetKernelArg(kernel, a, sizes[a], values[a]);
 
-		Update = 0;
-		err = CL_SUCCESS;
-		for (a = 0; a < s; a++)
-			err |= clSetKernelArg(ComputeKernel, a, sizes[a], values[a]);
+	return err;
+}
 
-		if (err)
-			return -10;
+// Animated frames regenerate A and B with mmmFill rather than on the host,
+// except on the overlapped path, which streams the inputs itself
+static int
+DeviceGenerates(void)
+{
+	return DeviceInputs && Animated && !Overlap;
+}
+
+// Fills A and B in place with new values in [0, 1) on the compute queue
+static int
+EnqueueInputFill(void)
+{
+	cl_mem buffers[2] = { ComputeMatrixA, ComputeMatrixB };
+	cl_uint counts[2] = { (cl_uint)(Width0 * Height0), (cl_uint)(Width1 * Height1) };
+	cl_float low = 0.0f;
+	cl_float high = 1.0f;
+	size_t local = 64;
+	int err = CL_SUCCESS;
+
+	FillSeed++;
+	for (int i = 0; i < 2 && !err; i++)
+	{
+		size_t global = (counts[i] + local - 1) / local * local;
+		cl_uint seed = 2 * FillSeed + i;
+
+		err = SetKernelArg(FillKernel, 0, sizeof(cl_mem), &buffers[i]);
+		err |= SetKernelArg(FillKernel, 1, sizeof(cl_uint), &counts[i]);
+		err |= SetKernelArg(FillKernel, 2, sizeof(cl_uint), &seed);
+		err |= SetKernelArg(FillKernel, 3, sizeof(cl_float), &low);
+		err |= SetKernelArg(FillKernel, 4, sizeof(cl_float), &high);
+		err |= EnqueueKernel(ComputeCommands, FillKernel, 1, NULL, &global, &local, 0, NULL, NULL);
 	}
 
-	global[0] = Width1 / 4;
-	global[1] = Height0/ 4;
-	local[0] = BlockSize;
-	local[1] = BlockSize;
+	return err;
+}
 
-#if (DEBUG_INFO)
-	if(FrameCount <= 1)
-		printf("Global[%4d %4d] Local[%4d %4d]\n", 
-			(int)global[0], (int)global[1],
-			(int)local[0], (int)local[1]);
-#endif
+// Tonemaps the float matrix C into the RGBA8 display image on the compute queue,
+// right behind the GEMM. Without GL attachments only the image is read back
+static int
+EnqueuePresent(cl_event *present_event)
+{
+	size_t global[2] = { TextureWidth, TextureHeight };
+	int err = 0;
 
-	err = clEnqueueNDRangeKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, NULL);
-	if (err)
+	err = SetKernelArg(PresentKernel, 0, sizeof(cl_mem), &ComputeMatrixC);
+	err |= SetKernelArg(PresentKernel, 1, sizeof(cl_mem), &ComputeImage);
+	err |= SetKernelArg(PresentKernel, 2, sizeof(cl_int), &Width1);
+	err |= SetKernelArg(PresentKernel, 3, sizeof(cl_int), &Height0);
+	err |= SetKernelArg(PresentKernel, 4, sizeof(cl_float), &PresentExposure);
+	if (err != CL_SUCCESS)
 	{
-		printf("Failed to enqueue kernel! %d\n", err);
-		return err;
+		printf("Failed to set present kernel arguments! %d\n", err);
+		return EXIT_FAILURE;
 	}
 
 #if (USE_GL_ATTACHMENTS)
@@ -438,14 +672,10 @@ Recompute(void)
 		return EXIT_FAILURE;
 	}
 
-	size_t origin[] = { 0, 0, 0 };
-	size_t region[] = { TextureWidth, TextureHeight, 1 };
-	err = clEnqueueCopyBufferToImage(ComputeCommands, ComputeMatrixC, ComputeImage, 
-		0, origin, region, 0, NULL, 0);
-
-	if(err != CL_SUCCESS)
+	err = EnqueueKernel(ComputeCommands, PresentKernel, 2, NULL, global, NULL, 0, NULL, present_event);
+	if (err != CL_SUCCESS)
 	{
-		printf("Failed to copy buffer to image! %d\n", err);
+		printf("Failed to enqueue present kernel! %d\n", err);
 		return EXIT_FAILURE;
 	}
 
@@ -458,10 +688,19 @@ Recompute(void)
 
 #else
 
-	err = clEnqueueReadBuffer( ComputeCommands, ComputeMatrixC, CL_TRUE, 0, Width * Height * TextureTypeSize * 4, HostImageBuffer, 0, NULL, NULL );      
+	err = EnqueueKernel(ComputeCommands, PresentKernel, 2, NULL, global, NULL, 0, NULL, present_event);
+	if (err != CL_SUCCESS)
+	{
+		printf("Failed to enqueue present kernel! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	size_t origin[] = { 0, 0, 0 };
+	size_t region[] = { TextureWidth, TextureHeight, 1 };
+	err = clEnqueueReadImage(ComputeCommands, ComputeImage, CL_TRUE, origin, region, 0, 0, HostImageBuffer, 0, NULL, NULL);
 	if (err != CL_SUCCESS)
 	{
-		printf("Failed to read buffer! %d\n", err);
+		printf("Failed to read image! %d\n", err);
 		return EXIT_FAILURE;
 	}
 
@@ -470,494 +709,2130 @@ Recompute(void)
 	return CL_SUCCESS;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-static int 
-CreateComputeResource(void)
+static int
+EnqueueDirect(size_t *global, size_t *local, cl_event *kernel_event, cl_event *copy_event)
 {
+	int err = 0;
 
-
+	// The kernel writes the texture itself, so there is nothing to copy afterwards
 #if (USE_GL_ATTACHMENTS)
-	int err;
 
-	if(ComputeImage)
-		clReleaseMemObject(ComputeImage);
-	ComputeImage = 0;
+	err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputeImage, 0, 0, 0);
+	if (err != CL_SUCCESS)
+	{
+		printf("Failed to acquire GL object! %d\n", err);
+		return EXIT_FAILURE;
+	}
 
-	printf("Allocating compute result image in device memory...\n");
-	ComputeImage = clCreateFromGLTexture(ComputeContext, CL_MEM_WRITE_ONLY, TextureTarget, 0, TextureId, &err);
-	if (!ComputeImage || err != CL_SUCCESS)
+	err = EnqueueKernel(ComputeCommands, ComputeImageKernel, 2, NULL, global, local, 0, NULL, kernel_event);
+	if (err)
 	{
-		printf("Failed to create OpenGL texture reference! %d\n", err);
-		return -1;
+		printf("Failed to enqueue kernel! %d\n", err);
+		return err;
 	}
 
-#else
+	err = clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputeImage, 0, 0, 0);
+	if (err != CL_SUCCESS)
+	{
+		printf("Failed to release GL object! %d\n", err);
+		return EXIT_FAILURE;
+	}
 
-	if (HostImageBuffer)
-		free(HostImageBuffer);
+	if (copy_event)
+		*copy_event = 0;
 
-	printf("Allocating compute result image in host memory...\n");
-	HostImageBuffer = malloc(TextureWidth * TextureHeight * TextureTypeSize * 4);
-	if(!HostImageBuffer)
+#else
+
+	err = EnqueueKernel(ComputeCommands, ComputeImageKernel, 2, NULL, global, local, 0, NULL, kernel_event);
+	if (err)
 	{
-		printf("Failed to create host image buffer!\n");
-		return -1;
+		printf("Failed to enqueue kernel! %d\n", err);
+		return err;
 	}
 
-	memset(HostImageBuffer, 0, TextureWidth * TextureHeight * TextureTypeSize * 4);
+	// Without a shared texture the image is still read back for display
+	size_t origin[] = { 0, 0, 0 };
+	size_t region[] = { TextureWidth, TextureHeight, 1 };
+	err = clEnqueueReadImage(ComputeCommands, ComputeImage, CL_TRUE, origin, region, 0, 0, HostImageBuffer, 0, NULL, copy_event);
+	if (err != CL_SUCCESS)
+	{
+		printf("Failed to read image! %d\n", err);
+		return EXIT_FAILURE;
+	}
 
 #endif
 
-	if(ComputeMatrixA)
-		clReleaseMemObject(ComputeMatrixA);
-	ComputeMatrixA = 0;
+	return CL_SUCCESS;
+}
 
-	ComputeMatrixA = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY, sizeof(cl_float) * Width0 * Height0, NULL, NULL);
-	if (!ComputeMatrixA)
-	{
-		printf("Failed to create OpenCL array!\n");
-		return -1;
-	}
+// Partitions of one device share its memory and work on the primary buffers
+// directly, separate devices go through buffers of their own
+static int
+PrivateBuffers(cl_uint device)
+{
+	return FirstPrivateDevice && device >= FirstPrivateDevice;
+}
 
-	if(ComputeMatrixB)
-		clReleaseMemObject(ComputeMatrixB);
-	ComputeMatrixB = 0;
+static void
+PartitionWork(size_t units, size_t *offset, size_t *count)
+{
+	cl_uint i;
+	size_t start = 0;
 
-	ComputeMatrixB = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY, sizeof(cl_float) * Width1 * Height1, NULL, NULL);
-	if (!ComputeMatrixB)
+	for(i = 0; i < DeviceCount; i++)
 	{
-		printf("Failed to create OpenCL array!\n");
-		return -1;
+		size_t n = (i == DeviceCount - 1) ? units - start : (size_t)(units * DeviceShare[i] + 0.5f);
+		if (start + n > units)
+			n = units - start;
+
+		offset[i] = start;
+		count[i] = n;
+		start += n;
 	}
+}
 
+static void
+BalanceDevices(size_t *count, double *ms)
+{
+	cl_uint i;
+	double rate[MAX_DEVICES];
+	double measured_rate = 0;
+	double measured_share = 0;
+
+	// Devices that got no work this frame keep their share, the rest split
+	// what is left in proportion to the rows per ms they just achieved
+	for(i = 0; i < DeviceCount; i++)
+	{
+		rate[i] = (count[i] && ms[i] > 0) ? count[i] / ms[i] : 0;
+		if (rate[i] > 0)
+		{
+			measured_rate += rate[i];
+			measured_share += DeviceShare[i];
+		}
+	}
 
-	if(ComputeMatrixC)
-		clReleaseMemObject(ComputeMatrixC);
-	ComputeMatrixC = 0;
+	if (measured_rate <= 0)
+		return;
 
-	ComputeMatrixC = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, TextureTypeSize * 4 * TextureWidth * TextureHeight, NULL, NULL);
-	if (!ComputeMatrixC)
+	for(i = 0; i < DeviceCount; i++)
 	{
-		printf("Failed to create OpenCL array!\n");
-		return -1;
+		if (rate[i] > 0)
+			DeviceShare[i] = 0.5f * DeviceShare[i] + 0.5f * (float)(measured_share * rate[i] / measured_rate);
 	}
-
-	return CL_SUCCESS;
 }
 
-static int 
-SetupComputeDevices(int gpu)
+static int
+EnqueueMultiDevice(size_t *global, size_t *local)
 {
-	int err;
-	size_t returned_size;
-	ComputeDeviceType = gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
+	int err = CL_SUCCESS;
+	cl_uint i;
+	size_t offset[MAX_DEVICES];
+	size_t count[MAX_DEVICES];
+	double ms[MAX_DEVICES];
+	cl_event events[MAX_DEVICES];
+	cl_event ready = 0;
+	size_t row_bytes = Width1 * sizeof(float);
+
+	// The other devices read A and B once the primary queue has written them
+	if (FirstPrivateDevice < DeviceCount)
+	{
+		err = clEnqueueMarkerWithWaitList(ComputeCommands, 0, NULL, &ready);
+		if (err)
+		{
+			printf("Failed to enqueue marker! %d\n", err);
+			return err;
+		}
+	}
 
-#if (USE_GL_ATTACHMENTS)
+	// Row blocks of C in units of work-group rows, each work-item covers ItemRows() rows
+	PartitionWork(global[1] / local[1], offset, count);
 
-	printf(SEPARATOR);
-	printf("Using active OpenGL context...\n");
+	for(i = 0; i < DeviceCount; i++)
+	{
+		size_t band_offset[2] = { 0, offset[i] * local[1] };
+		size_t band_global[2] = { global[0], count[i] * local[1] };
+		int other = (i >= FirstPrivateDevice);
 
-// Bind to platform
-	cl_platform_id platform_id;
+		events[i] = 0;
+		if (!count[i])
+			continue;
 
-	cl_uint numPlatforms;
-	cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
-	if (status != CL_SUCCESS)
-	{
-		printf("clGetPlatformIDs Failed\n");
-		return EXIT_FAILURE;
+		err = SetComputeKernelArgs(ComputeKernel, PrivateBuffers(i) ? &DeviceResult[i] : &ComputeMatrixC);
+		err |= EnqueueKernel(DeviceCommands[i], ComputeKernel, 2, band_offset, band_global, local,
+			other ? 1 : 0, other ? &ready : NULL, &events[i]);
+		if (err)
+		{
+			printf("Failed to enqueue kernel on device %d! %d\n", i, err);
+			break;
+		}
+		clFlush(DeviceCommands[i]);
 	}
+	if (ready)
+		clReleaseEvent(ready);
+	if (err)
+		return err;
 
-	if (0 < numPlatforms)
+	err = SetComputeKernelArgs(ComputeKernel, &ComputeMatrixC);
+
+	// Copy the row blocks computed elsewhere into matrix C as each device
+	// finishes, device to device without a trip through the host
+	for(i = FirstPrivateDevice; i < DeviceCount && !err; i++)
 	{
-		cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
+		size_t first = offset[i] * local[1] * ItemRows();
+		size_t rows = count[i] * local[1] * ItemRows();
+		if (!rows || !PrivateBuffers(i))
+			continue;
 
-		status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+		err = clEnqueueCopyBuffer(ComputeCommands, DeviceResult[i], ComputeMatrixC, first * row_bytes, first * row_bytes,
+			rows * row_bytes, 1, &events[i], NULL);
+	}
 
-		char platformName[100];
+	for(i = 0; i < DeviceCount; i++)
+	{
+		ms[i] = 0;
+		if (!events[i])
+			continue;
+
+		clWaitForEvents(1, &events[i]);
+		ms[i] = GetEventTime(events[i]);
+		DeviceTime[i] += ms[i];
+	}
+	MultiDeviceCount++;
+
+	if (err)
+	{
+		printf("Failed to gather device results! %d\n", err);
+		return err;
+	}
+
+	if (Balance)
+		BalanceDevices(count, ms);
+
+	return CL_SUCCESS;
+}
+
+static void
+AccumulateEvents(cl_event *events, int count, double *busy, cl_ulong *first, cl_ulong *last)
+{
+	for (int i = 0; i < count; i++)
+	{
+		cl_ulong start = 0;
+		cl_ulong end = 0;
+
+		if (!events[i])
+			continue;
+
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		clReleaseEvent(events[i]);
+
+		*busy += (end - start) / 1000000.0;
+		if (!*first || start < *first)
+			*first = start;
+		if (end > *last)
+			*last = end;
+	}
+}
+
+static int
+EnqueueOverlapped(size_t *global, size_t *local, int chunks)
+{
+	int err = 0;
+	size_t groups = global[1] / local[1];
+	size_t row_bytes_a = Width0 * sizeof(float);
+	cl_event upload_b;
+	cl_event upload[MAX_CHUNKS];
+	cl_event kernel[MAX_CHUNKS];
+	cl_event download[MAX_CHUNKS];
+	double transfer = 0;
+	double compute = 0;
+	cl_ulong first = 0;
+	cl_ulong last = 0;
+
+	if (chunks > (int)groups)
+		chunks = groups;
+	if (chunks > MAX_CHUNKS)
+		chunks = MAX_CHUNKS;
+
+	// B is needed whole by every chunk, A and C are streamed in row blocks
+	err = clEnqueueWriteBuffer(UploadCommands, ComputeMatrixB, CL_FALSE, 0, Width1 * Height1 * sizeof(float), Input1, 0, NULL, &upload_b);
+
+	for (int k = 0; k < chunks; k++)
+	{
+		size_t start = groups * k / chunks;
+		size_t count = groups * (k + 1) / chunks - start;
+		size_t row = start * local[1] * ItemRows();
+		size_t rows = count * local[1] * ItemRows();
+		size_t offset[2] = { 0, start * local[1] };
+		size_t range[2] = { global[0], count * local[1] };
+		cl_event deps[2];
+
+		err |= clEnqueueWriteBuffer(UploadCommands, ComputeMatrixA, CL_FALSE, row * row_bytes_a, rows * row_bytes_a,
+			(char *)Input0 + row * row_bytes_a, 0, NULL, &upload[k]);
+
+		deps[0] = upload_b;
+		deps[1] = upload[k];
+		err |= EnqueueKernel(ComputeCommands, ComputeKernel, 2, offset, range, local, 2, deps, &kernel[k]);
+
+#if (USE_GL_ATTACHMENTS)
+		download[k] = 0;
+#else
+		size_t row_bytes_c = Width1 * sizeof(float);
+		err |= clEnqueueReadBuffer(DownloadCommands, ComputeMatrixC, CL_FALSE, row * row_bytes_c, rows * row_bytes_c,
+			(char *)Output + row * row_bytes_c, 1, &kernel[k], &download[k]);
+#endif
+		if (err)
+		{
+			printf("Failed to enqueue chunk %d! %d\n", k, err);
+			return err;
+		}
+
+		// Get this chunk going so the next upload runs under its kernel
+		clFlush(UploadCommands);
+		clFlush(ComputeCommands);
+	}
+
+	clFlush(DownloadCommands);
+	clFinish(UploadCommands);
+	clFinish(ComputeCommands);
+	clFinish(DownloadCommands);
+
+	AccumulateEvents(&upload_b, 1, &transfer, &first, &last);
+	AccumulateEvents(upload, chunks, &transfer, &first, &last);
+	AccumulateEvents(download, chunks, &transfer, &first, &last);
+	AccumulateEvents(kernel, chunks, &compute, &first, &last);
+
+	double span = (last - first) / 1000000.0;
+	OverlapSpan += span;
+	OverlapTransfer += transfer;
+	OverlapCompute += compute;
+	OverlapHidden += (transfer + compute > span) ? transfer + compute - span : 0;
+	OverlapCount++;
+
+	return CL_SUCCESS;
+}
+
+static int
+Recompute(void)
+{
+	if(!ComputeKernel || !ComputeMatrixC)
+		return CL_SUCCESS;
+
+    if (NDRangeCount > MaxNDRange)
+    {
+        printf("Reach Max NDRange, Quitting\n");
+        Cleanup();
+        exit(0);
+    }
+
+    if ( EnableStideExec && (ExecutionCount / ExecuteStride) % 2 == 1)
+    {
+        printf("GL only for frame %d\n", ExecutionCount);
+        return CL_SUCCESS;
+    }
+
+	size_t global[2];
+	size_t local[2];
+
+	int err = 0;
+
+	if(Animated || Update)
+	{
+		// The overlapped path streams the inputs itself
+		if (DeviceGenerates())
+		{
+			err = EnqueueInputFill();
+			if (err)
+			{
+				printf("Failed to generate inputs! %d\n", err);
+				return err;
+			}
+		}
+		else if (!Overlap)
+		{
+			clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixA, CL_TRUE, 0, Width0 * Height0 * sizeof(float), Input0, 0, NULL, NULL);
+			clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixB, CL_TRUE, 0, Width1 * Height1 * sizeof(float), Input1, 0, NULL, NULL);
+			clFlush(ComputeCommands);
+		}
+	}
+
+	// The roofline wait for the last launch stays out of the host time
+	CollectRoofline();
+	double submit = GetHostTime();
+
+	if(Animated || Update)
+	{
+		Update = 0;
+		err = SetComputeKernelArgs(ComputeKernel, &ComputeMatrixC);
+		if (Direct)
+			err |= SetComputeKernelArgs(ComputeImageKernel, &ComputeImage);
+
+		if (err)
+			return -10;
+	}
+
+	global[0] = Width1 / ItemCols();
+	global[1] = Height0 / ItemRows();
+	local[0] = BlockSize;
+	local[1] = BlockSize;
+
+#if (DEBUG_INFO)
+	if(FrameCount <= 1)
+		printf("Global[%4d %4d] Local[%4d %4d]\n", 
+			(int)global[0], (int)global[1],
+			(int)local[0], (int)local[1]);
+#endif
+
+	if (Direct)
+	{
+		err = EnqueueDirect(global, local, NULL, NULL);
+		CountHostSubmit(submit);
+		return err;
+	}
+
+	if (Overlap)
+	{
+		err = EnqueueOverlapped(global, local, Chunks);
+		if (err)
+			return err;
+
+		return EnqueuePresent(NULL);
+	}
+
+	if (MultiDevice)
+		err = EnqueueMultiDevice(global, local);
+	else
+		err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, Roofline ? &RooflineEvent : NULL);
+	if (err)
+	{
+		printf("Failed to enqueue kernel! %d\n", err);
+		return err;
+	}
+
+	// Multi-device frames wait for their devices inside the launch
+	if (!MultiDevice)
+		CountHostSubmit(submit);
+
+	return EnqueuePresent((Roofline && !MultiDevice) ? &PresentEvent : NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int 
+CreateComputeResource(void)
+{
+	ResetKernelArgs();
+
+
+#if (USE_GL_ATTACHMENTS)
+	int err;
+
+	if(ComputeImage)
+		clReleaseMemObject(ComputeImage);
+	ComputeImage = 0;
+
+	printf("Allocating compute result image in device memory...\n");
+	ComputeImage = clCreateFromGLTexture(ComputeContext, CL_MEM_WRITE_ONLY, TextureTarget, 0, TextureId, &err);
+	if (!ComputeImage || err != CL_SUCCESS)
+	{
+		printf("Failed to create OpenGL texture reference! %d\n", err);
+		return -1;
+	}
+
+#else
+
+	if (HostImageBuffer)
+		free(HostImageBuffer);
+
+	printf("Allocating compute result image in host memory...\n");
+	HostImageBuffer = malloc(TextureWidth * TextureHeight * TextureTypeSize * 4);
+	if(!HostImageBuffer)
+	{
+		printf("Failed to create host image buffer!\n");
+		return -1;
+	}
+
+	memset(HostImageBuffer, 0, TextureWidth * TextureHeight * TextureTypeSize * 4);
+
+	if(ComputeImage)
+		clReleaseMemObject(ComputeImage);
+	ComputeImage = 0;
+
+	// Presentation writes this image and reads it back, instead of the floats of C
+	{
+		int err = 0;
+		cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+		cl_image_desc desc;
+
+		memset(&desc, 0, sizeof(desc));
+		desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+		desc.image_width = TextureWidth;
+		desc.image_height = TextureHeight;
+
+		printf("Allocating compute result image object...\n");
+		ComputeImage = clCreateImage(ComputeContext, CL_MEM_WRITE_ONLY, &format, &desc, NULL, &err);
+		if (!ComputeImage || err != CL_SUCCESS)
+		{
+			printf("Failed to create OpenCL image! %d\n", err);
+			return -1;
+		}
+	}
+
+#endif
+
+	if(ComputeMatrixA)
+		clReleaseMemObject(ComputeMatrixA);
+	ComputeMatrixA = 0;
+
+	ComputeMatrixA = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY, sizeof(cl_float) * Width0 * Height0, NULL, NULL);
+	if (!ComputeMatrixA)
+	{
+		printf("Failed to create OpenCL array!\n");
+		return -1;
+	}
+
+	if(ComputeMatrixB)
+		clReleaseMemObject(ComputeMatrixB);
+	ComputeMatrixB = 0;
+
+	ComputeMatrixB = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY, sizeof(cl_float) * Width1 * Height1, NULL, NULL);
+	if (!ComputeMatrixB)
+	{
+		printf("Failed to create OpenCL array!\n");
+		return -1;
+	}
+
+
+	if(ComputeMatrixC)
+		clReleaseMemObject(ComputeMatrixC);
+	ComputeMatrixC = 0;
+
+	ComputeMatrixC = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_float) * Width1 * Height0, NULL, NULL);
+	if (!ComputeMatrixC)
+	{
+		printf("Failed to create OpenCL array!\n");
+		return -1;
+	}
+
+	if(MultiDevice)
+	{
+		for(cl_uint i = FirstPrivateDevice; i < DeviceCount && PrivateBuffers(i); i++)
+		{
+			if(DeviceResult[i])
+				clReleaseMemObject(DeviceResult[i]);
+
+			DeviceResult[i] = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, sizeof(cl_float) * Width1 * Height0, NULL, NULL);
+			if (!DeviceResult[i])
+			{
+				printf("Failed to create OpenCL array for device %d!\n", i);
+				return -1;
+			}
+		}
+	}
+
+	return CL_SUCCESS;
+}
+
+static int
+PartitionDevice(void)
+{
+	cl_device_partition_property properties[MAX_DEVICES + 3];
+	cl_uint p = 0;
+	cl_uint i;
+	cl_uint count = 0;
+	int err;
+
+	if (ComputeDeviceType != CL_DEVICE_TYPE_CPU)
+	{
+		printf("Device fission needs the CPU device, ignoring '%s'\n", FissionSpec);
+		return CL_SUCCESS;
+	}
+
+	// equal:<units>, counts:<units>,<units>,... or an affinity domain (numa, l3, l2, next)
+	if (!strncmp(FissionSpec, "equal:", 6))
+	{
+		properties[p++] = CL_DEVICE_PARTITION_EQUALLY;
+		properties[p++] = atoi(FissionSpec + 6);
+	}
+	else if (!strncmp(FissionSpec, "counts:", 7))
+	{
+		const char *c = FissionSpec + 7;
+
+		properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS;
+		while (c && *c && p < MAX_DEVICES + 1)
+		{
+			properties[p++] = atoi(c);
+			c = strchr(c, ',');
+			if (c)
+				c++;
+		}
+		properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+	}
+	else
+	{
+		properties[p++] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+		if (!strcmp(FissionSpec, "numa"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+		else if (!strcmp(FissionSpec, "l3"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE;
+		else if (!strcmp(FissionSpec, "l2"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE;
+		else if (!strcmp(FissionSpec, "next"))
+			properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE;
+		else
+		{
+			printf("Error: Unknown device fission '%s', use equal:<units>, counts:<units>,... numa, l3, l2 or next!\n",
+				FissionSpec);
+			return EXIT_FAILURE;
+		}
+	}
+	properties[p++] = 0;
+
+	err = clCreateSubDevices(ComputeDeviceId, properties, 0, NULL, &count);
+	if (err != CL_SUCCESS || !count || count >= MAX_DEVICES)
+	{
+		printf("Error: Failed to partition compute device '%s'! %d\n", FissionSpec, err);
+		return EXIT_FAILURE;
+	}
+
+	err = clCreateSubDevices(ComputeDeviceId, properties, count, DeviceIds, &DeviceCount);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to create sub-devices! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	// Every partition works on its range of the root device buffers, the root
+	// device runs the monolithic baseline
+	FirstPrivateDevice = 0;
+	MultiDevice = 1;
+	for(i = 0; i < DeviceCount; i++)
+		DeviceShare[i] = 1.0f / DeviceCount;
+
+	printf("Partitioned compute device into %d sub-devices (%s)...\n", DeviceCount, FissionSpec);
+
+	return CL_SUCCESS;
+}
+
+static void
+ListContextDevices(void)
+{
+	cl_uint i;
+
+	// The root goes first so it is still the device picked for the main queue
+	ContextDeviceCount = 0;
+	if (!FirstPrivateDevice)
+		ContextDeviceIds[ContextDeviceCount++] = ComputeDeviceId;
+	for(i = 0; i < DeviceCount; i++)
+		ContextDeviceIds[ContextDeviceCount++] = DeviceIds[i];
+}
+
+static int
+GatherDevices(cl_platform_id platform_id)
+{
+	cl_uint i;
+	int err;
+
+	err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, MAX_DEVICES, DeviceIds, &DeviceCount);
+	if (err != CL_SUCCESS || !DeviceCount)
+	{
+		printf("Error: Failed to locate compute devices!\n");
+		return EXIT_FAILURE;
+	}
+	if (DeviceCount > MAX_DEVICES)
+		DeviceCount = MAX_DEVICES;
+
+	// Keep the requested device first, it owns the result and the GL copy
+	for(i = 0; i < DeviceCount; i++)
+	{
+		if(DeviceIds[i] == ComputeDeviceId)
+		{
+			DeviceIds[i] = DeviceIds[0];
+			DeviceIds[0] = ComputeDeviceId;
+			break;
+		}
+	}
+
+	for(i = 0; i < DeviceCount; i++)
+		DeviceShare[i] = 1.0f / DeviceCount;
+
+	return CL_SUCCESS;
+}
+
+static int
+CreateDeviceQueues(void)
+{
+	cl_uint i;
+	int err;
+
+	for(i = FirstPrivateDevice; i < DeviceCount; i++)
+	{
+		cl_char device_name[1024] = {0};
+
+		DeviceCommands[i] = clCreateCommandQueue(ComputeContext, DeviceIds[i], CL_QUEUE_PROFILING_ENABLE, &err);
+		if (!DeviceCommands[i])
+		{
+			printf("Error: Failed to create a command queue for device %d!\n", i);
+			return EXIT_FAILURE;
+		}
+
+		clGetDeviceInfo(DeviceIds[i], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+		printf("Connecting to %s as device %d...\n", device_name, i);
+	}
+
+	return CL_SUCCESS;
+}
+
+static int 
+SetupComputeDevices(int gpu)
+{
+	int err;
+	size_t returned_size;
+	ComputeDeviceType = gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
+
+#if (USE_GL_ATTACHMENTS)
+
+	printf(SEPARATOR);
+	printf("Using active OpenGL context...\n");
+
+// Bind to platform
+	cl_platform_id platform_id;
+
+	cl_uint numPlatforms;
+	cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
+	if (status != CL_SUCCESS)
+	{
+		printf("clGetPlatformIDs Failed\n");
+		return EXIT_FAILURE;
+	}
+
+	if (0 < numPlatforms)
+	{
+		cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
+
+		status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+
+		char platformName[100];
+		for (unsigned i = 0; i < numPlatforms; ++i)
+		{
+			status = clGetPlatformInfo(platforms[i],
+				CL_PLATFORM_VENDOR,
+				sizeof(platformName),
+				platformName,
+				NULL);
+			platform_id = platforms[i];
+			if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
+			{
+				break;
+			}
+		}
+		printf("Platform found : %s\n", platformName);
+		free(platforms);
+	}
+	if(NULL == platform_id)
+	{
+		printf("NULL platform found so Exiting Application.\n");
+		return EXIT_FAILURE;
+	}
+
+// Get ID for the device
+	err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to locate compute device!\n");
+		return EXIT_FAILURE;
+	}
+	DeviceIds[0] = ComputeDeviceId;
+
+	if (FissionSpec)
+		err = PartitionDevice();
+	else if (MultiDevice)
+		err = GatherDevices(platform_id);
+	if (err != CL_SUCCESS)
+		return EXIT_FAILURE;
+	ListContextDevices();
+
+// Create a context  
+	cl_context_properties properties[] =
+	{
+		CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
+		CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
+		CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_id),
+		0
+	};
+
+// Create a context from a CGL share group
+//
+	ComputeContext = clCreateContext(properties, ContextDeviceCount, ContextDeviceIds, NULL, 0, 0);
+	if (!ComputeContext)
+	{
+		printf("Error: Failed to create a compute context!\n");
+		return EXIT_FAILURE;
+	}
+
+#else
+
+// Bind to platform
+	cl_platform_id platform_id;
+
+	cl_uint numPlatforms;
+	cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
+	if (status != CL_SUCCESS)
+	{
+		printf("clGetPlatformIDs Failed\n");
+		return EXIT_FAILURE;
+	}
+
+	if (0 < numPlatforms)
+	{
+		cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
+
+		status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+
+		char platformName[100];
 		for (unsigned i = 0; i < numPlatforms; ++i)
 		{
-			status = clGetPlatformInfo(platforms[i],
-				CL_PLATFORM_VENDOR,
-				sizeof(platformName),
-				platformName,
-				NULL);
-			platform_id = platforms[i];
-			if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
-			{
-				break;
-			}
+			status = clGetPlatformInfo(platforms[i],
+				CL_PLATFORM_VENDOR,
+				sizeof(platformName),
+				platformName,
+				NULL);
+			platform_id = platforms[i];
+			if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
+			{
+				break;
+			}
+		}
+		printf("Platform found : %s\n", platformName);
+		free(platforms);
+	}
+	if(NULL == platform_id)
+	{
+		printf("NULL platform found so Exiting Application.\n");
+		return EXIT_FAILURE;
+	}
+
+// Get ID for the device
+	err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to locate compute device!\n");
+		return EXIT_FAILURE;
+	}
+	DeviceIds[0] = ComputeDeviceId;
+
+	if (FissionSpec)
+		err = PartitionDevice();
+	else if (MultiDevice)
+		err = GatherDevices(platform_id);
+	if (err != CL_SUCCESS)
+		return EXIT_FAILURE;
+	ListContextDevices();
+
+// Create a context containing the compute device(s)
+//
+	ComputeContext = clCreateContext(0, ContextDeviceCount, ContextDeviceIds, NULL, NULL, &err);
+	if (!ComputeContext)
+	{
+		printf("Error: Failed to create a compute context!\n");
+		return EXIT_FAILURE;
+	}
+
+#endif
+
+	unsigned int device_count;
+	cl_device_id device_ids[16];
+
+	err = clGetContextInfo(ComputeContext, CL_CONTEXT_DEVICES, sizeof(device_ids), device_ids, &returned_size);
+	if(err)
+	{
+		printf("Error: Failed to retrieve compute devices for context!\n");
+		return EXIT_FAILURE;
+	}
+
+	device_count = returned_size / sizeof(cl_device_id);
+
+	unsigned int i = 0;
+	int device_found = 0;
+	cl_device_type device_type; 
+	for(i = 0; i < device_count; i++) 
+	{
+		clGetDeviceInfo(device_ids[i], CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, NULL);
+		if(device_type == ComputeDeviceType) 
+		{
+			ComputeDeviceId = device_ids[i];
+			device_found = 1;
+			break;
+		} 
+	}
+
+	if(!device_found)
+	{
+		printf("Error: Failed to locate compute device!\n");
+		return EXIT_FAILURE;
+	}
+
+// Create a command queue
+//
+	cl_command_queue_properties queue_properties = (Direct || MultiDevice || Overlap || Roofline || Tiled || Precision) ? CL_QUEUE_PROFILING_ENABLE : 0;
+	ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
+	if (!ComputeCommands)
+	{
+		printf("Error: Failed to create a command queue!\n");
+		return EXIT_FAILURE;
+	}
+
+	// Transfers get their own queues so they can run under the kernels
+	if (Overlap)
+	{
+		UploadCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
+		DownloadCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
+		if (!UploadCommands || !DownloadCommands)
+		{
+			printf("Error: Failed to create transfer command queues!\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+// Report the device vendor and device name
+// 
+	cl_char vendor_name[1024] = {0};
+	cl_char device_name[1024] = {0};
+	err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, &returned_size);
+	err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, &returned_size);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to retrieve device info!\n");
+		return EXIT_FAILURE;
+	}
+
+	printf(SEPARATOR);
+	printf("Connecting to %s %s...\n", vendor_name, device_name);
+
+	if (FirstPrivateDevice)
+		DeviceCommands[0] = ComputeCommands;
+	if (MultiDevice)
+		return CreateDeviceQueues();
+
+	return CL_SUCCESS;
+}
+
+// The tiled kernel covers C in blocks of BlockSize times the register tile, steps
+// along A in TileK columns and has every thread load whole float4s of both tiles
+static int
+CheckTiledShape(void)
+{
+	int tile_m = BlockSize * RegTileM;
+	int tile_n = BlockSize * RegTileN;
+	int threads = BlockSize * BlockSize;
+	size_t tile_bytes = 2 * TileK * (tile_m + tile_n) * sizeof(cl_float);
+	cl_ulong local_size = 0;
+
+	if (RegTileM < 1 || RegTileN < 1 || TileK < 4 || TileK % 4 || tile_n % 4 ||
+		Height0 % tile_m || Width1 % tile_n || Width0 % TileK ||
+		(tile_m * TileK / 4) % threads || (TileK * tile_n / 4) % threads)
+	{
+		printf("Error: Register tile %dx%d with k tile %d does not divide %d x %d x %d!\n", RegTileM, RegTileN, TileK,
+			Height0, Width1, Width0);
+		return EXIT_FAILURE;
+	}
+
+	clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &local_size, NULL);
+	if (tile_bytes > local_size)
+	{
+		printf("Error: Double-buffered tiles need %d bytes of local memory, the device has %d!\n", (int)tile_bytes,
+			(int)local_size);
+		return EXIT_FAILURE;
+	}
+
+	return CL_SUCCESS;
+}
+
+static int 
+SetupComputeKernel(void)
+{
+	int err = 0;
+	char *source = 0;
+	size_t length = 0;
+	char options[512];
+
+	ResetKernelArgs();
+
+	if(ComputeKernel)
+		clReleaseKernel(ComputeKernel);    
+	ComputeKernel = 0;
+
+	if(ComputeProgram)
+		clReleaseProgram(ComputeProgram);
+	ComputeProgram = 0;
+
+	printf(SEPARATOR);
+	printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);    
+	err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
+	if (!source || err)
+	{
+		printf("Error: Failed to load kernel source!\n");
+		return EXIT_FAILURE;
+	}
+
+#if (DEBUG_INFO)
+	printf("%s", source);
+#endif
+
+// Create the compute program from the source buffer
+//
+	ComputeProgram = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
+	if (!ComputeProgram || err != CL_SUCCESS)
+	{
+		printf("Error: Failed to create compute program!\n");
+		return EXIT_FAILURE;
+	}
+	free(source);
+
+// Build the program executable, the tiled kernel takes its tile shape as defines
+//
+	if (Tiled && CheckTiledShape() != CL_SUCCESS)
+		return EXIT_FAILURE;
+
+	snprintf(options, sizeof(options), "%s -D BLOCK_SIZE=%d -D REG_TILE_M=%d -D REG_TILE_N=%d -D TILE_K=%d",
+		BuildOptions ? BuildOptions : "", BlockSize, RegTileM, RegTileN, TileK);
+	printf("Building program with options '%s'...\n", options);
+	err = clBuildProgram(ComputeProgram, 0, NULL, options, NULL, NULL);
+	if (err != CL_SUCCESS)
+	{
+		size_t len;
+		char buffer[2048];
+
+		printf("Error: Failed to build program executable!\n");
+		clGetProgramBuildInfo(ComputeProgram, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+		printf("%s\n", buffer);
+		return EXIT_FAILURE;
+	}
+
+// Create the compute kernel from within the program
+//
+	if (Tiled)
+	{
+		printf("Creating kernel '%s' (%dx%d register tile, k tile %d)...\n", COMPUTE_KERNEL_TILED_NAME,
+			RegTileM, RegTileN, TileK);
+		ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_TILED_NAME, &err);
+	}
+	else if (Lds)
+	{
+		printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_MATMUL_LDS_NAME); 
+		ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_LDS_NAME, &err);
+	}
+	else
+	{
+		printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_MATMUL_NAME); 
+		ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_NAME, &err);
+	}
+
+	if (!ComputeKernel || err != CL_SUCCESS)
+	{
+		printf("Error: Failed to create compute kernel!\n");
+		return EXIT_FAILURE;
+	}
+
+	if (Direct)
+	{
+		const char *name = Tiled ? COMPUTE_KERNEL_TILED_IMAGE_NAME : Lds ? COMPUTE_KERNEL_LDS_IMAGE_NAME :
+			COMPUTE_KERNEL_IMAGE_NAME;
+
+		if(ComputeImageKernel)
+			clReleaseKernel(ComputeImageKernel);
+
+		printf("Creating kernel '%s'...\n", name);
+		ComputeImageKernel = clCreateKernel(ComputeProgram, name, &err);
+		if (!ComputeImageKernel || err != CL_SUCCESS)
+		{
+			printf("Error: Failed to create compute kernel!\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(PresentKernel)
+		clReleaseKernel(PresentKernel);
+
+	PresentKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_PRESENT_NAME, &err);
+	if (!PresentKernel || err != CL_SUCCESS)
+	{
+		printf("Error: Failed to create present kernel!\n");
+		return EXIT_FAILURE;
+	}
+
+	if(FillKernel)
+		clReleaseKernel(FillKernel);
+	FillKernel = 0;
+
+	if (DeviceInputs)
+	{
+		FillKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_FILL_NAME, &err);
+		if (!FillKernel || err != CL_SUCCESS)
+		{
+			printf("Error: Failed to create fill kernel!\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+// Get the maximum work group size for executing the kernel on the device
+//
+	err = clGetKernelWorkGroupInfo(ComputeKernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &MaxWorkGroupSize, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+		exit(1);
+	}
+
+#if (DEBUG_INFO)
+	printf("MaxWorkGroupSize: %d\n", MaxWorkGroupSize);
+	printf("WorkGroupItems: %d\n", WorkGroupItems);
+#endif
+
+	WorkGroupSize[0] = (MaxWorkGroupSize > 1) ? (MaxWorkGroupSize / WorkGroupItems) : MaxWorkGroupSize;
+	WorkGroupSize[1] = MaxWorkGroupSize / WorkGroupSize[0];
+
+	printf(SEPARATOR);
+
+	return CL_SUCCESS;
+
+}
+
+static void
+Cleanup(void)
+{
+	clFinish(ComputeCommands);
+	if (RooflineEvent)
+		clReleaseEvent(RooflineEvent);
+	if (PresentEvent)
+		clReleaseEvent(PresentEvent);
+	RooflineEvent = 0;
+	PresentEvent = 0;
+	ResetKernelArgs();
+	clReleaseKernel(ComputeKernel);
+	clReleaseKernel(PresentKernel);
+	if (FillKernel)
+		clReleaseKernel(FillKernel);
+	if (Direct)
+		clReleaseKernel(ComputeImageKernel);
+	clReleaseProgram(ComputeProgram);
+	clReleaseCommandQueue(ComputeCommands);
+	if (Overlap)
+	{
+		clReleaseCommandQueue(UploadCommands);
+		clReleaseCommandQueue(DownloadCommands);
+	}
+	clReleaseMemObject(ComputeMatrixA);
+	clReleaseMemObject(ComputeMatrixB);
+	clReleaseMemObject(ComputeMatrixC);
+	clReleaseMemObject(ComputeImage);
+	if (MultiDevice)
+	{
+		for(cl_uint i = FirstPrivateDevice; i < DeviceCount; i++)
+		{
+			clFinish(DeviceCommands[i]);
+			clReleaseCommandQueue(DeviceCommands[i]);
+			if(DeviceResult[i])
+				clReleaseMemObject(DeviceResult[i]);
+			DeviceCommands[i] = 0;
+			DeviceResult[i] = 0;
+		}
+		if (!FirstPrivateDevice)
+		{
+			for(cl_uint i = 0; i < DeviceCount; i++)
+				clReleaseDevice(DeviceIds[i]);
+		}
+	}
+	clReleaseContext(ComputeContext);
+
+	ComputeCommands = 0;
+	UploadCommands = 0;
+	DownloadCommands = 0;
+	ComputeKernel = 0;
+	ComputeImageKernel = 0;
+	PresentKernel = 0;
+	FillKernel = 0;
+	ComputeProgram = 0;    
+	ComputeMatrixA = 0;
+	ComputeMatrixB = 0;
+	ComputeMatrixC = 0;
+	ComputeImage = 0;
+	ComputeContext = 0;
+}
+
+static void
+Shutdown(void)
+{	
+	if (fp)
+		fclose(fp);
+	printf(SEPARATOR);
+	printf("Shutting down...\n");
+	Cleanup();
+	exit(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int 
+SetupGraphics(void)
+{
+	CreateTexture(Width, Height);
+
+	glClearColor (0.0, 0.0, 0.0, 0.0);
+
+	glDisable(GL_DEPTH_TEST);
+	glActiveTexture(GL_TEXTURE0);
+	glViewport(0, 0, Width, Height);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+
+	TexCoords[3][0] = 0.0f;
+	TexCoords[3][1] = 0.0f;
+	TexCoords[2][0] = Width;
+	TexCoords[2][1] = 0.0f;
+	TexCoords[1][0] = Width;
+	TexCoords[1][1] = Height;
+	TexCoords[0][0] = 0.0f;
+	TexCoords[0][1] = Height;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, VertexPos);
+	glClientActiveTexture(GL_TEXTURE0);
+	glTexCoordPointer(2, GL_FLOAT, 0, TexCoords);
+	return GL_NO_ERROR;
+}
+
+static int 
+Initialize(int gpu)
+{
+	int err;
+	err = SetupGraphics();
+	if (err != GL_NO_ERROR)
+	{
+		printf ("Failed to setup OpenGL state!");
+		exit (err);
+	}
+
+	err = SetupComputeDevices(gpu);
+	if(err != CL_SUCCESS)
+	{
+		printf ("Failed to connect to compute device! Error %d\n", err);
+		exit (err);
+	}
+
+	cl_bool image_support;
+	err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_IMAGE_SUPPORT,
+		sizeof(image_support), &image_support, NULL);
+	if (err != CL_SUCCESS) {
+		printf("Unable to query device for image support");
+		exit(err);
+	}
+	if (image_support == CL_FALSE) {
+		printf("MatMul requires images: Images not supported on this device.");
+		return CL_IMAGE_FORMAT_NOT_SUPPORTED;
+	}
+
+	err = SetupComputeKernel();
+	if (err != CL_SUCCESS)
+	{
+		printf ("Failed to setup compute kernel! Error %d\n", err);
+		exit (err);
+	}
+
+	err = CreateComputeResource();
+	if(err != CL_SUCCESS)
+	{
+		printf ("Failed to create compute result! Error %d\n", err);
+		exit (err);
+	}
+
+	Input0 = CreateRandomFilledArray_Float(Width0, Height0, 0.0, 1.0);
+	Input1 = CreateRandomFilledArray_Float(Width1, Height1, 0.0, 1.0);
+	Output = CreateRandomFilledArray_Float(Width1, Height0, 0.0, 1.0);
+
+	// Each element of C sums Width0 products, so its mean is Width0 times the input means
+	double mean0 = 0;
+	double mean1 = 0;
+	for (int i = 0; i < Width0 * Height0; i++)
+		mean0 += Input0[i] / (Width0 * Height0);
+	for (int i = 0; i < Width1 * Height1; i++)
+		mean1 += Input1[i] / (Width1 * Height1);
+	if (mean0 * mean1 > 0)
+		PresentExposure = (float)(1.0 / (Width0 * mean0 * mean1));
+
+	return CL_SUCCESS;
+}
+
+
+// Average time of BenchmarkFrames launches on the compute queue, after an untimed one
+static double
+TimeKernel(cl_kernel kernel, size_t *global, size_t *local, int *err)
+{
+	double ms = 0;
+
+	for (int f = 0; f <= BenchmarkFrames && !*err; f++)
+	{
+		cl_event event;
+
+		*err = clEnqueueNDRangeKernel(ComputeCommands, kernel, 2, NULL, global, local, 0, NULL, &event);
+		if (*err)
+			break;
+
+		clWaitForEvents(1, &event);
+		double time = GetEventTime(event);
+		if (f)
+			ms += time / BenchmarkFrames;
+	}
+
+	return ms;
+}
+
+// Largest difference from the reference relative to its largest magnitude, a NaN
+// counts as infinite. The relative rms difference goes to rms when it is given
+static double
+MatrixError(const float *result, const float *reference, size_t count, double *rms)
+{
+	double magnitude = 0;
+	double diff = 0;
+	double sum = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		double d = fabs((double)result[i] - reference[i]);
+		diff = (d > diff || d != d) ? d : diff;
+		sum += d * d;
+		magnitude = fabs(reference[i]) > magnitude ? fabs(reference[i]) : magnitude;
+	}
+
+	diff = (diff != diff) ? HUGE_VAL : diff;
+	if (rms)
+		*rms = (magnitude > 0 ? sqrt(sum / count) / magnitude : sqrt(sum / count));
+
+	return magnitude > 0 ? diff / magnitude : diff;
+}
+
+// Times the three GEMM kernels on the same inputs, checking the other two against mmmKernel
+static int
+CompareKernels(void)
+{
+	const char *names[3] = { COMPUTE_KERNEL_MATMUL_NAME, COMPUTE_KERNEL_MATMUL_LDS_NAME, COMPUTE_KERNEL_TILED_NAME };
+	size_t bytes = Width1 * Height0 * sizeof(float);
+	float *results[3] = { NULL, NULL, NULL };
+	double ms[3] = { 0, 0, 0 };
+	double error[3] = { 0, 0, 0 };
+	int err = 0;
+	int k;
+
+	cl_mem output = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+	if (!output || err != CL_SUCCESS)
+	{
+		printf("Failed to create comparison buffer! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixA, CL_TRUE, 0, Width0 * Height0 * sizeof(float), Input0, 0, NULL, NULL);
+	clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixB, CL_TRUE, 0, Width1 * Height1 * sizeof(float), Input1, 0, NULL, NULL);
+
+	for (k = 0; k < 3 && !err; k++)
+	{
+		size_t global[2] = { (size_t)Width1 / (k == 2 ? RegTileN : 4), (size_t)Height0 / (k == 2 ? RegTileM : 4) };
+		size_t local[2] = { (size_t)BlockSize, (size_t)BlockSize };
+
+		cl_kernel kernel = clCreateKernel(ComputeProgram, names[k], &err);
+		if (!kernel || err != CL_SUCCESS)
+		{
+			printf("Failed to create kernel '%s'! %d\n", names[k], err);
+			break;
 		}
-		printf("Platform found : %s\n", platformName);
-		free(platforms);
+
+		err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &ComputeMatrixA);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &ComputeMatrixB);
+		err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &output);
+		err |= clSetKernelArg(kernel, 3, sizeof(cl_int), &Width0);
+		if (k == 1)
+			err |= clSetKernelArg(kernel, 4, (BlockSize * 4) * (BlockSize * 4) * sizeof(cl_float), NULL);
+		else
+			err |= clSetKernelArg(kernel, 4, sizeof(cl_int), &Width1);
+
+		if (!err)
+			ms[k] = TimeKernel(kernel, global, local, &err);
+
+		results[k] = (float *)malloc(bytes);
+		if (!err && results[k])
+			err = clEnqueueReadBuffer(ComputeCommands, output, CL_TRUE, 0, bytes, results[k], 0, NULL, NULL);
+
+		clReleaseKernel(kernel);
+		if (err)
+			printf("Failed to run kernel '%s'! %d\n", names[k], err);
 	}
-	if(NULL == platform_id)
+
+	if (!err && results[0] && results[1] && results[2])
 	{
-		printf("NULL platform found so Exiting Application.\n");
-		return EXIT_FAILURE;
+		for (k = 1; k < 3; k++)
+			error[k] = MatrixError(results[k], results[0], bytes / sizeof(float), NULL);
+
+		printf(SEPARATOR);
+		printf("GEMM kernel comparison (%d frames, %d x %d x %d, %dx%d register tile, k tile %d)\n", BenchmarkFrames,
+			Height0, Width1, Width0, RegTileM, RegTileN, TileK);
+		for (k = 0; k < 3; k++)
+			printf("  %-22s %8.3f ms  %8.1f GFLOP/s  max error %.2e\n", names[k], ms[k],
+				KernelFlops() / ms[k] * 1e-6, error[k]);
+		printf("  Tiled speedup:   %5.2fx over %s  %5.2fx over %s\n", ms[0] / ms[2], names[0], ms[1] / ms[2], names[1]);
+		printf(SEPARATOR);
+
+		if (fp)
+			fprintf(fp, "GEMM %.1f %.1f %.1f GFLOP/s Tiled %dx%d k %d\n", KernelFlops() / ms[0] * 1e-6,
+				KernelFlops() / ms[1] * 1e-6, KernelFlops() / ms[2] * 1e-6, RegTileM, RegTileN, TileK);
 	}
 
-// Get ID for the device
-	err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
-	if (err != CL_SUCCESS)
+	for (k = 0; k < 3; k++)
+		free(results[k]);
+	clReleaseMemObject(output);
+
+	Update = 1;
+	return err ? err : CL_SUCCESS;
+}
+
+// fp32 to fp16 with round to nearest even, the layout vload_half reads
+static cl_half
+FloatToHalf(float value)
+{
+	union { float f; unsigned int u; } bits;
+	bits.f = value;
+
+	unsigned int sign = (bits.u >> 16) & 0x8000;
+	unsigned int mantissa = bits.u & 0x7fffff;
+	int exponent = (int)((bits.u >> 23) & 0xff) - 127 + 15;
+
+	if (((bits.u >> 23) & 0xff) == 0xff)
+		return (cl_half)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31)
+		return (cl_half)(sign | 0x7c00);
+	if (exponent < -10)
+		return (cl_half)sign;
+
+	// Subnormal halves keep the implicit bit in the mantissa
+	unsigned int shift = 13;
+	if (exponent <= 0)
 	{
-		printf("Error: Failed to locate compute device!\n");
-		return EXIT_FAILURE;
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+		exponent = 0;
 	}
 
-// Create a context  
-	cl_context_properties properties[] =
+	unsigned int half = (exponent << 10) | (mantissa >> shift);
+	unsigned int rest = mantissa & ((1u << shift) - 1);
+	unsigned int middle = 1u << (shift - 1);
+
+	// A carry out of the mantissa moves on to the next exponent, as it should
+	if (rest > middle || (rest == middle && (half & 1)))
+		half++;
+
+	return (cl_half)(sign | half);
+}
+
+// Symmetric int8 quantization with one scale per row, or per column when columns is set
+static void
+QuantizeInt8(const float *input, cl_char *output, float *scales, int width, int height, int columns)
+{
+	int lines = columns ? width : height;
+	int length = columns ? height : width;
+
+	for (int l = 0; l < lines; l++)
 	{
-		CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
-		CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
-		CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_id),
-		0
-	};
+		float largest = 0;
+		for (int i = 0; i < length; i++)
+		{
+			float value = fabsf(input[columns ? i * width + l : l * width + i]);
+			largest = value > largest ? value : largest;
+		}
 
-// Create a context from a CGL share group
-//
-	ComputeContext = clCreateContext(properties, 1, &ComputeDeviceId, NULL, 0, 0);
-	if (!ComputeContext)
+		scales[l] = largest > 0 ? largest / 127.0f : 1.0f;
+		for (int i = 0; i < length; i++)
+		{
+			int index = columns ? i * width + l : l * width + i;
+			output[index] = (cl_char)floorf(input[index] / scales[l] + 0.5f);
+		}
+	}
+}
+
+// Runs mmmKernel on fp32 inputs, then on fp16 and int8 copies quantized on the host,
+// reporting the throughput of each and its error against the fp32 result
+static int
+ComparePrecision(void)
+{
+	const char *names[3] = { COMPUTE_KERNEL_MATMUL_NAME, COMPUTE_KERNEL_HALF_NAME, COMPUTE_KERNEL_INT8_NAME };
+	const char *labels[3] = { "fp32", "fp16", "int8" };
+	size_t element_sizes[3] = { sizeof(cl_float), sizeof(cl_half), sizeof(cl_char) };
+	int buffer_counts[3] = { 2, 2, 4 };
+	size_t count0 = Width0 * Height0;
+	size_t count1 = Width1 * Height1;
+	size_t bytes = Width1 * Height0 * sizeof(float);
+	size_t global[2] = { (size_t)Width1 / 4, (size_t)Height0 / 4 };
+	size_t local[2] = { (size_t)BlockSize, (size_t)BlockSize };
+	cl_mem buffers[3][4] = { { ComputeMatrixA, ComputeMatrixB, 0, 0 } };
+	float *results[3] = { NULL, NULL, NULL };
+	double ms[3] = { 0, 0, 0 };
+	double quantize[3] = { 0, 0, 0 };
+	double error[3] = { 0, 0, 0 };
+	double rms[3] = { 0, 0, 0 };
+	char extensions[4096] = {0};
+	int err = 0;
+	int k;
+
+	clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_EXTENSIONS, sizeof(extensions), extensions, NULL);
+	int native_half = strstr(extensions, "cl_khr_fp16") != NULL;
+
+	cl_half *half0 = (cl_half *)malloc(count0 * sizeof(cl_half));
+	cl_half *half1 = (cl_half *)malloc(count1 * sizeof(cl_half));
+	cl_char *char0 = (cl_char *)malloc(count0 * sizeof(cl_char));
+	cl_char *char1 = (cl_char *)malloc(count1 * sizeof(cl_char));
+	float *scale0 = (float *)malloc(Height0 * sizeof(float));
+	float *scale1 = (float *)malloc(Width1 * sizeof(float));
+	cl_mem output = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+	if (!half0 || !half1 || !char0 || !char1 || !scale0 || !scale1 || !output)
 	{
-		printf("Error: Failed to create a compute context!\n");
-		return EXIT_FAILURE;
+		printf("Failed to allocate quantized inputs! %d\n", err);
+		err = EXIT_FAILURE;
 	}
 
-#else
+	// The quantization is timed as well, it runs whenever the inputs change
+	if (!err)
+	{
+		double start = GetPreciseTime();
+		for (size_t i = 0; i < count0; i++)
+			half0[i] = FloatToHalf(Input0[i]);
+		for (size_t i = 0; i < count1; i++)
+			half1[i] = FloatToHalf(Input1[i]);
+		quantize[1] = GetPreciseTime() - start;
+
+		start = GetPreciseTime();
+		QuantizeInt8(Input0, char0, scale0, Width0, Height0, 0);
+		QuantizeInt8(Input1, char1, scale1, Width1, Height1, 1);
+		quantize[2] = GetPreciseTime() - start;
+
+		clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixA, CL_TRUE, 0, count0 * sizeof(float), Input0, 0, NULL, NULL);
+		clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixB, CL_TRUE, 0, count1 * sizeof(float), Input1, 0, NULL, NULL);
+
+		cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+		buffers[1][0] = clCreateBuffer(ComputeContext, flags, count0 * sizeof(cl_half), half0, &err);
+		buffers[1][1] = clCreateBuffer(ComputeContext, flags, count1 * sizeof(cl_half), half1, &err);
+		buffers[2][0] = clCreateBuffer(ComputeContext, flags, count0 * sizeof(cl_char), char0, &err);
+		buffers[2][1] = clCreateBuffer(ComputeContext, flags, count1 * sizeof(cl_char), char1, &err);
+		buffers[2][2] = clCreateBuffer(ComputeContext, flags, Height0 * sizeof(float), scale0, &err);
+		buffers[2][3] = clCreateBuffer(ComputeContext, flags, Width1 * sizeof(float), scale1, &err);
+		if (!buffers[1][0] || !buffers[1][1] || !buffers[2][0] || !buffers[2][1] || !buffers[2][2] || !buffers[2][3])
+		{
+			printf("Failed to create quantized buffers! %d\n", err);
+			err = EXIT_FAILURE;
+		}
+	}
 
-// Bind to platform
-	cl_platform_id platform_id;
+	for (k = 0; k < 3 && !err; k++)
+	{
+		cl_kernel kernel = clCreateKernel(ComputeProgram, names[k], &err);
+		if (!kernel || err != CL_SUCCESS)
+		{
+			printf("Failed to create kernel '%s'! %d\n", names[k], err);
+			break;
+		}
 
-	cl_uint numPlatforms;
-	cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
-	if (status != CL_SUCCESS)
+		// Inputs, output, then the scales of the int8 kernel and the widths
+		int a = 0;
+		err = clSetKernelArg(kernel, a++, sizeof(cl_mem), &buffers[k][0]);
+		err |= clSetKernelArg(kernel, a++, sizeof(cl_mem), &buffers[k][1]);
+		err |= clSetKernelArg(kernel, a++, sizeof(cl_mem), &output);
+		for (int b = 2; b < buffer_counts[k]; b++)
+			err |= clSetKernelArg(kernel, a++, sizeof(cl_mem), &buffers[k][b]);
+		err |= clSetKernelArg(kernel, a++, sizeof(cl_int), &Width0);
+		err |= clSetKernelArg(kernel, a++, sizeof(cl_int), &Width1);
+
+		if (!err)
+			ms[k] = TimeKernel(kernel, global, local, &err);
+
+		results[k] = (float *)malloc(bytes);
+		if (!err && results[k])
+			err = clEnqueueReadBuffer(ComputeCommands, output, CL_TRUE, 0, bytes, results[k], 0, NULL, NULL);
+
+		clReleaseKernel(kernel);
+		if (err)
+			printf("Failed to run kernel '%s'! %d\n", names[k], err);
+	}
+
+	if (!err && results[0] && results[1] && results[2])
 	{
-		printf("clGetPlatformIDs Failed\n");
-		return EXIT_FAILURE;
+		printf(SEPARATOR);
+		printf("Reduced precision GEMM (%d frames, %d x %d x %d, fp16 %s)\n", BenchmarkFrames, Height0, Width1, Width0,
+			native_half ? "native" : "through vload_half");
+		for (k = 0; k < 3; k++)
+		{
+			double traffic = (double)(count0 + count1) * element_sizes[k] + bytes;
+			if (k)
+				error[k] = MatrixError(results[k], results[0], bytes / sizeof(float), &rms[k]);
+
+			printf("  %s  %8.3f ms  %8.1f GFLOP/s  %7.1f GB/s  quantize %8.3f ms  max error %.2e  rms %.2e\n", labels[k],
+				ms[k], KernelFlops() / ms[k] * 1e-6, traffic / ms[k] * 1e-6, quantize[k], error[k], rms[k]);
+
+			if (fp)
+				fprintf(fp, "Precision %s %.3f ms %.1f GFLOP/s Error %.2e RMS %.2e\n", labels[k], ms[k],
+					KernelFlops() / ms[k] * 1e-6, error[k], rms[k]);
+		}
+		printf(SEPARATOR);
 	}
 
-	if (0 < numPlatforms)
+	for (k = 1; k < 3; k++)
+		for (int b = 0; b < 4; b++)
+			if (buffers[k][b])
+				clReleaseMemObject(buffers[k][b]);
+	for (k = 0; k < 3; k++)
+		free(results[k]);
+	if (output)
+		clReleaseMemObject(output);
+	free(half0);
+	free(half1);
+	free(char0);
+	free(char1);
+	free(scale0);
+	free(scale1);
+
+	Update = 1;
+	return err ? err : CL_SUCCESS;
+}
+
+// Plain triple loop over one n x n product
+static void
+MultiplyReference(const float *a, const float *b, float *c, int n)
+{
+	for (int row = 0; row < n; row++)
 	{
-		cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
+		for (int col = 0; col < n; col++)
+		{
+			float sum = 0;
+			for (int k = 0; k < n; k++)
+				sum += a[row * n + k] * b[k * n + col];
+			c[row * n + col] = sum;
+		}
+	}
+}
 
-		status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+// Multiplies count n x n matrices in one NDRange, or with one launch per matrix the
+// way mmmKernel would be driven, and returns the wall time of a pass in ms
+static double
+RunBatched(cl_kernel kernel, cl_mem *buffers, int buffer_count, int n, int count, int per_launch)
+{
+	int items = n * n / 4;
+	int per_group = (BATCHED_GROUP_SIZE / items > 1) ? BATCHED_GROUP_SIZE / items : 1;
+	size_t local = BATCHED_GROUP_SIZE;
+	size_t global = ((count + per_group - 1) / per_group) * local;
+	int first = 0;
+	int err = 0;
 
-		char platformName[100];
-		for (unsigned i = 0; i < numPlatforms; ++i)
+	for (int b = 0; b < buffer_count; b++)
+		err |= clSetKernelArg(kernel, b, sizeof(cl_mem), &buffers[b]);
+	err |= clSetKernelArg(kernel, buffer_count, sizeof(cl_int), &n);
+	err |= clSetKernelArg(kernel, buffer_count + 1, sizeof(cl_int), &count);
+	err |= clSetKernelArg(kernel, buffer_count + 2, sizeof(cl_int), &first);
+
+	// The first pass is not timed
+	if (!err)
+		err = clEnqueueNDRangeKernel(ComputeCommands, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
+	clFinish(ComputeCommands);
+
+	double start = GetPreciseTime();
+	for (int p = 0; p < BATCHED_PASSES && !err; p++)
+	{
+		if (!per_launch)
 		{
-			status = clGetPlatformInfo(platforms[i],
-				CL_PLATFORM_VENDOR,
-				sizeof(platformName),
-				platformName,
-				NULL);
-			platform_id = platforms[i];
-			if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
-			{
-				break;
-			}
+			err = clEnqueueNDRangeKernel(ComputeCommands, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
+			continue;
+		}
+
+		for (first = 0; first < count && !err; first++)
+		{
+			int end = first + 1;
+			err = clSetKernelArg(kernel, buffer_count + 1, sizeof(cl_int), &end);
+			err |= clSetKernelArg(kernel, buffer_count + 2, sizeof(cl_int), &first);
+			err |= clEnqueueNDRangeKernel(ComputeCommands, kernel, 1, NULL, &local, &local, 0, NULL, NULL);
 		}
-		printf("Platform found : %s\n", platformName);
-		free(platforms);
 	}
-	if(NULL == platform_id)
+	clFinish(ComputeCommands);
+
+	if (err)
 	{
-		printf("NULL platform found so Exiting Application.\n");
-		return EXIT_FAILURE;
+		printf("Failed to run batched kernel! %d\n", err);
+		return -1;
 	}
 
-// Get ID for the device
-	err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
-	if (err != CL_SUCCESS)
+	return (GetPreciseTime() - start) / BATCHED_PASSES;
+}
+
+// Largest difference between the checked matrices of a batch and the CPU, relative
+// to the largest reference magnitude. Returns the CPU time per matrix in ms
+static double
+CheckBatched(const float *a, const float *b, const float *c, const cl_uint *slots, int n, int count, double *error)
+{
+	int checked = count < BATCHED_CHECK ? count : BATCHED_CHECK;
+	float *reference = (float *)malloc(n * n * sizeof(float));
+	double magnitude = 0;
+	double diff = 0;
+	double cpu = 0;
+
+	if (!reference)
+		return 0;
+
+	for (int m = 0; m < checked; m++)
 	{
-		printf("Error: Failed to locate compute device!\n");
-		return EXIT_FAILURE;
+		// slots are in float4s, the same as the kernels see them
+		size_t a_offset = slots ? 4 * (size_t)slots[3 * m] : (size_t)m * n * n;
+		size_t b_offset = slots ? 4 * (size_t)slots[3 * m + 1] : (size_t)m * n * n;
+		size_t c_offset = slots ? 4 * (size_t)slots[3 * m + 2] : (size_t)m * n * n;
+
+		double start = GetPreciseTime();
+		MultiplyReference(a + a_offset, b + b_offset, reference, n);
+		cpu += GetPreciseTime() - start;
+
+		for (int i = 0; i < n * n; i++)
+		{
+			double d = fabs((double)c[c_offset + i] - reference[i]);
+			diff = (d > diff || d != d) ? d : diff;
+			magnitude = fabs(reference[i]) > magnitude ? fabs(reference[i]) : magnitude;
+		}
 	}
+	free(reference);
 
-// Create a context containing the compute device(s)
-//
-	ComputeContext = clCreateContext(0, 1, &ComputeDeviceId, NULL, NULL, &err);
-	if (!ComputeContext)
+	diff = (diff != diff) ? HUGE_VAL : diff;
+	diff = magnitude > 0 ? diff / magnitude : diff;
+	*error = diff > *error ? diff : *error;
+
+	return cpu / checked;
+}
+
+// One point of the batched sweep, count n x n products in each layout
+static int
+CompareBatchedPoint(cl_kernel strided, cl_kernel indexed, int n, int count)
+{
+	size_t elements = (size_t)count * n * n;
+	int items = n * n / 4;
+	int err = 0;
+	double error = 0;
+	cl_mem buffers[4] = { 0, 0, 0, 0 };
+
+	float *a = CreateRandomFilledArray_Float(n * n, count, 0.0, 1.0);
+	float *b = CreateRandomFilledArray_Float(n * n, count, 0.0, 1.0);
+	float *c = (float *)malloc(elements * sizeof(float));
+	cl_uint *slots = (cl_uint *)malloc(3 * count * sizeof(cl_uint));
+	if (!a || !b || !c || !slots)
 	{
-		printf("Error: Failed to create a compute context!\n");
+		printf("Failed to allocate batch of %d %dx%d matrices!\n", count, n, n);
+		free(a);
+		free(b);
+		free(c);
+		free(slots);
 		return EXIT_FAILURE;
 	}
 
-#endif
+	// The indexed layout scatters A and B through their buffers
+	for (int m = 0; m < count; m++)
+	{
+		slots[3 * m] = (count - 1 - m) * items;
+		slots[3 * m + 1] = ((m + count / 2) % count) * items;
+		slots[3 * m + 2] = m * items;
+	}
 
-	unsigned int device_count;
-	cl_device_id device_ids[16];
+	buffers[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, elements * sizeof(float), a, &err);
+	buffers[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, elements * sizeof(float), b, &err);
+	buffers[2] = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, elements * sizeof(float), NULL, &err);
+	buffers[3] = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 3 * count * sizeof(cl_uint), slots, &err);
+	if (!buffers[0] || !buffers[1] || !buffers[2] || !buffers[3])
+	{
+		printf("Failed to create batch buffers! %d\n", err);
+		err = EXIT_FAILURE;
+	}
 
-	err = clGetContextInfo(ComputeContext, CL_CONTEXT_DEVICES, sizeof(device_ids), device_ids, &returned_size);
-	if(err)
+	double strided_ms = err ? -1 : RunBatched(strided, buffers, 3, n, count, 0);
+	double cpu_ms = 0;
+	if (strided_ms >= 0)
 	{
-		printf("Error: Failed to retrieve compute devices for context!\n");
-		return EXIT_FAILURE;
+		err = clEnqueueReadBuffer(ComputeCommands, buffers[2], CL_TRUE, 0, elements * sizeof(float), c, 0, NULL, NULL);
+		cpu_ms = CheckBatched(a, b, c, NULL, n, count, &error);
 	}
 
-	device_count = returned_size / sizeof(cl_device_id);
+	double indexed_ms = (err || strided_ms < 0) ? -1 : RunBatched(indexed, buffers, 4, n, count, 0);
+	if (indexed_ms >= 0)
+	{
+		err = clEnqueueReadBuffer(ComputeCommands, buffers[2], CL_TRUE, 0, elements * sizeof(float), c, 0, NULL, NULL);
+		CheckBatched(a, b, c, slots, n, count, &error);
+	}
 
-	unsigned int i = 0;
-	int device_found = 0;
-	cl_device_type device_type; 
-	for(i = 0; i < device_count; i++) 
+	double launch_ms = (err || indexed_ms < 0) ? -1 : RunBatched(strided, buffers, 3, n, count, 1);
+	if (launch_ms >= 0 && !err)
 	{
-		clGetDeviceInfo(device_ids[i], CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, NULL);
-		if(device_type == ComputeDeviceType) 
-		{
-			ComputeDeviceId = device_ids[i];
-			device_found = 1;
-			break;
-		} 
+		printf("  %4d %6d %15.0f %15.0f %15.0f %15.0f %11.2e\n", n, count, 1000.0 * count / strided_ms,
+			1000.0 * count / indexed_ms, 1000.0 * count / launch_ms, cpu_ms > 0 ? 1000.0 / cpu_ms : 0.0, error);
+
+		if (fp)
+			fprintf(fp, "Batched %d x %d Strided %.0f Indexed %.0f PerLaunch %.0f CPU %.0f matrices/s Error %.2e\n", count, n,
+				1000.0 * count / strided_ms, 1000.0 * count / indexed_ms, 1000.0 * count / launch_ms,
+				cpu_ms > 0 ? 1000.0 / cpu_ms : 0.0, error);
 	}
+	else if (!err)
+		err = EXIT_FAILURE;
+
+	for (int i = 0; i < 4; i++)
+		if (buffers[i])
+			clReleaseMemObject(buffers[i]);
+	free(a);
+	free(b);
+	free(c);
+	free(slots);
+
+	return err;
+}
 
-	if(!device_found)
+// Sweeps batch counts and sizes of small products, comparing one NDRange over the
+// batch in either layout with a launch per matrix and with the CPU
+static int
+CompareBatched(void)
+{
+	static const int sizes[] = { 16, 32, 64, 128 };
+	static const int counts[] = { 64, 256, 1024, 4096 };
+	int err = 0;
+
+	cl_kernel strided = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_BATCHED_NAME, &err);
+	cl_kernel indexed = strided ? clCreateKernel(ComputeProgram, COMPUTE_KERNEL_INDEXED_NAME, &err) : 0;
+	if (!strided || !indexed)
 	{
-		printf("Error: Failed to locate compute device!\n");
+		printf("Failed to create batched kernels! %d\n", err);
+		if (strided)
+			clReleaseKernel(strided);
 		return EXIT_FAILURE;
 	}
 
-// Create a command queue
-//
-	ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
-	if (!ComputeCommands)
+	printf(SEPARATOR);
+	printf("Batched GEMM (%d passes, work-groups of %d, first %d matrices checked)\n", BATCHED_PASSES,
+		BATCHED_GROUP_SIZE, BATCHED_CHECK);
+	printf("     n  count   strided mat/s   indexed mat/s    launch mat/s       CPU mat/s   max error\n");
+
+	for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && !err; s++)
 	{
-		printf("Error: Failed to create a command queue!\n");
-		return EXIT_FAILURE;
+		for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]) && !err; c++)
+		{
+			if ((size_t)counts[c] * sizes[s] * sizes[s] > BATCHED_MAX_ELEMENTS)
+				continue;
+
+			err = CompareBatchedPoint(strided, indexed, sizes[s], counts[c]);
+		}
 	}
+	printf(SEPARATOR);
 
-// Report the device vendor and device name
-// 
-	cl_char vendor_name[1024] = {0};
-	cl_char device_name[1024] = {0};
-	err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, &returned_size);
-	err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, &returned_size);
-	if (err != CL_SUCCESS)
+	clReleaseKernel(strided);
+	clReleaseKernel(indexed);
+
+	Update = 1;
+	return err ? err : CL_SUCCESS;
+}
+
+static int
+CompareImageWrites(void)
+{
+	int err = 0;
+	size_t global[2];
+	size_t local[2];
+	cl_event kernel_event;
+	cl_event copy_event;
+	double buffer_kernel = 0;
+	double buffer_copy = 0;
+	double direct_kernel = 0;
+	double direct_copy = 0;
+
+	clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixA, CL_TRUE, 0, Width0 * Height0 * sizeof(float), Input0, 0, NULL, NULL);
+	clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixB, CL_TRUE, 0, Width1 * Height1 * sizeof(float), Input1, 0, NULL, NULL);
+
+	err = SetComputeKernelArgs(ComputeKernel, &ComputeMatrixC);
+	err |= SetComputeKernelArgs(ComputeImageKernel, &ComputeImage);
+	if (err)
+		return -10;
+
+	global[0] = Width1 / ItemCols();
+	global[1] = Height0 / ItemRows();
+	local[0] = BlockSize;
+	local[1] = BlockSize;
+
+	for (int f = 0; f < BenchmarkFrames; f++)
 	{
-		printf("Error: Failed to retrieve device info!\n");
-		return EXIT_FAILURE;
+		// Kernel into matrix C, then the presentation Recompute does every frame
+		err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, &kernel_event);
+		if (err)
+		{
+			printf("Failed to enqueue kernel! %d\n", err);
+			return err;
+		}
+
+		err = EnqueuePresent(&copy_event);
+		if (err)
+			return err;
+
+		clFinish(ComputeCommands);
+		buffer_kernel += GetEventTime(kernel_event);
+		buffer_copy += GetEventTime(copy_event);
+
+		// Kernel writing the image directly
+		err = EnqueueDirect(global, local, &kernel_event, &copy_event);
+		if (err)
+			return err;
+
+		clFinish(ComputeCommands);
+		direct_kernel += GetEventTime(kernel_event);
+		if (copy_event)
+			direct_copy += GetEventTime(copy_event);
 	}
 
+	buffer_kernel /= BenchmarkFrames;
+	buffer_copy /= BenchmarkFrames;
+	direct_kernel /= BenchmarkFrames;
+	direct_copy /= BenchmarkFrames;
+
 	printf(SEPARATOR);
-	printf("Connecting to %s %s...\n", vendor_name, device_name);
+	printf("Image write comparison (%d frames, %d x %d, %s)\n", BenchmarkFrames, TextureWidth, TextureHeight,
+		USE_GL_ATTACHMENTS ? "attached" : "copying");
+	printf("  Buffer + present: kernel %8.3f ms  copy %8.3f ms\n", buffer_kernel, buffer_copy);
+	printf("  Direct image:     kernel %8.3f ms  copy %8.3f ms\n", direct_kernel, direct_copy);
+	printf("  Saved per frame:  %8.3f ms\n", (buffer_kernel + buffer_copy) - (direct_kernel + direct_copy));
+	printf(SEPARATOR);
+
+	if (fp)
+		fprintf(fp, "Buffer %.3f + %.3f ms Direct %.3f + %.3f ms\n", buffer_kernel, buffer_copy, direct_kernel, direct_copy);
 
+	Update = 1;
 	return CL_SUCCESS;
 }
 
-static int 
-SetupComputeKernel(void)
+static int
+CompareDevices(void)
 {
 	int err = 0;
-	char *source = 0;
-	size_t length = 0;
-
-	if(ComputeKernel)
-		clReleaseKernel(ComputeKernel);    
-	ComputeKernel = 0;
+	int f;
+	cl_uint i, d;
+	size_t global[2];
+	size_t local[2];
+	double single[MAX_DEVICES];
+	double single_rate = 0;
+	double best = 0;
+	double multi;
+	double monolithic = 0;
+	float shares[MAX_DEVICES];
+
+	clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixA, CL_TRUE, 0, Width0 * Height0 * sizeof(float), Input0, 0, NULL, NULL);
+	clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixB, CL_TRUE, 0, Width1 * Height1 * sizeof(float), Input1, 0, NULL, NULL);
+
+	global[0] = Width1 / ItemCols();
+	global[1] = Height0 / ItemRows();
+	local[0] = BlockSize;
+	local[1] = BlockSize;
 
-	if(ComputeProgram)
-		clReleaseProgram(ComputeProgram);
-	ComputeProgram = 0;
+	memcpy(shares, DeviceShare, sizeof(shares));
 
-	printf(SEPARATOR);
-	printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);    
-	err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
-	if (!source || err)
+	// Each device on its own with the whole matrix
+	for(d = 0; d < DeviceCount; d++)
 	{
-		printf("Error: Failed to load kernel source!\n");
-		return EXIT_FAILURE;
-	}
+		for(i = 0; i < DeviceCount; i++)
+			DeviceShare[i] = (i == d) ? 1.0f : 0.0f;
 
-#if (DEBUG_INFO)
-	printf("%s", source);
-#endif
+		long start = GetCurrentTime();
+		for(f = 0; f < BenchmarkFrames && !err; f++)
+			err = EnqueueMultiDevice(global, local);
+		clFinish(ComputeCommands);
+		if (err)
+			return err;
 
-// Create the compute program from the source buffer
-//
-	ComputeProgram = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
-	if (!ComputeProgram || err != CL_SUCCESS)
-	{
-		printf("Error: Failed to create compute program!\n");
-		return EXIT_FAILURE;
+		single[d] = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+		single_rate += 1.0 / single[d];
+		if (!best || single[d] < best)
+			best = single[d];
 	}
-	free(source);
 
-// Build the program executable
-//
-	err = clBuildProgram(ComputeProgram, 0, NULL, NULL, NULL, NULL);
-	if (err != CL_SUCCESS)
-	{
-		size_t len;
-		char buffer[2048];
+	// All devices together, letting the balancer settle first when enabled
+	memcpy(DeviceShare, shares, sizeof(shares));
+	for(f = 0; f < (Balance ? BenchmarkFrames : 1) && !err; f++)
+		err = EnqueueMultiDevice(global, local);
+	clFinish(ComputeCommands);
 
-		printf("Error: Failed to build program executable!\n");
-		clGetProgramBuildInfo(ComputeProgram, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-		printf("%s\n", buffer);
-		return EXIT_FAILURE;
-	}
+	long start = GetCurrentTime();
+	for(f = 0; f < BenchmarkFrames && !err; f++)
+		err = EnqueueMultiDevice(global, local);
+	clFinish(ComputeCommands);
+	if (err)
+		return err;
 
-// Create the compute kernel from within the program
-//
-	if (Lds)
-	{
-		printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_MATMUL_LDS_NAME); 
-		ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_LDS_NAME, &err);
-	}
-	else
-	{
-		printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_MATMUL_NAME); 
-		ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_NAME, &err);
-	}
+	multi = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
 
-	if (!ComputeKernel || err != CL_SUCCESS)
+	// With fission the root device shares the context, time it on the whole problem
+	if (!FirstPrivateDevice)
 	{
-		printf("Error: Failed to create compute kernel!\n");
-		return EXIT_FAILURE;
+		start = GetCurrentTime();
+		for(f = 0; f < BenchmarkFrames && !err; f++)
+			err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, NULL);
+		clFinish(ComputeCommands);
+		if (err)
+			return err;
+
+		monolithic = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
 	}
 
-// Get the maximum work group size for executing the kernel on the device
-//
-	err = clGetKernelWorkGroupInfo(ComputeKernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &MaxWorkGroupSize, NULL);
-	if (err != CL_SUCCESS)
+	printf(SEPARATOR);
+	printf("Multi-device scaling (%d frames, %d x %d, %s)\n", BenchmarkFrames, Width1, Height0,
+		Balance ? "balanced" : "equal split");
+	for(d = 0; d < DeviceCount; d++)
 	{
-		printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-		exit(1);
+		cl_char device_name[1024] = {0};
+		clGetDeviceInfo(DeviceIds[d], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+		printf("  Device %2d: %8.3f ms  share %5.1f%%  %s\n", d, single[d], 100.0f * DeviceShare[d], device_name);
 	}
+	printf("  All devices: %8.3f ms  speedup %5.2fx  efficiency %5.1f%%\n",
+		multi, best / multi, 100.0 * (1.0 / multi) / single_rate);
+	if (!FirstPrivateDevice)
+		printf("  Monolithic:  %8.3f ms  partitions %5.2fx\n", monolithic, monolithic / multi);
+	printf(SEPARATOR);
 
-#if (DEBUG_INFO)
-	printf("MaxWorkGroupSize: %d\n", MaxWorkGroupSize);
-	printf("WorkGroupItems: %d\n", WorkGroupItems);
-#endif
-
-	WorkGroupSize[0] = (MaxWorkGroupSize > 1) ? (MaxWorkGroupSize / WorkGroupItems) : MaxWorkGroupSize;
-	WorkGroupSize[1] = MaxWorkGroupSize / WorkGroupSize[0];
+	if (fp)
+		fprintf(fp, "Devices %d Best %.3f ms All %.3f ms Efficiency %.1f%%\n", DeviceCount, best, multi,
+			100.0 * (1.0 / multi) / single_rate);
+	if (fp && !FirstPrivateDevice)
+		fprintf(fp, "Monolithic %.3f ms\n", monolithic);
 
-	printf(SEPARATOR);
+	for(d = 0; d < DeviceCount; d++)
+		DeviceTime[d] = 0;
+	MultiDeviceCount = 0;
 
+	Update = 1;
 	return CL_SUCCESS;
-
 }
 
-static void
-Cleanup(void)
+static int
+CompareOverlap(void)
 {
-	clFinish(ComputeCommands);
-	clReleaseKernel(ComputeKernel);
-	clReleaseProgram(ComputeProgram);
-	clReleaseCommandQueue(ComputeCommands);
-	clReleaseMemObject(ComputeMatrixA);
-	clReleaseMemObject(ComputeMatrixB);
-	clReleaseMemObject(ComputeMatrixC);
-	clReleaseMemObject(ComputeImage);
-	clReleaseContext(ComputeContext);
+	int err = 0;
+	size_t global[2];
+	size_t local[2];
+	int chunks[2] = { 1, Chunks };
 
-	ComputeCommands = 0;
-	ComputeKernel = 0;
-	ComputeProgram = 0;    
-	ComputeMatrixA = 0;
-	ComputeMatrixB = 0;
-	ComputeMatrixC = 0;
-	ComputeImage = 0;
-	ComputeContext = 0;
-}
+	err = SetComputeKernelArgs(ComputeKernel, &ComputeMatrixC);
+	if (err)
+		return -10;
+
+	global[0] = Width1 / ItemCols();
+	global[1] = Height0 / ItemRows();
+	local[0] = BlockSize;
+	local[1] = BlockSize;
 
-static void
-Shutdown(void)
-{	
-	if (fp)
-		fclose(fp);
 	printf(SEPARATOR);
-	printf("Shutting down...\n");
-	Cleanup();
-	exit(0);
-}
+	printf("Transfer overlap (%d frames, %d x %d, %s)\n", BenchmarkFrames, Width1, Height0,
+		USE_GL_ATTACHMENTS ? "attached" : "copying");
 
-////////////////////////////////////////////////////////////////////////////////
+	for (int c = 0; c < 2; c++)
+	{
+		OverlapSpan = OverlapTransfer = OverlapCompute = OverlapHidden = 0;
+		OverlapCount = 0;
 
-static int 
-SetupGraphics(void)
-{
-	CreateTexture(Width, Height);
+		for (int f = 0; f < BenchmarkFrames && !err; f++)
+			err = EnqueueOverlapped(global, local, chunks[c]);
+		if (err)
+			return err;
 
-	glClearColor (0.0, 0.0, 0.0, 0.0);
+		printf("  %2d chunk(s):  span %8.3f ms  transfers %8.3f ms  kernels %8.3f ms  hidden %5.1f%%\n",
+			chunks[c], OverlapSpan / OverlapCount, OverlapTransfer / OverlapCount, OverlapCompute / OverlapCount,
+			OverlapTransfer > 0 ? 100.0 * OverlapHidden / OverlapTransfer : 0.0);
 
-	glDisable(GL_DEPTH_TEST);
-	glActiveTexture(GL_TEXTURE0);
-	glViewport(0, 0, Width, Height);
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
+		if (fp)
+			fprintf(fp, "Chunks %d Span %.3f ms Transfers %.3f ms Kernels %.3f ms Hidden %.3f ms\n", chunks[c],
+				OverlapSpan / OverlapCount, OverlapTransfer / OverlapCount, OverlapCompute / OverlapCount,
+				OverlapHidden / OverlapCount);
+	}
+	printf(SEPARATOR);
 
-	TexCoords[3][0] = 0.0f;
-	TexCoords[3][1] = 0.0f;
-	TexCoords[2][0] = Width;
-	TexCoords[2][1] = 0.0f;
-	TexCoords[1][0] = Width;
-	TexCoords[1][1] = Height;
-	TexCoords[0][0] = 0.0f;
-	TexCoords[0][1] = Height;
+	OverlapSpan = OverlapTransfer = OverlapCompute = OverlapHidden = 0;
+	OverlapCount = 0;
 
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	glVertexPointer(2, GL_FLOAT, 0, VertexPos);
-	glClientActiveTexture(GL_TEXTURE0);
-	glTexCoordPointer(2, GL_FLOAT, 0, TexCoords);
-	return GL_NO_ERROR;
+	Update = 1;
+	return CL_SUCCESS;
 }
 
-static int 
-Initialize(int gpu)
+// Animated frames with A and B refilled on the host and uploaded, as the frame
+// loop does by default, against mmmFill refilling them in place. Each step is
+// timed to its completion, and presentation is left out of both
+static int
+CompareInputs(void)
 {
-	int err;
-	err = SetupGraphics();
-	if (err != GL_NO_ERROR)
+	const char *labels[2] = { "host fill + upload", "device fill" };
+	double fill_ms[2] = { 0, 0 };
+	double upload_ms[2] = { 0, 0 };
+	double compute_ms[2] = { 0, 0 };
+	double fps[2] = { 0, 0 };
+	size_t global[2] = { (size_t)Width1 / ItemCols(), (size_t)Height0 / ItemRows() };
+	size_t local[2] = { (size_t)BlockSize, (size_t)BlockSize };
+	int err = SetComputeKernelArgs(ComputeKernel, &ComputeMatrixC);
+	int m, f;
+
+	for (m = 0; m < 2 && !err; m++)
 	{
-		printf ("Failed to setup OpenGL state!");
-		exit (err);
-	}
+		// One untimed frame each
+		for (f = 0; f <= BenchmarkFrames && !err; f++)
+		{
+			double start = GetPreciseTime();
+			double filled = start;
 
-	err = SetupComputeDevices(gpu);
-	if(err != CL_SUCCESS)
-	{
-		printf ("Failed to connect to compute device! Error %d\n", err);
-		exit (err);
-	}
+			if (m == 0)
+			{
+				RandomFillArray_Float(Input0, Width0, Height0, 0.0, 1.0);
+				RandomFillArray_Float(Input1, Width1, Height1, 0.0, 1.0);
+				filled = GetPreciseTime();
+				err = clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixA, CL_TRUE, 0, Width0 * Height0 * sizeof(float), Input0, 0, NULL, NULL);
+				err |= clEnqueueWriteBuffer(ComputeCommands, ComputeMatrixB, CL_TRUE, 0, Width1 * Height1 * sizeof(float), Input1, 0, NULL, NULL);
+			}
+			else
+			{
+				err = EnqueueInputFill();
+				err |= clFinish(ComputeCommands);
+				filled = GetPreciseTime();
+			}
+			double uploaded = GetPreciseTime();
 
-	cl_bool image_support;
-	err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_IMAGE_SUPPORT,
-		sizeof(image_support), &image_support, NULL);
-	if (err != CL_SUCCESS) {
-		printf("Unable to query device for image support");
-		exit(err);
-	}
-	if (image_support == CL_FALSE) {
-		printf("MatMul requires images: Images not supported on this device.");
-		return CL_IMAGE_FORMAT_NOT_SUPPORTED;
+			err |= EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, global, local, 0, NULL, NULL);
+			err |= clFinish(ComputeCommands);
+			if (f)
+			{
+				fill_ms[m] += (filled - start) / BenchmarkFrames;
+				upload_ms[m] += (uploaded - filled) / BenchmarkFrames;
+				compute_ms[m] += (GetPreciseTime() - uploaded) / BenchmarkFrames;
+			}
+		}
+		fps[m] = 1000.0 / (fill_ms[m] + upload_ms[m] + compute_ms[m]);
 	}
 
-	err = SetupComputeKernel();
-	if (err != CL_SUCCESS)
+	if (err)
 	{
-		printf ("Failed to setup compute kernel! Error %d\n", err);
-		exit (err);
+		printf("Failed to run input generation comparison! %d\n", err);
+		return err;
 	}
 
-	err = CreateComputeResource();
-	if(err != CL_SUCCESS)
-	{
-		printf ("Failed to create compute result! Error %d\n", err);
-		exit (err);
-	}
+	printf(SEPARATOR);
+	printf("Animated inputs (%d frames, A %d x %d, B %d x %d)\n", BenchmarkFrames, Height0, Width0, Height1, Width1);
+	for (m = 0; m < 2; m++)
+		printf("  %-20s fill %8.3f ms  upload %8.3f ms  compute %8.3f ms  %8.1f fps\n", labels[m], fill_ms[m],
+			upload_ms[m], compute_ms[m], fps[m]);
+	printf("  Device inputs: %.1f fps pure compute against %.1f fps end to end (%.2fx)\n", fps[1], fps[0], fps[1] / fps[0]);
+	printf(SEPARATOR);
 
-	Input0 = CreateRandomFilledArray_Float(Width0, Height0, 0.0, 1.0);
-	Input1 = CreateRandomFilledArray_Float(Width1, Height1, 0.0, 1.0);
-	Output = CreateRandomFilledArray_Float(Width1, Height0, 0.0, 1.0);
+	if (fp)
+		fprintf(fp, "Inputs Host %.3f ms %.1f fps Device %.3f ms %.1f fps\n", 1000.0 / fps[0], fps[0], 1000.0 / fps[1], fps[1]);
 
+	Update = 1;
 	return CL_SUCCESS;
 }
 
-
 static void
 ReportInfo(void)
 {
@@ -986,24 +2861,75 @@ ReportInfo(void)
 
 static void 
 ReportStats(
-	uint64_t uiStartTime, uint64_t uiEndTime)
+	double fStartTime, double fEndTime)
 {
-	TimeElapsed += SubtractTime(uiEndTime, uiStartTime);
+	double frame_ms = fEndTime - fStartTime;
+	int measured = MeasureFrame(&Frames, frame_ms);
+
+	TimeElapsed += frame_ms;
 
-	if(TimeElapsed && FrameCount && FrameCount > (int)ReportStatsInterval) 
+	// Frames the policy drops still go through the report to reset the per-frame
+	// counters, they are just not shown
+	if(TimeElapsed && FrameCount && (!measured || (FrameCount > (int)ReportStatsInterval && TimeElapsed >= MinRunTime)))
 	{
 		double fMs = (TimeElapsed / (double) FrameCount);
+		double fMean = fMs;
+		double fMad = 0;
+		double fLow = fMs;
+		double fHigh = fMs;
+		if (measured)
+			RobustStats(&Frames, &fMs, &fMad, &fLow, &fHigh);
 		double fFps = 1.0 / (fMs / 1000.0);
 
 		sprintf(StatsString, "[%s] Compute: %3.2f ms  Display: %3.2f fps (%s)\n", 
 			(ComputeDeviceType == CL_DEVICE_TYPE_GPU) ? "GPU" : "CPU", 
 			fMs, fFps, USE_GL_ATTACHMENTS ? "attached" : "copying");
+		sprintf(StatsString + strlen(StatsString) - 1, "  Mean: %3.2f ms  MAD: %3.2f ms  95%% CI: %3.2f-%3.2f ms\n",
+			fMean, fMad, fLow, fHigh);
+		if (Frames.count > MAX_WINDOW_FRAMES)
+			sprintf(StatsString + strlen(StatsString) - 1, "  Window: latest %d of %d frames\n",
+				MAX_WINDOW_FRAMES, Frames.count);
 
-		glutSetWindowTitle(StatsString);
-		if (fp)
-			fprintf(fp, "%s", StatsString);
+		if(Overlap && OverlapCount)
+		{
+			sprintf(StatsString + strlen(StatsString) - 1, "  Overlap: %3.2f ms span  %3.0f%% of transfers hidden\n",
+				OverlapSpan / OverlapCount, OverlapTransfer > 0 ? 100.0 * OverlapHidden / OverlapTransfer : 0.0);
+			OverlapSpan = OverlapTransfer = OverlapCompute = OverlapHidden = 0;
+			OverlapCount = 0;
+		}
+
+		if(MultiDevice && MultiDeviceCount)
+		{
+			for(cl_uint d = 0; d < DeviceCount && strlen(StatsString) < sizeof(StatsString) - 32; d++)
+			{
+				sprintf(StatsString + strlen(StatsString) - 1, "  [%d] %3.2f ms %3.0f%%\n",
+					d, DeviceTime[d] / MultiDeviceCount, 100.0f * DeviceShare[d]);
+				DeviceTime[d] = 0;
+			}
+			MultiDeviceCount = 0;
+		}
+
+		if(HostLaunches)
+		{
+			sprintf(StatsString + strlen(StatsString) - 1, "  Host: %3.1f us/frame (%2.1f%%) over %d frames %d args set %d cached %d launches\n",
+				HostSubmitFrames ? 1000.0 * HostSubmitTime / HostSubmitFrames : 0.0, 100.0 * HostSubmitTime / TimeElapsed,
+				HostSubmitFrames, HostArgSets, HostArgSkips, HostLaunches);
+			HostSubmitTime = 0;
+			HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+		}
+
+		if(Roofline)
+			ReportRoofline();
+
+		if(measured)
+		{
+			glutSetWindowTitle(StatsString);
+			if (fp)
+				fprintf(fp, "%s", StatsString);
+		}
 		FrameCount = 0;
 		TimeElapsed = 0;
+		Frames.count = 0;
 	}    
 }
 
@@ -1012,12 +2938,12 @@ Display_(void)
 {
 	FrameCount++;
 	ExecutionCount++;
-	uint64_t uiStartTime = GetCurrentTime();
+	double fStartTime = GetPreciseTime();
 
 	glClearColor (0.0, 0.0, 0.0, 0.0);
 	glClear (GL_COLOR_BUFFER_BIT);
 
-	if(Animated)
+	if(Animated && !DeviceGenerates())
 	{
 		RandomFillArray_Float(Input0, Width0, Height0, 0.0, 1.0);
 		RandomFillArray_Float(Input1, Width1, Height1, 0.0, 1.0);
@@ -1042,8 +2968,8 @@ Display_(void)
 
 	glFinish(); // for timing
 
-	uint64_t uiEndTime = GetCurrentTime();
-	ReportStats(uiStartTime, uiEndTime);
+	double fEndTime = GetPreciseTime();
+	ReportStats(fStartTime, fEndTime);
 	DrawText(TextOffset[0], TextOffset[1], 1, (Animated == 0) ? "Press space to animate" : " ");
 	glutSwapBuffers();
 }
@@ -1123,9 +3049,52 @@ int main(int argc, char** argv)
 		else if (strstr(argv[i], "-lds"))
 			Lds = 1;
 
+		else if (strstr(argv[i], "-precision"))
+			Precision = 1;
+
+		else if (strstr(argv[i], "-batched"))
+			Batched = 1;
+
+		else if (strstr(argv[i], "-tiled"))
+			Tiled = 1;
+
+		else if (strstr(argv[i], "-regtile"))
+		{
+			Tiled = 1;
+			if (sscanf(argv[i+1], "%dx%d", &RegTileM, &RegTileN) != 2)
+				RegTileM = RegTileN = atoi(argv[i+1]);
+		}
+
+		else if (strstr(argv[i], "-tilek"))
+		{
+			Tiled = 1;
+			TileK = atoi(argv[i+1]);
+		}
+
+		else if (strstr(argv[i], "-direct"))
+			Direct = 1;
+
+		else if (strstr(argv[i], "-multi"))
+			MultiDevice = 1;
+
+		else if (strstr(argv[i], "-balance"))
+			Balance = 1;
+
+		else if(strstr(argv[i], "-fission"))
+			FissionSpec = argv[i+1];
+
+		else if (strstr(argv[i], "-overlap"))
+			Overlap = 1;
+
+		else if (strstr(argv[i], "-chunks"))
+			Chunks = (atoi(argv[i+1]) > 1) ? atoi(argv[i+1]) : 1;
+
         else if(strstr(argv[i], "-animate"))
             Animated = 1;
 
+        else if(strstr(argv[i], "-devicegen"))
+            DeviceInputs = 1;
+
         else if(strstr(argv[i], "-output"))
         {
             EnableOutput = 1;
@@ -1135,6 +3104,33 @@ int main(int argc, char** argv)
         else if(strstr(argv[i], "-maxframe"))
             MaxNDRange = atoi(argv[i+1]);
 
+        else if(strstr(argv[i], "-buildopts"))
+            BuildOptions = argv[i+1];
+
+        else if(strstr(argv[i], "-discard"))
+            Frames.warmup_frames = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-steadycv"))
+            Frames.steady_cv = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-mintime"))
+            MinRunTime = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-roofline"))
+            Roofline = 1;
+
+        else if(strstr(argv[i], "-peakgflops"))
+        {
+            Roofline = 1;
+            Rooflines.peak_gflops = atof(argv[i+1]);
+        }
+
+        else if(strstr(argv[i], "-peakbw"))
+        {
+            Roofline = 1;
+            Rooflines.peak_bandwidth = atof(argv[i+1]);
+        }
+
         else if(strstr(argv[i], "-stride"))
         {
             ExecuteStride = atoi(argv[i+1]);
@@ -1150,11 +3146,39 @@ int main(int argc, char** argv)
 	glutCreateWindow (argv[0]);
 	if (Initialize (use_gpu) == GL_NO_ERROR)
 	{
+		if (Tiled && CompareKernels() != CL_SUCCESS)
+			Shutdown();
+
+		if (Precision && ComparePrecision() != CL_SUCCESS)
+			Shutdown();
+
+		if (Batched && CompareBatched() != CL_SUCCESS)
+			Shutdown();
+
+		if (Direct && CompareImageWrites() != CL_SUCCESS)
+			Shutdown();
+
+		if (MultiDevice && CompareDevices() != CL_SUCCESS)
+			Shutdown();
+
+		if (Overlap && CompareOverlap() != CL_SUCCESS)
+			Shutdown();
+
+		if (DeviceInputs && CompareInputs() != CL_SUCCESS)
+			Shutdown();
+
+		if (Roofline)
+			ShowRooflineModel(&Rooflines, KernelFlops(), KernelBytes());
+
 		glutDisplayFunc(Display_);
 		glutIdleFunc(Idle);
 		glutReshapeFunc(Reshape);
 		glutKeyboardFunc(Keyboard);
 
+		// Startup comparisons do not count towards the per-frame host overhead
+		HostSubmitTime = 0;
+		HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+
 		atexit(Shutdown);
 		printf("Starting event loop...\n");
 
@@ -27,6 +27,7 @@
 
 #include "CLUtil.hpp"
 #include "SDKBitMap.hpp"
+#include "MeasureUtil.h"
 using namespace appsdk;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -37,6 +38,9 @@ using namespace appsdk;
 #define COMPUTE_KERNEL_FILENAME_2       ("GaussianNoiseGL_Kernels2.cl")
 #define COMPUTE_KERNEL_METHOD_NAME      ("gaussian_transform")
 #define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#define MAX_CACHED_KERNELS              (8)
+#define MAX_CACHED_ARGS                 (16)
+#define MAX_CACHED_ARG_SIZE             (64)
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -54,6 +58,15 @@ static cl_uint                          PixelSize = sizeof(uchar4);
 
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef struct
+{
+    cl_kernel kernel;
+    size_t sizes[MAX_CACHED_ARGS];
+    unsigned char values[MAX_CACHED_ARGS][MAX_CACHED_ARG_SIZE];
+} KernelArgCache;
+
+typedef cl_event (*CreateEventFromGLsyncFn)(cl_context, cl_GLsync, cl_int *);
+
 static cl_context                       ComputeContext;
 static cl_command_queue                 ComputeCommands;
 static cl_kernel                        ComputeKernel;
@@ -62,6 +75,9 @@ static cl_program                       ComputeProgram1;
 static cl_program                       ComputeProgram2;
 static cl_device_id                     ComputeDeviceId;
 static cl_device_type                   ComputeDeviceType;
+static CreateEventFromGLsyncFn          CreateEventFromGLsync;
+static GLsync                           PendingFence;
+static cl_event                         PendingGLEvent;
 static cl_mem                           ComputeInputImage;
 static cl_mem                           ComputeOutputImage;
 static size_t                           MaxBlockSize;
@@ -75,6 +91,24 @@ static int Incre                        = 2;
 ////////////////////////////////////////////////////////////////////////////////
 
 static int MaxNDRange                   = 0x7FFFFFFF;
+static int BenchmarkFrames              = 20;
+
+static KernelArgCache ArgCache[MAX_CACHED_KERNELS];
+static double HostSubmitTime            = 0;
+static int HostSubmitFrames             = 0;
+static int HostArgSets                  = 0;
+static int HostArgSkips                 = 0;
+static int HostLaunches                 = 0;
+
+static const char *BuildOptions         = NULL;
+
+static int Roofline                     = 0;
+static RooflineStats Rooflines;
+static cl_event RooflineEvent           = 0;
+
+static int GLSyncEvents                 = 0;
+static double SyncStall                 = 0;
+static int SyncCount                    = 0;
 
 static int Width                        = 0;
 static int Height                       = 0;
@@ -98,12 +132,15 @@ static int FrameCount                   = 0;
 static int NDRangeCount                 = 0;
 static uint ReportStatsInterval         = 30;
 
+static FrameWindow Frames               = { 10, 5.0 };     // warm-up frames and steady cv
+static double MinRunTime                = 0;
+
 static float ShadowTextColor[4]         = { 0.0f, 0.0f, 0.0f, 1.0f };
 static float HighlightTextColor[4]      = { 0.9f, 0.9f, 0.9f, 1.0f };
 static uint TextOffset[2]               = { 25, 25 };
 
 static uint ShowStats                   = 1;
-static char StatsString[512]            = "\0";
+static char StatsString[1024]           = "\0";
 static uint ShowInfo                    = 1;
 static char InfoString[512]             = "\0";
 
@@ -128,20 +165,113 @@ static void Cleanup();
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static long
-GetCurrentTime()
+static double
+GetPreciseTime()
 {
     struct timeval tv;
 
     gettimeofday(&tv, NULL);
 
-    return tv.tv_sec * 1000 + tv.tv_usec/1000.0;
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Analytic work per launch of gaussian_transform: about 44 flops per pair of
+// pixels for the averages, the uniform deviates, Box-Muller and the blend,
+// counting each transcendental as one, against a uchar4 in and out per pixel
+static double
+KernelFlops(void)
+{
+    return 22.0 * Width * Height;
+}
+
+static double
+KernelBytes(void)
+{
+    return 2.0 * 4 * sizeof(unsigned char) * Width * Height;
+}
+
+static void
+CollectRoofline(void)
+{
+    if (!RooflineEvent)
+        return;
+
+    clWaitForEvents(1, &RooflineEvent);
+    Rooflines.time += GetEventTime(RooflineEvent);
+    Rooflines.count++;
+    RooflineEvent = 0;
 }
 
-static double 
-SubtractTime( long uiEndTime, long uiStartTime )
+// Appends the achieved rates of the kernel launches timed since the last report
+static void
+ReportRoofline(void)
 {
-    return uiEndTime - uiStartTime;
+    CollectRoofline();
+    AppendRoofline(&Rooflines, KernelFlops(), KernelBytes(), StatsString, sizeof(StatsString));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+ResetKernelArgs(void)
+{
+    memset(ArgCache, 0, sizeof(ArgCache));
+}
+
+// clSetKernelArg copies the value, so an argument that is bound to the same
+// bytes already can be skipped. Local memory sizes are always passed through.
+static cl_int
+SetKernelArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+{
+    KernelArgCache *cache = NULL;
+    cl_int err;
+
+    for (int i = 0; i < MAX_CACHED_KERNELS && !cache; i++)
+    {
+        if (ArgCache[i].kernel == kernel || !ArgCache[i].kernel)
+        {
+            cache = &ArgCache[i];
+            cache->kernel = kernel;
+        }
+    }
+
+    int cacheable = cache && value && index < MAX_CACHED_ARGS && size <= MAX_CACHED_ARG_SIZE;
+    if (cacheable && cache->sizes[index] == size && !memcmp(cache->values[index], value, size))
+    {
+        HostArgSkips++;
+        return CL_SUCCESS;
+    }
+
+    err = clSetKernelArg(kernel, index, size, value);
+    if (cacheable && err == CL_SUCCESS)
+    {
+        cache->sizes[index] = size;
+        memcpy(cache->values[index], value, size);
+    }
+    else if (cache && index < MAX_CACHED_ARGS)
+    {
+        cache->sizes[index] = 0;
+    }
+
+    HostArgSets++;
+    return err;
+}
+
+static cl_int
+EnqueueKernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t *offset, const size_t *global,
+    const size_t *local, cl_uint wait_count, const cl_event *wait_list, cl_event *event)
+{
+    HostLaunches++;
+    return clEnqueueNDRangeKernel(queue, kernel, dims, offset, global, local, wait_count, wait_list, event);
+}
+
+// A frame's argument setup and launches are timed as one block, the single
+// calls are too short to time on their own
+static void
+CountHostSubmit(double start)
+{
+    HostSubmitTime += GetHostTime() - start;
+    HostSubmitFrames++;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -477,11 +607,83 @@ RenderTexture( void *pvData )
 
 }
 
+static void
+SetupGLSync(cl_platform_id platform_id)
+{
+    size_t length = 0;
+    int supported = 0;
+
+    // Fences need the CL context to share the GL one, copying builds keep the hard syncs
+    if (USE_GL_ATTACHMENTS && GLEW_ARB_sync &&
+        clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_EXTENSIONS, 0, NULL, &length) == CL_SUCCESS)
+    {
+        char *extensions = (char *)calloc(length + 1, sizeof(char));
+        if (clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_EXTENSIONS, length, extensions, NULL) == CL_SUCCESS)
+            supported = strstr(extensions, "cl_khr_gl_event") != NULL;
+        free(extensions);
+    }
+
+    if (supported)
+        CreateEventFromGLsync = (CreateEventFromGLsyncFn)clGetExtensionFunctionAddressForPlatform(platform_id,
+            "clCreateEventFromGLsyncKHR");
+
+    if (!CreateEventFromGLsync)
+    {
+        printf("GL sync events not available, falling back to glFinish/clFinish...\n");
+        GLSyncEvents = 0;
+        return;
+    }
+
+    printf("Synchronizing with GL through cl_khr_gl_event...\n");
+}
+
+static void
+WaitForGL(void)
+{
+    double start = GetPreciseTime();
+    int err = CL_SUCCESS;
+
+    if (GLSyncEvents)
+    {
+        // The queue waits on a fence behind the GL commands issued so far, the host does not
+        PendingFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        PendingGLEvent = CreateEventFromGLsync(ComputeContext, (cl_GLsync)PendingFence, &err);
+        if (PendingGLEvent)
+            err = clEnqueueBarrierWithWaitList(ComputeCommands, 1, &PendingGLEvent, NULL);
+    }
+
+    if (!GLSyncEvents || !PendingGLEvent || err != CL_SUCCESS)
+        glFinish();
+
+    SyncStall += GetPreciseTime() - start;
+}
+
+static void
+WaitForCL(void)
+{
+    double start = GetPreciseTime();
+
+    // cl_khr_gl_event orders later GL commands after the release, a flush is enough
+    if (GLSyncEvents)
+        clFlush(ComputeCommands);
+    else
+        clFinish(ComputeCommands);
+
+    if (PendingGLEvent)
+        clReleaseEvent(PendingGLEvent);
+    if (PendingFence)
+        glDeleteSync(PendingFence);
+    PendingGLEvent = 0;
+    PendingFence = 0;
+
+    SyncStall += GetPreciseTime() - start;
+    SyncCount++;
+}
+
 static int
 Recompute(void)
 {
-    glFinish();
-
     if(!ComputeKernel || !ComputeOutputImage)
         return CL_SUCCESS;
 
@@ -498,6 +700,8 @@ Recompute(void)
         return CL_SUCCESS;
     }
 
+    WaitForGL();
+
     int err = 0;
 
 #if (USE_GL_ATTACHMENTS)
@@ -528,12 +732,16 @@ Recompute(void)
     sizes[s++] = sizeof(cl_mem);
     sizes[s++] = sizeof(int);
 
+    // The roofline wait for the last launch stays out of the host time
+    CollectRoofline();
+    double submit = GetHostTime();
+
     if(Animated || Update)
     {
         Update = 0;
         err = CL_SUCCESS;
         for (a = 0; a < s; a++)
-            err |= clSetKernelArg(ComputeKernel, a, sizes[a], values[a]);
+            err |= SetKernelArg(ComputeKernel, a, sizes[a], values[a]);
 
         if (err)
             return -10;
@@ -595,12 +803,13 @@ Recompute(void)
             (int)localThreads[0], (int)localThreads[1]);
 #endif
 
-    err = clEnqueueNDRangeKernel(ComputeCommands, ComputeKernel, 2, NULL, globalThreads, localThreads, 0, NULL, NULL);
+    err = EnqueueKernel(ComputeCommands, ComputeKernel, 2, NULL, globalThreads, localThreads, 0, NULL, Roofline ? &RooflineEvent : NULL);
     if (err)
     {
         printf("Failed to enqueue kernel! %d\n", err);
         return err;
     }
+    CountHostSubmit(submit);
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -670,7 +879,7 @@ Recompute(void)
 
 #endif  
 
-    clFinish(ComputeCommands);
+    WaitForCL();
 
     NDRangeCount++;
 
@@ -684,6 +893,8 @@ CreateComputeBuffers(void)
 {
     int err = 0;
 
+    ResetKernelArgs();
+
 #if (USE_GL_ATTACHMENTS)
 
     if(ComputeOutputImage)
@@ -987,13 +1198,17 @@ SetupComputeDevices(int gpu)
 
     // Create a command queue
     //
-    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
+    cl_command_queue_properties queue_properties = Roofline ? CL_QUEUE_PROFILING_ENABLE : 0;
+    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
     if (!ComputeCommands)
     {
         printf("Error: Failed to create a command queue!\n");
         return EXIT_FAILURE;
     }
 
+    if (GLSyncEvents)
+        SetupGLSync(platform_id);
+
     // Report the device vendor and device name
     // 
     cl_char vendor_name[1024] = {0};
@@ -1019,10 +1234,16 @@ SetupComputeKernel(void)
     char *source = 0;
     size_t length = 0;
 
+    ResetKernelArgs();
+
     if(ComputeKernel)
         clReleaseKernel(ComputeKernel);    
     ComputeKernel = 0;
 
+    // The options only go to the compile step, the linker does not accept most of them
+    if (BuildOptions)
+        printf("Compiling programs with options '%s'...\n", BuildOptions);
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     // Program 1
     if(ComputeProgram1)
@@ -1048,7 +1269,7 @@ SetupComputeKernel(void)
     }
     free(source);
 
-    err = clCompileProgram(ComputeProgram1, 0, 0, 0, 0, 0, 0, NULL, NULL);
+    err = clCompileProgram(ComputeProgram1, 0, 0, BuildOptions, 0, 0, 0, NULL, NULL);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to compile compute program 1!\n");
@@ -1080,7 +1301,7 @@ SetupComputeKernel(void)
     }
     free(source);
 
-    err = clCompileProgram(ComputeProgram2, 0, 0, 0, 0, 0, 0, NULL, NULL);
+    err = clCompileProgram(ComputeProgram2, 0, 0, BuildOptions, 0, 0, 0, NULL, NULL);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to compile compute program 2!\n");
@@ -1142,10 +1363,68 @@ SetupComputeKernel(void)
 
 }
 
+static int
+CompareSync(void)
+{
+    int err = 0;
+    int sync = GLSyncEvents;
+    int ndrange = NDRangeCount;
+    double ms[2];
+    double stall[2];
+
+    // The same frames with the hard syncs and then with the fences, both drained at the end
+    for (int mode = 0; mode < 2 && !err; mode++)
+    {
+        GLSyncEvents = mode;
+        SyncStall = 0;
+        SyncCount = 0;
+
+        glFinish();
+        clFinish(ComputeCommands);
+
+        double start = GetPreciseTime();
+        for (int f = 0; f < BenchmarkFrames && !err; f++)
+        {
+            Update = 1;
+            err = Recompute();
+        }
+        glFinish();
+        clFinish(ComputeCommands);
+
+        ms[mode] = (GetPreciseTime() - start) / BenchmarkFrames;
+        stall[mode] = SyncCount ? SyncStall / SyncCount : 0;
+    }
+
+    GLSyncEvents = sync;
+    NDRangeCount = ndrange;
+    SyncStall = 0;
+    SyncCount = 0;
+    if (err)
+        return err;
+
+    printf(SEPARATOR);
+    printf("GL/CL synchronization (%d frames)\n", BenchmarkFrames);
+    printf("  glFinish/clFinish: %8.3f ms per frame  stalled %8.3f ms\n", ms[0], stall[0]);
+    printf("  GL sync events:    %8.3f ms per frame  stalled %8.3f ms\n", ms[1], stall[1]);
+    printf("  Hard syncs cost    %8.3f ms per frame (%4.1f%%)\n", ms[0] - ms[1],
+        ms[0] > 0 ? 100.0 * (ms[0] - ms[1]) / ms[0] : 0.0);
+    printf(SEPARATOR);
+
+    if (fp)
+        fprintf(fp, "Hard %.3f ms Stall %.3f ms Fenced %.3f ms Stall %.3f ms\n", ms[0], stall[0], ms[1], stall[1]);
+
+    Update = 1;
+    return CL_SUCCESS;
+}
+
 static void
 Cleanup(void)
 {
     clFinish(ComputeCommands);
+    if (RooflineEvent)
+        clReleaseEvent(RooflineEvent);
+    RooflineEvent = 0;
+    ResetKernelArgs();
     clReleaseKernel(ComputeKernel);
     clReleaseProgram(ComputeProgram);
     clReleaseCommandQueue(ComputeCommands);
@@ -1292,24 +1571,64 @@ ReportInfo(void)
 
 static void 
 ReportStats(
-    uint64_t uiStartTime, uint64_t uiEndTime)
+    double fStartTime, double fEndTime)
 {
-    TimeElapsed += SubtractTime(uiEndTime, uiStartTime);
+    double frame_ms = fEndTime - fStartTime;
+    int measured = MeasureFrame(&Frames, frame_ms);
 
-    if(TimeElapsed && FrameCount && FrameCount > (int)ReportStatsInterval) 
+    TimeElapsed += frame_ms;
+
+    // Frames the policy drops still go through the report to reset the per-frame
+    // counters, they are just not shown
+    if(TimeElapsed && FrameCount && (!measured || (FrameCount > (int)ReportStatsInterval && TimeElapsed >= MinRunTime)))
     {
         double fMs = (TimeElapsed / (double) FrameCount);
+        double fMean = fMs;
+        double fMad = 0;
+        double fLow = fMs;
+        double fHigh = fMs;
+        if (measured)
+            RobustStats(&Frames, &fMs, &fMad, &fLow, &fHigh);
         double fFps = 1.0 / (fMs / 1000.0);
 
         sprintf(StatsString, "[%s] Compute: %3.2f ms  Display: %3.2f fps (%s)\n", 
             (ComputeDeviceType == CL_DEVICE_TYPE_GPU) ? "GPU" : "CPU", 
             fMs, fFps, USE_GL_ATTACHMENTS ? "attached" : "copying");
+        sprintf(StatsString + strlen(StatsString) - 1, "  Mean: %3.2f ms  MAD: %3.2f ms  95%% CI: %3.2f-%3.2f ms\n",
+            fMean, fMad, fLow, fHigh);
+        if (Frames.count > MAX_WINDOW_FRAMES)
+            sprintf(StatsString + strlen(StatsString) - 1, "  Window: latest %d of %d frames\n",
+                MAX_WINDOW_FRAMES, Frames.count);
 
-        glutSetWindowTitle(StatsString);
-        if (EnableOutput)
-            fprintf(fp, "%s\n", StatsString);
+        if(SyncCount)
+        {
+            sprintf(StatsString + strlen(StatsString) - 1, "  Sync: %3.2f ms stalled (%2.0f%%)\n",
+                SyncStall / SyncCount, 100.0 * SyncStall / TimeElapsed);
+            SyncStall = 0;
+            SyncCount = 0;
+        }
+
+        if(HostLaunches)
+        {
+            sprintf(StatsString + strlen(StatsString) - 1, "  Host: %3.1f us/frame (%2.1f%%) over %d frames %d args set %d cached %d launches\n",
+                HostSubmitFrames ? 1000.0 * HostSubmitTime / HostSubmitFrames : 0.0, 100.0 * HostSubmitTime / TimeElapsed,
+                HostSubmitFrames, HostArgSets, HostArgSkips, HostLaunches);
+            HostSubmitTime = 0;
+            HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+        }
+
+        if(Roofline)
+            ReportRoofline();
+
+        if(measured)
+        {
+            glutSetWindowTitle(StatsString);
+            if (EnableOutput)
+                fprintf(fp, "%s\n", StatsString);
+        }
         FrameCount = 0;
         TimeElapsed = 0;
+        Frames.count = 0;
     }    
 }
 
@@ -1318,7 +1637,7 @@ Display_(void)
 {
     FrameCount++;
     ExecutionCount++;
-    uint64_t uiStartTime = GetCurrentTime();
+    double fStartTime = GetPreciseTime();
 
     if(Animated)
     {
@@ -1347,8 +1666,8 @@ Display_(void)
 
     glFinish(); // for timing
     
-    uint64_t uiEndTime = GetCurrentTime();
-    ReportStats(uiStartTime, uiEndTime);
+    double fEndTime = GetPreciseTime();
+    ReportStats(fStartTime, fEndTime);
     DrawText(TextOffset[0], TextOffset[1], 1, (Animated == 0) ? "Press space to animate" : " ");
     WriteOutputImage(OUTPUT_IMAGE);
     glutSwapBuffers();
@@ -1452,6 +1771,36 @@ int main(int argc, char** argv)
         else if(strstr(argv[i], "-maxframe"))
             MaxNDRange = atoi(argv[i+1]);
 
+        else if(strstr(argv[i], "-glsync"))
+            GLSyncEvents = 1;
+
+        else if(strstr(argv[i], "-buildopts"))
+            BuildOptions = argv[i+1];
+
+        else if(strstr(argv[i], "-discard"))
+            Frames.warmup_frames = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-steadycv"))
+            Frames.steady_cv = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-mintime"))
+            MinRunTime = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-roofline"))
+            Roofline = 1;
+
+        else if(strstr(argv[i], "-peakgflops"))
+        {
+            Roofline = 1;
+            Rooflines.peak_gflops = atof(argv[i+1]);
+        }
+
+        else if(strstr(argv[i], "-peakbw"))
+        {
+            Roofline = 1;
+            Rooflines.peak_bandwidth = atof(argv[i+1]);
+        }
+
         else if(strstr(argv[i], "-stride"))
         {
             ExecuteStride = atoi(argv[i+1]);
@@ -1474,11 +1823,21 @@ int main(int argc, char** argv)
     glutCreateWindow (argv[0]);
     if (Initialize (use_gpu) == GL_NO_ERROR)
     {
+        if (GLSyncEvents && CompareSync() != CL_SUCCESS)
+            Shutdown();
+
+        if (Roofline)
+            ShowRooflineModel(&Rooflines, KernelFlops(), KernelBytes());
+
         glutDisplayFunc(Display_);
         glutIdleFunc(Idle);
         glutReshapeFunc(Reshape);
         glutKeyboardFunc(Keyboard);
 
+        // Startup comparisons do not count towards the per-frame host overhead
+        HostSubmitTime = 0;
+        HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+
         atexit(Shutdown);
         printf("Starting event loop...\n");
 
@@ -13,8 +13,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -25,13 +27,28 @@
 #include <CL/cl.h>
 #include <CL/cl_gl.h>
 
+#include "MeasureUtil.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 
 #define USE_GL_ATTACHMENTS              (1)  // enable OpenGL attachments for Compute results
 #define DEBUG_INFO                      (0)
 #define COMPUTE_KERNEL_FILENAME         ("NBody_Kernels.cl")
 #define COMPUTE_KERNEL_MATMUL_NAME      ("nbody_sim")
+#define MAX_BUILD_OPTION_SETS           (8)
 #define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#define MAX_CACHED_KERNELS              (8)
+#define MAX_CACHED_ARGS                 (16)
+#define MAX_CACHED_ARG_SIZE             (64)
+#define MAX_DEVICES                     (16)
+#define COMPUTE_KERNEL_CUTOFF_NAME      ("nbody_cutoff")
+#define MAX_GRID_CELLS                  (64)        // cells along each axis of the cutoff grid
+#define RADIX_BITS                      (4)         // digit bits of a sort pass, as in the kernels
+#define RADIX_RUN                       (64)        // keys counted and scattered by each work-item
+#define ZORDER_STEPS                    (64)        // steps of each Z-order reorder interval
+#define CUTOFF_CHECK_BODIES             (16384)     // largest cutoff sweep checked over all pairs
+#define SNAPSHOT_MAGIC                  ("NBODYSNP")
+#define SNAPSHOT_VERSION                (1)
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -86,18 +103,124 @@ const char *FragShaderSource =
 
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef struct
+{
+    cl_kernel kernel;
+    size_t sizes[MAX_CACHED_ARGS];
+    unsigned char values[MAX_CACHED_ARGS][MAX_CACHED_ARG_SIZE];
+} KernelArgCache;
+
+// Kernels of one short-range step, in launch order
+enum { CELL_COUNT, CELL_SCAN, CELL_SCATTER, CELL_FORCE, CELL_KERNEL_COUNT };
+
+typedef struct
+{
+    cl_kernel kernels[CELL_KERNEL_COUNT];
+    cl_mem cell_of;                     // cell of each body
+    cl_mem rank;                        // slot of each body within its cell
+    cl_mem cell_count;
+    cl_mem cell_start;                  // one more entry for the end of the last cell
+    cl_mem sorted_pos;
+    cl_mem sorted_vel;
+    cl_mem sorted_index;                // body each slot came from
+    cl_mem pair_count;                  // pairs within the cutoff of each slot
+    cl_kernel track;                    // cell_ids, only when the ids are tracked
+    cl_mem ids;                         // body each slot holds across the steps
+    cl_mem sorted_ids;
+    cl_float4 origin;                   // w is the cell width
+    cl_int4 dims;                       // w is the cell count
+    int bodies;
+    int cached;
+} CellGrid;
+
+// Kernels of one radix sort pass, in launch order
+enum { RADIX_COUNT, RADIX_SCAN, RADIX_SCATTER, RADIX_KERNEL_COUNT };
+
+typedef struct
+{
+    cl_kernel kernels[RADIX_KERNEL_COUNT];
+    cl_mem counts;                      // digit counts of each work-item's run
+    cl_mem starts;
+    cl_mem keys;                        // the other half of the ping-pong between passes
+    cl_mem values;
+    int size;
+    int items;
+    int passes;
+} RadixSort;
+
+typedef struct
+{
+    cl_kernel codes;
+    cl_kernel permute;
+    RadixSort sort;
+    cl_mem keys;                        // Z-order codes, sorted after a reorder
+    cl_mem order;                       // body each slot takes in a reorder
+    cl_mem ids;                         // body each slot held at the start
+    cl_mem sorted_pos;
+    cl_mem sorted_vel;
+    cl_mem sorted_ids;
+    cl_float4 frame;                    // w is 1024 over the width
+    int bodies;
+} ZOrder;
+
+// Snapshot file: this header, then the float4 positions and the float4
+// velocities of every body. The header is 64 bytes, so the arrays stay
+// aligned in a mapping of the file.
+typedef struct
+{
+    char magic[8];                      // SNAPSHOT_MAGIC without its terminator
+    cl_uint version;
+    cl_uint bodies;
+    cl_ulong step;                      // steps from the initial conditions
+    cl_float delta_time;
+    cl_float eps_sqr;
+    cl_uint reserved[8];
+} SnapshotHeader;
+
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    cl_command_queue queue;             // read backs beside the compute queue
+    cl_mem device;                      // positions, velocities and Z-order ids after the step
+    cl_mem pinned;
+    char *host;                         // mapping of pinned, in slot order
+    char *file;                         // the header and then the arrays in body order
+    unsigned char *seen;                // bodies already placed in the file image
+    cl_event ready;                     // read back of the pending checkpoint
+    int pending;
+    int quit;
+    int started;
+    int written;
+    int skipped;
+} SnapshotWriter;
+
+typedef cl_event (*CreateEventFromGLsyncFn)(cl_context, cl_GLsync, cl_int *);
+
 static cl_context                       ComputeContext;
 static cl_command_queue                 ComputeCommands;
 static cl_kernel                        ComputeKernel;
 static cl_program                       ComputeProgram;
 static cl_device_id                     ComputeDeviceId;
 static cl_device_type                   ComputeDeviceType;
+static CreateEventFromGLsyncFn          CreateEventFromGLsync;
+static GLsync                           PendingFence;
+static cl_event                         PendingGLEvent;
 static cl_mem                           ComputePosBuffer[2];
 static cl_mem                           ComputeVelBuffer[2];
 static size_t                           MaxWorkGroupSize;
 static int                              WorkGroupSize[1];
 static int                              WorkGroupItems = 32;
 static int                              CurrentBuffer = 0;
+static cl_device_id                     DeviceIds[MAX_DEVICES];
+static cl_command_queue                 DeviceCommands[MAX_DEVICES];
+static cl_mem                           DevicePos[MAX_DEVICES];
+static cl_mem                           DeviceVel[MAX_DEVICES];
+static cl_uint                          DeviceCount = 1;
+static cl_device_id                     ContextDeviceIds[MAX_DEVICES + 1];
+static cl_uint                          ContextDeviceCount = 1;
+static cl_uint                          FirstPrivateDevice = 1;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -116,6 +239,51 @@ static float espSqr                     = 500.0f;
 
 static int GroupSize                    = 128;
 static int MaxNDRange                   = 0x7FFFFFFF;
+static int BenchmarkFrames              = 20;
+
+static KernelArgCache ArgCache[MAX_CACHED_KERNELS];
+static double HostSubmitTime            = 0;
+static int HostSubmitFrames             = 0;
+static int HostArgSets                  = 0;
+static int HostArgSkips                 = 0;
+static int HostLaunches                 = 0;
+
+static int Roofline                     = 0;
+static RooflineStats Rooflines;
+static cl_event RooflineEvent           = 0;
+
+static int GLSyncEvents                 = 0;
+static double SyncStall                 = 0;
+static int SyncCount                    = 0;
+
+static int MultiDevice                  = 0;
+static int Balance                      = 0;
+static const char *FissionSpec          = NULL;
+static const char *BuildOptions         = NULL;
+static int BuildSweep                   = 0;
+static const char *BuildOptionSets[]    = { "", "-cl-mad-enable", "-cl-no-signed-zeros", "-cl-finite-math-only",
+                                            "-cl-unsafe-math-optimizations", "-cl-fast-relaxed-math", "-cl-opt-disable" };
+static float DeviceShare[MAX_DEVICES];
+static double DeviceTime[MAX_DEVICES];
+static int MultiDeviceCount             = 0;
+static float CutoffRadius               = 0;
+static const int CutoffBodyScales[]     = { 1, 4, 16 };
+static const float CutoffScales[]       = { 0.5f, 1.0f, 2.0f };
+static const char *CellKernelNames[]    = { "cell_count", "exclusive_scan", "cell_scatter", COMPUTE_KERNEL_CUTOFF_NAME };
+static CellGrid FrameGrid;
+static int ZOrderInterval               = 0;
+static const int ZOrderIntervals[]      = { 0, 64, 16, 4, 1 };
+static const char *RadixKernelNames[]   = { "radix_count", "exclusive_scan", "radix_scatter" };
+static ZOrder FrameOrder;
+static const char *RestartPath          = NULL;
+static const char *CheckpointPath       = NULL;
+static int CheckpointInterval           = 100;
+static cl_ulong SimulatedSteps          = 0;
+static int PauseCheckpoints             = 0;
+static int SnapshotBodyCount            = 0;
+static void *SnapshotMap                = NULL;
+static size_t SnapshotBytes             = 0;
+static SnapshotWriter Snapshots;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -124,12 +292,15 @@ static int FrameCount                   = 0;
 static int NDRangeCount                 = 0;
 static uint ReportStatsInterval         = 30;
 
+static FrameWindow Frames               = { 10, 5.0 };     // warm-up frames and steady cv
+static double MinRunTime                = 0;
+
 static float ShadowTextColor[4]         = { 0.0f, 0.0f, 0.0f, 1.0f };
 static float HighlightTextColor[4]      = { 0.9f, 0.9f, 0.9f, 1.0f };
 static uint TextOffset[2]               = { 25, 25 };
 
 static uint ShowStats                   = 1;
-static char StatsString[512]            = "\0";
+static char StatsString[1024]           = "\0";
 static uint ShowInfo                    = 1;
 static char InfoString[512]             = "\0";
 
@@ -155,961 +326,3023 @@ SubtractTime( long uiEndTime, long uiStartTime )
     return uiEndTime - uiStartTime;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-static int LoadTextFromFile(
-    const char *file_name, char **result_string, size_t *string_len)
+static double
+GetPreciseTime()
 {
-    int fd;
-    unsigned file_len;
-    struct stat file_status;
-    int ret;
-
-    *string_len = 0;
-    fd = open(file_name, O_RDONLY);
-    if (fd == -1)
-    {
-        printf("Error opening file %s\n", file_name);
-        return -1;
-    }
-    ret = fstat(fd, &file_status);
-    if (ret)
-    {
-        printf("Error reading status for file %s\n", file_name);
-        return -1;
-    }
-    file_len = file_status.st_size;
-
-    *result_string = (char*)calloc(file_len + 1, sizeof(char));
-    ret = read(fd, *result_string, file_len);
-    if (!ret)
-    {
-        printf("Error reading from file %s\n", file_name);
-        return -1;
-    }
+    struct timeval tv;
 
-    close(fd);
+    gettimeofday(&tv, NULL);
 
-    *string_len = file_len;
-    return 0;
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
 }
 
-static void DrawString(float x, float y, float color[4], char *buffer)
+// Analytic work per launch of nbody_sim: 20 flops per body pair for the
+// softened inverse cube and the acceleration sum, while DRAM only has to
+// deliver each body's position and velocity and take the new ones back
+static double
+KernelFlops(void)
 {
-    unsigned int uiLen, i;
-
-    glPushAttrib(GL_LIGHTING_BIT);
-    glDisable(GL_LIGHTING);
+    return 20.0 * DataBodyCount * DataBodyCount;
+}
 
-    glRasterPos2f(x, y);
-    glColor3f(color[0], color[1], color[2]);
-    uiLen = (unsigned int) strlen(buffer);
-    for (i = 0; i < uiLen; i++)
-    {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, buffer[i]);
-    }
-    glPopAttrib();
+static double
+KernelBytes(void)
+{
+    return 4.0 * 4 * sizeof(float) * DataBodyCount;
 }
 
-static void DrawText(float x, float y, int light, const char *format, ...)
+static void
+CollectRoofline(void)
 {
-    va_list args;
-    char buffer[256];
-    GLint iVP[4];
-    GLint iMatrixMode;
+    if (!RooflineEvent)
+        return;
 
-    va_start(args, format);
-    vsprintf(buffer, format, args);
-    va_end(args);
+    clWaitForEvents(1, &RooflineEvent);
+    Rooflines.time += GetEventTime(RooflineEvent);
+    Rooflines.count++;
+    RooflineEvent = 0;
+}
 
-    glPushAttrib(GL_LIGHTING_BIT);
-    glDisable(GL_LIGHTING);
-    glDisable(GL_BLEND);
+// Appends the achieved rates of the kernel launches timed since the last report
+static void
+ReportRoofline(void)
+{
+    CollectRoofline();
+    AppendRoofline(&Rooflines, KernelFlops(), KernelBytes(), StatsString, sizeof(StatsString));
+}
 
-    glGetIntegerv(GL_VIEWPORT, iVP);
-    glViewport(0, 0, WindowWidth, WindowHeight);
-    glGetIntegerv(GL_MATRIX_MODE, &iMatrixMode);
+////////////////////////////////////////////////////////////////////////////////
 
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
+static void
+ResetKernelArgs(void)
+{
+    memset(ArgCache, 0, sizeof(ArgCache));
+}
 
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
+// clSetKernelArg copies the value, so an argument that is bound to the same
+// bytes already can be skipped. Local memory sizes are always passed through.
+static cl_int
+SetKernelArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+{
+    KernelArgCache *cache = NULL;
+    cl_int err;
 
-    glScalef(2.0f / WindowWidth, -2.0f / WindowHeight, 1.0f);
-    glTranslatef(-WindowWidth / 2.0f, -WindowHeight / 2.0f, 0.0f);
+    for (int i = 0; i < MAX_CACHED_KERNELS && !cache; i++)
+    {
+        if (ArgCache[i].kernel == kernel || !ArgCache[i].kernel)
+        {
+            cache = &ArgCache[i];
+            cache->kernel = kernel;
+        }
+    }
 
-    if(light)
+    int cacheable = cache && value && index < MAX_CACHED_ARGS && size <= MAX_CACHED_ARG_SIZE;
+    if (cacheable && cache->sizes[index] == size && !memcmp(cache->values[index], value, size))
     {
-        glColor4fv(ShadowTextColor);
-        DrawString(x-0, y-0, ShadowTextColor, buffer);
+        HostArgSkips++;
+        return CL_SUCCESS;
+    }
 
-        glColor4fv(HighlightTextColor);
-        DrawString(x-2, y-2, HighlightTextColor, buffer);
+    err = clSetKernelArg(kernel, index, size, value);
+    if (cacheable && err == CL_SUCCESS)
+    {
+        cache->sizes[index] = size;
+        memcpy(cache->values[index], value, size);
     }
-    else
+    else if (cache && index < MAX_CACHED_ARGS)
     {
-        glColor4fv(HighlightTextColor);
-        DrawString(x-0, y-0, HighlightTextColor, buffer);
-
-        glColor4fv(ShadowTextColor);
-        DrawString(x-2, y-2, ShadowTextColor, buffer);   
+        cache->sizes[index] = 0;
     }
 
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-
-    glPopMatrix();
-    glMatrixMode(iMatrixMode);
-
-    glPopAttrib();
-    glViewport(iVP[0], iVP[1], iVP[2], iVP[3]);
+    HostArgSets++;
+    return err;
 }
 
-
-static float
-RandomFloat(float randMax, float randMin)
+static cl_int
+EnqueueKernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t *offset, const size_t *global,
+    const size_t *local, cl_uint wait_count, const cl_event *wait_list, cl_event *event)
 {
-    float result;
-    result =(float)rand() / (float)RAND_MAX;
-
-    return ((1.0f - result) * randMin + result *randMax);
+    HostLaunches++;
+    return clEnqueueNDRangeKernel(queue, kernel, dims, offset, global, local, wait_count, wait_list, event);
 }
 
-static int 
-InitData()
+// A frame's argument setup and launches are timed as one block, the single
+// calls are too short to time on their own
+static void
+CountHostSubmit(double start)
 {
-    // make sure DataParticleCount is multiple of group size
-    DataParticleCount = DataParticleCount < GroupSize ? GroupSize :
-    DataParticleCount;
-    DataParticleCount = (DataParticleCount / GroupSize) * GroupSize;
+    HostSubmitTime += GetHostTime() - start;
+    HostSubmitFrames++;
+}
 
-    DataBodyCount = DataParticleCount;
+////////////////////////////////////////////////////////////////////////////////
 
-    if (DataInput)
-        free(DataInput);
-    DataInput = (float *)calloc(1, DataBodyCount * sizeof(cl_float4));
+// Bounding box of the bodies, returns its largest extent
+static float
+BodyBounds(const float *bodies, int count, float *lo, float *hi)
+{
+    float extent = 0;
+    int i, j;
 
-    // initialization of inputs
-    for(int i = 0; i < DataBodyCount; ++i)
+    for (j = 0; j < 3; j++)
+        lo[j] = hi[j] = bodies[j];
+    for (i = 1; i < count; i++)
     {
-        int index = 4 * i;
-
-        // First 3 values are position in x,y and z direction
-        for(int j = 0; j < 3; ++j)
+        for (j = 0; j < 3; j++)
         {
-            DataInput[index + j] = RandomFloat(3, 50);
+            lo[j] = (bodies[4 * i + j] < lo[j]) ? bodies[4 * i + j] : lo[j];
+            hi[j] = (bodies[4 * i + j] > hi[j]) ? bodies[4 * i + j] : hi[j];
         }
-
-        // Mass value
-        DataInput[index + 3] = RandomFloat(1, 1000);
     }
+    for (j = 0; j < 3; j++)
+        extent = (hi[j] - lo[j] > extent) ? hi[j] - lo[j] : extent;
 
-    return 1;
+    return extent;
 }
 
-
-#if USE_GL_ATTACHMENTS
-#else
+// Creates the kernels and buffers of a cell grid for count bodies and a cutoff.
+// The grid spans the bodies with a quarter of their extent to spare on each
+// side for the ones moving out, strays beyond that fall in the border cells.
 static int
-UpdateVBO(int index, void *data, int gl_attrib_array_index)
+CreateCellGrid(CellGrid *grid, cl_program program, const float *bodies, int count, float cutoff, int cached)
 {
-    if (VboPosID[index] && data)
-    {
-        glBindBuffer(GL_ARRAY_BUFFER, VboPosID[index]);
-        glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float) * DataBodyCount, data, GL_STATIC_DRAW);
-        glVertexAttribPointer(gl_attrib_array_index, 4, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(gl_attrib_array_index);
-    }
-    else
-    {
-        printf("Invalid VboPosID[%d]\n", index);
-        return -1;
+    int err = CL_SUCCESS;
+    int i, j;
+    float lo[3], hi[3];
+    float extent = BodyBounds(bodies, count, lo, hi);
+
+    memset(grid, 0, sizeof(CellGrid));
+    grid->bodies = count;
+    grid->cached = cached;
+
+    // Cells narrower than the cutoff would miss pairs, and more than
+    // MAX_GRID_CELLS along an axis only make the scan longer
+    float margin = 0.25f * extent;
+    float width = (extent + 2 * margin) / MAX_GRID_CELLS;
+    width = (cutoff > width) ? cutoff : width;
+    grid->origin.s[3] = width;
+    grid->dims.s[3] = 1;
+    for (j = 0; j < 3; j++)
+    {
+        grid->origin.s[j] = lo[j] - margin;
+        grid->dims.s[j] = (int)ceil((hi[j] - lo[j] + 2 * margin) / width);
+        grid->dims.s[j] = (grid->dims.s[j] > 0) ? grid->dims.s[j] : 1;
+        grid->dims.s[3] *= grid->dims.s[j];
+    }
+
+    int cells = grid->dims.s[3];
+    float cutoff_sqr = cutoff * cutoff;
+    size_t bytes = 4 * sizeof(float) * count;
+    cl_uint *zero = (cl_uint *)calloc(cells, sizeof(cl_uint));
+
+    grid->cell_of = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * count, NULL, NULL);
+    grid->rank = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * count, NULL, NULL);
+    grid->cell_count = zero ? clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint) * cells, zero, NULL) : 0;
+    grid->cell_start = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * (cells + 1), NULL, NULL);
+    grid->sorted_pos = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+    grid->sorted_vel = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+    grid->sorted_index = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * count, NULL, NULL);
+    grid->pair_count = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * count, NULL, NULL);
+    free(zero);
+
+    for (i = 0; i < CELL_KERNEL_COUNT; i++)
+    {
+        grid->kernels[i] = clCreateKernel(program, CellKernelNames[i], NULL);
+        err |= grid->kernels[i] ? CL_SUCCESS : EXIT_FAILURE;
+    }
+    if (err != CL_SUCCESS || !grid->cell_of || !grid->rank || !grid->cell_count || !grid->cell_start ||
+        !grid->sorted_pos || !grid->sorted_vel || !grid->sorted_index || !grid->pair_count)
+    {
+        printf("Failed to create cell grid resources!\n");
+        return EXIT_FAILURE;
     }
 
-    return 1;
+    // Everything but the bodies stays bound for the lifetime of the grid
+    cl_kernel *k = grid->kernels;
+    err = clSetKernelArg(k[CELL_COUNT], 1, sizeof(cl_float4), &grid->origin);
+    err |= clSetKernelArg(k[CELL_COUNT], 2, sizeof(cl_int4), &grid->dims);
+    err |= clSetKernelArg(k[CELL_COUNT], 3, sizeof(cl_mem), &grid->cell_of);
+    err |= clSetKernelArg(k[CELL_COUNT], 4, sizeof(cl_mem), &grid->rank);
+    err |= clSetKernelArg(k[CELL_COUNT], 5, sizeof(cl_mem), &grid->cell_count);
+    err |= clSetKernelArg(k[CELL_SCAN], 0, sizeof(cl_mem), &grid->cell_count);
+    err |= clSetKernelArg(k[CELL_SCAN], 1, sizeof(int), &cells);
+    err |= clSetKernelArg(k[CELL_SCAN], 2, sizeof(cl_mem), &grid->cell_start);
+    err |= clSetKernelArg(k[CELL_SCAN], 3, sizeof(cl_uint) * GroupSize, NULL);
+    err |= clSetKernelArg(k[CELL_SCATTER], 2, sizeof(cl_mem), &grid->cell_of);
+    err |= clSetKernelArg(k[CELL_SCATTER], 3, sizeof(cl_mem), &grid->rank);
+    err |= clSetKernelArg(k[CELL_SCATTER], 4, sizeof(cl_mem), &grid->cell_start);
+    err |= clSetKernelArg(k[CELL_SCATTER], 5, sizeof(cl_mem), &grid->sorted_pos);
+    err |= clSetKernelArg(k[CELL_SCATTER], 6, sizeof(cl_mem), &grid->sorted_vel);
+    err |= clSetKernelArg(k[CELL_SCATTER], 7, sizeof(cl_mem), &grid->sorted_index);
+    err |= clSetKernelArg(k[CELL_FORCE], 0, sizeof(cl_mem), &grid->sorted_pos);
+    err |= clSetKernelArg(k[CELL_FORCE], 1, sizeof(cl_mem), &grid->sorted_vel);
+    err |= clSetKernelArg(k[CELL_FORCE], 2, sizeof(cl_mem), &grid->cell_start);
+    err |= clSetKernelArg(k[CELL_FORCE], 3, sizeof(cl_float4), &grid->origin);
+    err |= clSetKernelArg(k[CELL_FORCE], 4, sizeof(cl_int4), &grid->dims);
+    err |= clSetKernelArg(k[CELL_FORCE], 5, sizeof(float), &delT);
+    err |= clSetKernelArg(k[CELL_FORCE], 6, sizeof(float), &espSqr);
+    err |= clSetKernelArg(k[CELL_FORCE], 7, sizeof(float), &cutoff_sqr);
+    err |= clSetKernelArg(k[CELL_FORCE], 10, sizeof(cl_mem), &grid->pair_count);
+    if (err != CL_SUCCESS)
+        printf("Failed to set cell grid kernel args! %d\n", err);
+
+    return err;
 }
-#endif
 
+// Lets a grid follow which body each slot holds from step to step. The bodies
+// come out of every step in cell order, checkpoints have to put them back.
 static int
-CreateGLResouce()
+TrackCellGrid(CellGrid *grid, cl_program program)
 {
-    GLint bsize;
+    size_t bytes = sizeof(cl_uint) * grid->bodies;
+    cl_uint *ids = (cl_uint *)malloc(bytes);
+    int err;
 
-    // VAO
-    glGenVertexArrays(1, &VaoID);
-    glBindVertexArray(VaoID);
-    if (!VaoID)
+    for (int i = 0; ids && i < grid->bodies; i++)
+        ids[i] = i;
+
+    grid->track = clCreateKernel(program, "cell_ids", NULL);
+    grid->ids = ids ? clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes, ids, NULL) : 0;
+    grid->sorted_ids = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+    free(ids);
+    if (!grid->track || !grid->ids || !grid->sorted_ids)
     {
-        printf("VAO generating failed!\n");
-        return -1;
+        printf("Failed to create cell grid tracking resources!\n");
+        return EXIT_FAILURE;
     }
 
-    // VBOPOS0
-    if (VboPosID[0])
-        glDeleteBuffers(1, &VboPosID[0]);
-    glGenBuffers(1, &VboPosID[0]);
-    if (!VboPosID[0])
+    err = clSetKernelArg(grid->track, 0, sizeof(cl_mem), &grid->ids);
+    err |= clSetKernelArg(grid->track, 1, sizeof(cl_mem), &grid->sorted_index);
+    err |= clSetKernelArg(grid->track, 2, sizeof(cl_mem), &grid->sorted_ids);
+    if (err != CL_SUCCESS)
+        printf("Failed to set cell grid tracking args! %d\n", err);
+
+    return err;
+}
+
+static void
+ReleaseCellGrid(CellGrid *grid)
+{
+    cl_mem buffers[] = { grid->cell_of, grid->rank, grid->cell_count, grid->cell_start,
+        grid->sorted_pos, grid->sorted_vel, grid->sorted_index, grid->pair_count, grid->ids, grid->sorted_ids };
+
+    for (int i = 0; i < CELL_KERNEL_COUNT; i++)
     {
-        printf("VBO VboPosID[0] generation failed\n");
-        return -1;
+        if (grid->kernels[i])
+            clReleaseKernel(grid->kernels[i]);
     }
-    glBindBuffer(GL_ARRAY_BUFFER, VboPosID[0]);
-    glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float) * DataBodyCount, DataInput, GL_STATIC_DRAW);
-    glVertexAttribPointer(VboPosLoc[0], 4, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(VboPosLoc[0]);
-
-    // recheck the size of the created buffer to make sure its what we requested
-    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bsize); 
-    if ((GLuint)bsize != 4 * sizeof(float) * DataBodyCount) {
-        printf("Vertex Buffer object (%d) has incorrect size (%d).\n", VboPosID[0], bsize);
+    if (grid->track)
+        clReleaseKernel(grid->track);
+    for (int i = 0; i < (int)(sizeof(buffers) / sizeof(buffers[0])); i++)
+    {
+        if (buffers[i])
+            clReleaseMemObject(buffers[i]);
     }
+    memset(grid, 0, sizeof(CellGrid));
+}
 
-    // VBOPOS1
-    if (VboPosID[1])
-        glDeleteBuffers(1, &VboPosID[1]);
-    glGenBuffers(1, &VboPosID[1]);
-    if (!VboPosID[1])
+// One step of the short-range mode, the bodies come out in cell order. The
+// grid of the frame loop goes through the argument cache, transient ones
+// bypass it. events takes one event per kernel when it is not NULL.
+static cl_int
+EnqueueCellStep(cl_command_queue queue, CellGrid *grid, cl_mem pos, cl_mem vel, cl_mem new_pos, cl_mem new_vel,
+    cl_event *events)
+{
+    cl_kernel *k = grid->kernels;
+    size_t bodies = grid->bodies;
+    size_t local = GroupSize;
+    size_t global[CELL_KERNEL_COUNT] = { bodies, local, bodies, bodies };
+    cl_int err = CL_SUCCESS;
+    int i;
+
+    if (events)
+        memset(events, 0, sizeof(cl_event) * CELL_KERNEL_COUNT);
+
+    if (grid->cached)
     {
-        printf("VBO VboPosID[1] generation failed\n");
-        return -1;
+        err |= SetKernelArg(k[CELL_COUNT], 0, sizeof(cl_mem), &pos);
+        err |= SetKernelArg(k[CELL_SCATTER], 0, sizeof(cl_mem), &pos);
+        err |= SetKernelArg(k[CELL_SCATTER], 1, sizeof(cl_mem), &vel);
+        err |= SetKernelArg(k[CELL_FORCE], 8, sizeof(cl_mem), &new_pos);
+        err |= SetKernelArg(k[CELL_FORCE], 9, sizeof(cl_mem), &new_vel);
+    }
+    else
+    {
+        err |= clSetKernelArg(k[CELL_COUNT], 0, sizeof(cl_mem), &pos);
+        err |= clSetKernelArg(k[CELL_SCATTER], 0, sizeof(cl_mem), &pos);
+        err |= clSetKernelArg(k[CELL_SCATTER], 1, sizeof(cl_mem), &vel);
+        err |= clSetKernelArg(k[CELL_FORCE], 8, sizeof(cl_mem), &new_pos);
+        err |= clSetKernelArg(k[CELL_FORCE], 9, sizeof(cl_mem), &new_vel);
     }
-    glBindBuffer(GL_ARRAY_BUFFER, VboPosID[1]);
-    glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float) * DataBodyCount, DataInput, GL_STATIC_DRAW);
-    glVertexAttribPointer(VboPosLoc[1], 4, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(VboPosLoc[1]);
 
-    // recheck the size of the created buffer to make sure its what we requested
-    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bsize); 
-    if ((GLuint)bsize != 4 * sizeof(float) * DataBodyCount) {
-        printf("Vertex Buffer object (%d) has incorrect size (%d).\n", VboPosID[1], bsize);
+    // The scan is a single work-group
+    for (i = 0; i < CELL_KERNEL_COUNT && err == CL_SUCCESS; i++)
+    {
+        if (grid->cached)
+            err = EnqueueKernel(queue, k[i], 1, NULL, &global[i], &local, 0, NULL, events ? &events[i] : NULL);
+        else
+            err = clEnqueueNDRangeKernel(queue, k[i], 1, NULL, &global[i], &local, 0, NULL, events ? &events[i] : NULL);
     }
 
-    GLenum error_check_value = glGetError();
-    if (error_check_value != GL_NO_ERROR)
+    // The ids follow the bodies the same way
+    if (grid->track && err == CL_SUCCESS)
     {
-        fprintf(stderr, "error: could not create VBO: %s\n",
-            gluErrorString(error_check_value));
-        exit(1);
+        err = clEnqueueNDRangeKernel(queue, grid->track, 1, NULL, &bodies, &local, 0, NULL, NULL);
+        err |= clEnqueueCopyBuffer(queue, grid->sorted_ids, grid->ids, 0, 0, sizeof(cl_uint) * bodies, 0, NULL, NULL);
     }
 
-    return 1;
+    return err;
 }
 
+// Creates a radix sort for up to size keys of the given significant bits
 static int
-Recompute(void)
+CreateRadixSort(RadixSort *sort, cl_program program, int size, int bits)
 {
-    if(!ComputeKernel)
-        return CL_SUCCESS;
+    int err = CL_SUCCESS;
+    int i;
 
-    if (NDRangeCount > MaxNDRange)
+    memset(sort, 0, sizeof(RadixSort));
+    sort->size = size;
+    sort->passes = (bits + RADIX_BITS - 1) / RADIX_BITS;
+    sort->items = ((size + RADIX_RUN - 1) / RADIX_RUN + GroupSize - 1) / GroupSize * GroupSize;
+
+    int counts = sort->items << RADIX_BITS;
+    sort->counts = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * counts, NULL, NULL);
+    sort->starts = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * (counts + 1), NULL, NULL);
+    sort->keys = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * size, NULL, NULL);
+    sort->values = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * size, NULL, NULL);
+    for (i = 0; i < RADIX_KERNEL_COUNT; i++)
     {
-        printf("Reach Max NDRange, Quitting\n");
-        Cleanup();
-        exit(0);
+        sort->kernels[i] = clCreateKernel(program, RadixKernelNames[i], NULL);
+        err |= sort->kernels[i] ? CL_SUCCESS : EXIT_FAILURE;
     }
-
-    if ( EnableStideExec && (ExecutionCount / ExecuteStride) % 2 == 1)
+    if (err != CL_SUCCESS || !sort->counts || !sort->starts || !sort->keys || !sort->values)
     {
-    	printf("GL only for frame %d\n", ExecutionCount);
-    	return CL_SUCCESS;
+        printf("Failed to create radix sort resources!\n");
+        return EXIT_FAILURE;
     }
 
-    int err = 0;
+    // The scan is the same for every pass
+    err = clSetKernelArg(sort->kernels[RADIX_SCAN], 0, sizeof(cl_mem), &sort->counts);
+    err |= clSetKernelArg(sort->kernels[RADIX_SCAN], 1, sizeof(int), &counts);
+    err |= clSetKernelArg(sort->kernels[RADIX_SCAN], 2, sizeof(cl_mem), &sort->starts);
+    err |= clSetKernelArg(sort->kernels[RADIX_SCAN], 3, sizeof(cl_uint) * GroupSize, NULL);
+    if (err != CL_SUCCESS)
+        printf("Failed to set radix sort kernel args! %d\n", err);
 
-    int currentBuffer = CurrentBuffer;
-    int nextBuffer = (CurrentBuffer+1)%2;
-
-    if(Animated || Update)
-    {
+    return err;
+}
 
-        glFinish();
+static void
+ReleaseRadixSort(RadixSort *sort)
+{
+    cl_mem buffers[] = { sort->counts, sort->starts, sort->keys, sort->values };
 
-        // If use shared context, then data should be already in GL VBOs even for the 1st frame
-#if (USE_GL_ATTACHMENTS)
+    for (int i = 0; i < RADIX_KERNEL_COUNT; i++)
+    {
+        if (sort->kernels[i])
+            clReleaseKernel(sort->kernels[i]);
+    }
+    for (int i = 0; i < (int)(sizeof(buffers) / sizeof(buffers[0])); i++)
+    {
+        if (buffers[i])
+            clReleaseMemObject(buffers[i]);
+    }
+    memset(sort, 0, sizeof(RadixSort));
+}
 
-        err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputePosBuffer[currentBuffer], 0, 0, 0);
-        if (err != CL_SUCCESS)
+// Sorts the keys in place and moves the values along, keys of the same value
+// keep their order. The passes ping-pong with the scratch buffers of the sort,
+// an odd number of them needs a copy back.
+static cl_int
+EnqueueRadixSort(cl_command_queue queue, RadixSort *sort, cl_mem keys, cl_mem values)
+{
+    cl_kernel *k = sort->kernels;
+    cl_uint count = sort->size;
+    cl_uint run = RADIX_RUN;
+    size_t global = sort->items;
+    size_t local = GroupSize;
+    cl_mem from[2] = { keys, values };
+    cl_mem to[2] = { sort->keys, sort->values };
+    cl_int err = CL_SUCCESS;
+
+    for (int p = 0; p < sort->passes && err == CL_SUCCESS; p++)
+    {
+        cl_uint shift = p * RADIX_BITS;
+
+        err = clSetKernelArg(k[RADIX_COUNT], 0, sizeof(cl_mem), &from[0]);
+        err |= clSetKernelArg(k[RADIX_COUNT], 1, sizeof(cl_uint), &count);
+        err |= clSetKernelArg(k[RADIX_COUNT], 2, sizeof(cl_uint), &run);
+        err |= clSetKernelArg(k[RADIX_COUNT], 3, sizeof(cl_uint), &shift);
+        err |= clSetKernelArg(k[RADIX_COUNT], 4, sizeof(cl_mem), &sort->counts);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 0, sizeof(cl_mem), &from[0]);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 1, sizeof(cl_mem), &from[1]);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 2, sizeof(cl_uint), &count);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 3, sizeof(cl_uint), &run);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 4, sizeof(cl_uint), &shift);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 5, sizeof(cl_mem), &sort->starts);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 6, sizeof(cl_mem), &to[0]);
+        err |= clSetKernelArg(k[RADIX_SCATTER], 7, sizeof(cl_mem), &to[1]);
+
+        // The scan is a single work-group
+        err |= clEnqueueNDRangeKernel(queue, k[RADIX_COUNT], 1, NULL, &global, &local, 0, NULL, NULL);
+        err |= clEnqueueNDRangeKernel(queue, k[RADIX_SCAN], 1, NULL, &local, &local, 0, NULL, NULL);
+        err |= clEnqueueNDRangeKernel(queue, k[RADIX_SCATTER], 1, NULL, &global, &local, 0, NULL, NULL);
+
+        for (int i = 0; i < 2; i++)
         {
-            printf("Failed to acquire GL object! %d\n", err);
-            return EXIT_FAILURE;
+            cl_mem swap = from[i];
+            from[i] = to[i];
+            to[i] = swap;
         }
+    }
 
-        err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputePosBuffer[nextBuffer], 0, 0, 0);
-        if (err != CL_SUCCESS)
-        {
-            printf("Failed to acquire GL object! %d\n", err);
-            return EXIT_FAILURE;
-        }
+    if (sort->passes & 1)
+    {
+        err |= clEnqueueCopyBuffer(queue, from[0], keys, 0, 0, sizeof(cl_uint) * count, 0, NULL, NULL);
+        err |= clEnqueueCopyBuffer(queue, from[1], values, 0, 0, sizeof(cl_uint) * count, 0, NULL, NULL);
+    }
 
-#if (DEBUG_INFO)
-        float *DataCurPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
-        float *DataNexPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
+    return err;
+}
 
-        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[currentBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataCurPos, 0, NULL, NULL );      
-        if (err != CL_SUCCESS)
-        {
-            printf("Failed to read buffer! %d\n", err);
-            return EXIT_FAILURE;
-        }
+// Creates the Z-order pass for count bodies, the curve spanning their bounds
+// with the same margin as the cell grid. ids start out as the body indices.
+static int
+CreateZOrder(ZOrder *order, cl_program program, const float *bodies, int count)
+{
+    int err;
+    int i;
+    float lo[3], hi[3];
+    float extent = BodyBounds(bodies, count, lo, hi);
+    float margin = 0.25f * extent;
+    size_t bytes = 4 * sizeof(float) * count;
+    cl_uint *ids = (cl_uint *)malloc(sizeof(cl_uint) * count);
+
+    memset(order, 0, sizeof(ZOrder));
+    order->bodies = count;
+    for (i = 0; i < 3; i++)
+        order->frame.s[i] = lo[i] - margin;
+    order->frame.s[3] = (extent > 0) ? 1024.0f / (extent + 2 * margin) : 0.0f;
+
+    for (i = 0; ids && i < count; i++)
+        ids[i] = i;
+
+    order->codes = clCreateKernel(program, "morton_codes", NULL);
+    order->permute = clCreateKernel(program, "permute_bodies", NULL);
+    order->keys = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * count, NULL, NULL);
+    order->order = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * count, NULL, NULL);
+    order->ids = ids ? clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint) * count, ids, NULL) : 0;
+    order->sorted_pos = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+    order->sorted_vel = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+    order->sorted_ids = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, sizeof(cl_uint) * count, NULL, NULL);
+    free(ids);
+
+    if (!order->codes || !order->permute || !order->keys || !order->order || !order->ids ||
+        !order->sorted_pos || !order->sorted_vel || !order->sorted_ids)
+    {
+        printf("Failed to create Z-order resources!\n");
+        return EXIT_FAILURE;
+    }
 
-        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[nextBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataNexPos, 0, NULL, NULL );      
-        if (err != CL_SUCCESS)
-        {
-            printf("Failed to read buffer! %d\n", err);
-            return EXIT_FAILURE;
-        }
+    err = CreateRadixSort(&order->sort, program, count, 30);
+    err |= clSetKernelArg(order->codes, 1, sizeof(cl_float4), &order->frame);
+    err |= clSetKernelArg(order->codes, 2, sizeof(cl_mem), &order->keys);
+    err |= clSetKernelArg(order->codes, 3, sizeof(cl_mem), &order->order);
+    err |= clSetKernelArg(order->permute, 2, sizeof(cl_mem), &order->ids);
+    err |= clSetKernelArg(order->permute, 3, sizeof(cl_mem), &order->order);
+    err |= clSetKernelArg(order->permute, 4, sizeof(cl_mem), &order->sorted_pos);
+    err |= clSetKernelArg(order->permute, 5, sizeof(cl_mem), &order->sorted_vel);
+    err |= clSetKernelArg(order->permute, 6, sizeof(cl_mem), &order->sorted_ids);
 
-        for (int i = 0; i < DataBodyCount; ++i)
-            printf("Before NDRange %d - %d: org [%f %f %f %f] - org curr [%f %f %f %f] - org next [%f %f %f %f]\n", NDRangeCount, i, 
-                DataInput[4 * i], DataInput[4 * i + 1], DataInput[4 * i + 2], DataInput[4 * i + 3],
-                DataCurPos[4 * i], DataCurPos[4 * i + 1], DataCurPos[4 * i + 2], DataCurPos[4 * i + 3],
-                DataNexPos[4 * i], DataNexPos[4 * i + 1], DataNexPos[4 * i + 2], DataNexPos[4 * i + 3]);
+    return err;
+}
 
-        free(DataCurPos);
-        free(DataNexPos);
-#endif
+static void
+ReleaseZOrder(ZOrder *order)
+{
+    cl_mem buffers[] = { order->keys, order->order, order->ids, order->sorted_pos, order->sorted_vel, order->sorted_ids };
 
-#else
-        // Not sharing context with OpenGL, needs to explicitly send data to GPU for the 1st frame
-        if (!NDRangeCount)
-        {
-            printf("1st Frame! Let's send data to GPU!\n");
-            err = clEnqueueWriteBuffer(ComputeCommands, ComputePosBuffer[currentBuffer], 1, 0, 
-                4 * sizeof(float) * DataBodyCount, DataInput, 0, 0, NULL);
-            if (err != CL_SUCCESS)
-            {
-                printf("Failed to write buffer! %d\n", err);
-                return EXIT_FAILURE;
-            }
+    if (order->codes)
+        clReleaseKernel(order->codes);
+    if (order->permute)
+        clReleaseKernel(order->permute);
+    for (int i = 0; i < (int)(sizeof(buffers) / sizeof(buffers[0])); i++)
+    {
+        if (buffers[i])
+            clReleaseMemObject(buffers[i]);
+    }
+    ReleaseRadixSort(&order->sort);
+    memset(order, 0, sizeof(ZOrder));
+}
 
-            err = clEnqueueWriteBuffer(ComputeCommands, ComputePosBuffer[nextBuffer], 1, 0, 
-                4 * sizeof(float) * DataBodyCount, DataInput, 0, 0, NULL);
-            if (err != CL_SUCCESS)
-            {
-                printf("Failed to write buffer! %d\n", err);
-                return EXIT_FAILURE;
-            }
-        }
+// Reorders the bodies in pos and vel along the Z curve, in place
+static cl_int
+EnqueueZOrder(cl_command_queue queue, ZOrder *order, cl_mem pos, cl_mem vel)
+{
+    size_t global = order->bodies;
+    size_t local = GroupSize;
+    size_t bytes = 4 * sizeof(float) * order->bodies;
+    cl_int err;
+
+    err = clSetKernelArg(order->codes, 0, sizeof(cl_mem), &pos);
+    err |= clSetKernelArg(order->permute, 0, sizeof(cl_mem), &pos);
+    err |= clSetKernelArg(order->permute, 1, sizeof(cl_mem), &vel);
+    err |= clEnqueueNDRangeKernel(queue, order->codes, 1, NULL, &global, &local, 0, NULL, NULL);
+    err |= EnqueueRadixSort(queue, &order->sort, order->keys, order->order);
+    err |= clEnqueueNDRangeKernel(queue, order->permute, 1, NULL, &global, &local, 0, NULL, NULL);
+    err |= clEnqueueCopyBuffer(queue, order->sorted_pos, pos, 0, 0, bytes, 0, NULL, NULL);
+    err |= clEnqueueCopyBuffer(queue, order->sorted_vel, vel, 0, 0, bytes, 0, NULL, NULL);
+    err |= clEnqueueCopyBuffer(queue, order->sorted_ids, order->ids, 0, 0, sizeof(cl_uint) * order->bodies, 0, NULL, NULL);
+
+    return err;
+}
 
-#endif
-        Update = 0;
-        err = CL_SUCCESS;
-        err |= clSetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputePosBuffer[currentBuffer]);
-        err |= clSetKernelArg(ComputeKernel, 1, sizeof(cl_mem), &ComputeVelBuffer[currentBuffer]);
-        err |= clSetKernelArg(ComputeKernel, 5, sizeof(cl_mem), &ComputePosBuffer[nextBuffer]);
-        err |= clSetKernelArg(ComputeKernel, 6, sizeof(cl_mem), &ComputeVelBuffer[nextBuffer]);
-        if (err)
-            return -10;
+////////////////////////////////////////////////////////////////////////////////
 
-        size_t global[1];
-        size_t local[1];
+// Which body each slot of the frame loop holds, when the frame loop reorders the
+// bodies. Without one slot i holds body i.
+static cl_mem
+SlotIds(void)
+{
+    return FrameOrder.bodies ? FrameOrder.ids : FrameGrid.ids;
+}
 
-        global[0] = DataBodyCount;
-        local[0] = GroupSize;
+// Maps a snapshot to start from. The positions seed DataInput in InitData,
+// the velocities go up straight from the mapping in UploadSnapshot.
+static int
+OpenSnapshot(const char *path)
+{
+    struct stat info;
+    int fd = open(path, O_RDONLY);
 
-#if (DEBUG_INFO)
-        if(FrameCount <= 1)
-            printf("Global[%4d] Local[%4d]\n", 
-                (int)global[0], (int)local[0]);
-#endif
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        printf("Failed to open snapshot '%s'!\n", path);
+        if (fd >= 0)
+            close(fd);
+        return EXIT_FAILURE;
+    }
 
-        err = clEnqueueNDRangeKernel(ComputeCommands, ComputeKernel, 1, NULL, global, local, 0, NULL, NULL);
-        if (err)
-        {
-            printf("Failed to enqueue kernel! %d\n", err);
-            return err;
-        }
+    SnapshotBytes = info.st_size;
+    SnapshotMap = (SnapshotBytes >= sizeof(SnapshotHeader)) ?
+        mmap(NULL, SnapshotBytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (SnapshotMap == MAP_FAILED)
+    {
+        printf("Failed to map snapshot '%s'!\n", path);
+        SnapshotMap = NULL;
+        return EXIT_FAILURE;
+    }
 
-        NDRangeCount++;
+    const SnapshotHeader *header = (const SnapshotHeader *)SnapshotMap;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) || header->version != SNAPSHOT_VERSION ||
+        !header->bodies || SnapshotBytes != sizeof(SnapshotHeader) + 2 * 4 * sizeof(float) * (size_t)header->bodies)
+    {
+        printf("Invalid snapshot '%s'!\n", path);
+        munmap(SnapshotMap, SnapshotBytes);
+        SnapshotMap = NULL;
+        return EXIT_FAILURE;
+    }
 
-#if (DEBUG_INFO)
+    // Both arrays are read once, front to back
+    madvise(SnapshotMap, SnapshotBytes, MADV_SEQUENTIAL);
 
-        float *DataCurPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
-        float *DataNexPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
+    delT = header->delta_time;
+    espSqr = header->eps_sqr;
+    SimulatedSteps = header->step;
+    printf("Mapped snapshot of %u bodies at step %llu (%.1f MB) from '%s'\n", header->bodies,
+        (unsigned long long)header->step, SnapshotBytes / (1024.0 * 1024.0), path);
 
-        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[currentBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataCurPos, 0, NULL, NULL );      
-        if (err != CL_SUCCESS)
-        {
-            printf("Failed to read buffer! %d\n", err);
-            return EXIT_FAILURE;
-        }
+    return CL_SUCCESS;
+}
 
-        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[nextBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataNexPos, 0, NULL, NULL );      
-        if (err != CL_SUCCESS)
-        {
-            printf("Failed to read buffer! %d\n", err);
-            return EXIT_FAILURE;
-        }
+// Velocities of the snapshot into the first velocity buffer. A buffer over
+// the mapping is zero-copy where the runtime can use the pages in place,
+// otherwise they are written from the mapping. The mapping goes away after
+// that, DataInput has the positions.
+static int
+UploadSnapshot(void)
+{
+    const SnapshotHeader *header = (const SnapshotHeader *)SnapshotMap;
+    size_t bytes = 4 * sizeof(float) * header->bodies;
+    size_t offset = sizeof(SnapshotHeader) + bytes;
+    size_t padding = 4 * sizeof(float) * (DataBodyCount - header->bodies);
+    float *zero = (float *)calloc(1, padding + 1);
+    double start = GetPreciseTime();
+    cl_mem mapped;
+    int err;
 
-        for (int i = 0; i < DataBodyCount; ++i)
-            printf("After NDRange %d - %d: org [%f %f %f %f] - org curr [%f %f %f %f] - org next [%f %f %f %f]\n", NDRangeCount, i, 
-                DataInput[4 * i], DataInput[4 * i + 1], DataInput[4 * i + 2], DataInput[4 * i + 3],
-                DataCurPos[4 * i], DataCurPos[4 * i + 1], DataCurPos[4 * i + 2], DataCurPos[4 * i + 3],
-                DataNexPos[4 * i], DataNexPos[4 * i + 1], DataNexPos[4 * i + 2], DataNexPos[4 * i + 3]);
-        
-        free(DataCurPos);
-        free(DataNexPos);
-#endif
+    mapped = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, SnapshotBytes, SnapshotMap, &err);
+    if (mapped)
+        err = clEnqueueCopyBuffer(ComputeCommands, mapped, ComputeVelBuffer[CurrentBuffer], offset, 0, bytes, 0, NULL, NULL);
+    else
+        err = clEnqueueWriteBuffer(ComputeCommands, ComputeVelBuffer[CurrentBuffer], CL_FALSE, 0, bytes,
+            (const char *)SnapshotMap + offset, 0, NULL, NULL);
 
-#if (USE_GL_ATTACHMENTS)
+    // The padding bodies start at rest
+    if (padding)
+        err |= zero ? clEnqueueWriteBuffer(ComputeCommands, ComputeVelBuffer[CurrentBuffer], CL_FALSE, bytes, padding, zero, 0, NULL, NULL) : EXIT_FAILURE;
+    err |= clFinish(ComputeCommands);
 
-        // Release control and the data is already in VBOs
-        err = clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputePosBuffer[currentBuffer], 0, 0, 0);
-        if (err != CL_SUCCESS)
+    if (mapped)
+        clReleaseMemObject(mapped);
+    munmap(SnapshotMap, SnapshotBytes);
+    SnapshotMap = NULL;
+    free(zero);
+
+    if (err != CL_SUCCESS)
+    {
+        printf("Failed to upload snapshot! %d\n", err);
+        return err;
+    }
+
+    printf("Uploaded %.1f MB of velocities %s in %.1f ms\n", bytes / (1024.0 * 1024.0),
+        mapped ? "through a buffer over the mapping" : "from the mapping", GetPreciseTime() - start);
+    return CL_SUCCESS;
+}
+
+// Writes the checkpoints handed over by EnqueueSnapshot. Each one goes to a
+// temporary file that is renamed over the last checkpoint, so a run stopped
+// mid-write still has that one.
+static void *
+SnapshotThread(void *arg)
+{
+    SnapshotWriter *writer = (SnapshotWriter *)arg;
+    const SnapshotHeader *header = (const SnapshotHeader *)writer->file;
+    const float *pos = (const float *)writer->host;
+    const float *vel = pos + 4 * DataBodyCount;
+    const cl_uint *ids = (const cl_uint *)(vel + 4 * DataBodyCount);
+    float *out = (float *)(writer->file + sizeof(SnapshotHeader));
+    size_t bytes = sizeof(SnapshotHeader) + 2 * 4 * sizeof(float) * SnapshotBodyCount;
+    char temp[1024];
+
+    snprintf(temp, sizeof(temp), "%s.tmp", CheckpointPath);
+
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->quit || writer->pending)
+    {
+        if (!writer->pending)
         {
-            printf("Failed to release GL object! %d\n", err);
-            return EXIT_FAILURE;
+            pthread_cond_wait(&writer->cond, &writer->lock);
+            continue;
         }
+        pthread_mutex_unlock(&writer->lock);
 
-        err = clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputePosBuffer[nextBuffer], 0, 0, 0);
-        if (err != CL_SUCCESS)
+        double start = GetPreciseTime();
+        int ok = (clWaitForEvents(1, &writer->ready) == CL_SUCCESS);
+        clReleaseEvent(writer->ready);
+        if (ok)
         {
-            printf("Failed to release GL object! %d\n", err);
-            return EXIT_FAILURE;
+            // Back from the reordered slots to the bodies, without the massless padding.
+            // Every body has to turn up exactly once, or the file would mix them up.
+            int tracked = (SlotIds() != 0);
+            int placed = 0;
+            memset(writer->seen, 0, SnapshotBodyCount);
+            for (int i = 0; i < DataBodyCount; i++)
+            {
+                cl_uint id = tracked ? ids[i] : (cl_uint)i;
+                if (id >= (cl_uint)SnapshotBodyCount || writer->seen[id])
+                    continue;
+                writer->seen[id] = 1;
+                placed++;
+                memcpy(out + 4 * id, pos + 4 * i, 4 * sizeof(float));
+                memcpy(out + 4 * (SnapshotBodyCount + id), vel + 4 * i, 4 * sizeof(float));
+            }
+            if (placed != SnapshotBodyCount)
+            {
+                printf("Checkpoint of step %llu is missing %d bodies!\n", (unsigned long long)header->step,
+                    SnapshotBodyCount - placed);
+                ok = 0;
+            }
         }
-
-#else
-        // Explicitly copy data back to host
-        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[nextBuffer], CL_TRUE, 0, DataParticleCount * sizeof(float), DataInput, 0, NULL, NULL );      
-        if (err != CL_SUCCESS)
+        if (ok)
         {
-            printf("Failed to read buffer! %d\n", err);
-            return EXIT_FAILURE;
+            FILE *file = fopen(temp, "wb");
+            ok = file && fwrite(writer->file, 1, bytes, file) == bytes;
+            if (file && fclose(file))
+                ok = 0;
+            ok = ok && !rename(temp, CheckpointPath);
         }
+        double ms = GetPreciseTime() - start;
 
-        // Data in host side, copy to VBOs
-        UpdateVBO(nextBuffer, DataInput, nextBuffer);
-#endif
+        if (ok)
+            printf("Checkpoint of step %llu written to '%s' in %.1f ms (%.1f MB/s)\n", (unsigned long long)header->step,
+                CheckpointPath, ms, (ms > 0) ? bytes / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0);
+        else
+            printf("Failed to write checkpoint '%s'!\n", CheckpointPath);
 
-        clFinish(ComputeCommands);
+        pthread_mutex_lock(&writer->lock);
+        writer->pending = 0;
+        writer->written += ok;
     }
+    pthread_mutex_unlock(&writer->lock);
 
-    // Notify GL side which attribute index is using
-    glUniform1i(UniformCurBufIdxLocation, nextBuffer);
+    return NULL;
+}
 
-    // Switch buffers
-    CurrentBuffer = nextBuffer;
+// The checkpoint writer has a device copy of the bodies, a pinned host copy,
+// the file image, and a queue and thread of its own, so neither the read back
+// nor the file write holds up the compute queue
+static int
+CreateSnapshotWriter(void)
+{
+    SnapshotWriter *writer = &Snapshots;
+    size_t bytes = (2 * 4 * sizeof(float) + sizeof(cl_uint)) * DataBodyCount;
+    int err;
+
+    memset(writer, 0, sizeof(SnapshotWriter));
+    writer->queue = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
+    writer->device = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+    writer->pinned = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, NULL);
+    if (writer->queue && writer->pinned)
+        writer->host = (char *)clEnqueueMapBuffer(writer->queue, writer->pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+            bytes, 0, NULL, NULL, &err);
+    writer->file = (char *)malloc(sizeof(SnapshotHeader) + 2 * 4 * sizeof(float) * SnapshotBodyCount);
+    writer->seen = (unsigned char *)malloc(SnapshotBodyCount);
+    if (!writer->queue || !writer->device || !writer->pinned || !writer->host || !writer->file || !writer->seen)
+    {
+        printf("Failed to create checkpoint resources!\n");
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if (pthread_create(&writer->thread, NULL, SnapshotThread, writer))
+    {
+        printf("Failed to start checkpoint thread!\n");
+        return EXIT_FAILURE;
+    }
+    writer->started = 1;
 
     return CL_SUCCESS;
 }
 
-////////////////////////////////////////////////////////////////////////////////
+static void
+ReleaseSnapshotWriter(void)
+{
+    SnapshotWriter *writer = &Snapshots;
+
+    // The last checkpoint handed over still gets written
+    if (writer->started)
+    {
+        pthread_mutex_lock(&writer->lock);
+        writer->quit = 1;
+        pthread_cond_signal(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->cond);
+        printf("%d checkpoints written, %d skipped while the previous one was still being written\n",
+            writer->written, writer->skipped);
+    }
+
+    if (writer->host)
+    {
+        clEnqueueUnmapMemObject(writer->queue, writer->pinned, writer->host, 0, NULL, NULL);
+        clFinish(writer->queue);
+    }
+    if (writer->pinned)
+        clReleaseMemObject(writer->pinned);
+    if (writer->device)
+        clReleaseMemObject(writer->device);
+    if (writer->queue)
+        clReleaseCommandQueue(writer->queue);
+    free(writer->file);
+    free(writer->seen);
+    memset(writer, 0, sizeof(SnapshotWriter));
+}
 
-static int 
-CreateComputeResource(void)
+// Takes a checkpoint of the bodies after a step. The device copies go on the
+// compute queue behind the step and the read back on the writer queue, which
+// the writer thread waits for. While the last checkpoint is still being
+// written this one is skipped rather than waited for.
+static cl_int
+EnqueueSnapshot(cl_mem pos, cl_mem vel, cl_ulong step)
 {
-    int err = 0;
+    SnapshotWriter *writer = &Snapshots;
+    SnapshotHeader *header = (SnapshotHeader *)writer->file;
+    size_t bytes = 4 * sizeof(float) * DataBodyCount;
+    size_t ids = SlotIds() ? sizeof(cl_uint) * DataBodyCount : 0;
+    cl_event copied;
+    cl_int err;
+    int busy;
+
+    pthread_mutex_lock(&writer->lock);
+    busy = writer->pending;
+    writer->skipped += busy;
+    pthread_mutex_unlock(&writer->lock);
+    if (busy)
+        return CL_SUCCESS;
 
-#if (USE_GL_ATTACHMENTS)
+    err = clEnqueueCopyBuffer(ComputeCommands, pos, writer->device, 0, 0, bytes, 0, NULL, NULL);
+    err |= clEnqueueCopyBuffer(ComputeCommands, vel, writer->device, 0, bytes, bytes, 0, NULL, ids ? NULL : &copied);
 
-    // CL Context is created from GL context, GL VBOs and CL Buffers point to the same data in GPU memory
-    // Updating VBO or associated CL Buffer affects both CL and GL.
+    // The Z-order or cell grid ids say which body each slot holds
+    if (ids)
+        err |= clEnqueueCopyBuffer(ComputeCommands, SlotIds(), writer->device, 0, 2 * bytes, ids, 0, NULL, &copied);
+    if (err != CL_SUCCESS)
+        return err;
+
+    // The writer queue only sees the copies complete once the compute queue is flushed
+    err = clFlush(ComputeCommands);
+    err |= clEnqueueReadBuffer(writer->queue, writer->device, CL_FALSE, 0, 2 * bytes + ids, writer->host,
+        1, &copied, &writer->ready);
+    err |= clFlush(writer->queue);
+    clReleaseEvent(copied);
+    if (err != CL_SUCCESS)
+        return err;
 
-    // CL buffer Pos 0
-    if(ComputePosBuffer[0])
-        clReleaseMemObject(ComputePosBuffer[0]);
-    ComputePosBuffer[0] = 0;
+    memset(header, 0, sizeof(SnapshotHeader));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->bodies = SnapshotBodyCount;
+    header->step = step;
+    header->delta_time = delT;
+    header->eps_sqr = espSqr;
 
-    if (VboPosID[0])
+    pthread_mutex_lock(&writer->lock);
+    writer->pending = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    return CL_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int LoadTextFromFile(
+    const char *file_name, char **result_string, size_t *string_len)
+{
+    int fd;
+    unsigned file_len;
+    struct stat file_status;
+    int ret;
+
+    *string_len = 0;
+    fd = open(file_name, O_RDONLY);
+    if (fd == -1)
     {
-        printf("Allocating compute input/output real part for FFT in device memory...\n");
-        ComputePosBuffer[0] = clCreateFromGLBuffer(ComputeContext, CL_MEM_READ_WRITE, VboPosID[0], &err);
-        if (!ComputePosBuffer[0] || err != CL_SUCCESS)
-        {
-            printf("Failed to create OpenGL VBO reference! %d\n", err);
-            return -1;
-        }
+        printf("Error opening file %s\n", file_name);
+        return -1;
     }
-    else
+    ret = fstat(fd, &file_status);
+    if (ret)
     {
-        printf("VboPosID[0] not valid!\n");
+        printf("Error reading status for file %s\n", file_name);
         return -1;
     }
+    file_len = file_status.st_size;
 
-    // CL buffer Pos 1
-    if(ComputePosBuffer[1])
-        clReleaseMemObject(ComputePosBuffer[1]);
-    ComputePosBuffer[1] = 0;
+    *result_string = (char*)calloc(file_len + 1, sizeof(char));
+    ret = read(fd, *result_string, file_len);
+    if (!ret)
+    {
+        printf("Error reading from file %s\n", file_name);
+        return -1;
+    }
 
-    if (VboPosID[1])
+    close(fd);
+
+    *string_len = file_len;
+    return 0;
+}
+
+static void DrawString(float x, float y, float color[4], char *buffer)
+{
+    unsigned int uiLen, i;
+
+    glPushAttrib(GL_LIGHTING_BIT);
+    glDisable(GL_LIGHTING);
+
+    glRasterPos2f(x, y);
+    glColor3f(color[0], color[1], color[2]);
+    uiLen = (unsigned int) strlen(buffer);
+    for (i = 0; i < uiLen; i++)
     {
-        printf("Allocating compute input/output real part for FFT in device memory...\n");
-        ComputePosBuffer[1] = clCreateFromGLBuffer(ComputeContext, CL_MEM_READ_WRITE, VboPosID[1], &err);
-        if (!ComputePosBuffer[1] || err != CL_SUCCESS)
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, buffer[i]);
+    }
+    glPopAttrib();
+}
+
+static void DrawText(float x, float y, int light, const char *format, ...)
+{
+    va_list args;
+    char buffer[256];
+    GLint iVP[4];
+    GLint iMatrixMode;
+
+    va_start(args, format);
+    vsprintf(buffer, format, args);
+    va_end(args);
+
+    glPushAttrib(GL_LIGHTING_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_BLEND);
+
+    glGetIntegerv(GL_VIEWPORT, iVP);
+    glViewport(0, 0, WindowWidth, WindowHeight);
+    glGetIntegerv(GL_MATRIX_MODE, &iMatrixMode);
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    glScalef(2.0f / WindowWidth, -2.0f / WindowHeight, 1.0f);
+    glTranslatef(-WindowWidth / 2.0f, -WindowHeight / 2.0f, 0.0f);
+
+    if(light)
+    {
+        glColor4fv(ShadowTextColor);
+        DrawString(x-0, y-0, ShadowTextColor, buffer);
+
+        glColor4fv(HighlightTextColor);
+        DrawString(x-2, y-2, HighlightTextColor, buffer);
+    }
+    else
+    {
+        glColor4fv(HighlightTextColor);
+        DrawString(x-0, y-0, HighlightTextColor, buffer);
+
+        glColor4fv(ShadowTextColor);
+        DrawString(x-2, y-2, ShadowTextColor, buffer);   
+    }
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+
+    glPopMatrix();
+    glMatrixMode(iMatrixMode);
+
+    glPopAttrib();
+    glViewport(iVP[0], iVP[1], iVP[2], iVP[3]);
+}
+
+
+static float
+RandomFloat(float randMax, float randMin)
+{
+    float result;
+    result =(float)rand() / (float)RAND_MAX;
+
+    return ((1.0f - result) * randMin + result *randMax);
+}
+
+static int 
+InitData()
+{
+    const SnapshotHeader *snapshot = (const SnapshotHeader *)SnapshotMap;
+
+    // A snapshot is padded up to the group size with massless bodies
+    if (snapshot)
+        DataParticleCount = (snapshot->bodies + GroupSize - 1) / GroupSize * GroupSize;
+
+    // make sure DataParticleCount is multiple of group size
+    DataParticleCount = DataParticleCount < GroupSize ? GroupSize :
+    DataParticleCount;
+    DataParticleCount = (DataParticleCount / GroupSize) * GroupSize;
+
+    DataBodyCount = DataParticleCount;
+
+    if (DataInput)
+        free(DataInput);
+    DataInput = (float *)calloc(1, DataBodyCount * sizeof(cl_float4));
+
+    // Checkpoints leave the padding out
+    SnapshotBodyCount = snapshot ? (int)snapshot->bodies : DataBodyCount;
+
+    if (snapshot)
+    {
+        const float *pos = (const float *)(snapshot + 1);
+
+        memcpy(DataInput, pos, 4 * sizeof(float) * snapshot->bodies);
+        for (int i = snapshot->bodies; i < DataBodyCount; i++)
+            memcpy(DataInput + 4 * i, pos + 4 * (snapshot->bodies - 1), 3 * sizeof(float));
+
+        return 1;
+    }
+
+    // initialization of inputs
+    for(int i = 0; i < DataBodyCount; ++i)
+    {
+        int index = 4 * i;
+
+        // First 3 values are position in x,y and z direction
+        for(int j = 0; j < 3; ++j)
         {
-            printf("Failed to create OpenGL VBO reference! %d\n", err);
-            return -1;
+            DataInput[index + j] = RandomFloat(3, 50);
         }
+
+        // Mass value
+        DataInput[index + 3] = RandomFloat(1, 1000);
+    }
+
+    return 1;
+}
+
+
+#if USE_GL_ATTACHMENTS
+#else
+static int
+UpdateVBO(int index, void *data, int gl_attrib_array_index)
+{
+    if (VboPosID[index] && data)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VboPosID[index]);
+        glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float) * DataBodyCount, data, GL_STATIC_DRAW);
+        glVertexAttribPointer(gl_attrib_array_index, 4, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(gl_attrib_array_index);
     }
     else
     {
-        printf("VboPosID[1] not valid!\n");
+        printf("Invalid VboPosID[%d]\n", index);
         return -1;
     }
 
-#else
+    return 1;
+}
+#endif
 
-    // Not sharing context, so just create CL buffers as normal
-    if(ComputePosBuffer[0])
-        clReleaseMemObject(ComputePosBuffer[0]);
-    ComputePosBuffer[0] = 0;
+static int
+CreateGLResouce()
+{
+    GLint bsize;
 
-    printf("Allocating compute buffer 0 for NBody in device memory...\n");
-    ComputePosBuffer[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
-        4 * sizeof(float) * DataBodyCount, 0, &err);
-    if (!ComputePosBuffer[0] || err != CL_SUCCESS)
+    // VAO
+    glGenVertexArrays(1, &VaoID);
+    glBindVertexArray(VaoID);
+    if (!VaoID)
     {
-        printf("Failed to create OpenGL VBO reference! %d\n", err);
+        printf("VAO generating failed!\n");
         return -1;
     }
 
-    if(ComputePosBuffer[1])
-        clReleaseMemObject(ComputePosBuffer[1]);
-    ComputePosBuffer[1] = 0;
+    // VBOPOS0
+    if (VboPosID[0])
+        glDeleteBuffers(1, &VboPosID[0]);
+    glGenBuffers(1, &VboPosID[0]);
+    if (!VboPosID[0])
+    {
+        printf("VBO VboPosID[0] generation failed\n");
+        return -1;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, VboPosID[0]);
+    glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float) * DataBodyCount, DataInput, GL_STATIC_DRAW);
+    glVertexAttribPointer(VboPosLoc[0], 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(VboPosLoc[0]);
 
-    printf("Allocating compute buffer 1 for NBody in device memory...\n");
-    ComputePosBuffer[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
-        4 * sizeof(float) * DataBodyCount, 0, &err);
-    if (!ComputePosBuffer[1] || err != CL_SUCCESS)
+    // recheck the size of the created buffer to make sure its what we requested
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bsize); 
+    if ((GLuint)bsize != 4 * sizeof(float) * DataBodyCount) {
+        printf("Vertex Buffer object (%d) has incorrect size (%d).\n", VboPosID[0], bsize);
+    }
+
+    // VBOPOS1
+    if (VboPosID[1])
+        glDeleteBuffers(1, &VboPosID[1]);
+    glGenBuffers(1, &VboPosID[1]);
+    if (!VboPosID[1])
     {
-        printf("Failed to create OpenGL VBO reference! %d\n", err);
+        printf("VBO VboPosID[1] generation failed\n");
         return -1;
     }
+    glBindBuffer(GL_ARRAY_BUFFER, VboPosID[1]);
+    glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float) * DataBodyCount, DataInput, GL_STATIC_DRAW);
+    glVertexAttribPointer(VboPosLoc[1], 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(VboPosLoc[1]);
 
-#endif
+    // recheck the size of the created buffer to make sure its what we requested
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bsize); 
+    if ((GLuint)bsize != 4 * sizeof(float) * DataBodyCount) {
+        printf("Vertex Buffer object (%d) has incorrect size (%d).\n", VboPosID[1], bsize);
+    }
 
-    // Velocity buffer 0
-    if(ComputeVelBuffer[0])
-        clReleaseMemObject(ComputeVelBuffer[0]);
-    ComputeVelBuffer[0] = 0;
+    GLenum error_check_value = glGetError();
+    if (error_check_value != GL_NO_ERROR)
+    {
+        fprintf(stderr, "error: could not create VBO: %s\n",
+            gluErrorString(error_check_value));
+        exit(1);
+    }
 
-    printf("Allocating compute velocity buffer 0 for NBody in device memory...\n");
-    ComputeVelBuffer[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
-        4 * sizeof(float) * DataBodyCount, 0, &err);
-    if (!ComputeVelBuffer[0] || err != CL_SUCCESS)
+    return 1;
+}
+
+// Partitions of one device share its memory and work on the primary buffers
+// directly, separate devices go through buffers of their own
+static int
+PrivateBuffers(cl_uint device)
+{
+    return FirstPrivateDevice && device >= FirstPrivateDevice;
+}
+
+static void
+PartitionWork(size_t units, size_t *offset, size_t *count)
+{
+    cl_uint i;
+    size_t start = 0;
+
+    for(i = 0; i < DeviceCount; i++)
     {
-        printf("Failed to create OpenGL VBO reference! %d\n", err);
-        return -1;
+        size_t n = (i == DeviceCount - 1) ? units - start : (size_t)(units * DeviceShare[i] + 0.5f);
+        if (start + n > units)
+            n = units - start;
+
+        offset[i] = start;
+        count[i] = n;
+        start += n;
     }
+}
+
+static void
+BalanceDevices(size_t *count, double *ms)
+{
+    cl_uint i;
+    double rate[MAX_DEVICES];
+    double measured_rate = 0;
+    double measured_share = 0;
+
+    // Devices that got no work this frame keep their share, the rest split
+    // what is left in proportion to the work-groups per ms they just achieved
+    for(i = 0; i < DeviceCount; i++)
+    {
+        rate[i] = (count[i] && ms[i] > 0) ? count[i] / ms[i] : 0;
+        if (rate[i] > 0)
+        {
+            measured_rate += rate[i];
+            measured_share += DeviceShare[i];
+        }
+    }
+
+    if (measured_rate <= 0)
+        return;
+
+    for(i = 0; i < DeviceCount; i++)
+    {
+        if (rate[i] > 0)
+            DeviceShare[i] = 0.5f * DeviceShare[i] + 0.5f * (float)(measured_share * rate[i] / measured_rate);
+    }
+}
+
+static int
+SetBodyKernelArgs(cl_mem *pos, cl_mem *vel, cl_mem *new_pos, cl_mem *new_vel)
+{
+    int err = CL_SUCCESS;
+
+    err |= SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), pos);
+    err |= SetKernelArg(ComputeKernel, 1, sizeof(cl_mem), vel);
+    err |= SetKernelArg(ComputeKernel, 5, sizeof(cl_mem), new_pos);
+    err |= SetKernelArg(ComputeKernel, 6, sizeof(cl_mem), new_vel);
+
+    return err;
+}
+
+static int
+EnqueueMultiDevice(size_t *global, size_t *local, int currentBuffer, int nextBuffer)
+{
+    int err = CL_SUCCESS;
+    cl_uint i;
+    size_t offset[MAX_DEVICES];
+    size_t count[MAX_DEVICES];
+    double ms[MAX_DEVICES];
+    cl_event events[MAX_DEVICES];
+    cl_event ready = 0;
+
+    // Every device reads all current bodies straight from the primary buffers
+    // in the shared context, once the primary queue has finished writing them.
+    // Partitions also write their body ranges straight into the next buffers
+    if (FirstPrivateDevice < DeviceCount)
+    {
+        err = clEnqueueMarkerWithWaitList(ComputeCommands, 0, NULL, &ready);
+        if (err)
+        {
+            printf("Failed to enqueue marker! %d\n", err);
+            return err;
+        }
+    }
+
+    PartitionWork(global[0] / local[0], offset, count);
+
+    for(i = 0; i < DeviceCount; i++)
+    {
+        size_t range_offset = offset[i] * local[0];
+        size_t range_global = count[i] * local[0];
+        int other = (i >= FirstPrivateDevice);
+
+        events[i] = 0;
+        if (!count[i])
+            continue;
+
+        if (PrivateBuffers(i))
+            err = SetBodyKernelArgs(&ComputePosBuffer[currentBuffer], &ComputeVelBuffer[currentBuffer],
+                &DevicePos[i], &DeviceVel[i]);
+        else
+            err = SetBodyKernelArgs(&ComputePosBuffer[currentBuffer], &ComputeVelBuffer[currentBuffer],
+                &ComputePosBuffer[nextBuffer], &ComputeVelBuffer[nextBuffer]);
+        err |= EnqueueKernel(DeviceCommands[i], ComputeKernel, 1, &range_offset, &range_global, local,
+            other ? 1 : 0, other ? &ready : NULL, &events[i]);
+        if (err)
+        {
+            printf("Failed to enqueue kernel on device %d! %d\n", i, err);
+            break;
+        }
+        clFlush(DeviceCommands[i]);
+    }
+    if (ready)
+        clReleaseEvent(ready);
+    if (err)
+        return err;
+
+    err = SetBodyKernelArgs(&ComputePosBuffer[currentBuffer], &ComputeVelBuffer[currentBuffer],
+        &ComputePosBuffer[nextBuffer], &ComputeVelBuffer[nextBuffer]);
+
+    // Copy the body ranges integrated elsewhere into the primary next buffers
+    // as each device finishes, device to device without a trip through the host
+    for(i = FirstPrivateDevice; i < DeviceCount && !err; i++)
+    {
+        size_t first = 4 * sizeof(float) * offset[i] * local[0];
+        size_t length = 4 * sizeof(float) * count[i] * local[0];
+        if (!length || !PrivateBuffers(i))
+            continue;
+
+        err = clEnqueueCopyBuffer(ComputeCommands, DevicePos[i], ComputePosBuffer[nextBuffer], first, first, length,
+            1, &events[i], NULL);
+        err |= clEnqueueCopyBuffer(ComputeCommands, DeviceVel[i], ComputeVelBuffer[nextBuffer], first, first, length,
+            1, &events[i], NULL);
+    }
+
+    for(i = 0; i < DeviceCount; i++)
+    {
+        ms[i] = 0;
+        if (!events[i])
+            continue;
+
+        clWaitForEvents(1, &events[i]);
+        ms[i] = GetEventTime(events[i]);
+        DeviceTime[i] += ms[i];
+    }
+    MultiDeviceCount++;
+
+    if (err)
+    {
+        printf("Failed to gather device results! %d\n", err);
+        return err;
+    }
+
+    if (Balance)
+        BalanceDevices(count, ms);
+
+    return CL_SUCCESS;
+}
+
+static void
+SetupGLSync(cl_platform_id platform_id)
+{
+    size_t length = 0;
+    int supported = 0;
+
+    // Fences need the CL context to share the GL one, copying builds keep the hard syncs
+    if (USE_GL_ATTACHMENTS && GLEW_ARB_sync &&
+        clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_EXTENSIONS, 0, NULL, &length) == CL_SUCCESS)
+    {
+        char *extensions = (char *)calloc(length + 1, sizeof(char));
+        if (clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_EXTENSIONS, length, extensions, NULL) == CL_SUCCESS)
+            supported = strstr(extensions, "cl_khr_gl_event") != NULL;
+        free(extensions);
+    }
+
+    if (supported)
+        CreateEventFromGLsync = (CreateEventFromGLsyncFn)clGetExtensionFunctionAddressForPlatform(platform_id,
+            "clCreateEventFromGLsyncKHR");
+
+    if (!CreateEventFromGLsync)
+    {
+        printf("GL sync events not available, falling back to glFinish/clFinish...\n");
+        GLSyncEvents = 0;
+        return;
+    }
+
+    printf("Synchronizing with GL through cl_khr_gl_event...\n");
+}
+
+static void
+WaitForGL(void)
+{
+    double start = GetPreciseTime();
+    int err = CL_SUCCESS;
+
+    if (GLSyncEvents)
+    {
+        // The queue waits on a fence behind the GL commands issued so far, the host does not
+        PendingFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        PendingGLEvent = CreateEventFromGLsync(ComputeContext, (cl_GLsync)PendingFence, &err);
+        if (PendingGLEvent)
+            err = clEnqueueBarrierWithWaitList(ComputeCommands, 1, &PendingGLEvent, NULL);
+    }
+
+    if (!GLSyncEvents || !PendingGLEvent || err != CL_SUCCESS)
+        glFinish();
+
+    SyncStall += GetPreciseTime() - start;
+}
+
+static void
+WaitForCL(void)
+{
+    double start = GetPreciseTime();
+
+    // cl_khr_gl_event orders later GL commands after the release, a flush is enough
+    if (GLSyncEvents)
+        clFlush(ComputeCommands);
+    else
+        clFinish(ComputeCommands);
+
+    if (PendingGLEvent)
+        clReleaseEvent(PendingGLEvent);
+    if (PendingFence)
+        glDeleteSync(PendingFence);
+    PendingGLEvent = 0;
+    PendingFence = 0;
+
+    SyncStall += GetPreciseTime() - start;
+    SyncCount++;
+}
+
+static int
+Recompute(void)
+{
+    if(!ComputeKernel)
+        return CL_SUCCESS;
+
+    if (NDRangeCount > MaxNDRange)
+    {
+        printf("Reach Max NDRange, Quitting\n");
+        Cleanup();
+        exit(0);
+    }
+
+    if ( EnableStideExec && (ExecutionCount / ExecuteStride) % 2 == 1)
+    {
+    	printf("GL only for frame %d\n", ExecutionCount);
+    	return CL_SUCCESS;
+    }
+
+    int err = 0;
+
+    int currentBuffer = CurrentBuffer;
+    int nextBuffer = (CurrentBuffer+1)%2;
+
+    if(Animated || Update)
+    {
+
+        WaitForGL();
+
+        // If use shared context, then data should be already in GL VBOs even for the 1st frame
+#if (USE_GL_ATTACHMENTS)
+
+        err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputePosBuffer[currentBuffer], 0, 0, 0);
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to acquire GL object! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        err = clEnqueueAcquireGLObjects(ComputeCommands, 1, &ComputePosBuffer[nextBuffer], 0, 0, 0);
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to acquire GL object! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+#if (DEBUG_INFO)
+        float *DataCurPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
+        float *DataNexPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
+
+        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[currentBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataCurPos, 0, NULL, NULL );      
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to read buffer! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[nextBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataNexPos, 0, NULL, NULL );      
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to read buffer! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < DataBodyCount; ++i)
+            printf("Before NDRange %d - %d: org [%f %f %f %f] - org curr [%f %f %f %f] - org next [%f %f %f %f]\n", NDRangeCount, i, 
+                DataInput[4 * i], DataInput[4 * i + 1], DataInput[4 * i + 2], DataInput[4 * i + 3],
+                DataCurPos[4 * i], DataCurPos[4 * i + 1], DataCurPos[4 * i + 2], DataCurPos[4 * i + 3],
+                DataNexPos[4 * i], DataNexPos[4 * i + 1], DataNexPos[4 * i + 2], DataNexPos[4 * i + 3]);
+
+        free(DataCurPos);
+        free(DataNexPos);
+#endif
+
+#else
+        // Not sharing context with OpenGL, needs to explicitly send data to GPU for the 1st frame
+        if (!NDRangeCount)
+        {
+            printf("1st Frame! Let's send data to GPU!\n");
+            err = clEnqueueWriteBuffer(ComputeCommands, ComputePosBuffer[currentBuffer], 1, 0, 
+                4 * sizeof(float) * DataBodyCount, DataInput, 0, 0, NULL);
+            if (err != CL_SUCCESS)
+            {
+                printf("Failed to write buffer! %d\n", err);
+                return EXIT_FAILURE;
+            }
+
+            err = clEnqueueWriteBuffer(ComputeCommands, ComputePosBuffer[nextBuffer], 1, 0, 
+                4 * sizeof(float) * DataBodyCount, DataInput, 0, 0, NULL);
+            if (err != CL_SUCCESS)
+            {
+                printf("Failed to write buffer! %d\n", err);
+                return EXIT_FAILURE;
+            }
+        }
+
+#endif
+        Update = 0;
+
+        // Periodic reorder along the Z curve, before the step reads the bodies
+        if (FrameOrder.bodies && NDRangeCount % ZOrderInterval == 0)
+        {
+            err = EnqueueZOrder(ComputeCommands, &FrameOrder, ComputePosBuffer[currentBuffer], ComputeVelBuffer[currentBuffer]);
+            if (err != CL_SUCCESS)
+            {
+                printf("Failed to reorder bodies! %d\n", err);
+                return err;
+            }
+        }
+
+        // The roofline wait for the last launch stays out of the host time
+        CollectRoofline();
+        double submit = GetHostTime();
+
+        err = CL_SUCCESS;
+        err |= SetKernelArg(ComputeKernel, 0, sizeof(cl_mem), &ComputePosBuffer[currentBuffer]);
+        err |= SetKernelArg(ComputeKernel, 1, sizeof(cl_mem), &ComputeVelBuffer[currentBuffer]);
+        err |= SetKernelArg(ComputeKernel, 5, sizeof(cl_mem), &ComputePosBuffer[nextBuffer]);
+        err |= SetKernelArg(ComputeKernel, 6, sizeof(cl_mem), &ComputeVelBuffer[nextBuffer]);
+        if (err)
+            return -10;
+
+        size_t global[1];
+        size_t local[1];
+
+        global[0] = DataBodyCount;
+        local[0] = GroupSize;
+
+#if (DEBUG_INFO)
+        if(FrameCount <= 1)
+            printf("Global[%4d] Local[%4d]\n", 
+                (int)global[0], (int)local[0]);
+#endif
+
+        if (MultiDevice)
+            err = EnqueueMultiDevice(global, local, currentBuffer, nextBuffer);
+        else if (CutoffRadius > 0)
+            err = EnqueueCellStep(ComputeCommands, &FrameGrid, ComputePosBuffer[currentBuffer],
+                ComputeVelBuffer[currentBuffer], ComputePosBuffer[nextBuffer], ComputeVelBuffer[nextBuffer], NULL);
+        else
+            err = EnqueueKernel(ComputeCommands, ComputeKernel, 1, NULL, global, local, 0, NULL, Roofline ? &RooflineEvent : NULL);
+        if (err)
+        {
+            printf("Failed to enqueue kernel! %d\n", err);
+            return err;
+        }
+
+        // Multi-device frames wait for their devices inside the launch
+        if (!MultiDevice)
+            CountHostSubmit(submit);
+
+        NDRangeCount++;
+        SimulatedSteps++;
+
+        // Checkpoints come off the device without waiting for the writer
+        if (CheckpointPath && !PauseCheckpoints && SimulatedSteps % CheckpointInterval == 0)
+        {
+            err = EnqueueSnapshot(ComputePosBuffer[nextBuffer], ComputeVelBuffer[nextBuffer], SimulatedSteps);
+            if (err != CL_SUCCESS)
+            {
+                printf("Failed to enqueue checkpoint! %d\n", err);
+                return err;
+            }
+        }
+
+#if (DEBUG_INFO)
+
+        float *DataCurPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
+        float *DataNexPos = (float *)calloc(1, 4 * sizeof(float) * DataBodyCount);
+
+        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[currentBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataCurPos, 0, NULL, NULL );      
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to read buffer! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[nextBuffer], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataNexPos, 0, NULL, NULL );      
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to read buffer! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < DataBodyCount; ++i)
+            printf("After NDRange %d - %d: org [%f %f %f %f] - org curr [%f %f %f %f] - org next [%f %f %f %f]\n", NDRangeCount, i, 
+                DataInput[4 * i], DataInput[4 * i + 1], DataInput[4 * i + 2], DataInput[4 * i + 3],
+                DataCurPos[4 * i], DataCurPos[4 * i + 1], DataCurPos[4 * i + 2], DataCurPos[4 * i + 3],
+                DataNexPos[4 * i], DataNexPos[4 * i + 1], DataNexPos[4 * i + 2], DataNexPos[4 * i + 3]);
+        
+        free(DataCurPos);
+        free(DataNexPos);
+#endif
+
+#if (USE_GL_ATTACHMENTS)
+
+        // Release control and the data is already in VBOs
+        err = clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputePosBuffer[currentBuffer], 0, 0, 0);
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to release GL object! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        err = clEnqueueReleaseGLObjects(ComputeCommands, 1, &ComputePosBuffer[nextBuffer], 0, 0, 0);
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to release GL object! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+#else
+        // Explicitly copy data back to host
+        err = clEnqueueReadBuffer( ComputeCommands, ComputePosBuffer[nextBuffer], CL_TRUE, 0, DataParticleCount * sizeof(float), DataInput, 0, NULL, NULL );      
+        if (err != CL_SUCCESS)
+        {
+            printf("Failed to read buffer! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        // Data in host side, copy to VBOs
+        UpdateVBO(nextBuffer, DataInput, nextBuffer);
+#endif
+
+        WaitForCL();
+    }
+
+    // Notify GL side which attribute index is using
+    glUniform1i(UniformCurBufIdxLocation, nextBuffer);
+
+    // Switch buffers
+    CurrentBuffer = nextBuffer;
+
+    return CL_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int 
+CreateComputeResource(void)
+{
+    int err = 0;
+
+    ResetKernelArgs();
+
+#if (USE_GL_ATTACHMENTS)
+
+    // CL Context is created from GL context, GL VBOs and CL Buffers point to the same data in GPU memory
+    // Updating VBO or associated CL Buffer affects both CL and GL.
+
+    // CL buffer Pos 0
+    if(ComputePosBuffer[0])
+        clReleaseMemObject(ComputePosBuffer[0]);
+    ComputePosBuffer[0] = 0;
+
+    if (VboPosID[0])
+    {
+        printf("Allocating compute input/output real part for FFT in device memory...\n");
+        ComputePosBuffer[0] = clCreateFromGLBuffer(ComputeContext, CL_MEM_READ_WRITE, VboPosID[0], &err);
+        if (!ComputePosBuffer[0] || err != CL_SUCCESS)
+        {
+            printf("Failed to create OpenGL VBO reference! %d\n", err);
+            return -1;
+        }
+    }
+    else
+    {
+        printf("VboPosID[0] not valid!\n");
+        return -1;
+    }
+
+    // CL buffer Pos 1
+    if(ComputePosBuffer[1])
+        clReleaseMemObject(ComputePosBuffer[1]);
+    ComputePosBuffer[1] = 0;
+
+    if (VboPosID[1])
+    {
+        printf("Allocating compute input/output real part for FFT in device memory...\n");
+        ComputePosBuffer[1] = clCreateFromGLBuffer(ComputeContext, CL_MEM_READ_WRITE, VboPosID[1], &err);
+        if (!ComputePosBuffer[1] || err != CL_SUCCESS)
+        {
+            printf("Failed to create OpenGL VBO reference! %d\n", err);
+            return -1;
+        }
+    }
+    else
+    {
+        printf("VboPosID[1] not valid!\n");
+        return -1;
+    }
+
+#else
+
+    // Not sharing context, so just create CL buffers as normal
+    if(ComputePosBuffer[0])
+        clReleaseMemObject(ComputePosBuffer[0]);
+    ComputePosBuffer[0] = 0;
+
+    printf("Allocating compute buffer 0 for NBody in device memory...\n");
+    ComputePosBuffer[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
+        4 * sizeof(float) * DataBodyCount, 0, &err);
+    if (!ComputePosBuffer[0] || err != CL_SUCCESS)
+    {
+        printf("Failed to create OpenGL VBO reference! %d\n", err);
+        return -1;
+    }
+
+    if(ComputePosBuffer[1])
+        clReleaseMemObject(ComputePosBuffer[1]);
+    ComputePosBuffer[1] = 0;
+
+    printf("Allocating compute buffer 1 for NBody in device memory...\n");
+    ComputePosBuffer[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
+        4 * sizeof(float) * DataBodyCount, 0, &err);
+    if (!ComputePosBuffer[1] || err != CL_SUCCESS)
+    {
+        printf("Failed to create OpenGL VBO reference! %d\n", err);
+        return -1;
+    }
+
+#endif
+
+    // Velocity buffer 0
+    if(ComputeVelBuffer[0])
+        clReleaseMemObject(ComputeVelBuffer[0]);
+    ComputeVelBuffer[0] = 0;
+
+    printf("Allocating compute velocity buffer 0 for NBody in device memory...\n");
+    ComputeVelBuffer[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
+        4 * sizeof(float) * DataBodyCount, 0, &err);
+    if (!ComputeVelBuffer[0] || err != CL_SUCCESS)
+    {
+        printf("Failed to create OpenGL VBO reference! %d\n", err);
+        return -1;
+    }
+
+    // Velocity buffer 1
+    if(ComputeVelBuffer[1])
+        clReleaseMemObject(ComputeVelBuffer[1]);
+    ComputeVelBuffer[1] = 0;
+
+    printf("Allocating compute velocity buffer 0 for NBody in device memory...\n");
+    ComputeVelBuffer[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
+        4 * sizeof(float) * DataBodyCount, 0, &err);
+    if (!ComputeVelBuffer[1] || err != CL_SUCCESS)
+    {
+        printf("Failed to create OpenGL VBO reference! %d\n", err);
+        return -1;
+    }
+
+    // Initialize the velocity buffer to zero
+    float* p = (float*) clEnqueueMapBuffer(ComputeCommands, ComputeVelBuffer[0], CL_TRUE,
+        CL_MAP_WRITE
+        , 0, 4 * sizeof(float) * DataBodyCount, 0, NULL, NULL, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error mapping ComputeVelBuffer[0]\n");
+        exit(-1);
+    }
+    memset(p, 0, 4 * sizeof(float) * DataBodyCount);
+    err = clEnqueueUnmapMemObject(ComputeCommands, ComputeVelBuffer[0], p, 0, NULL,NULL);
+
+    p = (float*) clEnqueueMapBuffer(ComputeCommands, ComputeVelBuffer[1], CL_TRUE,
+        CL_MAP_WRITE
+        , 0, 4 * sizeof(float) * DataBodyCount, 0, NULL, NULL, &err);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error mapping ComputeVelBuffer[1]\n");
+        exit(-1);
+    }
+    memset(p, 0, 4 * sizeof(float) * DataBodyCount);
+    err = clEnqueueUnmapMemObject(ComputeCommands, ComputeVelBuffer[1], p, 0, NULL,NULL);
+
+    if (MultiDevice)
+    {
+        // The other devices integrate their body ranges into these, the
+        // current bodies they read from the primary buffers
+        for(cl_uint i = FirstPrivateDevice; i < DeviceCount && PrivateBuffers(i); i++)
+        {
+            if(DevicePos[i])
+                clReleaseMemObject(DevicePos[i]);
+            if(DeviceVel[i])
+                clReleaseMemObject(DeviceVel[i]);
+
+            DevicePos[i] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, 4 * sizeof(float) * DataBodyCount, 0, &err);
+            DeviceVel[i] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, 4 * sizeof(float) * DataBodyCount, 0, &err);
+            if (!DevicePos[i] || !DeviceVel[i])
+            {
+                printf("Failed to create buffers for device %d! %d\n", i, err);
+                return -1;
+            }
+        }
+    }
+
+    return CL_SUCCESS;
+}
+
+static int
+PartitionDevice(void)
+{
+    cl_device_partition_property properties[MAX_DEVICES + 3];
+    cl_uint p = 0;
+    cl_uint i;
+    cl_uint count = 0;
+    int err;
+
+    if (ComputeDeviceType != CL_DEVICE_TYPE_CPU)
+    {
+        printf("Device fission needs the CPU device, ignoring '%s'\n", FissionSpec);
+        return CL_SUCCESS;
+    }
+
+    // equal:<units>, counts:<units>,<units>,... or an affinity domain (numa, l3, l2, next)
+    if (!strncmp(FissionSpec, "equal:", 6))
+    {
+        properties[p++] = CL_DEVICE_PARTITION_EQUALLY;
+        properties[p++] = atoi(FissionSpec + 6);
+    }
+    else if (!strncmp(FissionSpec, "counts:", 7))
+    {
+        const char *c = FissionSpec + 7;
+
+        properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS;
+        while (c && *c && p < MAX_DEVICES + 1)
+        {
+            properties[p++] = atoi(c);
+            c = strchr(c, ',');
+            if (c)
+                c++;
+        }
+        properties[p++] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+    }
+    else
+    {
+        properties[p++] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+        if (!strcmp(FissionSpec, "numa"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+        else if (!strcmp(FissionSpec, "l3"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE;
+        else if (!strcmp(FissionSpec, "l2"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE;
+        else if (!strcmp(FissionSpec, "next"))
+            properties[p++] = CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE;
+        else
+        {
+            printf("Error: Unknown device fission '%s', use equal:<units>, counts:<units>,... numa, l3, l2 or next!\n",
+                FissionSpec);
+            return EXIT_FAILURE;
+        }
+    }
+    properties[p++] = 0;
+
+    err = clCreateSubDevices(ComputeDeviceId, properties, 0, NULL, &count);
+    if (err != CL_SUCCESS || !count || count >= MAX_DEVICES)
+    {
+        printf("Error: Failed to partition compute device '%s'! %d\n", FissionSpec, err);
+        return EXIT_FAILURE;
+    }
+
+    err = clCreateSubDevices(ComputeDeviceId, properties, count, DeviceIds, &DeviceCount);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create sub-devices! %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    // Every partition works on its range of the root device buffers, the root
+    // device runs the monolithic baseline
+    FirstPrivateDevice = 0;
+    MultiDevice = 1;
+    for(i = 0; i < DeviceCount; i++)
+        DeviceShare[i] = 1.0f / DeviceCount;
+
+    printf("Partitioned compute device into %d sub-devices (%s)...\n", DeviceCount, FissionSpec);
+
+    return CL_SUCCESS;
+}
+
+static void
+ListContextDevices(void)
+{
+    cl_uint i;
+
+    // The root goes first so it is still the device picked for the main queue
+    ContextDeviceCount = 0;
+    if (!FirstPrivateDevice)
+        ContextDeviceIds[ContextDeviceCount++] = ComputeDeviceId;
+    for(i = 0; i < DeviceCount; i++)
+        ContextDeviceIds[ContextDeviceCount++] = DeviceIds[i];
+}
+
+static int
+GatherDevices(cl_platform_id platform_id)
+{
+    cl_uint i;
+    int err;
+
+    err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, MAX_DEVICES, DeviceIds, &DeviceCount);
+    if (err != CL_SUCCESS || !DeviceCount)
+    {
+        printf("Error: Failed to locate compute devices!\n");
+        return EXIT_FAILURE;
+    }
+    if (DeviceCount > MAX_DEVICES)
+        DeviceCount = MAX_DEVICES;
+
+    // Keep the requested device first, it owns the result and the GL copy
+    for(i = 0; i < DeviceCount; i++)
+    {
+        if(DeviceIds[i] == ComputeDeviceId)
+        {
+            DeviceIds[i] = DeviceIds[0];
+            DeviceIds[0] = ComputeDeviceId;
+            break;
+        }
+    }
+
+    for(i = 0; i < DeviceCount; i++)
+        DeviceShare[i] = 1.0f / DeviceCount;
+
+    return CL_SUCCESS;
+}
+
+static int
+CreateDeviceQueues(void)
+{
+    cl_uint i;
+    int err;
+
+    for(i = FirstPrivateDevice; i < DeviceCount; i++)
+    {
+        cl_char device_name[1024] = {0};
+
+        DeviceCommands[i] = clCreateCommandQueue(ComputeContext, DeviceIds[i], CL_QUEUE_PROFILING_ENABLE, &err);
+        if (!DeviceCommands[i])
+        {
+            printf("Error: Failed to create a command queue for device %d!\n", i);
+            return EXIT_FAILURE;
+        }
+
+        clGetDeviceInfo(DeviceIds[i], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+        printf("Connecting to %s as device %d...\n", device_name, i);
+    }
+
+    return CL_SUCCESS;
+}
+
+static int 
+SetupComputeDevices(int gpu)
+{
+    int err;
+    size_t returned_size;
+    ComputeDeviceType = gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
+
+#if (USE_GL_ATTACHMENTS)
+
+    printf(SEPARATOR);
+    printf("Using active OpenGL context...\n");
+
+    // Bind to platform
+    cl_platform_id platform_id;
+
+    cl_uint numPlatforms;
+    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
+    if (status != CL_SUCCESS)
+    {
+        printf("clGetPlatformIDs Failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (0 < numPlatforms)
+    {
+        cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
+
+        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+
+        char platformName[100];
+        for (unsigned i = 0; i < numPlatforms; ++i)
+        {
+            status = clGetPlatformInfo(platforms[i],
+                CL_PLATFORM_VENDOR,
+                sizeof(platformName),
+                platformName,
+                NULL);
+            platform_id = platforms[i];
+            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
+            {
+                break;
+            }
+        }
+        printf("Platform found : %s\n", platformName);
+        free(platforms);
+    }
+    if(NULL == platform_id)
+    {
+        printf("NULL platform found so Exiting Application.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Get ID for the device
+    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+    DeviceIds[0] = ComputeDeviceId;
+
+    if (FissionSpec)
+        err = PartitionDevice();
+    else if (MultiDevice)
+        err = GatherDevices(platform_id);
+    if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+    ListContextDevices();
+
+    // Create a context  
+    cl_context_properties properties[] =
+    {
+        CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
+        CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
+        CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_id),
+        0
+    };
+
+    // Create a context from a CGL share group
+    //
+    ComputeContext = clCreateContext(properties, ContextDeviceCount, ContextDeviceIds, NULL, 0, 0);
+    if (!ComputeContext)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+#else
+
+    // Bind to platform
+    cl_platform_id platform_id;
+
+    cl_uint numPlatforms;
+    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
+    if (status != CL_SUCCESS)
+    {
+        printf("clGetPlatformIDs Failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (0 < numPlatforms)
+    {
+        cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
+
+        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+
+        char platformName[100];
+        for (unsigned i = 0; i < numPlatforms; ++i)
+        {
+            status = clGetPlatformInfo(platforms[i],
+                CL_PLATFORM_VENDOR,
+                sizeof(platformName),
+                platformName,
+                NULL);
+            platform_id = platforms[i];
+            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
+            {
+                break;
+            }
+        }
+        printf("Platform found : %s\n", platformName);
+        free(platforms);
+    }
+    if(NULL == platform_id)
+    {
+        printf("NULL platform found so Exiting Application.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Get ID for the device
+    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+    DeviceIds[0] = ComputeDeviceId;
+
+    if (FissionSpec)
+        err = PartitionDevice();
+    else if (MultiDevice)
+        err = GatherDevices(platform_id);
+    if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+    ListContextDevices();
+
+    // Create a context containing the compute device(s)
+    //
+    ComputeContext = clCreateContext(0, ContextDeviceCount, ContextDeviceIds, NULL, NULL, &err);
+    if (!ComputeContext)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+#endif
+
+    unsigned int device_count;
+    cl_device_id device_ids[16];
+
+    err = clGetContextInfo(ComputeContext, CL_CONTEXT_DEVICES, sizeof(device_ids), device_ids, &returned_size);
+    if(err)
+    {
+        printf("Error: Failed to retrieve compute devices for context!\n");
+        return EXIT_FAILURE;
+    }
+
+    device_count = returned_size / sizeof(cl_device_id);
+
+    unsigned int i = 0;
+    int device_found = 0;
+    cl_device_type device_type; 
+    for(i = 0; i < device_count; i++) 
+    {
+        clGetDeviceInfo(device_ids[i], CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, NULL);
+        if(device_type == ComputeDeviceType) 
+        {
+            ComputeDeviceId = device_ids[i];
+            device_found = 1;
+            break;
+        } 
+    }
+
+    if(!device_found)
+    {
+        printf("Error: Failed to locate compute device!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Create a command queue
+    //
+    cl_command_queue_properties queue_properties = (MultiDevice || Roofline) ? CL_QUEUE_PROFILING_ENABLE : 0;
+    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, queue_properties, &err);
+    if (!ComputeCommands)
+    {
+        printf("Error: Failed to create a command queue!\n");
+        return EXIT_FAILURE;
+    }
+
+    if (GLSyncEvents)
+        SetupGLSync(platform_id);
+
+    // Report the device vendor and device name
+    // 
+    cl_char vendor_name[1024] = {0};
+    cl_char device_name[1024] = {0};
+    err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, &returned_size);
+    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, &returned_size);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve device info!\n");
+        return EXIT_FAILURE;
+    }
+
+    printf(SEPARATOR);
+    printf("Connecting to %s %s...\n", vendor_name, device_name);
+
+    if (FirstPrivateDevice)
+        DeviceCommands[0] = ComputeCommands;
+    if (MultiDevice)
+        return CreateDeviceQueues();
+
+    return CL_SUCCESS;
+}
+
+static int
+SetupGLProgram()
+{
+    GLenum error_check_value = glGetError();
+
+    if(VertexShaderID)
+        glDeleteShader(VertexShaderID);
+    VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(VertexShaderID, 1, &VertexShaderSource, NULL);
+    glCompileShader(VertexShaderID);
+
+    if(FragShaderID)
+        glDeleteShader(FragShaderID);
+    FragShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(FragShaderID, 1, &FragShaderSource, NULL);
+    glCompileShader(FragShaderID);
+
+    if (GLProgramID)
+    {
+        glUseProgram(0);
+        glDeleteProgram(GLProgramID);
+    }
+    GLProgramID = glCreateProgram();
+    glAttachShader(GLProgramID, VertexShaderID);
+    glAttachShader(GLProgramID, FragShaderID);
+
+    glLinkProgram(GLProgramID);
+    glUseProgram(GLProgramID);
+
+    VboPosLoc[0] = glGetAttribLocation(GLProgramID, "pos0");
+    VboPosLoc[1] = glGetAttribLocation(GLProgramID, "pos1");
+
+    printf("%d %d\n", VboPosLoc[0], VboPosLoc[1]);
+
+    UniformCurBufIdxLocation = glGetUniformLocation(GLProgramID, "curBufIdx");
+    if(UniformCurBufIdxLocation == 0xFFFFFFFF)
+        return -1;
+
+    error_check_value = glGetError();
+    if (error_check_value != GL_NO_ERROR)
+    {
+        fprintf(stderr, "error: %s: %s\n",
+            __FUNCTION__,
+            gluErrorString(error_check_value));
+        exit(1);
+    }
+
+    return 1;
+}
+
+static cl_program
+BuildComputeProgram(const char *options)
+{
+    int err = 0;
+    char *source = 0;
+    size_t length = 0;
+    cl_program program;
+
+    printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);
+    err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
+    if (!source || err)
+    {
+        printf("Error: Failed to load kernel source!\n");
+        return 0;
+    }
+
+#if (DEBUG_INFO)
+    printf("%s", source);
+#endif
+
+    // Create the compute program from the source buffer
+    //
+    program = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
+    free(source);
+    if (!program || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute program!\n");
+        return 0;
+    }
+
+    // Build the program executable
+    //
+    if (options && options[0])
+        printf("Building program with options '%s'...\n", options);
+    err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build program executable!\n");
+        clGetProgramBuildInfo(program, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+static int 
+SetupComputeKernel(void)
+{
+    int err = 0;
+
+    ResetKernelArgs();
+
+    if(ComputeKernel)
+        clReleaseKernel(ComputeKernel);    
+    ComputeKernel = 0;
+
+    if(ComputeProgram)
+        clReleaseProgram(ComputeProgram);
+    ComputeProgram = 0;
+
+    printf(SEPARATOR);
+    ComputeProgram = BuildComputeProgram(BuildOptions);
+    if (!ComputeProgram)
+        return EXIT_FAILURE;
+
+    // Create the compute kernel from within the program
+    //
+    printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_MATMUL_NAME); 
+    ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_NAME, &err);
+
+    if (!ComputeKernel || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute kernel!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Get the maximum work group size for executing the kernel on the device
+    //
+    err = clGetKernelWorkGroupInfo(ComputeKernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &MaxWorkGroupSize, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+        exit(1);
+    }
+
+#if (DEBUG_INFO)
+    printf("MaxWorkGroupSize: %d\n", MaxWorkGroupSize);
+    printf("WorkGroupItems: %d\n", WorkGroupItems);
+#endif
+
+    WorkGroupSize[0] = (MaxWorkGroupSize > 1) ? (MaxWorkGroupSize / WorkGroupItems) : MaxWorkGroupSize;
+    // WorkGroupSize[1] = MaxWorkGroupSize / WorkGroupSize[0];
 
-    // Velocity buffer 1
-    if(ComputeVelBuffer[1])
-        clReleaseMemObject(ComputeVelBuffer[1]);
-    ComputeVelBuffer[1] = 0;
+    printf(SEPARATOR);
 
-    printf("Allocating compute velocity buffer 0 for NBody in device memory...\n");
-    ComputeVelBuffer[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE,
-        4 * sizeof(float) * DataBodyCount, 0, &err);
-    if (!ComputeVelBuffer[1] || err != CL_SUCCESS)
+    // Setup several arguments that won't change
+    // DataBodyCount
+    err = SetKernelArg(
+        ComputeKernel,
+        2,
+        sizeof(int),
+        (void *)&DataBodyCount);
+    if (err != CL_SUCCESS)
     {
-        printf("Failed to create OpenGL VBO reference! %d\n", err);
-        return -1;
+        printf("Error: Failed to set kernel arg 2: DataBodyCount! %d\n", err);
+        exit(1);
     }
 
-    // Initialize the velocity buffer to zero
-    float* p = (float*) clEnqueueMapBuffer(ComputeCommands, ComputeVelBuffer[0], CL_TRUE,
-        CL_MAP_WRITE
-        , 0, 4 * sizeof(float) * DataBodyCount, 0, NULL, NULL, &err);
+    // time step
+    err = SetKernelArg(
+        ComputeKernel,
+        3,
+        sizeof(float),
+        (void *)&delT);
     if (err != CL_SUCCESS)
     {
-        printf("Error mapping ComputeVelBuffer[0]\n");
-        exit(-1);
+        printf("Error: Failed to set kernel arg 3: delT! %d\n", err);
+        exit(1);
     }
-    memset(p, 0, 4 * sizeof(float) * DataBodyCount);
-    err = clEnqueueUnmapMemObject(ComputeCommands, ComputeVelBuffer[0], p, 0, NULL,NULL);
 
-    p = (float*) clEnqueueMapBuffer(ComputeCommands, ComputeVelBuffer[1], CL_TRUE,
-        CL_MAP_WRITE
-        , 0, 4 * sizeof(float) * DataBodyCount, 0, NULL, NULL, &err);
+    // upward Pseudoprobability
+    err = SetKernelArg(
+        ComputeKernel,
+        4,
+        sizeof(float),
+        (void *)&espSqr);
     if (err != CL_SUCCESS)
     {
-        printf("Error mapping ComputeVelBuffer[1]\n");
-        exit(-1);
+        printf("Error: Failed to set kernel arg 4: espSqr! %d\n", err);
+        exit(1);
     }
-    memset(p, 0, 4 * sizeof(float) * DataBodyCount);
-    err = clEnqueueUnmapMemObject(ComputeCommands, ComputeVelBuffer[1], p, 0, NULL,NULL);
 
     return CL_SUCCESS;
 }
 
-static int 
-SetupComputeDevices(int gpu)
+static int
+CompareDevices(void)
 {
-    int err;
-    size_t returned_size;
-    ComputeDeviceType = gpu ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
+    int err = 0;
+    int f;
+    cl_uint i, d;
+    size_t global[1];
+    size_t local[1];
+    double single[MAX_DEVICES];
+    double single_rate = 0;
+    double best = 0;
+    double multi;
+    double monolithic = 0;
+    float shares[MAX_DEVICES];
+
+    global[0] = DataBodyCount;
+    local[0] = GroupSize;
+
+    glFinish();
 
 #if (USE_GL_ATTACHMENTS)
-
-    printf(SEPARATOR);
-    printf("Using active OpenGL context...\n");
-
-    // Bind to platform
-    cl_platform_id platform_id;
-
-    cl_uint numPlatforms;
-    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
-    if (status != CL_SUCCESS)
-    {
-        printf("clGetPlatformIDs Failed\n");
-        return EXIT_FAILURE;
-    }
-
-    if (0 < numPlatforms)
-    {
-        cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
-
-        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
-
-        char platformName[100];
-        for (unsigned i = 0; i < numPlatforms; ++i)
-        {
-            status = clGetPlatformInfo(platforms[i],
-                CL_PLATFORM_VENDOR,
-                sizeof(platformName),
-                platformName,
-                NULL);
-            platform_id = platforms[i];
-            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
-            {
-                break;
-            }
-        }
-        printf("Platform found : %s\n", platformName);
-        free(platforms);
-    }
-    if(NULL == platform_id)
+    err = clEnqueueAcquireGLObjects(ComputeCommands, 2, ComputePosBuffer, 0, 0, 0);
+    if (err != CL_SUCCESS)
     {
-        printf("NULL platform found so Exiting Application.\n");
+        printf("Failed to acquire GL object! %d\n", err);
         return EXIT_FAILURE;
     }
-
-    // Get ID for the device
-    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
+#else
+    err = clEnqueueWriteBuffer(ComputeCommands, ComputePosBuffer[0], CL_TRUE, 0, 4 * sizeof(float) * DataBodyCount, DataInput, 0, NULL, NULL);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to locate compute device!\n");
+        printf("Failed to write buffer! %d\n", err);
         return EXIT_FAILURE;
     }
+#endif
 
-    // Create a context  
-    cl_context_properties properties[] =
-    {
-        CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
-        CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
-        CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_id),
-        0
-    };
+    memcpy(shares, DeviceShare, sizeof(shares));
 
-    // Create a context from a CGL share group
-    //
-    ComputeContext = clCreateContext(properties, 1, &ComputeDeviceId, NULL, 0, 0);
-    if (!ComputeContext)
+    // Each device on its own with every body, always stepping buffer 0 into 1
+    for(d = 0; d < DeviceCount; d++)
     {
-        printf("Error: Failed to create a compute context!\n");
-        return EXIT_FAILURE;
+        for(i = 0; i < DeviceCount; i++)
+            DeviceShare[i] = (i == d) ? 1.0f : 0.0f;
+
+        long start = GetCurrentTime();
+        for(f = 0; f < BenchmarkFrames && !err; f++)
+            err = EnqueueMultiDevice(global, local, 0, 1);
+        clFinish(ComputeCommands);
+        if (err)
+            return err;
+
+        single[d] = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+        single_rate += 1.0 / single[d];
+        if (!best || single[d] < best)
+            best = single[d];
     }
 
-#else
+    // All devices together, letting the balancer settle first when enabled
+    memcpy(DeviceShare, shares, sizeof(shares));
+    for(f = 0; f < (Balance ? BenchmarkFrames : 1) && !err; f++)
+        err = EnqueueMultiDevice(global, local, 0, 1);
+    clFinish(ComputeCommands);
 
-    // Bind to platform
-    cl_platform_id platform_id;
+    long start = GetCurrentTime();
+    for(f = 0; f < BenchmarkFrames && !err; f++)
+        err = EnqueueMultiDevice(global, local, 0, 1);
+    clFinish(ComputeCommands);
+    if (err)
+        return err;
 
-    cl_uint numPlatforms;
-    cl_int status = clGetPlatformIDs(0, NULL, &numPlatforms);
-    if (status != CL_SUCCESS)
+    multi = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
+
+    // With fission the root device shares the context, time it on the whole problem
+    if (!FirstPrivateDevice)
     {
-        printf("clGetPlatformIDs Failed\n");
-        return EXIT_FAILURE;
+        start = GetCurrentTime();
+        for(f = 0; f < BenchmarkFrames && !err; f++)
+            err = EnqueueKernel(ComputeCommands, ComputeKernel, 1, NULL, global, local, 0, NULL, NULL);
+        clFinish(ComputeCommands);
+        if (err)
+            return err;
+
+        monolithic = SubtractTime(GetCurrentTime(), start) / BenchmarkFrames;
     }
 
-    if (0 < numPlatforms)
+#if (USE_GL_ATTACHMENTS)
+    clEnqueueReleaseGLObjects(ComputeCommands, 2, ComputePosBuffer, 0, 0, 0);
+    clFinish(ComputeCommands);
+#endif
+
+    printf(SEPARATOR);
+    printf("Multi-device scaling (%d steps, %d bodies, %s)\n", BenchmarkFrames, DataBodyCount,
+        Balance ? "balanced" : "equal split");
+    for(d = 0; d < DeviceCount; d++)
+    {
+        cl_char device_name[1024] = {0};
+        clGetDeviceInfo(DeviceIds[d], CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+        printf("  Device %2d: %8.3f ms  share %5.1f%%  %s\n", d, single[d], 100.0f * DeviceShare[d], device_name);
+    }
+    printf("  All devices: %8.3f ms  speedup %5.2fx  efficiency %5.1f%%\n",
+        multi, best / multi, 100.0 * (1.0 / multi) / single_rate);
+    if (!FirstPrivateDevice)
+        printf("  Monolithic:  %8.3f ms  partitions %5.2fx\n", monolithic, monolithic / multi);
+    printf(SEPARATOR);
+
+    if (EnableOutput)
+        fprintf(fp, "Devices %d Best %.3f ms All %.3f ms Efficiency %.1f%%\n", DeviceCount, best, multi,
+            100.0 * (1.0 / multi) / single_rate);
+    if (EnableOutput && !FirstPrivateDevice)
+        fprintf(fp, "Monolithic %.3f ms\n", monolithic);
+
+    for(d = 0; d < DeviceCount; d++)
+        DeviceTime[d] = 0;
+    MultiDeviceCount = 0;
+
+    Update = 1;
+    return CL_SUCCESS;
+}
+
+static int
+CompareSync(void)
+{
+    int err = 0;
+    int sync = GLSyncEvents;
+    int ndrange = NDRangeCount;
+    int pause = PauseCheckpoints;
+    double ms[2];
+    double stall[2];
+
+    // The same frames with the hard syncs and then with the fences, both drained at the end.
+    // The bodies still advance, but no checkpoint lands in the timed frames.
+    PauseCheckpoints = 1;
+    for (int mode = 0; mode < 2 && !err; mode++)
     {
-        cl_platform_id* platforms = (cl_platform_id*)calloc(numPlatforms, sizeof(cl_platform_id));
+        GLSyncEvents = mode;
+        SyncStall = 0;
+        SyncCount = 0;
 
-        status = clGetPlatformIDs(numPlatforms, platforms, NULL);
+        glFinish();
+        clFinish(ComputeCommands);
 
-        char platformName[100];
-        for (unsigned i = 0; i < numPlatforms; ++i)
+        double start = GetPreciseTime();
+        for (int f = 0; f < BenchmarkFrames && !err; f++)
         {
-            status = clGetPlatformInfo(platforms[i],
-                CL_PLATFORM_VENDOR,
-                sizeof(platformName),
-                platformName,
-                NULL);
-            platform_id = platforms[i];
-            if (!strcmp(platformName, "Advanced Micro Devices, Inc."))
-            {
-                break;
-            }
+            Update = 1;
+            err = Recompute();
         }
-        printf("Platform found : %s\n", platformName);
-        free(platforms);
-    }
-    if(NULL == platform_id)
-    {
-        printf("NULL platform found so Exiting Application.\n");
-        return EXIT_FAILURE;
-    }
+        glFinish();
+        clFinish(ComputeCommands);
 
-    // Get ID for the device
-    err = clGetDeviceIDs(platform_id, ComputeDeviceType, 1, &ComputeDeviceId, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to locate compute device!\n");
-        return EXIT_FAILURE;
+        ms[mode] = (GetPreciseTime() - start) / BenchmarkFrames;
+        stall[mode] = SyncCount ? SyncStall / SyncCount : 0;
     }
 
-    // Create a context containing the compute device(s)
-    //
-    ComputeContext = clCreateContext(0, 1, &ComputeDeviceId, NULL, NULL, &err);
-    if (!ComputeContext)
-    {
-        printf("Error: Failed to create a compute context!\n");
-        return EXIT_FAILURE;
-    }
+    GLSyncEvents = sync;
+    NDRangeCount = ndrange;
+    PauseCheckpoints = pause;
+    SyncStall = 0;
+    SyncCount = 0;
+    if (err)
+        return err;
 
-#endif
+    printf(SEPARATOR);
+    printf("GL/CL synchronization (%d frames)\n", BenchmarkFrames);
+    printf("  glFinish/clFinish: %8.3f ms per frame  stalled %8.3f ms\n", ms[0], stall[0]);
+    printf("  GL sync events:    %8.3f ms per frame  stalled %8.3f ms\n", ms[1], stall[1]);
+    printf("  Hard syncs cost    %8.3f ms per frame (%4.1f%%)\n", ms[0] - ms[1],
+        ms[0] > 0 ? 100.0 * (ms[0] - ms[1]) / ms[0] : 0.0);
+    printf(SEPARATOR);
 
-    unsigned int device_count;
-    cl_device_id device_ids[16];
+    if (fp)
+        fprintf(fp, "Hard %.3f ms Stall %.3f ms Fenced %.3f ms Stall %.3f ms\n", ms[0], stall[0], ms[1], stall[1]);
 
-    err = clGetContextInfo(ComputeContext, CL_CONTEXT_DEVICES, sizeof(device_ids), device_ids, &returned_size);
-    if(err)
-    {
-        printf("Error: Failed to retrieve compute devices for context!\n");
-        return EXIT_FAILURE;
-    }
+    Update = 1;
+    return CL_SUCCESS;
+}
 
-    device_count = returned_size / sizeof(cl_device_id);
+// Largest and root mean square difference to the reference output, both relative to
+// the largest reference magnitude. NaNs and infinities count as an infinite error.
+static void
+MeasureError(const float *reference, const float *result, size_t count, double *max_err, double *rms_err)
+{
+    double scale = 0;
+    double sum = 0;
+    size_t i;
 
-    unsigned int i = 0;
-    int device_found = 0;
-    cl_device_type device_type; 
-    for(i = 0; i < device_count; i++) 
+    *max_err = 0;
+    for (i = 0; i < count; i++)
     {
-        clGetDeviceInfo(device_ids[i], CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, NULL);
-        if(device_type == ComputeDeviceType) 
-        {
-            ComputeDeviceId = device_ids[i];
-            device_found = 1;
-            break;
-        } 
+        double diff = fabs((double)result[i] - reference[i]);
+        if (diff != diff)
+            diff = HUGE_VAL;
+        scale = (fabs(reference[i]) > scale) ? fabs(reference[i]) : scale;
+        *max_err = (diff > *max_err) ? diff : *max_err;
+        sum += diff * diff;
     }
 
-    if(!device_found)
-    {
-        printf("Error: Failed to locate compute device!\n");
-        return EXIT_FAILURE;
-    }
+    scale = (scale > 0) ? scale : 1;
+    *max_err /= scale;
+    *rms_err = sqrt(sum / count) / scale;
+}
 
-    // Create a command queue
-    //
-    ComputeCommands = clCreateCommandQueue(ComputeContext, ComputeDeviceId, 0, &err);
-    if (!ComputeCommands)
+// Host reference for nbody_cutoff, the positions after one step from rest
+static void
+ReferenceCutoffStep(const float *bodies, int count, float cutoff_sqr, float *reference)
+{
+    for (int i = 0; i < count; i++)
     {
-        printf("Error: Failed to create a command queue!\n");
-        return EXIT_FAILURE;
-    }
+        const float *p = bodies + 4 * i;
+        double acc[3] = { 0, 0, 0 };
 
-    // Report the device vendor and device name
-    // 
-    cl_char vendor_name[1024] = {0};
-    cl_char device_name[1024] = {0};
-    err = clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, &returned_size);
-    err|= clGetDeviceInfo(ComputeDeviceId, CL_DEVICE_NAME, sizeof(device_name), device_name, &returned_size);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to retrieve device info!\n");
-        return EXIT_FAILURE;
-    }
+        for (int j = 0; j < count; j++)
+        {
+            const float *q = bodies + 4 * j;
+            double r[3] = { q[0] - p[0], q[1] - p[1], q[2] - p[2] };
+            double dist_sqr = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
 
-    printf(SEPARATOR);
-    printf("Connecting to %s %s...\n", vendor_name, device_name);
+            if (dist_sqr < cutoff_sqr)
+            {
+                double inv_dist = 1.0 / sqrt(dist_sqr + espSqr);
+                double s = q[3] * inv_dist * inv_dist * inv_dist;
+                for (int d = 0; d < 3; d++)
+                    acc[d] += s * r[d];
+            }
+        }
 
-    return CL_SUCCESS;
+        for (int d = 0; d < 3; d++)
+            reference[4 * i + d] = (float)(p[d] + acc[d] * 0.5 * delT * delT);
+        reference[4 * i + 3] = p[3];
+    }
 }
 
+// Steps CutoffBodyScales times the bodies through the cell grid at CutoffScales
+// times the cutoff, and through nbody_sim over all pairs for comparison. Every
+// run starts from the same random bodies at rest, so the positions after a
+// step can be checked against the host.
 static int
-SetupGLProgram()
+CompareCutoff(void)
 {
-    GLenum error_check_value = glGetError();
-
-    if(VertexShaderID)
-        glDeleteShader(VertexShaderID);
-    VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(VertexShaderID, 1, &VertexShaderSource, NULL);
-    glCompileShader(VertexShaderID);
+    int err = CL_SUCCESS;
+    int b, c, f, i;
+    int body_scales = (int)(sizeof(CutoffBodyScales) / sizeof(CutoffBodyScales[0]));
+    int cutoff_scales = (int)(sizeof(CutoffScales) / sizeof(CutoffScales[0]));
+    cl_command_queue queue = clCreateCommandQueue(ComputeContext, ComputeDeviceId, CL_QUEUE_PROFILING_ENABLE, &err);
+    cl_kernel all_pairs = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_NAME, NULL);
 
-    if(FragShaderID)
-        glDeleteShader(FragShaderID);
-    FragShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(FragShaderID, 1, &FragShaderSource, NULL);
-    glCompileShader(FragShaderID);
-
-    if (GLProgramID)
+    if (!queue || !all_pairs)
     {
-        glUseProgram(0);
-        glDeleteProgram(GLProgramID);
+        printf("Failed to create cutoff comparison resources!\n");
+        err = EXIT_FAILURE;
+        body_scales = 0;
     }
-    GLProgramID = glCreateProgram();
-    glAttachShader(GLProgramID, VertexShaderID);
-    glAttachShader(GLProgramID, FragShaderID);
+    else
+    {
+        printf(SEPARATOR);
+        printf("Cutoff forces (%d steps each, cell grid against all pairs)\n", BenchmarkFrames);
+        printf("   bodies  cutoff    cells  pairs/body   bin ms  force ms  step ms  Mpairs/s  all pairs ms  speedup    max err\n");
+    }
+
+    for (b = 0; b < body_scales && err == CL_SUCCESS; b++)
+    {
+        int count = DataBodyCount * CutoffBodyScales[b];
+        size_t bytes = 4 * sizeof(float) * count;
+        size_t global = count;
+        size_t local = GroupSize;
+        int checked = (count <= CUTOFF_CHECK_BODIES);
+        double all_ms = 0;
+        float *bodies = (float *)malloc(bytes);
+        float *zero = (float *)calloc(1, bytes);
+        float *sorted = (float *)malloc(bytes);
+        float *result = (float *)malloc(bytes);
+        float *reference = (float *)malloc(bytes);
+        cl_uint *index = (cl_uint *)malloc(sizeof(cl_uint) * count);
+        cl_uint *pairs = (cl_uint *)malloc(sizeof(cl_uint) * count);
+        cl_mem buffers[4] = { 0, 0, 0, 0 };
+
+        if (bodies && zero)
+        {
+            for (i = 0; i < count; i++)
+            {
+                bodies[4 * i + 0] = RandomFloat(3, 50);
+                bodies[4 * i + 1] = RandomFloat(3, 50);
+                bodies[4 * i + 2] = RandomFloat(3, 50);
+                bodies[4 * i + 3] = RandomFloat(1, 1000);
+            }
+            buffers[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, bodies, NULL);
+            buffers[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, zero, NULL);
+            buffers[2] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+            buffers[3] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+        }
+        if (!sorted || !result || !reference || !index || !pairs || !buffers[0] || !buffers[1] || !buffers[2] || !buffers[3])
+        {
+            printf("Failed to create cutoff comparison buffers!\n");
+            err = EXIT_FAILURE;
+            cutoff_scales = 0;
+        }
+        else
+        {
+            // A transient kernel, so the arguments bypass the cache
+            err = clSetKernelArg(all_pairs, 0, sizeof(cl_mem), &buffers[0]);
+            err |= clSetKernelArg(all_pairs, 1, sizeof(cl_mem), &buffers[1]);
+            err |= clSetKernelArg(all_pairs, 2, sizeof(int), &count);
+            err |= clSetKernelArg(all_pairs, 3, sizeof(float), &delT);
+            err |= clSetKernelArg(all_pairs, 4, sizeof(float), &espSqr);
+            err |= clSetKernelArg(all_pairs, 5, sizeof(cl_mem), &buffers[2]);
+            err |= clSetKernelArg(all_pairs, 6, sizeof(cl_mem), &buffers[3]);
+        }
 
-    glLinkProgram(GLProgramID);
-    glUseProgram(GLProgramID);
+        // One untimed step, then the time to each step being complete on the device.
+        // All pairs are quadratic in the bodies, so large sweeps skip them
+        for (f = 0; f <= BenchmarkFrames && checked && err == CL_SUCCESS; f++)
+        {
+            double start = GetPreciseTime();
 
-    VboPosLoc[0] = glGetAttribLocation(GLProgramID, "pos0");
-    VboPosLoc[1] = glGetAttribLocation(GLProgramID, "pos1");
+            err = clEnqueueNDRangeKernel(queue, all_pairs, 1, NULL, &global, &local, 0, NULL, NULL);
+            err |= clFinish(queue);
+            all_ms += f ? (GetPreciseTime() - start) / BenchmarkFrames : 0;
+        }
 
-    printf("%d %d\n", VboPosLoc[0], VboPosLoc[1]);
+        for (c = 0; c < cutoff_scales && err == CL_SUCCESS; c++)
+        {
+            CellGrid grid;
+            float cutoff = CutoffRadius * CutoffScales[c];
+            double bin_ms = 0, force_ms = 0, step_ms = 0;
+            double max_err = 0, rms_err = 0;
+            double pair_total = 0;
+
+            err = CreateCellGrid(&grid, ComputeProgram, bodies, count, cutoff, 0);
+            for (f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+            {
+                cl_event events[CELL_KERNEL_COUNT];
+                double start = GetPreciseTime();
+
+                err = EnqueueCellStep(queue, &grid, buffers[0], buffers[1], buffers[2], buffers[3], events);
+                err |= clFinish(queue);
+                step_ms += f ? (GetPreciseTime() - start) / BenchmarkFrames : 0;
+                for (i = 0; i < CELL_KERNEL_COUNT; i++)
+                {
+                    double ms = events[i] ? GetEventTime(events[i]) : 0;
+                    if (i == CELL_FORCE)
+                        force_ms += f ? ms / BenchmarkFrames : 0;
+                    else
+                        bin_ms += f ? ms / BenchmarkFrames : 0;
+                }
+            }
 
-    UniformCurBufIdxLocation = glGetUniformLocation(GLProgramID, "curBufIdx");
-    if(UniformCurBufIdxLocation == 0xFFFFFFFF)
-        return -1;
+            err |= clEnqueueReadBuffer(queue, buffers[2], CL_FALSE, 0, bytes, sorted, 0, NULL, NULL);
+            err |= clEnqueueReadBuffer(queue, grid.sorted_index, CL_FALSE, 0, sizeof(cl_uint) * count, index, 0, NULL, NULL);
+            err |= clEnqueueReadBuffer(queue, grid.pair_count, CL_TRUE, 0, sizeof(cl_uint) * count, pairs, 0, NULL, NULL);
+            if (err == CL_SUCCESS)
+            {
+                // Back to the order of the bodies for the reference
+                for (i = 0; i < count; i++)
+                {
+                    memcpy(result + 4 * index[i], sorted + 4 * i, 4 * sizeof(float));
+                    pair_total += pairs[i];
+                }
+                if (checked)
+                {
+                    ReferenceCutoffStep(bodies, count, cutoff * cutoff, reference);
+                    MeasureError(reference, result, 4 * count, &max_err, &rms_err);
+                }
+
+                printf("  %7d %7.2f %8d %11.1f %8.3f %9.3f %8.3f %9.1f", count, cutoff, grid.dims.s[3], pair_total / count,
+                    bin_ms, force_ms, step_ms, (step_ms > 0) ? pair_total / (step_ms * 1000.0) : 0.0);
+                if (checked)
+                    printf(" %13.3f %7.2fx  %9.3e\n", all_ms, (step_ms > 0) ? all_ms / step_ms : 0.0, max_err);
+                else
+                    printf(" %13s %8s  %9s\n", "-", "-", "-");
+                if (fp && checked)
+                    fprintf(fp, "Cutoff %d bodies %.2f radius %d cells Bin %.3f ms Force %.3f ms Step %.3f ms AllPairs %.3f ms Pairs %.0f MaxErr %.3e\n",
+                        count, cutoff, grid.dims.s[3], bin_ms, force_ms, step_ms, all_ms, pair_total, max_err);
+                else if (fp)
+                    fprintf(fp, "Cutoff %d bodies %.2f radius %d cells Bin %.3f ms Force %.3f ms Step %.3f ms AllPairs NA Pairs %.0f MaxErr NA\n",
+                        count, cutoff, grid.dims.s[3], bin_ms, force_ms, step_ms, pair_total);
+            }
+            ReleaseCellGrid(&grid);
+        }
 
-    error_check_value = glGetError();
-    if (error_check_value != GL_NO_ERROR)
+        for (i = 0; i < 4; i++)
+        {
+            if (buffers[i])
+                clReleaseMemObject(buffers[i]);
+        }
+        free(bodies);
+        free(zero);
+        free(sorted);
+        free(result);
+        free(reference);
+        free(index);
+        free(pairs);
+    }
+
+    if (err != CL_SUCCESS)
+        printf("Failed to run cutoff comparison! %d\n", err);
+    else
     {
-        fprintf(stderr, "error: %s: %s\n",
-            __FUNCTION__,
-            gluErrorString(error_check_value));
-        exit(1);
+        printf("  Pairs are the ones within the cutoff, errors are against a host loop over all pairs\n");
+        printf("  All pairs are skipped above %d bodies\n", CUTOFF_CHECK_BODIES);
+        printf(SEPARATOR);
     }
 
-    return 1;
+    if (all_pairs)
+        clReleaseKernel(all_pairs);
+    if (queue)
+        clReleaseCommandQueue(queue);
+
+    return err;
 }
 
-static int 
-SetupComputeKernel(void)
+// Steps ZORDER_STEPS frames of the initial bodies with the kernel of the frame
+// loop, reordering them along the Z curve every ZOrderIntervals steps, and
+// times the reorders and the steps apart. After each run the codes have to be
+// in order and the ids still a permutation of the bodies.
+static int
+CompareZOrder(void)
 {
-    int err = 0;
-    char *source = 0;
-    size_t length = 0;
+    int err = CL_SUCCESS;
+    int r, f, i;
+    int rows = (int)(sizeof(ZOrderIntervals) / sizeof(ZOrderIntervals[0]));
+    size_t bytes = 4 * sizeof(float) * DataBodyCount;
+    size_t global = DataBodyCount;
+    size_t local = GroupSize;
+    double reorder_ms[sizeof(ZOrderIntervals) / sizeof(ZOrderIntervals[0])];
+    double step_ms[sizeof(ZOrderIntervals) / sizeof(ZOrderIntervals[0])];
+    int reorders[sizeof(ZOrderIntervals) / sizeof(ZOrderIntervals[0])];
+    float *zero = (float *)calloc(1, bytes);
+    cl_uint *keys = (cl_uint *)malloc(sizeof(cl_uint) * DataBodyCount);
+    cl_uint *ids = (cl_uint *)malloc(sizeof(cl_uint) * DataBodyCount);
+    int *seen = (int *)malloc(sizeof(int) * DataBodyCount);
+    cl_kernel all_pairs = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_NAME, NULL);
+    cl_mem pos[2], vel[2];
+    CellGrid grid;
+    ZOrder order;
+
+    memset(&grid, 0, sizeof(grid));
+    memset(&order, 0, sizeof(order));
+    for (i = 0; i < 2; i++)
+    {
+        pos[i] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+        vel[i] = clCreateBuffer(ComputeContext, CL_MEM_READ_WRITE, bytes, NULL, NULL);
+    }
+    if (!zero || !keys || !ids || !seen || !all_pairs || !pos[0] || !pos[1] || !vel[0] || !vel[1])
+    {
+        printf("Failed to create Z-order comparison resources!\n");
+        err = EXIT_FAILURE;
+        rows = 0;
+    }
+    else if (CutoffRadius > 0)
+        err = CreateCellGrid(&grid, ComputeProgram, DataInput, DataBodyCount, CutoffRadius, 0);
+
+    // The first row is one untimed reorder and step, so no row pays for the first launches
+    for (r = -1; r < rows && err == CL_SUCCESS; r++)
+    {
+        int interval = (r < 0) ? 1 : ZOrderIntervals[r];
+        int steps = (r < 0) ? 1 : ZORDER_STEPS;
+        int current = 0;
+        double reorder = 0, step = 0;
+        int count = 0;
+
+        err = CreateZOrder(&order, ComputeProgram, DataInput, DataBodyCount);
+        err |= clEnqueueWriteBuffer(ComputeCommands, pos[0], CL_FALSE, 0, bytes, DataInput, 0, NULL, NULL);
+        err |= clEnqueueWriteBuffer(ComputeCommands, vel[0], CL_FALSE, 0, bytes, zero, 0, NULL, NULL);
+        err |= clFinish(ComputeCommands);
+
+        for (f = 0; f < steps && err == CL_SUCCESS; f++)
+        {
+            double start = GetPreciseTime();
 
-    if(ComputeKernel)
-        clReleaseKernel(ComputeKernel);    
-    ComputeKernel = 0;
+            if (interval && f % interval == 0)
+            {
+                err = EnqueueZOrder(ComputeCommands, &order, pos[current], vel[current]);
+                err |= clFinish(ComputeCommands);
+                reorder += GetPreciseTime() - start;
+                start = GetPreciseTime();
+                count++;
+            }
 
-    if(ComputeProgram)
-        clReleaseProgram(ComputeProgram);
-    ComputeProgram = 0;
+            if (CutoffRadius > 0)
+                err |= EnqueueCellStep(ComputeCommands, &grid, pos[current], vel[current], pos[1 - current], vel[1 - current], NULL);
+            else
+            {
+                // A transient kernel, so the arguments bypass the cache
+                err |= clSetKernelArg(all_pairs, 0, sizeof(cl_mem), &pos[current]);
+                err |= clSetKernelArg(all_pairs, 1, sizeof(cl_mem), &vel[current]);
+                err |= clSetKernelArg(all_pairs, 2, sizeof(int), &DataBodyCount);
+                err |= clSetKernelArg(all_pairs, 3, sizeof(float), &delT);
+                err |= clSetKernelArg(all_pairs, 4, sizeof(float), &espSqr);
+                err |= clSetKernelArg(all_pairs, 5, sizeof(cl_mem), &pos[1 - current]);
+                err |= clSetKernelArg(all_pairs, 6, sizeof(cl_mem), &vel[1 - current]);
+                err |= clEnqueueNDRangeKernel(ComputeCommands, all_pairs, 1, NULL, &global, &local, 0, NULL, NULL);
+            }
+            err |= clFinish(ComputeCommands);
+            step += (GetPreciseTime() - start) / steps;
+            current = 1 - current;
+        }
 
-    printf(SEPARATOR);
-    printf("Loading kernel source from file '%s'...\n", COMPUTE_KERNEL_FILENAME);    
-    err = LoadTextFromFile(COMPUTE_KERNEL_FILENAME, &source, &length);
-    if (!source || err)
-    {
-        printf("Error: Failed to load kernel source!\n");
-        return EXIT_FAILURE;
-    }
+        if (count && err == CL_SUCCESS)
+        {
+            err = clEnqueueReadBuffer(ComputeCommands, order.keys, CL_FALSE, 0, sizeof(cl_uint) * DataBodyCount, keys, 0, NULL, NULL);
+            err |= clEnqueueReadBuffer(ComputeCommands, order.ids, CL_TRUE, 0, sizeof(cl_uint) * DataBodyCount, ids, 0, NULL, NULL);
 
-#if (DEBUG_INFO)
-    printf("%s", source);
-#endif
+            memset(seen, 0, sizeof(int) * DataBodyCount);
+            for (i = 0; i < DataBodyCount && err == CL_SUCCESS; i++)
+            {
+                if ((i && keys[i] < keys[i - 1]) || ids[i] >= (cl_uint)DataBodyCount || seen[ids[i]]++)
+                {
+                    printf("Z-order reorder lost the order of the bodies at slot %d!\n", i);
+                    err = EXIT_FAILURE;
+                }
+            }
+        }
+        ReleaseZOrder(&order);
 
-    // Create the compute program from the source buffer
-    //
-    ComputeProgram = clCreateProgramWithSource(ComputeContext, 1, (const char **) & source, NULL, &err);
-    if (!ComputeProgram || err != CL_SUCCESS)
-    {
-        printf("Error: Failed to create compute program!\n");
-        return EXIT_FAILURE;
+        if (r >= 0)
+        {
+            reorder_ms[r] = reorder;
+            step_ms[r] = step;
+            reorders[r] = count;
+        }
     }
-    free(source);
 
-    // Build the program executable
-    //
-    // err = clBuildProgram(ComputeProgram, 0, NULL, "-x clc++", NULL, NULL);
-    err = clBuildProgram(ComputeProgram, 0, NULL, NULL, NULL, NULL);
     if (err != CL_SUCCESS)
+        printf("Failed to run Z-order comparison! %d\n", err);
+    else
     {
-        size_t len;
-        char buffer[2048];
+        int best = 0;
 
-        printf("Error: Failed to build program executable!\n");
-        clGetProgramBuildInfo(ComputeProgram, ComputeDeviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-        printf("%s\n", buffer);
-        return EXIT_FAILURE;
+        printf(SEPARATOR);
+        printf("Z-order reordering (%d steps of %d bodies with %s)\n", ZORDER_STEPS, DataBodyCount,
+            (CutoffRadius > 0) ? COMPUTE_KERNEL_CUTOFF_NAME : COMPUTE_KERNEL_MATMUL_NAME);
+        printf("  interval  reorders  reorder ms   step ms  total ms/step  speedup\n");
+        for (r = 0; r < rows; r++)
+        {
+            double total = step_ms[r] + reorder_ms[r] / ZORDER_STEPS;
+            double first = step_ms[0] + reorder_ms[0] / ZORDER_STEPS;
+
+            if (ZOrderIntervals[r])
+                printf("  %8d", ZOrderIntervals[r]);
+            else
+                printf("  %8s", "never");
+            printf("  %8d  %10.3f  %8.3f  %13.3f  %6.2fx\n", reorders[r], reorders[r] ? reorder_ms[r] / reorders[r] : 0.0,
+                step_ms[r], total, (total > 0) ? first / total : 0.0);
+            if (fp)
+                fprintf(fp, "ZOrder interval %d reorders %d Reorder %.3f ms Step %.3f ms\n", ZOrderIntervals[r],
+                    reorders[r], reorder_ms[r], step_ms[r]);
+            if (total < step_ms[best] + reorder_ms[best] / ZORDER_STEPS)
+                best = r;
+        }
+        if (ZOrderIntervals[best])
+            printf("  Reordering every %d steps is the fastest, reorder ms includes the copy back\n", ZOrderIntervals[best]);
+        else
+            printf("  Reordering does not pay off within %d steps\n", ZORDER_STEPS);
+        printf(SEPARATOR);
     }
 
-    // Create the compute kernel from within the program
-    //
-    printf("Creating kernel '%s'...\n", COMPUTE_KERNEL_MATMUL_NAME); 
-    ComputeKernel = clCreateKernel(ComputeProgram, COMPUTE_KERNEL_MATMUL_NAME, &err);
-
-    if (!ComputeKernel || err != CL_SUCCESS)
+    ReleaseCellGrid(&grid);
+    for (i = 0; i < 2; i++)
     {
-        printf("Error: Failed to create compute kernel!\n");
-        return EXIT_FAILURE;
+        if (pos[i])
+            clReleaseMemObject(pos[i]);
+        if (vel[i])
+            clReleaseMemObject(vel[i]);
     }
+    if (all_pairs)
+        clReleaseKernel(all_pairs);
+    free(zero);
+    free(keys);
+    free(ids);
+    free(seen);
 
-    // Get the maximum work group size for executing the kernel on the device
-    //
-    err = clGetKernelWorkGroupInfo(ComputeKernel, ComputeDeviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &MaxWorkGroupSize, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-        exit(1);
-    }
+    return err;
+}
 
-#if (DEBUG_INFO)
-    printf("MaxWorkGroupSize: %d\n", MaxWorkGroupSize);
-    printf("WorkGroupItems: %d\n", WorkGroupItems);
-#endif
+// Builds nbody_sim with each option set and runs one step of the initial bodies on
+// private buffers, timing the kernel and comparing the positions to the default build
+static int
+CompareBuildOptions(void)
+{
+    int err = CL_SUCCESS;
+    int count = 0;
+    int s, f;
+    const char *options[MAX_BUILD_OPTION_SETS];
+    double ms[MAX_BUILD_OPTION_SETS];
+    double max_err[MAX_BUILD_OPTION_SETS];
+    double rms_err[MAX_BUILD_OPTION_SETS];
+    int built[MAX_BUILD_OPTION_SETS];
+
+    // The first set builds the reference, a -buildopts set is tried last
+    for (s = 0; s < (int)(sizeof(BuildOptionSets) / sizeof(BuildOptionSets[0])); s++)
+        options[count++] = BuildOptionSets[s];
+    if (BuildOptions)
+        options[count++] = BuildOptions;
+
+    size_t bytes = 4 * sizeof(float) * DataBodyCount;
+    size_t global = DataBodyCount;
+    size_t local = GroupSize;
+    float *zero = (float *)calloc(1, bytes);
+    float *reference = (float *)malloc(bytes);
+    float *result = (float *)malloc(bytes);
+    cl_command_queue queue = clCreateCommandQueue(ComputeContext, ComputeDeviceId, CL_QUEUE_PROFILING_ENABLE, &err);
+    cl_mem buffers[4];
+
+    buffers[0] = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, DataInput, NULL);
+    buffers[1] = clCreateBuffer(ComputeContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, zero, NULL);
+    buffers[2] = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, bytes, NULL, NULL);
+    buffers[3] = clCreateBuffer(ComputeContext, CL_MEM_WRITE_ONLY, bytes, NULL, NULL);
+    if (!zero || !reference || !result || !queue || !buffers[0] || !buffers[1] || !buffers[2] || !buffers[3])
+    {
+        printf("Failed to create build sweep resources!\n");
+        err = EXIT_FAILURE;
+        count = 0;
+    }
+
+    for (s = 0; s < count && err == CL_SUCCESS; s++)
+    {
+        cl_program program = BuildComputeProgram(options[s]);
+        cl_kernel kernel = program ? clCreateKernel(program, COMPUTE_KERNEL_MATMUL_NAME, NULL) : 0;
+
+        // Other sets may be rejected by the compiler, but the reference has to build
+        built[s] = (kernel != 0);
+        max_err[s] = rms_err[s] = 0;
+        if (!kernel)
+        {
+            if (program)
+                clReleaseProgram(program);
+            err = s ? CL_SUCCESS : EXIT_FAILURE;
+            continue;
+        }
 
-    WorkGroupSize[0] = (MaxWorkGroupSize > 1) ? (MaxWorkGroupSize / WorkGroupItems) : MaxWorkGroupSize;
-    // WorkGroupSize[1] = MaxWorkGroupSize / WorkGroupSize[0];
+        // A transient kernel, so the arguments bypass the cache
+        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffers[0]);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffers[1]);
+        err |= clSetKernelArg(kernel, 2, sizeof(int), &DataBodyCount);
+        err |= clSetKernelArg(kernel, 3, sizeof(float), &delT);
+        err |= clSetKernelArg(kernel, 4, sizeof(float), &espSqr);
+        err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &buffers[2]);
+        err |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &buffers[3]);
+
+        // One untimed launch, then the kernel time of each launch from its profiling event
+        ms[s] = 0;
+        for (f = 0; f <= BenchmarkFrames && err == CL_SUCCESS; f++)
+        {
+            cl_event event;
+            err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &local, 0, NULL, &event);
+            if (err == CL_SUCCESS)
+            {
+                clWaitForEvents(1, &event);
+                ms[s] += f ? GetEventTime(event) / BenchmarkFrames : 0;
+                if (!f)
+                    clReleaseEvent(event);
+            }
+        }
 
-    printf(SEPARATOR);
+        err |= clEnqueueReadBuffer(queue, buffers[2], CL_TRUE, 0, bytes, s ? result : reference, 0, NULL, NULL);
+        if (s)
+            MeasureError(reference, result, 4 * DataBodyCount, &max_err[s], &rms_err[s]);
 
-    // Setup several arguments that won't change
-    // DataBodyCount
-    err = clSetKernelArg(
-        ComputeKernel,
-        2,
-        sizeof(int),
-        (void *)&DataBodyCount);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to set kernel arg 2: DataBodyCount! %d\n", err);
-        exit(1);
+        clReleaseKernel(kernel);
+        clReleaseProgram(program);
     }
 
-    // time step
-    err = clSetKernelArg(
-        ComputeKernel,
-        3,
-        sizeof(float),
-        (void *)&delT);
     if (err != CL_SUCCESS)
+        printf("Failed to run build option sweep! %d\n", err);
+    else
     {
-        printf("Error: Failed to set kernel arg 3: delT! %d\n", err);
-        exit(1);
+        printf(SEPARATOR);
+        printf("Build option sweep (%d launches each, errors relative to the default build)\n", BenchmarkFrames);
+        for (s = 0; s < count; s++)
+        {
+            const char *label = options[s][0] ? options[s] : "(default)";
+            if (!built[s])
+                printf("  %-32s failed to build\n", label);
+            else
+                printf("  %-32s %8.3f ms %5.2fx  max err %9.3e  rms err %9.3e\n", label, ms[s],
+                    (ms[s] > 0) ? ms[0] / ms[s] : 0.0, max_err[s], rms_err[s]);
+            if (fp && built[s])
+                fprintf(fp, "BuildOptions '%s' %.3f ms MaxErr %.3e RmsErr %.3e\n", options[s], ms[s], max_err[s], rms_err[s]);
+        }
+        printf(SEPARATOR);
     }
 
-    // upward Pseudoprobability
-    err = clSetKernelArg(
-        ComputeKernel,
-        4,
-        sizeof(float),
-        (void *)&espSqr);
-    if (err != CL_SUCCESS)
+    for (f = 0; f < 4; f++)
     {
-        printf("Error: Failed to set kernel arg 4: espSqr! %d\n", err);
-        exit(1);
+        if (buffers[f])
+            clReleaseMemObject(buffers[f]);
     }
+    if (queue)
+        clReleaseCommandQueue(queue);
+    free(zero);
+    free(reference);
+    free(result);
 
-    return CL_SUCCESS;
+    return err;
 }
 
 static void
 Cleanup(void)
 {
     clFinish(ComputeCommands);
+    ReleaseSnapshotWriter();
+    if (RooflineEvent)
+        clReleaseEvent(RooflineEvent);
+    RooflineEvent = 0;
+    ResetKernelArgs();
+    ReleaseCellGrid(&FrameGrid);
+    ReleaseZOrder(&FrameOrder);
     clReleaseKernel(ComputeKernel);
     clReleaseProgram(ComputeProgram);
     clReleaseCommandQueue(ComputeCommands);
@@ -1117,6 +3350,26 @@ Cleanup(void)
     clReleaseMemObject(ComputePosBuffer[1]);
     clReleaseMemObject(ComputeVelBuffer[0]);
     clReleaseMemObject(ComputeVelBuffer[1]);
+    if (MultiDevice)
+    {
+        for(cl_uint i = FirstPrivateDevice; i < DeviceCount; i++)
+        {
+            clFinish(DeviceCommands[i]);
+            clReleaseCommandQueue(DeviceCommands[i]);
+            if (DevicePos[i])
+                clReleaseMemObject(DevicePos[i]);
+            if (DeviceVel[i])
+                clReleaseMemObject(DeviceVel[i]);
+            DevicePos[i] = 0;
+            DeviceVel[i] = 0;
+            DeviceCommands[i] = 0;
+        }
+        if (!FirstPrivateDevice)
+        {
+            for(cl_uint i = 0; i < DeviceCount; i++)
+                clReleaseDevice(DeviceIds[i]);
+        }
+    }
     clReleaseContext(ComputeContext);
 
     ComputeCommands = 0;
@@ -1185,6 +3438,16 @@ Initialize(int gpu)
         exit (err);
     }
 
+    if (RestartPath)
+    {
+        err = OpenSnapshot(RestartPath);
+        if (err != CL_SUCCESS)
+        {
+            printf ("Failed to load snapshot! Error %d\n", err);
+            exit (err);
+        }
+    }
+
     err = InitData();
     if (err != 1)
     {
@@ -1220,6 +3483,56 @@ Initialize(int gpu)
         exit (err);
     }
 
+    if (SnapshotMap)
+    {
+        err = UploadSnapshot();
+        if (err != CL_SUCCESS)
+        {
+            printf ("Failed to upload snapshot! Error %d\n", err);
+            exit (err);
+        }
+    }
+
+    if (CheckpointPath)
+    {
+        CheckpointInterval = (CheckpointInterval > 0) ? CheckpointInterval : 1;
+        err = CreateSnapshotWriter();
+        if (err != CL_SUCCESS)
+        {
+            printf ("Failed to create checkpoint writer! Error %d\n", err);
+            exit (err);
+        }
+        printf("Writing a checkpoint to '%s' every %d steps\n", CheckpointPath, CheckpointInterval);
+    }
+
+    // The frame loop steps through the cell grid, the bodies only have to stay in range
+    if (CutoffRadius > 0 && !MultiDevice)
+    {
+        err = CreateCellGrid(&FrameGrid, ComputeProgram, DataInput, DataBodyCount, CutoffRadius, 1);
+        if (err == CL_SUCCESS && CheckpointPath)
+            err = TrackCellGrid(&FrameGrid, ComputeProgram);
+        if (err != CL_SUCCESS)
+        {
+            printf ("Failed to create cell grid! Error %d\n", err);
+            exit (err);
+        }
+        printf("Cell grid of %dx%dx%d cells %.2f wide for cutoff %.2f\n", FrameGrid.dims.s[0], FrameGrid.dims.s[1],
+            FrameGrid.dims.s[2], FrameGrid.origin.s[3], CutoffRadius);
+    }
+
+    // The cell grid leaves the bodies in cell order every step, so only the all
+    // pairs frame loop takes the Z-order reorder
+    if (ZOrderInterval > 0 && !MultiDevice && CutoffRadius <= 0)
+    {
+        err = CreateZOrder(&FrameOrder, ComputeProgram, DataInput, DataBodyCount);
+        if (err != CL_SUCCESS)
+        {
+            printf ("Failed to create Z-order reorder! Error %d\n", err);
+            exit (err);
+        }
+        printf("Reordering bodies along the Z curve every %d frames\n", ZOrderInterval);
+    }
+
     return CL_SUCCESS;
 }
 
@@ -1252,24 +3565,75 @@ ReportInfo(void)
 
 static void 
 ReportStats(
-    uint64_t uiStartTime, uint64_t uiEndTime)
+    double fStartTime, double fEndTime)
 {
-    TimeElapsed += SubtractTime(uiEndTime, uiStartTime);
+    double frame_ms = fEndTime - fStartTime;
+    int measured = MeasureFrame(&Frames, frame_ms);
 
-    if(TimeElapsed && FrameCount && FrameCount > (int)ReportStatsInterval) 
+    TimeElapsed += frame_ms;
+
+    // Frames the policy drops still go through the report to reset the per-frame
+    // counters, they are just not shown
+    if(TimeElapsed && FrameCount && (!measured || (FrameCount > (int)ReportStatsInterval && TimeElapsed >= MinRunTime)))
     {
         double fMs = (TimeElapsed / (double) FrameCount);
+        double fMean = fMs;
+        double fMad = 0;
+        double fLow = fMs;
+        double fHigh = fMs;
+        if (measured)
+            RobustStats(&Frames, &fMs, &fMad, &fLow, &fHigh);
         double fFps = 1.0 / (fMs / 1000.0);
 
         sprintf(StatsString, "[%s] Compute: %3.2f ms  Display: %3.2f fps (%s)\n", 
             (ComputeDeviceType == CL_DEVICE_TYPE_GPU) ? "GPU" : "CPU", 
             fMs, fFps, USE_GL_ATTACHMENTS ? "attached" : "copying");
+        sprintf(StatsString + strlen(StatsString) - 1, "  Mean: %3.2f ms  MAD: %3.2f ms  95%% CI: %3.2f-%3.2f ms\n",
+            fMean, fMad, fLow, fHigh);
+        if (Frames.count > MAX_WINDOW_FRAMES)
+            sprintf(StatsString + strlen(StatsString) - 1, "  Window: latest %d of %d frames\n",
+                MAX_WINDOW_FRAMES, Frames.count);
+
+        if(MultiDevice && MultiDeviceCount)
+        {
+            for(cl_uint d = 0; d < DeviceCount && strlen(StatsString) < sizeof(StatsString) - 32; d++)
+            {
+                sprintf(StatsString + strlen(StatsString) - 1, "  [%d] %3.2f ms %3.0f%%\n",
+                    d, DeviceTime[d] / MultiDeviceCount, 100.0f * DeviceShare[d]);
+                DeviceTime[d] = 0;
+            }
+            MultiDeviceCount = 0;
+        }
+
+        if(SyncCount)
+        {
+            sprintf(StatsString + strlen(StatsString) - 1, "  Sync: %3.2f ms stalled (%2.0f%%)\n",
+                SyncStall / SyncCount, 100.0 * SyncStall / TimeElapsed);
+            SyncStall = 0;
+            SyncCount = 0;
+        }
+
+        if(HostLaunches)
+        {
+            sprintf(StatsString + strlen(StatsString) - 1, "  Host: %3.1f us/frame (%2.1f%%) over %d frames %d args set %d cached %d launches\n",
+                HostSubmitFrames ? 1000.0 * HostSubmitTime / HostSubmitFrames : 0.0, 100.0 * HostSubmitTime / TimeElapsed,
+                HostSubmitFrames, HostArgSets, HostArgSkips, HostLaunches);
+            HostSubmitTime = 0;
+            HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+        }
 
-        glutSetWindowTitle(StatsString);
-        if (EnableOutput)
-            fprintf(fp,"%s", StatsString);
+        if(Roofline)
+            ReportRoofline();
+
+        if(measured)
+        {
+            glutSetWindowTitle(StatsString);
+            if (EnableOutput)
+                fprintf(fp,"%s", StatsString);
+        }
         FrameCount = 0;
         TimeElapsed = 0;
+        Frames.count = 0;
     }    
 }
 
@@ -1278,7 +3642,7 @@ Display_(void)
 {
     FrameCount++;
     ExecutionCount++;
-    uint64_t uiStartTime = GetCurrentTime();
+    double fStartTime = GetPreciseTime();
 
     glClearColor (0.0, 0.0, 0.0, 0.0);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -1305,8 +3669,8 @@ Display_(void)
 
     glFinish(); // for timing
 
-    uint64_t uiEndTime = GetCurrentTime();
-    ReportStats(uiStartTime, uiEndTime);
+    double fEndTime = GetPreciseTime();
+    ReportStats(fStartTime, fEndTime);
     DrawText(TextOffset[0], TextOffset[1], 1, (Animated == 0) ? "Press space to animate" : " ");
     glutSwapBuffers();
 }
@@ -1395,9 +3759,66 @@ int main(int argc, char** argv)
         else if(strstr(argv[i], "-particles"))
             DataParticleCount = atoi(argv[i+1]);
 
+        else if(strstr(argv[i], "-multi"))
+            MultiDevice = 1;
+
+        else if(strstr(argv[i], "-balance"))
+            Balance = 1;
+
+        else if(strstr(argv[i], "-fission"))
+            FissionSpec = argv[i+1];
+
         else if(strstr(argv[i], "-maxframe"))
             MaxNDRange = atoi(argv[i+1]);
 
+        else if(strstr(argv[i], "-glsync"))
+            GLSyncEvents = 1;
+
+        else if(strstr(argv[i], "-buildopts"))
+            BuildOptions = argv[i+1];
+
+        else if(strstr(argv[i], "-buildsweep"))
+            BuildSweep = 1;
+
+        else if(strstr(argv[i], "-cutoff"))
+            CutoffRadius = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-zorder"))
+            ZOrderInterval = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-restart"))
+            RestartPath = argv[i+1];
+
+        else if(strstr(argv[i], "-checkpoint"))
+            CheckpointPath = argv[i+1];
+
+        else if(strstr(argv[i], "-checkevery"))
+            CheckpointInterval = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-discard"))
+            Frames.warmup_frames = atoi(argv[i+1]);
+
+        else if(strstr(argv[i], "-steadycv"))
+            Frames.steady_cv = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-mintime"))
+            MinRunTime = atof(argv[i+1]);
+
+        else if(strstr(argv[i], "-roofline"))
+            Roofline = 1;
+
+        else if(strstr(argv[i], "-peakgflops"))
+        {
+            Roofline = 1;
+            Rooflines.peak_gflops = atof(argv[i+1]);
+        }
+
+        else if(strstr(argv[i], "-peakbw"))
+        {
+            Roofline = 1;
+            Rooflines.peak_bandwidth = atof(argv[i+1]);
+        }
+
         else if(strstr(argv[i], "-stride"))
         {
         	ExecuteStride = atoi(argv[i+1]);
@@ -1413,11 +3834,33 @@ int main(int argc, char** argv)
     glutCreateWindow (argv[0]);
     if (Initialize (use_gpu) == GL_NO_ERROR)
     {
+        if (MultiDevice && CompareDevices() != CL_SUCCESS)
+            Shutdown();
+
+        if (BuildSweep && CompareBuildOptions() != CL_SUCCESS)
+            Shutdown();
+
+        if (GLSyncEvents && CompareSync() != CL_SUCCESS)
+            Shutdown();
+
+        if (CutoffRadius > 0 && CompareCutoff() != CL_SUCCESS)
+            Shutdown();
+
+        if (ZOrderInterval > 0 && CompareZOrder() != CL_SUCCESS)
+            Shutdown();
+
+        if (Roofline)
+            ShowRooflineModel(&Rooflines, KernelFlops(), KernelBytes());
+
         glutDisplayFunc(Display_);
         glutIdleFunc(Idle);
         glutReshapeFunc(Reshape);
         glutKeyboardFunc(Keyboard);
 
+        // Startup comparisons do not count towards the per-frame host overhead
+        HostSubmitTime = 0;
+        HostSubmitFrames = HostArgSets = HostArgSkips = HostLaunches = 0;
+
         atexit(Shutdown);
         printf("Starting event loop...\n");
 
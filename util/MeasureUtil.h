@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Measurement helpers shared by the benchmarks and the micro-benchmarks: the
+// host and event clocks, the frame window policy with its robust statistics,
+// and the roofline report. Plain C, so Julia can use it as well.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEASUREUTIL_H_
+#define MEASUREUTIL_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <CL/cl.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define STEADY_WINDOW                   (10)        // frames in the steady state window
+#define STEADY_MAX_FRAMES               (300)       // give up waiting for a steady state
+#define MAX_WINDOW_FRAMES               (1024)
+#define BOOTSTRAP_RESAMPLES             (200)
+#ifndef SEPARATOR
+#define SEPARATOR                       ("----------------------------------------------------------------------\n")
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Frame times of one report window, see MeasureFrame
+typedef struct
+{
+    int warmup_frames;                  // dropped before the steady state test
+    double steady_cv;                   // in percent, 0 skips the steady state test
+    int warmup_count;
+    int steady_count;
+    int steady;
+    double steady_times[STEADY_WINDOW];
+    double times[MAX_WINDOW_FRAMES];    // ring of the latest frames
+    int count;                          // frames measured, may be more than the ring holds
+} FrameWindow;
+
+// Kernel launches timed since the last report, against the peaks given by
+// -peakgflops and -peakbw
+typedef struct
+{
+    double peak_gflops;
+    double peak_bandwidth;
+    double time;
+    int count;
+} RooflineStats;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Monotonic clock in ms with ns resolution, for intervals of a few us
+static inline double
+GetHostTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Duration of a profiled command in ms, the event is released
+static inline double
+GetEventTime(cl_event event)
+{
+    cl_ulong start = 0;
+    cl_ulong end = 0;
+
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+    clReleaseEvent(event);
+
+    return (end - start) / 1000000.0;
+}
+
+static inline int
+CompareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static inline double
+SortedMedian(const double *sorted, int count)
+{
+    return (count & 1) ? sorted[count / 2] : 0.5 * (sorted[count / 2 - 1] + sorted[count / 2]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Measurement policy for the frame times: the first warmup_frames are dropped, then
+// frames are dropped until the coefficient of variation over the last STEADY_WINDOW
+// frames is at most steady_cv percent. Returns whether the frame counts.
+static inline int
+MeasureFrame(FrameWindow *window, double ms)
+{
+    int i;
+
+    if (window->warmup_count < window->warmup_frames)
+    {
+        window->warmup_count++;
+        return 0;
+    }
+
+    if (!window->steady && window->steady_cv > 0)
+    {
+        double mean = 0;
+        double variance = 0;
+
+        window->steady_times[window->steady_count++ % STEADY_WINDOW] = ms;
+        if (window->steady_count < STEADY_WINDOW)
+            return 0;
+
+        for (i = 0; i < STEADY_WINDOW; i++)
+            mean += window->steady_times[i] / STEADY_WINDOW;
+        for (i = 0; i < STEADY_WINDOW; i++)
+            variance += (window->steady_times[i] - mean) * (window->steady_times[i] - mean) / (STEADY_WINDOW - 1);
+
+        double cv = (mean > 0) ? 100.0 * sqrt(variance) / mean : 0;
+        if (cv > window->steady_cv && window->steady_count < STEADY_MAX_FRAMES)
+            return 0;
+
+        printf("%s after %d warm-up and %d settling frames (cv %.1f%%)\n",
+            (cv <= window->steady_cv) ? "Steady state" : "No steady state, measuring anyway",
+            window->warmup_count, window->steady_count, cv);
+        window->steady = 1;
+        return 0;
+    }
+
+    window->steady = 1;
+    // Long -mintime windows keep their latest frames in a ring
+    window->times[window->count++ % MAX_WINDOW_FRAMES] = ms;
+
+    return 1;
+}
+
+// Median and median absolute deviation of the frames in the report window, and a
+// percentile bootstrap 95% confidence interval of the median
+static inline void
+RobustStats(const FrameWindow *window, double *median, double *mad, double *low, double *high)
+{
+    double sorted[MAX_WINDOW_FRAMES];
+    double medians[BOOTSTRAP_RESAMPLES];
+    unsigned int seed = 1;
+    int count = (window->count < MAX_WINDOW_FRAMES) ? window->count : MAX_WINDOW_FRAMES;
+    int b, i;
+
+    if (!count)
+        return;
+
+    memcpy(sorted, window->times, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), CompareDoubles);
+    *median = SortedMedian(sorted, count);
+
+    for (i = 0; i < count; i++)
+        sorted[i] = fabs(window->times[i] - *median);
+    qsort(sorted, count, sizeof(double), CompareDoubles);
+    *mad = SortedMedian(sorted, count);
+
+    // A private generator with a fixed seed leaves rand() alone and keeps the intervals repeatable
+    for (b = 0; b < BOOTSTRAP_RESAMPLES; b++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            sorted[i] = window->times[(seed >> 16) % count];
+        }
+        qsort(sorted, count, sizeof(double), CompareDoubles);
+        medians[b] = SortedMedian(sorted, count);
+    }
+    qsort(medians, BOOTSTRAP_RESAMPLES, sizeof(double), CompareDoubles);
+    *low = medians[(int)(0.025 * BOOTSTRAP_RESAMPLES)];
+    *high = medians[(int)(0.975 * BOOTSTRAP_RESAMPLES) - 1];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Analytic FLOP and byte counts of one launch against the peaks
+static inline void
+ShowRooflineModel(const RooflineStats *roofline, double flops, double bytes)
+{
+    printf(SEPARATOR);
+    printf("Roofline model: %.3f GFLOP and %.3f MB per launch, %.2f FLOP/B\n",
+        flops * 1e-9, bytes / (1024.0 * 1024.0), flops / bytes);
+    if (roofline->peak_gflops > 0 && roofline->peak_bandwidth > 0)
+        printf("  Peaks %.1f GFLOP/s and %.1f GB/s, ridge at %.2f FLOP/B\n", roofline->peak_gflops,
+            roofline->peak_bandwidth, roofline->peak_gflops / roofline->peak_bandwidth);
+    else
+        printf("  Pass -peakgflops and -peakbw from the Bandwidth micro-benchmark for %% of bound\n");
+    printf(SEPARATOR);
+}
+
+// Appends the achieved rates of the launches timed since the last report to the
+// stats, whose last character is the newline, and starts over
+static inline void
+AppendRoofline(RooflineStats *roofline, double flops, double bytes, char *stats, size_t size)
+{
+    if (!roofline->count || roofline->time <= 0 || strlen(stats) > size - 128)
+        return;
+
+    double seconds = roofline->time / roofline->count / 1000.0;
+    double gflops = flops / seconds * 1e-9;
+    double gbs = bytes / seconds * 1e-9;
+    double intensity = flops / bytes;
+
+    sprintf(stats + strlen(stats) - 1, "  Roofline: %3.2f ms %3.1f GFLOP/s %3.1f GB/s %3.2f FLOP/B\n",
+        1000.0 * seconds, gflops, gbs, intensity);
+
+    // The attainable rate is the lower of the compute roof and the bandwidth slope
+    double bound = 0;
+    int memory = 0;
+    if (roofline->peak_bandwidth > 0)
+    {
+        bound = intensity * roofline->peak_bandwidth;
+        memory = 1;
+    }
+    if (roofline->peak_gflops > 0 && (!bound || roofline->peak_gflops < bound))
+    {
+        bound = roofline->peak_gflops;
+        memory = 0;
+    }
+    if (bound > 0)
+        sprintf(stats + strlen(stats) - 1, " %3.0f%% of %s bound\n", 100.0 * gflops / bound,
+            memory ? "memory" : "compute");
+
+    roofline->time = 0;
+    roofline->count = 0;
+}
+
+#endif